@@ -0,0 +1,271 @@
+#include "../include/accounting.hpp"
+#include "../include/environment.hpp"
+#include "../include/json_view.hpp"
+#include "../include/logger.hpp"
+#include "../include/query_string.hpp"
+#include "../include/route.hpp"
+#include "../include/server_gen.hpp"
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+using namespace cobble;
+
+/// @brief Formats like the standard output listener but discards the line
+class null_listener : public logger::stdout_listener {
+  void _finalize(const std::string &s) override {
+    benchmark::DoNotOptimize(s.data());
+  }
+};
+
+/// @brief Builds a configuration pointing at a scratch data directory
+/// @param cidr true to check CORS by subnet, false to check by origin
+/// @return A configuration usable by the request handlers
+static environment::configuration make_config(bool cidr) {
+  environment::configuration config{};
+
+  config.data_path = std::filesystem::temp_directory_path() / "cobble_bench";
+  config.listen_address = boost::asio::ip::make_address("127.0.0.1");
+  config.listen_port = 8080;
+  config.threads = 1;
+
+  if (cidr) {
+    environment::cidr_network_list entries{};
+    entries.v4.emplace_front(boost::asio::ip::make_network_v4("10.0.0.0/8"));
+    entries.v4.emplace_front(
+        boost::asio::ip::make_network_v4("192.168.88.0/24"));
+    entries.v4.emplace_front(boost::asio::ip::make_network_v4("127.0.0.1/32"));
+    config.cors_entries = std::move(entries);
+  } else {
+    config.cors_entries = std::forward_list<std::string>{
+        "http://localhost:5173", "https://example.com"};
+  }
+
+  // a tiny thumbnail so file routes have something to open
+  std::filesystem::create_directories(config.data_path / "thumbnails");
+  std::ofstream thumbnail{config.data_path / "thumbnails" / "1.webp",
+                          std::ios::binary | std::ios::trunc};
+  thumbnail << std::string(4096, '\0');
+
+  return config;
+}
+
+/// @brief Builds a synthetic GET request
+/// @param target The request target
+/// @return A request as `do_session` would read it
+static boost::beast::http::request<boost::beast::http::string_body>
+make_request(const std::string &target) {
+  boost::beast::http::request<boost::beast::http::string_body> request{
+      boost::beast::http::verb::get, target, 11};
+  request.set(boost::beast::http::field::host, "127.0.0.1:8080");
+  request.set(boost::beast::http::field::origin, "http://localhost:5173");
+  request.keep_alive(true);
+  return request;
+}
+
+/// @brief Runs a handler coroutine to completion, as a connection would
+/// @param io_context The benchmark's event loop
+/// @param awaitable The coroutine
+/// @return What it returned
+template <class T>
+static T run(boost::asio::io_context &io_context,
+             boost::asio::awaitable<T> awaitable) {
+  std::optional<T> result{};
+  boost::asio::co_spawn(
+      io_context,
+      [&]() -> boost::asio::awaitable<void> {
+        result.emplace(co_await std::move(awaitable));
+      },
+      [](std::exception_ptr e) {
+        if (e) {
+          std::rethrow_exception(e);
+        }
+      });
+  io_context.restart();
+  io_context.run();
+  return std::move(*result);
+}
+
+/// @brief Builds a metadata update like an uploader would POST
+/// @param videos How many videos the batch describes, 0 for a single video
+/// @return The JSON text
+static std::string make_metadata(std::size_t videos) {
+  const std::string one{
+      R"({"id": 123456, "title": "A fairly ordinary video title about cats", )"
+      R"("tags": ["cats", "funny", "animals", "compilation"]})"};
+  if (videos == 0) {
+    return one;
+  }
+
+  std::string batch{R"({"videos": [)"};
+  for (std::size_t i = 0; i < videos; ++i) {
+    batch += (i > 0 ? ", " : "") + one;
+  }
+  return batch + "]}";
+}
+
+/// @brief Adds what a benchmark used per iteration to its output, only in
+/// builds with allocation and syscall accounting. Setup done while timing is
+/// paused counts too.
+/// @param state The benchmark's state
+/// @param before What every thread used before the loop started
+static void report_usage(benchmark::State &state,
+                         const accounting::usage &before) {
+  if constexpr (accounting::enabled) {
+    const auto after = accounting::total();
+    const auto per_iteration = [](U64 count) {
+      return benchmark::Counter(static_cast<F64>(count),
+                                benchmark::Counter::kAvgIterations);
+    };
+    state.counters["allocs"] =
+        per_iteration(after.allocations - before.allocations);
+    state.counters["alloc_bytes"] = per_iteration(after.bytes - before.bytes);
+    state.counters["syscalls"] =
+        per_iteration(after.syscalls - before.syscalls);
+  }
+}
+
+// ============================================================================
+static void BM_query_string_parse(benchmark::State &state) {
+  const std::string target{"/thumb/?idx=123456&size=large&cursor=abcdef"};
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    std::filesystem::path path{};
+    auto parsed = query_string::parse(target, path);
+    benchmark::DoNotOptimize(parsed);
+  }
+  report_usage(state, used);
+}
+BENCHMARK(BM_query_string_parse);
+
+static void BM_origin_allowed_cidr(benchmark::State &state) {
+  const auto config = make_config(true);
+  const std::string peer_ip{"127.0.0.1"};
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        server_gen::origin_allowed(config, "", peer_ip));
+  }
+  report_usage(state, used);
+}
+BENCHMARK(BM_origin_allowed_cidr);
+
+static void BM_origin_allowed_dns(benchmark::State &state) {
+  const auto config = make_config(false);
+  const std::string peer_ip{"127.0.0.1"};
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(server_gen::origin_allowed(
+        config, "https://example.com", peer_ip));
+  }
+  report_usage(state, used);
+}
+BENCHMARK(BM_origin_allowed_dns);
+
+static void BM_route_api_get_page(benchmark::State &state) {
+  const auto config = make_config(true);
+  const std::filesystem::path path{"/page"};
+  boost::asio::io_context io_context{1};
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    auto routed =
+        run(io_context, route::api_get(config, path, {}, trace::context{}));
+    benchmark::DoNotOptimize(routed);
+  }
+  report_usage(state, used);
+}
+BENCHMARK(BM_route_api_get_page);
+
+static void BM_route_api_get_not_found(benchmark::State &state) {
+  const auto config = make_config(true);
+  const std::filesystem::path path{"/nowhere"};
+  boost::asio::io_context io_context{1};
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    auto routed =
+        run(io_context, route::api_get(config, path, {}, trace::context{}));
+    benchmark::DoNotOptimize(routed);
+  }
+  report_usage(state, used);
+}
+BENCHMARK(BM_route_api_get_not_found);
+
+static void BM_logger_log(benchmark::State &state) {
+  null_listener listener{};
+  const std::string peer_ip{"127.0.0.1"};
+  const U16 peer_port = 54321;
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    listener.log(logger::severity::debug, peer_ip, ":", peer_port, " reads '",
+                 "/thumb?idx=1", "' ", "GET");
+  }
+  report_usage(state, used);
+}
+BENCHMARK(BM_logger_log);
+
+static void BM_server_gen_handle(benchmark::State &state,
+                                 const std::string &target) {
+  const auto config = make_config(true);
+  const std::string peer_ip{"127.0.0.1"};
+  boost::asio::io_context io_context{1};
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto request = make_request(target);
+    state.ResumeTiming();
+
+    auto message = run(io_context,
+                       server_gen::handle(std::move(request), config, peer_ip,
+                                          54321, trace::context{}));
+    benchmark::DoNotOptimize(message);
+  }
+  report_usage(state, used);
+}
+BENCHMARK_CAPTURE(BM_server_gen_handle, page, std::string{"/page"});
+BENCHMARK_CAPTURE(BM_server_gen_handle, thumb, std::string{"/thumb?idx=1"});
+BENCHMARK_CAPTURE(BM_server_gen_handle, not_found, std::string{"/nowhere"});
+
+static void BM_json_view_parse(benchmark::State &state) {
+  const auto text = make_metadata(state.range(0));
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto body = text;
+    state.ResumeTiming();
+
+    auto parsed = json_view::document::parse(std::move(body));
+    benchmark::DoNotOptimize(parsed->root()["videos"].size());
+  }
+  report_usage(state, used);
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_json_view_parse)->Arg(0)->Arg(100);
+
+static void BM_jsoncpp_parse(benchmark::State &state) {
+  const auto text = make_metadata(state.range(0));
+  Json::CharReaderBuilder builder{};
+  const std::unique_ptr<Json::CharReader> reader{builder.newCharReader()};
+
+  const auto used = accounting::total();
+  for (auto _ : state) {
+    Json::Value root;
+    std::string errors{};
+    reader->parse(text.data(), text.data() + text.size(), &root, &errors);
+    benchmark::DoNotOptimize(root["videos"].size());
+  }
+  report_usage(state, used);
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_jsoncpp_parse)->Arg(0)->Arg(100);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,131 @@
+#if !defined(COBBLE_ACCOUNTING)
+#define COBBLE_ACCOUNTING
+#include "main.hpp"
+#include "trace.hpp"
+#include <json/json.h>
+#include <string_view>
+namespace cobble {
+/// @brief Counts heap allocations and file syscalls per thread and charges
+/// them to the route being served. Only counts in builds configured with
+/// `ACCOUNTING_IN_USE`, which replace `operator new` and hook the libc file
+/// calls. Otherwise everything here is empty and compiles to nothing.
+namespace accounting {
+/// @brief What a thread, or a route, used so far
+struct usage {
+  /// @brief Heap allocations through `operator new`
+  U64 allocations = 0;
+
+  /// @brief Bytes asked for by those allocations
+  U64 bytes = 0;
+
+  /// @brief Heap frees through `operator delete`
+  U64 frees = 0;
+
+  /// @brief Calls that open, read, write, sync, stat or close files
+  U64 syscalls = 0;
+};
+
+#if defined(ACCOUNTING_IN_USE)
+/// @brief Checks if this build counts anything
+constexpr bool enabled = true;
+
+/// @brief A route's counters, kept by the accounting module
+struct route_usage;
+
+/// @brief What the calling thread used since it started
+/// @return Its counters
+usage now();
+
+/// @brief What every thread used since the process started
+/// @return The sums, threads that never opened a scope aren't included
+usage total();
+
+/// @brief Charges what this thread uses to a route for a synchronous
+/// section, and to the request it's for. Opening one inside another pauses
+/// the outer one, so nothing is counted twice.
+class scope {
+  route_usage *_route;
+  U64 _request;
+  usage _start;
+  scope *_outer;
+
+  /// @brief Charges what was used since `_start` and restarts it
+  void charge();
+
+public:
+  /// @brief Starts charging to a route, counting the scope as one request
+  /// @param route The route, must outlive the process (a literal, or a key
+  /// of a static table)
+  scope(std::string_view route);
+
+  /// @brief Starts charging to a route on behalf of a request, which counts
+  /// as one request to its route when its ledger closes
+  /// @param route The route, must outlive the process
+  /// @param request The request's ID, from its ledger
+  scope(std::string_view route, U64 request);
+
+  /// @brief Starts charging to a request before or after it's routed, like
+  /// while it's parsed or its body is sent. It goes to the request's route
+  /// when its ledger closes.
+  /// @param request The request's ID, from its ledger
+  explicit scope(U64 request);
+
+  /// @brief Charges the section and resumes the outer scope, if any
+  ~scope();
+
+  scope(const scope &) = delete;
+  scope &operator=(const scope &) = delete;
+};
+
+/// @brief What one request used wherever it ran, on its connection's
+/// thread, on the worker pool and while its body was sent. Only scopes
+/// opened with its ID are charged to it.
+class ledger {
+  U64 _id;
+
+public:
+  /// @brief Opens the ledger, giving the request an ID if it isn't traced
+  /// and has none
+  /// @param request The request's trace context, its ID is the ledger's
+  ledger(trace::context &request);
+
+  /// @brief Closes the ledger, what the request used outside its route goes
+  /// to its route and it's listed among the recent requests
+  ~ledger();
+
+  ledger(const ledger &) = delete;
+  ledger &operator=(const ledger &) = delete;
+};
+#else
+constexpr bool enabled = false;
+
+inline usage now() { return usage{}; }
+
+inline usage total() { return usage{}; }
+
+class scope {
+public:
+  constexpr scope(std::string_view) {}
+  constexpr scope(std::string_view, U64) {}
+  constexpr explicit scope(U64) {}
+
+  scope(const scope &) = delete;
+  scope &operator=(const scope &) = delete;
+};
+
+class ledger {
+public:
+  constexpr ledger(trace::context &) {}
+
+  ledger(const ledger &) = delete;
+  ledger &operator=(const ledger &) = delete;
+};
+#endif
+
+/// @brief What was used so far
+/// @return Counters per thread, per route and per recent request, or just
+/// `enabled: false`
+Json::Value stats();
+} // namespace accounting
+} // namespace cobble
+#endif
@@ -0,0 +1,159 @@
+#if !defined(COBBLE_CATALOG)
+#define COBBLE_CATALOG
+#include "environment.hpp"
+#include "json_view.hpp"
+#include "main.hpp"
+#include "mp4.hpp"
+#include <filesystem>
+#include <functional>
+#include <json/json.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+namespace cobble {
+/// @brief What's known about every video, kept in the storage directory so
+/// that nothing has to be scanned or probed again at startup
+namespace catalog {
+/// @brief A video's metadata
+struct entry {
+  /// @brief The video ID
+  U64 id = 0;
+
+  /// @brief Its title, empty until its metadata is ingested
+  std::string title{};
+
+  /// @brief Its tags
+  std::vector<std::string> tags{};
+
+  /// @brief What its MP4 holds, nothing until it's been probed
+  std::optional<mp4::info> info{};
+};
+
+/// @brief Reads a title and tags from metadata, a JSON object with a `title`
+/// string and an optional `tags` array of strings
+/// @param which The entry to fill in, untouched if the metadata is bad
+/// @param root The metadata
+/// @return false if the metadata is bad
+bool describe(entry &which, const json_view::value &root);
+
+/// @brief Reads a title and tags from a metadata file. Throws on bad files.
+/// @param which The entry to fill in
+/// @param file The metadata file
+void describe(entry &which, const std::filesystem::path &file);
+
+/// @brief An append-only log of checksummed entries, the last entry of an ID
+/// wins. A snapshot of where each ID's entry is, sorted by ID, is memory
+/// mapped so opening costs the same however large the catalog is, and only
+/// the entries logged after the snapshot are scanned.
+class store {
+  /// @brief Where an ID's entry is in the log, as snapshotted
+  struct slot {
+    U64 id;
+    U64 offset;
+  };
+
+  std::filesystem::path _directory;
+  int _log = -1;
+  U64 _log_bytes = 0;
+
+  /// @brief The mapped snapshot, nothing if there's none
+  void *_mapped = nullptr;
+  std::size_t _mapped_size = 0;
+  const slot *_slots = nullptr;
+  std::size_t _slot_count = 0;
+
+  /// @brief Entries logged after the snapshot, by ID
+  std::map<U64, U64> _recent{};
+
+  /// @brief How many IDs there are
+  std::size_t _count = 0;
+
+  /// @brief Guards the snapshot and `_recent`
+  mutable std::shared_mutex _mutex{};
+
+  /// @brief Serializes appends and snapshots
+  std::mutex _append{};
+
+  /// @brief If puts are dropped
+  bool _sealed = false;
+
+  U64 _snapshots = 0;
+  U64 _recovered = 0;
+  U64 _appended = 0;
+
+  std::optional<U64> _offset(U64 id) const;
+  entry _read(U64 offset) const;
+  bool _map();
+  void _unmap();
+  void _scan(U64 from);
+  void _snapshot();
+
+public:
+  /// @brief Opens or creates a catalog, replaying only what was logged since
+  /// the last snapshot and cutting off a torn tail. Throws on errors.
+  /// @param directory Where the log and snapshot are
+  store(const std::filesystem::path &directory);
+  ~store();
+
+  store(const store &) = delete;
+  store &operator=(const store &) = delete;
+
+  /// @brief Logs entries with one `fdatasync`, replacing older ones of the
+  /// same IDs. Throws on errors.
+  /// @param entries The entries
+  void put(const std::vector<entry> &entries);
+
+  /// @brief Logs an entry, replacing an older one of the same ID
+  /// @param which The entry
+  void put(const entry &which);
+
+  /// @brief Stops logging, later puts are dropped, for a process handing the
+  /// storage directory over. Waits for a put in progress.
+  void seal();
+
+  /// @brief Looks up a video
+  /// @param id The video ID
+  /// @return Its entry, or nothing if it isn't cataloged
+  std::optional<entry> find(U64 id) const;
+
+  /// @brief Checks if a video is cataloged, without reading its entry
+  /// @param id The video ID
+  /// @return true if it is
+  bool contains(U64 id) const;
+
+  /// @brief Lists video IDs, newest (highest) first
+  /// @param skip How many newer IDs to skip
+  /// @param count Most IDs to list
+  /// @return The IDs
+  std::vector<U64> newest(U64 skip, U64 count) const;
+
+  /// @brief Visits every entry once, in one sequential read of the log
+  /// @param visit Called with each entry
+  void each(const std::function<void(const entry &)> &visit) const;
+
+  /// @brief How large the catalog is
+  /// @return Counts of videos, log bytes, snapshots and replayed entries
+  Json::Value stats() const;
+};
+
+/// @brief Gets the catalog in a configuration's storage directory, opened on
+/// first use and again only if the storage directory changes. The snapshot
+/// and the log after it are all there is, the directory isn't walked.
+/// @param config The server configuration
+/// @return The catalog
+std::shared_ptr<store> open(const environment::configuration &config);
+
+/// @brief Catalogs the videos and metadata files in the storage directory
+/// that aren't cataloged yet, a one-time migration for directories filled
+/// before there was a catalog. Walks the whole directory, so it's only run
+/// when an admin asks. Throws on errors.
+/// @param config The server configuration
+/// @return The entries cataloged
+std::vector<entry> import(const environment::configuration &config);
+} // namespace catalog
+} // namespace cobble
+#endif
@@ -0,0 +1,96 @@
+#if !defined(COBBLE_DESCRIPTOR)
+#define COBBLE_DESCRIPTOR
+#include "main.hpp"
+#include "timekeeper.hpp"
+#include <boost/beast.hpp>
+#include <ctime>
+#include <filesystem>
+#include <json/json.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+namespace cobble {
+/// @brief Keeps hot media files open, responses share one descriptor and read
+/// it with positioned reads so they never disturb each other
+namespace descriptor {
+/// @brief A read-only file descriptor with the size and modification time it
+/// was opened with, closed once nothing references it
+class file {
+  int _fd;
+  U64 _size;
+  dev_t _device;
+  ino_t _inode;
+  timespec _modified;
+  std::string _hash;
+
+public:
+  /// @brief Opens a file for reading
+  /// @param path The file
+  /// @param ec Set if the file couldn't be opened, nothing else is valid then
+  file(const std::filesystem::path &path, boost::beast::error_code &ec);
+  ~file();
+
+  file(const file &) = delete;
+  file &operator=(const file &) = delete;
+
+  /// @brief The file's size when it was opened
+  /// @return The size in bytes
+  U64 size() const;
+
+  /// @brief The content hash the file was ingested with
+  /// @return The SHA-256 in hex, or nothing
+  const std::string &hash() const;
+
+  /// @brief Checks if a path still names this file, unchanged
+  /// @param path The file's path
+  /// @return If the path was replaced, resized or modified since
+  bool stale(const std::filesystem::path &path) const;
+
+  /// @brief Reads bytes at an offset without moving any shared file position
+  /// @param offset Where to start in the file
+  /// @param buffer Where to put the bytes
+  /// @param length How many bytes fit
+  /// @param ec Set on read errors
+  /// @return Bytes put in `buffer`, zero at the end of the file
+  std::size_t read(U64 offset, void *buffer, std::size_t length,
+                   boost::beast::error_code &ec) const;
+};
+
+/// @brief A bounded table of open files keyed by media ID. Evicted and stale
+/// files are only closed when their last response is done with them.
+class cache {
+  struct entry {
+    std::shared_ptr<const file> opened;
+    timekeeper::instant checked;
+    std::list<U64>::iterator recent;
+  };
+
+  std::mutex _mutex{};
+  std::unordered_map<U64, entry> _entries{};
+  std::list<U64> _recent{};
+  std::size_t _capacity;
+
+public:
+  /// @brief Starts an empty table
+  /// @param capacity How many files may stay open at once
+  cache(std::size_t capacity);
+
+  /// @brief Gets a media file, opening it only on a miss or if it changed
+  /// @param id The media ID
+  /// @param path The media's file
+  /// @param ec Set if the file couldn't be opened
+  /// @return The file, or nothing if `ec` was set
+  std::shared_ptr<const file> open(U64 id, const std::filesystem::path &path,
+                                   boost::beast::error_code &ec);
+};
+
+/// @brief How well the open file tables have done so far
+/// @return Counters of hits, misses, stale and evicted files, and the hit
+/// ratio
+Json::Value stats();
+} // namespace descriptor
+} // namespace cobble
+#endif
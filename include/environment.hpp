@@ -4,6 +4,7 @@
 #include <boost/asio.hpp>
 #include <filesystem>
 #include <forward_list>
+#include <memory>
 #include <string>
 #include <toml++/toml.hpp>
 #include <variant>
@@ -19,11 +20,113 @@ struct cidr_network_list {
   std::forward_list<boost::asio::ip::network_v6> v6{};
 };
 
+/// @brief Token bucket request limits, per client address and per subnet
+struct rate_limits {
+  /// @brief Whether requests get limited at all
+  bool enabled = false;
+
+  /// @brief Requests per second a single client address refills
+  F64 rate = 0.0;
+
+  /// @brief Requests a single client address can burst
+  F64 burst = 0.0;
+
+  /// @brief Requests per second a whole subnet refills
+  F64 subnet_rate = 0.0;
+
+  /// @brief Requests a whole subnet can burst
+  F64 subnet_burst = 0.0;
+
+  /// @brief IPv4 subnet prefix length
+  U8 subnet_v4 = 24;
+
+  /// @brief IPv6 subnet prefix length
+  U8 subnet_v6 = 64;
+
+  /// @brief How many clients and subnets are tracked, fixed at first use
+  U32 capacity = 65536;
+};
+
+/// @brief The HTTPS listener
+struct tls_settings {
+  /// @brief Whether HTTPS is served alongside plain HTTP
+  bool enabled = false;
+
+  /// @brief The port HTTPS listens on, with the same address as HTTP
+  U16 port = 0;
+
+  /// @brief PEM certificate chain file
+  std::filesystem::path certificate;
+
+  /// @brief PEM private key file
+  std::filesystem::path private_key;
+
+  /// @brief Ask OpenSSL to hand record encryption to the kernel (Linux kTLS)
+  bool ktls = false;
+
+  /// @brief TLS sessions cached for resumption
+  U32 session_cache_size = 20480;
+};
+
+/// @brief An S3-compatible object store, addressed path-style
+struct s3_settings {
+  /// @brief The endpoint's host name or address
+  std::string host;
+
+  /// @brief The endpoint's port
+  U16 port = 80;
+
+  /// @brief The bucket media is stored in
+  std::string bucket;
+
+  /// @brief The region requests are signed for
+  std::string region = "us-east-1";
+
+  /// @brief The access key ID requests are signed with
+  std::string access_key;
+
+  /// @brief The secret access key requests are signed with
+  std::string secret_key;
+
+  bool operator==(const s3_settings &) const = default;
+};
+
+/// @brief Where media is stored and how much of it stays cached
+struct storage_settings {
+  /// @brief Whether media is only on local disk, or in an object store with
+  /// the storage directory as its cache
+  enum class kind : U8 {
+    /// @brief Everything is in the storage directory
+    local = 0,
+
+    /// @brief Everything is in an S3-compatible object store
+    s3 = 1
+  } backend = kind::local;
+
+  /// @brief Bytes of small, hot media kept in memory
+  U64 memory_cache = 0;
+
+  /// @brief Bytes of object store media kept in the storage directory
+  U64 disk_cache = 0;
+
+  /// @brief The object store, only for the `s3` backend
+  s3_settings s3;
+
+  bool operator==(const storage_settings &) const = default;
+};
+
 /// @brief A configuration structure
 struct configuration {
-  /// @brief The path we use to store thumbnails and videos
+  /// @brief The TOML file this configuration was loaded from
+  std::filesystem::path source;
+
+  /// @brief The path we use to store thumbnails and videos, or to cache them
+  /// for the object store
   std::filesystem::path data_path;
 
+  /// @brief The storage backend and its caches
+  storage_settings storage;
+
   /// @brief The IP address we listen with
   boost::asio::ip::address listen_address;
 
@@ -35,12 +138,48 @@ struct configuration {
 
   /// @brief Allowed CORS origin IPv4/IPv6 ranges OR allowed CORS origin URLs
   std::variant<std::forward_list<std::string>, cidr_network_list> cors_entries;
+
+  /// @brief Whether HTTP/2 is spoken, as h2c with prior knowledge on the
+  /// HTTP listener and as h2 over ALPN on the HTTPS listener
+  bool http2;
+
+  /// @brief The HTTPS listener, its address and port need a restart
+  tls_settings tls;
+
+  /// @brief Per-client and per-subnet request limits
+  rate_limits rate_limit;
+
+  /// @brief Whether `/page` warms the thumbnails it lists ahead of time
+  bool prefetch_enabled;
+
+  /// @brief Whether the `/admin` endpoints are served
+  bool admin_enabled;
+
+  /// @brief Fraction of requests whose phases get traced, 0.0 disables
+  F64 trace_sample_rate;
 };
 
 /// @brief Load a TOML configuration, throws an error if invalid
 /// @param where The file path
 /// @return A configuration
 configuration load(const std::filesystem::path &where);
+
+/// @brief An immutable, shareable configuration snapshot
+using snapshot = std::shared_ptr<const configuration>;
+
+/// @brief Gets the currently published configuration, requests should hold
+/// onto it until they finish so a reload never changes it under them
+/// @return The current snapshot
+snapshot current();
+
+/// @brief Atomically publishes a configuration for new requests to pick up
+/// @param config The configuration to publish
+void publish(configuration &&config);
+
+/// @brief Re-parses the current configuration's TOML file and publishes it,
+/// throws an error and keeps the current configuration if invalid
+/// @return The newly published snapshot
+snapshot reload();
 } // namespace environment
 } // namespace cobble
 #endif
\ No newline at end of file
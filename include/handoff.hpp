@@ -0,0 +1,78 @@
+#if !defined(COBBLE_HANDOFF)
+#define COBBLE_HANDOFF
+#include "main.hpp"
+#include <boost/asio.hpp>
+#include <optional>
+#include <sys/types.h>
+#include <vector>
+namespace cobble {
+/// @brief Upgrades the server binary without refusing a connection. The old
+/// process starts the new binary with the same arguments and passes it the
+/// listening sockets over a Unix socket, the new one adopts them and says so,
+/// the old one stops accepting and writing to the storage directory, then
+/// drains its sessions while the new one serves everything that connects.
+namespace handoff {
+/// @brief The environment variable naming the new process's end of the
+/// channel, only set for processes started by an upgrade
+constexpr const char *CHANNEL_VARIABLE = "COBBLE_HANDOFF_FD";
+
+/// @brief A new process started by `spawn`
+struct successor {
+  /// @brief Its process ID
+  pid_t pid;
+
+  /// @brief Our end of the channel
+  int channel;
+};
+
+/// @brief Listening sockets handed over by the process being upgraded
+struct inherited {
+  /// @brief Our end of the channel
+  int channel;
+
+  /// @brief The sockets not taken yet
+  std::vector<int> listeners;
+
+  /// @brief Takes the inherited socket listening on an endpoint
+  /// @param endpoint The address and port to listen on
+  /// @return The socket, or -1 if none listens there
+  int take(const boost::asio::ip::tcp::endpoint &endpoint);
+
+  /// @brief Tells the old process every listener is up, then waits until it
+  /// stopped writing to the storage directory, or died. Closes the channel
+  /// and whatever wasn't taken.
+  void take_over();
+};
+
+/// @brief Starts this binary again with the same arguments and sends it the
+/// listening sockets. Throws on errors.
+/// @param listeners The listening sockets, they stay open here
+/// @return The new process
+successor spawn(const std::vector<int> &listeners);
+
+/// @brief Waits until the new process adopted the sockets. If it didn't in
+/// time, it's killed and the channel closed.
+/// @param next The new process
+/// @return true if it's listening
+bool await_listening(const successor &next);
+
+/// @brief Tells the new process it may write to the storage directory, and
+/// closes the channel
+/// @param next The new process
+void release(const successor &next);
+
+/// @brief Receives the listening sockets, if this process was started by an
+/// upgrade. Throws on errors.
+/// @return The sockets, or nothing
+std::optional<inherited> receive();
+
+/// @brief Marks this process as handed over, sessions end after the
+/// response in flight and writes are refused
+void drain();
+
+/// @brief Checks if this process was handed over
+/// @return true once `drain` was called
+bool draining();
+} // namespace handoff
+} // namespace cobble
+#endif
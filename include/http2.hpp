@@ -0,0 +1,80 @@
+#if !defined(COBBLE_HTTP2)
+#define COBBLE_HTTP2
+#include "main.hpp"
+#include <boost/asio.hpp>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// nghttp2 stays out of every other translation unit
+struct nghttp2_session;
+
+namespace cobble {
+/// @brief Handles HTTP/2 framing on top of nghttp2
+namespace http2 {
+/// @brief The preface every HTTP/2 client opens its connection with
+constexpr std::string_view CLIENT_PREFACE{"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"};
+
+/// @brief A server-side HTTP/2 connection that doesn't do I/O by itself.
+/// Received bytes are fed in, each finished request stream is taken out and
+/// routed through `server_gen::respond`, and the bytes to send are pulled
+/// back out. HPACK,
+/// stream multiplexing and flow control are all nghttp2's.
+class connection {
+  struct stream;
+  struct callbacks;
+
+  nghttp2_session *_session;
+  std::string _peer_ip;
+  U16 _peer_port;
+  std::unordered_map<S32, std::unique_ptr<stream>> _streams;
+
+  /// @brief Streams whose request ended, in the order they ended
+  std::vector<S32> _finished;
+
+  /// @brief If GOAWAY was queued
+  bool _draining = false;
+
+public:
+  /// @brief Starts a session and queues our SETTINGS frame
+  /// @param peer_ip The peer IP address
+  /// @param peer_port The peer port
+  connection(const std::string &peer_ip, U16 peer_port);
+
+  /// @brief Ends the session
+  ~connection();
+
+  connection(const connection &) = delete;
+  connection &operator=(const connection &) = delete;
+
+  /// @brief Feeds bytes received from the peer, throws on protocol errors
+  /// @param data The received bytes
+  /// @param size How many bytes were received
+  void receive(const void *data, std::size_t size);
+
+  /// @brief Takes the streams whose request ended since the last call
+  /// @return Their stream IDs, in the order they ended
+  std::vector<S32> finished();
+
+  /// @brief Routes a finished stream's request and submits its response,
+  /// throws on protocol errors. Streams reset meanwhile are skipped.
+  /// @param stream_id The stream ID
+  boost::asio::awaitable<void> respond(S32 stream_id);
+
+  /// @brief Pulls the next chunk of bytes to send, valid until the next call
+  /// @return The bytes to send, empty when flow control or an idle session
+  /// has nothing more to give
+  boost::asio::const_buffer pending();
+
+  /// @brief Queues GOAWAY once, streams already open still finish
+  void drain();
+
+  /// @brief Checks if either side still wants to use the connection
+  /// @return false once the session is over (GOAWAY or closed)
+  bool alive() const;
+};
+} // namespace http2
+} // namespace cobble
+#endif
@@ -0,0 +1,45 @@
+#if !defined(COBBLE_INGEST)
+#define COBBLE_INGEST
+#include "environment.hpp"
+#include "main.hpp"
+#include <filesystem>
+#include <json/json.h>
+#include <string>
+namespace cobble {
+/// @brief Moves media into the storage directory by content. Every distinct
+/// file is stored once in `blobs/`, media paths like `videos/1.mp4` are hard
+/// links to it, so link counts are its reference count.
+namespace ingest {
+/// @brief What a file was stored as
+struct stored {
+  /// @brief The SHA-256 of its content, in hex
+  std::string hash;
+
+  /// @brief Its size in bytes
+  U64 size = 0;
+
+  /// @brief If the same content was already stored
+  bool deduplicated = false;
+};
+
+/// @brief Stores a file under a media path, replacing what was there and
+/// deleting the old content once nothing links to it. Throws on errors.
+/// @param config The server configuration
+/// @param key The media path, like `videos/1.mp4`
+/// @param source The file, in the storage directory's filesystem, it's
+/// removed once stored
+/// @return What it was stored as
+stored store(const environment::configuration &config, const std::string &key,
+             const std::filesystem::path &source);
+
+/// @brief Gets the content hash recorded for an open stored file
+/// @param fd The open file
+/// @return The SHA-256 in hex, or nothing if it wasn't ingested
+std::string hash_of(int fd);
+
+/// @brief How much ingest has deduplicated so far
+/// @return Counters of stored and deduplicated files and bytes saved
+Json::Value stats();
+} // namespace ingest
+} // namespace cobble
+#endif
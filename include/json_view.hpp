@@ -0,0 +1,147 @@
+#if !defined(COBBLE_JSON_VIEW)
+#define COBBLE_JSON_VIEW
+#include "main.hpp"
+#include <cstddef>
+#include <expected>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+namespace cobble {
+/// @brief Reads JSON request bodies in place. One pass validates the text
+/// and records where every value is on a flat tape, values are only decoded
+/// when a handler asks for them, and strings without escapes are handed out
+/// as views into the text.
+namespace json_view {
+/// @brief Largest text a document may be parsed from
+constexpr std::size_t MAX_BYTES = 1024 * 1024;
+
+/// @brief Deepest nesting of arrays and objects a document may have
+constexpr U32 MAX_DEPTH = 32;
+
+/// @brief What a value is
+enum class kind : U8 { missing, null, boolean, number, string, array, object };
+
+/// @brief Why a text isn't a document
+struct error {
+  /// @brief The error code sent to the client, like `BAD_JSON`
+  const char *code;
+
+  /// @brief Where in the text parsing stopped
+  std::size_t offset;
+};
+
+class document;
+
+/// @brief A value in a document, valid as long as the document isn't moved or
+/// destroyed. Looking up what isn't there gives a missing value rather than
+/// throwing, and every accessor of the wrong kind gives nothing.
+class value {
+  const document *_document = nullptr;
+  U32 _at = 0;
+
+  friend class document;
+  value(const document *owner, U32 at) : _document{owner}, _at{at} {}
+
+public:
+  /// @brief A missing value
+  value() = default;
+
+  /// @brief What this value is
+  /// @return The kind, `missing` if it isn't there
+  kind type() const;
+
+  /// @brief Checks if this value is there at all
+  explicit operator bool() const { return type() != kind::missing; }
+
+  /// @brief Reads a boolean
+  /// @return It, or nothing if this isn't a boolean
+  std::optional<bool> boolean() const;
+
+  /// @brief Reads a number that fits in an unsigned integer
+  /// @return It, or nothing if this isn't one
+  std::optional<U64> unsigned_integer() const;
+
+  /// @brief Reads a number that fits in a signed integer
+  /// @return It, or nothing if this isn't one
+  std::optional<S64> integer() const;
+
+  /// @brief Reads any number
+  /// @return It, or nothing if this isn't a number
+  std::optional<F64> real() const;
+
+  /// @brief Reads a string without copying it
+  /// @return A view into the text, or nothing if this isn't a string or the
+  /// string has escapes
+  std::optional<std::string_view> view() const;
+
+  /// @brief Reads any string, decoding its escapes
+  /// @return It, or nothing if this isn't a string
+  std::optional<std::string> string() const;
+
+  /// @brief How many elements or members this has
+  /// @return The count, 0 if this isn't an array or object
+  std::size_t size() const;
+
+  /// @brief Looks up an object member, the last one wins if a key repeats
+  /// @param key The member's key, without escapes
+  /// @return Its value, or a missing value
+  value operator[](std::string_view key) const;
+
+  /// @brief Visits each array element in order
+  /// @tparam Visit Callable with a `value`
+  /// @param visit Called with each element
+  template <class Visit> void each(Visit &&visit) const;
+};
+
+/// @brief A parsed JSON text, owning the text its values point into
+class document {
+  friend class value;
+
+  /// @brief One value's place in the text, containers are followed by their
+  /// elements, or by key and value pairs
+  struct node {
+    kind type;
+
+    /// @brief If this string has escapes to decode
+    bool escaped;
+
+    /// @brief Where the value starts, strings start after their quote
+    U32 start;
+
+    /// @brief Text length of strings and numbers, element or member count
+    /// of containers
+    U32 length;
+
+    /// @brief The tape index just past this value and its children
+    U32 next;
+  };
+
+  std::string _text{};
+  std::vector<node> _tape{};
+
+  class parser;
+
+public:
+  /// @brief Parses a JSON text
+  /// @param text The text, moved in so values can point into it
+  /// @return The document, or why it isn't one
+  static std::expected<document, error> parse(std::string text);
+
+  /// @brief The top-level value
+  /// @return It
+  value root() const { return value{this, 0}; }
+};
+
+template <class Visit> void value::each(Visit &&visit) const {
+  if (type() != kind::array) {
+    return;
+  }
+  const auto &tape = _document->_tape;
+  for (auto at = _at + 1; at < tape[_at].next; at = tape[at].next) {
+    visit(value{_document, at});
+  }
+}
+} // namespace json_view
+} // namespace cobble
+#endif
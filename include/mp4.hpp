@@ -0,0 +1,138 @@
+#if !defined(COBBLE_MP4)
+#define COBBLE_MP4
+#include "main.hpp"
+#include "splice.hpp"
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+namespace cobble {
+/// @brief Reads ISO base media (MP4) files and remuxes them into fragmented
+/// MP4 without re-encoding anything
+namespace mp4 {
+/// @brief Where one sample lives in the file and how it plays
+struct sample {
+  /// @brief Byte offset in the file
+  U64 offset;
+
+  /// @brief Decode time, in the track's timescale
+  U64 decode_time;
+
+  /// @brief Size in bytes
+  U32 size;
+
+  /// @brief Duration, in the track's timescale
+  U32 duration;
+
+  /// @brief Presentation minus decode time, in the track's timescale
+  S32 composition_offset;
+
+  /// @brief If the sample can be decoded on its own (a keyframe)
+  bool sync;
+};
+
+/// @brief A video or audio track and its sample table
+struct track {
+  /// @brief The track ID, as in `tkhd`
+  U32 id;
+
+  /// @brief Time units per second
+  U32 timescale;
+
+  /// @brief Duration, in the track's timescale
+  U64 duration;
+
+  /// @brief The handler type, `vide` or `soun`
+  std::string handler;
+
+  /// @brief The raw `tkhd`, `mdhd`, `hdlr`, media header, `dinf` and `stsd`
+  /// boxes, copied as-is into the initialization segment
+  std::string tkhd, mdhd, hdlr, media_header, dinf, stsd;
+
+  /// @brief Every sample, in decode order
+  std::vector<sample> samples;
+};
+
+/// @brief A parsed movie, only its video and audio tracks are kept
+struct movie {
+  /// @brief The raw `mvhd` box
+  std::string mvhd;
+
+  /// @brief The tracks
+  std::vector<track> tracks;
+};
+
+/// @brief A span of the movie starting at a keyframe of its first video track
+struct segment {
+  /// @brief Start time in seconds
+  F64 start;
+
+  /// @brief Duration in seconds
+  F64 duration;
+
+  /// @brief The `[first, last)` samples of each track in this segment
+  std::vector<std::pair<std::size_t, std::size_t>> samples;
+};
+
+/// @brief What a listing needs to know about a video, without sample tables
+struct info {
+  /// @brief Duration in seconds
+  F64 duration = 0.0;
+
+  /// @brief Width of the first video track in pixels, 0 without one
+  U32 width = 0;
+
+  /// @brief Height of the first video track in pixels, 0 without one
+  U32 height = 0;
+
+  /// @brief Codec of the first video track, like `avc1.64001f`
+  std::string video_codec{};
+
+  /// @brief Codec of the first audio track, like `mp4a`
+  std::string audio_codec{};
+
+  /// @brief File size in bytes
+  U64 size = 0;
+
+  /// @brief Average bitrate in bits per second
+  U64 bitrate = 0;
+
+  bool operator==(const info &) const = default;
+};
+
+/// @brief Reads only the metadata of a file's `moov` box, throws on files
+/// that aren't MP4
+/// @param path The file
+/// @return What the file holds
+info probe(const std::filesystem::path &path);
+
+/// @brief Reads the `moov` box of a file and builds its sample tables, throws
+/// on files that aren't MP4 or use features we can't remux
+/// @param path The file
+/// @return The movie
+movie parse(const std::filesystem::path &path);
+
+/// @brief Cuts a movie into segments at keyframes
+/// @param which The movie
+/// @param target Preferred segment duration in seconds, segments are only
+/// longer when keyframes are further apart
+/// @return The segments
+std::vector<segment> segments(const movie &which, F64 target);
+
+/// @brief Builds the initialization segment, a `ftyp` and a `moov` without
+/// samples
+/// @param which The movie
+/// @return The initialization segment
+std::string init_segment(const movie &which);
+
+/// @brief Builds a media segment, a `moof` and `mdat` header in memory and the
+/// samples as ranges of the original file
+/// @param which The movie
+/// @param part The segment
+/// @param sequence The fragment sequence number, starting at 1
+/// @param body The body to fill, its file must already be open
+void media_segment(const movie &which, const segment &part, U32 sequence,
+                   splice::body::value_type &body);
+} // namespace mp4
+} // namespace cobble
+#endif
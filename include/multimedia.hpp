@@ -1,32 +1,118 @@
 #if !defined(COBBLE_MULTIMEDIA)
 #define COBBLE_MULTIMEDIA
+#include "json_view.hpp"
 #include "main.hpp"
 #include "route.hpp"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 namespace cobble {
 /// @brief Audio/video (thumbnails and video streaming)
 namespace multimedia {
 /// @brief Handles HTTP GET of a thumbnail
 /// @param config the server configuration
 /// @param id the video ID
-/// @return a response structure for routing
-route::response_get thumbnail_get(const environment::configuration &config,
-                                  U64 id);
+/// @return a response structure for routing, or why there's none
+route::result<route::response_get>
+thumbnail_get(const environment::configuration &config, U64 id);
+/// @brief Queues thumbnails a client is about to request to be read ahead
+/// @param config the server configuration
+/// @param ids the video IDs
+void thumbnails_prefetch(const environment::configuration &config,
+                         const std::vector<U64> &ids);
 /// @brief Handles HTTP HEAD of a thumbnail
 /// @param config the server configuration
 /// @param id the video ID
+/// @return a response structure for routing, or why there's none
+route::result<route::response_head>
+thumbnail_head(const environment::configuration &config, U64 id);
+/// @brief Handles HTTP GET of many thumbnails in one `multipart/mixed` body,
+/// a missing thumbnail only fails its own part
+/// @param config the server configuration
+/// @param ids the video IDs as sent, each with its number or nothing if it
+/// didn't parse
 /// @return a response structure for routing
-route::response_head thumbnail_head(const environment::configuration &config,
-                                    U64 id);
+route::response_get thumbnails_get(
+    const environment::configuration &config,
+    const std::vector<std::pair<std::string_view, std::optional<U64>>> &ids);
+/// @brief Handles HTTP GET of a video's HLS playlist, its segments are cut
+/// from the stored MP4 when requested
+/// @param config the server configuration
+/// @param id the video ID
+/// @return a response structure for routing, or why there's none
+route::result<route::response_get>
+video_playlist_get(const environment::configuration &config, U64 id);
+/// @brief Handles HTTP GET of a video's fragmented MP4 initialization segment
+/// @param config the server configuration
+/// @param id the video ID
+/// @return a response structure for routing, or why there's none
+route::result<route::response_get>
+video_init_get(const environment::configuration &config, U64 id);
+/// @brief Handles HTTP GET of one of a video's fragmented MP4 media segments
+/// @param config the server configuration
+/// @param id the video ID
+/// @param segment the segment's index in the playlist
+/// @return a response structure for routing, or why there's none
+route::result<route::response_get>
+video_segment_get(const environment::configuration &config, U64 id,
+                  U64 segment);
 /// @brief Handles HTTP GET of an actual video
 /// @param config the server configuration
 /// @param id the video ID
-/// @return a response structure for routing
-route::response_get video_get(const environment::configuration &config, U64 id);
+/// @return a response structure for routing, or why there's none
+route::result<route::response_get>
+video_get(const environment::configuration &config, U64 id);
 /// @brief Handles HTTP HEAD of an actual video
 /// @param config the server configuration
 /// @param id the video ID
+/// @return a response structure for routing, or why there's none
+route::result<route::response_head>
+video_head(const environment::configuration &config, U64 id);
+/// @brief Lists cataloged videos with their metadata, newest first. Videos
+/// are probed once when first listed. Videos not fetched from the object
+/// store yet are listed without probed metadata.
+/// @param config the server configuration
+/// @param page which page of videos to list, starting at 0
+/// @return a JSON array of videos
+Json::Value video_list(const environment::configuration &config, U64 page);
+/// @brief Lists the videos watched most lately with their titles, from the
+/// latest trending snapshot
+/// @param config the server configuration
+/// @param count how many videos to list at most
+/// @return a JSON array of videos, highest score first
+Json::Value trending_list(const environment::configuration &config,
+                          U64 count);
+/// @brief Ingests a file from the storage directory's `incoming/` as a
+/// video, thumbnail or the video's searchable metadata, stored once per
+/// distinct content
+/// @param config the server configuration
+/// @param body an object with the `kind` (`video`, `thumbnail` or
+/// `metadata`), the video's `id` and the `file`'s name in `incoming/`
+/// @return a response structure for routing, or why there's none
+route::result<route::response_post>
+media_ingest(const environment::configuration &config,
+             const json_view::value &body);
+/// @brief Updates the titles and tags of one video, or of a batch of videos
+/// with one `fdatasync`, and makes them searchable. The catalog is the
+/// record, metadata files in storage are left as they were. Only videos that
+/// are stored can be described.
+/// @param config the server configuration
+/// @param body an object with an `id`, a `title` and `tags`, or an object
+/// with a `videos` array of those
+/// @return a response structure for routing, or why there's none, a HTTP 404
+/// if any of the videos isn't stored
+route::result<route::response_post>
+metadata_post(const environment::configuration &config,
+              const json_view::value &body);
+/// @brief Catalogs videos and metadata files stored before there was a
+/// catalog, and makes them searchable. Walks the storage directory, a
+/// one-time migration rather than something to call routinely.
+/// @param config the server configuration
 /// @return a response structure for routing
-route::response_head video_head(const environment::configuration &config, U64 id);
+route::response_post
+catalog_import(const environment::configuration &config);
 
 } // namespace multimedia
 } // namespace cobble
@@ -0,0 +1,134 @@
+#if !defined(COBBLE_MULTIPART)
+#define COBBLE_MULTIPART
+#include "descriptor.hpp"
+#include "main.hpp"
+#include <boost/beast.hpp>
+#include <boost/optional.hpp>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+namespace cobble {
+/// @brief Streams many files in one `multipart/mixed` response body
+namespace multipart {
+/// @brief One part of the response, either a file or a small inline body
+struct part {
+  /// @brief The item's ID as the client sent it, sent as the part's
+  /// `Content-ID` so a client can match even IDs that didn't parse
+  std::string id;
+
+  /// @brief The item's own HTTP status, sent as the part's `X-Status`
+  boost::beast::http::status status;
+
+  /// @brief The part's MIME type
+  std::string mime_type;
+
+  /// @brief The file to stream, only set for file parts
+  std::shared_ptr<const descriptor::file> file{};
+
+  /// @brief The body of inline parts, usually a JSON error
+  std::string inline_body{};
+
+  /// @brief The body of parts held elsewhere, like a thumbnail in the memory
+  /// cache, sent without copying it into the part
+  std::shared_ptr<const std::string> shared_body{};
+};
+
+/// @brief A Beast Body streaming parts from their files a chunk at a time, so
+/// no file is ever held in memory whole
+struct body {
+  /// @brief The parts and a read cursor over their serialized form
+  class value_type {
+    std::string _boundary{};
+    std::vector<part> _parts{};
+
+    U64 _request = 0;
+    std::size_t _part = 0;
+    U8 _stage = 0;
+    std::string _scratch{};
+    std::size_t _scratch_offset = 0;
+    U64 _file_offset = 0;
+
+    std::string _part_header(const part &which) const;
+    static U64 _length(const part &which);
+
+  public:
+    /// @brief Starts an empty body with a random boundary
+    value_type();
+
+    /// @brief Appends a part
+    /// @param which The part to append
+    void add(part &&which);
+
+    /// @brief The boundary, for the response's `Content-Type`
+    /// @return The boundary
+    std::string_view boundary() const;
+
+    /// @brief The exact serialized size, for the response's `Content-Length`
+    /// @return The size in bytes
+    U64 size() const;
+
+    /// @brief Hands out the rest of a shared part body where it is, if that's
+    /// what comes next, as if it was read
+    /// @return The bytes, or an empty buffer
+    boost::asio::const_buffer take_shared();
+
+    /// @brief Charges reading the body to a request in accounting
+    /// @param request The request's ID, from its ledger
+    void charge_to(U64 request);
+
+    /// @brief Serializes the next bytes of the body, sequentially
+    /// @param buffer Where to put them
+    /// @param length How many bytes fit
+    /// @param ec Set on file read errors
+    /// @return Bytes put in `buffer`, zero once the body is done
+    std::size_t read(void *buffer, std::size_t length,
+                     boost::beast::error_code &ec);
+  };
+
+  /// @brief Beast's hook for `Content-Length`
+  /// @param value The body
+  /// @return The size in bytes
+  static U64 size(const value_type &value) { return value.size(); }
+
+  /// @brief Serializes the body for Beast, shared bodies in place and
+  /// everything else through a 16 KiB chunk buffer of its own
+  class writer {
+    value_type &_value;
+    char _chunk[16384];
+
+  public:
+    /// @brief A buffer sequence of one buffer
+    using const_buffers_type = boost::asio::const_buffer;
+
+    template <bool isRequest, class Fields>
+    writer(const boost::beast::http::header<isRequest, Fields> &,
+           value_type &value)
+        : _value{value} {}
+
+    /// @brief Nothing to prepare
+    /// @param ec Always cleared
+    void init(boost::beast::error_code &ec) { ec = {}; }
+
+    /// @brief Hands Beast the next chunk
+    /// @param ec Set on file read errors
+    /// @return The chunk and whether more follows, or nothing when done
+    boost::optional<std::pair<const_buffers_type, bool>>
+    get(boost::beast::error_code &ec) {
+      ec = {};
+      if (const auto shared = _value.take_shared(); shared.size() > 0) {
+        return {{shared, true}};
+      }
+
+      const auto length = _value.read(_chunk, sizeof(_chunk), ec);
+      if (ec || length == 0) {
+        return boost::none;
+      }
+      return {{const_buffers_type{_chunk, length}, true}};
+    }
+  };
+};
+} // namespace multipart
+} // namespace cobble
+#endif
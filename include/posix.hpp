@@ -0,0 +1,30 @@
+#if !defined(COBBLE_POSIX)
+#define COBBLE_POSIX
+#include "main.hpp"
+#include <string>
+#include <system_error>
+namespace cobble {
+/// @brief Small helpers around POSIX file calls, shared by the modules that
+/// keep their own files
+namespace posix {
+/// @brief Wraps `errno` in an exception
+/// @param what What was being done, like `Could not open 'x'`
+/// @return The exception, to throw
+std::system_error error(const std::string &what);
+
+/// @brief FNV-1a over some bytes, not cryptographic, only there to catch torn
+/// writes and bit rot
+/// @param data The bytes
+/// @param size How many bytes
+/// @return The checksum
+U64 checksum(const void *data, std::size_t size);
+
+/// @brief Writes all of a buffer, retrying short and interrupted writes
+/// @param fd The file
+/// @param data The bytes
+/// @param size How many bytes
+/// @return false on errors, with `errno` set
+bool write_all(int fd, const void *data, std::size_t size);
+} // namespace posix
+} // namespace cobble
+#endif
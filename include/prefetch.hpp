@@ -0,0 +1,26 @@
+#if !defined(COBBLE_PREFETCH)
+#define COBBLE_PREFETCH
+#include "main.hpp"
+#include <filesystem>
+#include <json/json.h>
+namespace cobble {
+/// @brief Warms the page cache for files clients are about to request, on a
+/// single idle-priority thread
+namespace prefetch {
+/// @brief Queues a file to be read ahead, dropped if the queue is full or the
+/// file was prefetched recently
+/// @param path The file
+void enqueue(const std::filesystem::path &path);
+
+/// @brief Records that a file is being served, a hit if it was prefetched
+/// recently and a miss otherwise
+/// @param path The file
+void claim(const std::filesystem::path &path);
+
+/// @brief How useful prefetching has been so far
+/// @return Counters of queued, dropped, prefetched, hit, missed and wasted
+/// files, and the hit ratio of prefetched files
+Json::Value stats();
+} // namespace prefetch
+} // namespace cobble
+#endif
@@ -0,0 +1,83 @@
+#if !defined(COBBLE_PUSH)
+#define COBBLE_PUSH
+#include "catalog.hpp"
+#include "main.hpp"
+#include <deque>
+#include <functional>
+#include <json/json.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+namespace cobble {
+/// @brief Pushes catalog updates to WebSocket clients, so they needn't poll
+/// `/page`. Each update is serialized once and the same message is queued
+/// for every subscriber. A subscriber that lets its queue fill up is dropped
+/// and expected to reconnect and reload.
+namespace push {
+/// @brief The target clients upgrade to a WebSocket on
+constexpr const char *PATH = "/push";
+
+/// @brief Messages a subscriber may have queued before it's dropped
+constexpr std::size_t MAX_QUEUED = 256;
+
+/// @brief A serialized message, shared by every queue it's in
+using message = std::shared_ptr<const std::string>;
+
+/// @brief One WebSocket client's queue
+class subscriber {
+  std::mutex _mutex{};
+  std::deque<message> _queue{};
+  bool _overflowed = false;
+  std::function<void()> _wake;
+
+public:
+  /// @brief Makes a queue
+  /// @param wake Called from any thread when messages were queued or the
+  /// subscriber was dropped, must only schedule the session to look
+  subscriber(std::function<void()> wake);
+
+  /// @brief Queues a message, or drops the subscriber if the queue is full
+  /// @param queued The message
+  void offer(const message &queued);
+
+  /// @brief Takes every queued message
+  /// @return The messages, oldest first
+  std::vector<message> take();
+
+  /// @brief Checks if this subscriber fell too far behind
+  /// @return true once a message didn't fit
+  bool overflowed();
+
+  /// @brief Wakes the session, without queueing anything
+  void wake() { _wake(); }
+};
+
+/// @brief Subscribes a client to catalog updates
+/// @param wake See `subscriber`
+/// @return The subscriber, unsubscribed once it's destroyed
+std::shared_ptr<subscriber> subscribe(std::function<void()> wake);
+
+/// @brief The first message a subscriber gets
+/// @return A `hello` event with the sequence number of the last update
+message hello();
+
+/// @brief Sends changed catalog entries to every subscriber as one `catalog`
+/// event
+/// @param entries The entries, as logged
+void publish(const std::vector<catalog::entry> &entries);
+
+/// @brief Wakes every subscriber to end its session, for a process handing
+/// over to another
+void close();
+
+/// @brief Checks if `close` was called
+/// @return true if sessions should end
+bool closed();
+
+/// @brief How much was pushed so far
+/// @return Counters of subscribers, events, queued messages and drops
+Json::Value stats();
+} // namespace push
+} // namespace cobble
+#endif
@@ -18,6 +18,11 @@ std::unordered_map<std::string, std::string> parse(const std::string &what,
 /// @return A map with keys of the query string mapping to their values
 std::unordered_map<std::string, std::string>
 parse_only_query(const std::string &what);
+/// @brief Decodes a form-encoded query string value, `+` as a space and
+/// `%XX` as a byte, malformed escapes are kept as-is
+/// @param what What to decode
+/// @return The decoded value
+std::string decode(const std::string &what);
 } // namespace query_string
 } // namespace cobble
 #endif
\ No newline at end of file
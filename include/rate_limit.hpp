@@ -0,0 +1,80 @@
+#if !defined(COBBLE_RATE_LIMIT)
+#define COBBLE_RATE_LIMIT
+#include "environment.hpp"
+#include "main.hpp"
+#include <atomic>
+#include <boost/asio.hpp>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+namespace cobble {
+/// @brief Per-client and per-subnet request rate limiting
+namespace rate_limit {
+/// @brief A bounded table of token buckets, sharded into small sets of slots.
+/// Buckets are updated with compare-and-swap only, and when a set is full the
+/// least recently refilled bucket in it is evicted.
+class table {
+  /// @brief A slot, `state` packs milli-tokens (low 24 bits) with the last
+  /// refill time in milliseconds (high 40 bits)
+  struct alignas(16) bucket {
+    std::atomic<U64> key{0};
+    std::atomic<U64> state{0};
+  };
+
+  std::unique_ptr<bucket[]> _buckets;
+  std::size_t _sets;
+
+  bucket &_find(U64 key, U64 now_ms, U64 full);
+
+public:
+  /// @brief Allocates every bucket up front, memory never grows past this
+  /// @param capacity How many clients can be tracked at once
+  table(std::size_t capacity);
+
+  /// @brief Takes one token from a key's bucket
+  /// @param key The client key, never zero
+  /// @param rate Tokens refilled per second
+  /// @param burst Bucket size
+  /// @param now_ms Monotonic time in milliseconds
+  /// @return Nothing if allowed, otherwise milliseconds until a token refills
+  std::optional<U64> take(U64 key, F64 rate, F64 burst, U64 now_ms);
+
+  /// @brief Checks if a key's bucket is empty without taking from it
+  /// @param key The client key, never zero
+  /// @param rate Tokens refilled per second
+  /// @param burst Bucket size
+  /// @param now_ms Monotonic time in milliseconds
+  /// @return Nothing if a token is available, otherwise milliseconds until
+  /// one refills
+  std::optional<U64> peek(U64 key, F64 rate, F64 burst, U64 now_ms);
+};
+
+/// @brief Takes a token for a request from both the client's and its
+/// subnet's buckets
+/// @param limits The configured limits
+/// @param address The client address
+/// @return Nothing if allowed, otherwise seconds to put in `Retry-After`
+std::optional<U32> take(const environment::rate_limits &limits,
+                        const boost::asio::ip::address &address);
+
+/// @brief Checks right after accept if a client is already out of tokens,
+/// nothing is taken so connections aren't charged on top of requests
+/// @param limits The configured limits
+/// @param address The client address
+/// @return Nothing if allowed, otherwise seconds to put in `Retry-After`
+std::optional<U32> exhausted(const environment::rate_limits &limits,
+                             const boost::asio::ip::address &address);
+
+/// @brief The pre-rendered JSON body of a HTTP 429 response
+/// @return The body
+const std::string &rendered_body();
+
+/// @brief A HTTP/1.1 429 response that closes the connection, written raw to
+/// plaintext sockets refused right after accept
+/// @param retry_after Seconds to put in `Retry-After`
+/// @return The whole response, headers and body
+std::string rendered_response(U32 retry_after);
+} // namespace rate_limit
+} // namespace cobble
+#endif
@@ -2,15 +2,39 @@
 #define COBBLE_ROUTE
 #include "environment.hpp"
 #include "main.hpp"
+#include "multipart.hpp"
+#include "splice.hpp"
+#include "trace.hpp"
+#include <boost/asio.hpp>
 #include <boost/beast.hpp>
+#include <expected>
 #include <filesystem>
 #include <json/json.h>
 #include <optional>
 #include <unordered_map>
+#include <utility>
 #include <variant>
+#include <vector>
 namespace cobble {
 /// @brief Routes HTTP API paths to their appropriate handler
 namespace route {
+/// @brief Why a request can't be served, returned instead of thrown since
+/// missing media and bad input are ordinary
+struct failure {
+  /// @brief HTTP status code
+  boost::beast::http::status status;
+
+  /// @brief The error code sent to the client, like `NOT_FOUND`
+  std::string code;
+
+  /// @brief Seconds the client should wait before asking again, sent as
+  /// `Retry-After`, or nothing
+  std::optional<U32> retry_after = std::nullopt;
+};
+
+/// @brief A value, or the failure that stands in for it
+template <class T> using result = std::expected<T, failure>;
+
 /// @brief A response for HEAD requests, with a HTTP status code
 struct response_head {
   /// @brief HTTP status code
@@ -21,17 +45,31 @@ struct response_head {
 
   /// @brief The MIME type of the file
   std::string mime_type;
+
+  /// @brief Extra headers describing the resource
+  std::vector<std::pair<std::string, std::string>> headers{};
 };
 /// @brief A JSON response for GET requests, with a HTTP status code
 struct response_get {
   /// @brief HTTP status code
   boost::beast::http::status status;
 
-  /// @brief The JSON or file response body
-  std::variant<Json::Value, boost::beast::http::file_body::value_type> body;
+  /// @brief The JSON, file, multipart or spliced response body
+  std::variant<Json::Value, boost::beast::http::file_body::value_type,
+               multipart::body::value_type, splice::body::value_type>
+      body;
 
   /// @brief The MIME type of this response
   std::string mime_type;
+
+  /// @brief The `Cache-Control` header of spliced responses, or nothing
+  std::optional<std::string> cache_control = std::nullopt;
+
+  /// @brief The strong `ETag` of spliced responses, or nothing
+  std::optional<std::string> etag = std::nullopt;
+
+  /// @brief Extra headers of JSON responses
+  std::vector<std::pair<std::string, std::string>> headers{};
 };
 /// @brief A JSON response for POST requests, with a HTTP status code
 struct response_post {
@@ -44,36 +82,69 @@ struct response_post {
   /// @brief The MIME type of this response
   std::string mime_type;
 };
-/// @brief Handle a HEAD request
-/// @param config environment configuration
+/// @brief Parses a numeric query parameter without throwing
+/// @param query the query string map
+/// @param key the parameter
+/// @param code the error code if it's missing or not a number
+/// @return the number, or a HTTP 400 failure
+result<U64>
+number_parameter(const std::unordered_map<std::string, std::string> &query,
+                 const std::string &key, const char *code);
+
+/// @brief Renders a failure as a JSON response to a GET request
+/// @param why the failure
+/// @return a response object
+response_get failed_get(const failure &why);
+
+/// @brief Renders a failure as a JSON response to a POST request
+/// @param why the failure
+/// @return a response object
+response_post failed_post(const failure &why);
+
+/// @brief Renders a failure as a response to a HEAD request
+/// @param why the failure
+/// @return a response object
+response_head failed_head(const failure &why);
+
+/// @brief Handle a HEAD request, synchronous handlers run to completion in
+/// the awaiting coroutine without suspending it
+/// @param config environment configuration, must outlive the coroutine
 /// @param path the GET path
 /// @param query the query string map
+/// @param context the request's trace context
 /// @return a response object
-response_head api_head(const environment::configuration &config,
-                       const std::filesystem::path &path,
-                       std::unordered_map<std::string, std::string> &&query);
+boost::asio::awaitable<response_head>
+api_head(const environment::configuration &config,
+         const std::filesystem::path &path,
+         std::unordered_map<std::string, std::string> query,
+         trace::context context);
 
-/// @brief Handle a GET request
-/// @param config environment configuration
+/// @brief Handle a GET request, synchronous handlers run to completion in
+/// the awaiting coroutine without suspending it
+/// @param config environment configuration, must outlive the coroutine
 /// @param path the GET path
 /// @param query the query string map
+/// @param context the request's trace context
 /// @return a response object
-response_get api_get(const environment::configuration &config,
-                     const std::filesystem::path &path,
-                     std::unordered_map<std::string, std::string> &&query);
+boost::asio::awaitable<response_get>
+api_get(const environment::configuration &config,
+        const std::filesystem::path &path,
+        std::unordered_map<std::string, std::string> query,
+        trace::context context);
 
-/// @brief Handle a POST request
-/// @param config environment configuration
+/// @brief Handle a POST request, the body is parsed in place once and handed
+/// to the handler as a view
+/// @param config environment configuration, must outlive the coroutine
 /// @param path the POST path
 /// @param query the query string map
-/// @param body the JSON or file body
+/// @param body the JSON body, moved in rather than copied
+/// @param context the request's trace context
 /// @return a response object
-response_post
+boost::asio::awaitable<response_post>
 api_post(const environment::configuration &config,
          const std::filesystem::path &path,
-         std::unordered_map<std::string, std::string> &&query,
-         std::variant<Json::Value, boost::beast::http::file_body::value_type>
-             &&body);
+         std::unordered_map<std::string, std::string> query, std::string body,
+         trace::context context);
 } // namespace route
 } // namespace cobble
 #endif
\ No newline at end of file
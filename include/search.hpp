@@ -0,0 +1,156 @@
+#if !defined(COBBLE_SEARCH)
+#define COBBLE_SEARCH
+#include "environment.hpp"
+#include "main.hpp"
+#include "route.hpp"
+#include <functional>
+#include <json/json.h>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+namespace cobble {
+/// @brief Searches video titles and tags. Every word prefix of a query has to
+/// match, candidates come from a trigram index of the words so a query never
+/// scans the whole catalog.
+namespace search {
+/// @brief A video that matched a query
+struct hit {
+  /// @brief The video ID
+  U64 id;
+
+  /// @brief How well it matched, higher is better
+  U32 score;
+
+  /// @brief Its title, as stored
+  std::string title;
+
+  /// @brief Its tags, as stored
+  std::vector<std::string> tags;
+};
+
+/// @brief Where a page of hits ends, the next one starts after it
+struct position {
+  /// @brief The last hit's score
+  U32 score;
+
+  /// @brief The last hit's video ID
+  U64 id;
+};
+
+/// @brief One page of a query's hits, best first
+struct page {
+  /// @brief The hits
+  std::vector<hit> hits;
+
+  /// @brief Where this page ends, nothing on the last page
+  std::optional<position> next;
+};
+
+/// @brief An in-memory inverted index from trigrams to videos. Videos get
+/// ordinals in the order they're added, so posting lists only ever grow at
+/// their end and are stored as blocks of delta-encoded varints.
+class index {
+  /// @brief A sorted list of ordinals, in blocks that each start with a plain
+  /// ordinal so intersections can skip whole blocks without decoding them
+  struct postings {
+    /// @brief The first ordinal of each block
+    std::vector<U32> heads{};
+
+    /// @brief Where each block's deltas start in `deltas`
+    std::vector<U32> offsets{};
+
+    /// @brief Varint deltas to the previous ordinal, heads excluded
+    std::vector<U8> deltas{};
+
+    /// @brief The last ordinal
+    U32 last = 0;
+
+    /// @brief How many ordinals there are
+    U32 count = 0;
+
+    void append(U32 ordinal);
+    void decode(std::size_t block, std::vector<U32> &out) const;
+  };
+
+  /// @brief A video as indexed, dead once it's indexed again
+  struct document {
+    U64 id;
+    std::string title;
+    std::vector<std::string> tags;
+
+    /// @brief Normalized words of the title and of the tags
+    std::vector<std::string> title_words, tag_words;
+
+    bool live;
+  };
+
+  mutable std::shared_mutex _mutex{};
+  std::vector<document> _documents{};
+  std::unordered_map<U64, U32> _ordinals{};
+  std::unordered_map<U32, postings> _postings{};
+  U64 _live = 0;
+
+  /// @brief Visits videos that have every trigram of some words, newest
+  /// first, until the visitor returns false
+  void _match(const std::vector<std::string> &words,
+              const std::function<bool(U32)> &visit) const;
+
+  /// @brief Indexes a video, or leaves it be if it's indexed and `replace`
+  /// isn't set
+  /// @return If it was indexed
+  bool _add(U64 id, const std::string &title,
+            const std::vector<std::string> &tags, bool replace);
+
+public:
+  /// @brief Indexes a video, replacing what it was indexed as before
+  /// @param id The video ID
+  /// @param title Its title
+  /// @param tags Its tags
+  void add(U64 id, const std::string &title,
+           const std::vector<std::string> &tags);
+
+  /// @brief Indexes a video unless it's indexed already, for filling from a
+  /// catalog read that `add` calls since may have overtaken
+  /// @param id The video ID
+  /// @param title Its title
+  /// @param tags Its tags
+  /// @return If it was indexed
+  bool seed(U64 id, const std::string &title,
+            const std::vector<std::string> &tags);
+
+  /// @brief Finds videos whose title or tags have words starting with every
+  /// word of a query
+  /// @param query The query
+  /// @param after Where the previous page ended, nothing for the first page
+  /// @param limit Most hits to return
+  /// @return A page of hits
+  page find(std::string_view query, const std::optional<position> &after,
+            std::size_t limit) const;
+
+  /// @brief How large the index is
+  /// @return Counts of videos, trigrams and posting bytes
+  Json::Value stats() const;
+};
+
+/// @brief Gets the index for a configuration's catalog, filled in the
+/// background on first use, so it may answer with fewer hits for a moment
+/// after startup
+/// @param config The server configuration
+/// @return The index
+std::shared_ptr<index> open(const environment::configuration &config);
+
+/// @brief Handles HTTP GET of a search
+/// @param config the server configuration
+/// @param query the query, form-decoded
+/// @param cursor the cursor from the previous page, or empty
+/// @return a response structure for routing, or why there's none
+route::result<route::response_get>
+results_get(const environment::configuration &config, const std::string &query,
+            const std::string &cursor);
+} // namespace search
+} // namespace cobble
+#endif
@@ -6,10 +6,10 @@
 namespace cobble {
 /// @brief Handles HTTP requests
 namespace server {
-/// @brief Starts the HTTP server
-/// @param config The desired configuration
+/// @brief Starts the HTTP server with the published configuration, SIGHUP
+/// reloads it
 /// @param run If false, the server will terminate. 
-void start(const environment::configuration &config, std::atomic<bool> &run);
+void start(std::atomic<bool> &run);
 } // namespace server
 } // namespace cobble
 #endif
\ No newline at end of file
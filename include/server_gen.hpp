@@ -1,35 +1,84 @@
 #if !defined(COBBLE_SERVER_GEN)
 #define COBBLE_SERVER_GEN
+#include "accounting.hpp"
 #include "environment.hpp"
+#include "exception_handler.hpp"
+#include "json_view.hpp"
+#include "logger.hpp"
 #include "main.hpp"
+#include "multipart.hpp"
 #include "query_string.hpp"
+#include "rate_limit.hpp"
 #include "route.hpp"
+#include "splice.hpp"
+#include "timekeeper.hpp"
+#include "trace.hpp"
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
-#include <chrono>
 #include <forward_list>
 #include <json/json.h>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <variant>
 namespace cobble {
 /// @brief Handles HTTP message generation
 namespace server_gen {
-/// @brief Generates a HTTP response
+/// @brief Largest request body read off a connection, past the JSON parser's
+/// own limit so a body that's too large gets a 413 rather than a dropped
+/// connection or a reset stream
+constexpr U64 MAX_REQUEST_BODY = 2 * json_view::MAX_BYTES;
+
+/// @brief Checks a peer against the configured CORS origins or subnets
+/// @param config A listener configuration
+/// @param origin The value of the request's `Origin` header
+/// @param peer_ip The peer IP address
+/// @return true if the peer may use the API
+bool origin_allowed(const environment::configuration &config,
+                    std::string_view origin, const std::string &peer_ip);
+
+/// @brief Checks an `If-None-Match` header against a resource's ETag, with
+/// the weak comparison it calls for, so `W/` tags match too
+/// @param if_none_match The header, `*` or a comma-separated list of tags
+/// @param etag The resource's ETag, quoted
+/// @return true if the client already has the resource
+bool none_match(std::string_view if_none_match, std::string_view etag);
+
+/// @brief Sets a response's `Date` header to the time of the last clock tick
+/// @tparam Message HTTP response type
+/// @param response The response
+template <class Message> void stamp_date(Message &response) {
+  response.set(boost::beast::http::field::date, timekeeper::http_date().view());
+}
+
+/// @brief Any response a request can generate, kept typed so that HTTP/1.1
+/// and HTTP/2 can each serialize it their own way
+using response =
+    std::variant<boost::beast::http::response<boost::beast::http::string_body>,
+                 boost::beast::http::response<boost::beast::http::empty_body>,
+                 boost::beast::http::response<boost::beast::http::file_body>,
+                 boost::beast::http::response<multipart::body>,
+                 boost::beast::http::response<splice::body>>;
+
+/// @brief Generates a HTTP response, suspending only while a route handler
+/// does
 /// @tparam Body HTTP request body type
 /// @tparam Allocator HTTP request allocator type
 /// @param request The HTTP request
-/// @param config A listener configuration
+/// @param config A listener configuration, must outlive the coroutine
 /// @param peer_ip The peer IP address
 /// @param peer_port The peer port
-/// @return a message response
+/// @param context The request's trace context
+/// @return a typed response
 template <class Body, class Allocator>
-boost::beast::http::message_generator
-handle(boost::beast::http::request<
-           Body, boost::beast::http::basic_fields<Allocator>> &&request,
-       const environment::configuration &config, const std::string &peer_ip,
-       const U16 peer_port) {
+boost::asio::awaitable<response>
+respond(boost::beast::http::request<
+            Body, boost::beast::http::basic_fields<Allocator>> request,
+        const environment::configuration &config, std::string peer_ip,
+        const U16 peer_port, trace::context context) {
   // initial handle time
-  std::chrono::high_resolution_clock::time_point t0 =
-      std::chrono::high_resolution_clock::now();
+  const auto t0 = timekeeper::now();
 
   // 500 internal server error
   const auto server_error = [&request, &peer_ip, &peer_port, &t0] {
@@ -40,6 +89,7 @@ handle(boost::beast::http::request<
     response.set(boost::beast::http::field::access_control_allow_origin,
                  request["origin"]);
     response.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    stamp_date(response);
     response.set(boost::beast::http::field::content_type, "application/json");
     response.keep_alive(request.keep_alive());
 
@@ -50,10 +100,8 @@ handle(boost::beast::http::request<
     root["ok"] = false;
     root["code"] = "SERVER_ERROR";
     root["maintenanceMessage"] = "Please try again later";
-    std::chrono::high_resolution_clock::time_point t1 =
-        std::chrono::high_resolution_clock::now();
     root["responseTime"] =
-        std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        static_cast<Json::UInt64>(timekeeper::milliseconds_since(t0));
 
     response.body() = Json::writeString(builder, root);
 
@@ -70,6 +118,7 @@ handle(boost::beast::http::request<
     response.set(boost::beast::http::field::access_control_allow_origin,
                  request["origin"]);
     response.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    stamp_date(response);
     response.set(boost::beast::http::field::content_type, "application/json");
     response.keep_alive(request.keep_alive());
 
@@ -80,10 +129,8 @@ handle(boost::beast::http::request<
     root["ok"] = false;
     root["code"] = "BAD_REQUEST";
     root["maintenanceMessage"] = "Please try again later";
-    std::chrono::high_resolution_clock::time_point t1 =
-        std::chrono::high_resolution_clock::now();
     root["responseTime"] =
-        std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        static_cast<Json::UInt64>(timekeeper::milliseconds_since(t0));
     response.body() = Json::writeString(builder, root);
 
     response.prepare_payload();
@@ -100,6 +147,7 @@ handle(boost::beast::http::request<
     response.set(boost::beast::http::field::access_control_allow_origin,
                  request["origin"]);
     response.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    stamp_date(response);
     response.set(boost::beast::http::field::content_type, "application/json");
     response.keep_alive(request.keep_alive());
 
@@ -110,96 +158,105 @@ handle(boost::beast::http::request<
     root["ok"] = false;
     root["code"] = "UNAUTHORIZED";
     root["maintenanceMessage"] = "Can't access the API";
-    std::chrono::high_resolution_clock::time_point t1 =
-        std::chrono::high_resolution_clock::now();
     root["responseTime"] =
-        std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        static_cast<Json::UInt64>(timekeeper::milliseconds_since(t0));
     response.body() = Json::writeString(builder, root);
 
     response.prepare_payload();
     return response;
   };
 
+  // 429 too many requests, the body is rendered once up front
+  const auto too_many_requests = [&request, &peer_ip,
+                                  &peer_port](U32 retry_after) {
+    boost::beast::http::response<boost::beast::http::string_body> response{
+        boost::beast::http::status::too_many_requests, request.version()};
+
+    logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+                " returns HTTP 429");
+    response.set(boost::beast::http::field::access_control_allow_origin,
+                 request["origin"]);
+    response.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    stamp_date(response);
+    response.set(boost::beast::http::field::content_type, "application/json");
+    response.set(boost::beast::http::field::retry_after,
+                 std::to_string(retry_after));
+    response.keep_alive(request.keep_alive());
+    response.body() = rate_limit::rendered_body();
+
+    response.prepare_payload();
+    return response;
+  };
+
   try {
-    // Ensure CORS is not blocked here
-    bool in_network = false;
-
-    if (std::holds_alternative<std::forward_list<std::string>>(
-            config.cors_entries)) {
-      // holding DNS entries
-      const auto &cors =
-          std::get<std::forward_list<std::string>>(config.cors_entries);
-      for (const auto &origin : cors) {
-        if (request["origin"] == origin || origin == "*") {
-          in_network = true;
-          break;
-        }
+    const auto target = request.target();
+    std::filesystem::path target_path{};
+    std::unordered_map<std::string, std::string> parsed{};
+    {
+      // charged to the route the request ends up at, once it's known
+      accounting::scope counted{context.id};
+
+      // Throttle clients before doing any other work for them
+      if (const auto retry_after = rate_limit::take(
+              config.rate_limit, boost::asio::ip::make_address(peer_ip))) {
+        co_return too_many_requests(*retry_after);
       }
-    } else {
-      // holding IP address ranges
-      const auto ip_converted = boost::asio::ip::make_address(peer_ip);
-      const auto &cors =
-          std::get<environment::cidr_network_list>(config.cors_entries);
-
-      if (ip_converted.is_v4()) {
-        // peer is IPv4 so we need to use IPv4 ranges
-        for (const auto &cidr : cors.v4) {
-          auto hosts = cidr.hosts();
-          if (hosts.find(ip_converted.to_v4()) != hosts.end()) {
-            in_network = true;
-            break;
-          }
-        }
-      } else {
-        // peer is IPv6 so we need to use IPv6 ranges
-        for (const auto &cidr : cors.v6) {
-          auto hosts = cidr.hosts();
-          if (hosts.find(ip_converted.to_v6()) != hosts.end()) {
-            in_network = true;
-            break;
-          }
+
+      // Ensure CORS is not blocked here
+      {
+        trace::span span{"cors", context};
+        if (!origin_allowed(config, request["origin"], peer_ip)) {
+          co_return unauthorized();
         }
       }
-    }
-
-    if (!in_network) {
-      return unauthorized();
-    }
 
-    const auto target = request.target();
-    std::filesystem::path target_path{};
-    auto parsed = query_string::parse(target, target_path);
+      parsed = [&target, &target_path, &context] {
+        trace::span span{"query_string::parse", context};
+        return query_string::parse(target, target_path);
+      }();
 
-    logger::log(logger::severity::debug, peer_ip, ":", peer_port, " reads '",
-                target, "' ", request.method_string());
+      logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+                  " reads '", target, "' ", request.method_string());
+    }
 
     const auto method = request.method();
 
     switch (method) {
     case boost::beast::http::verb::head: {
-      auto routed = route::api_head(config, target_path, std::move(parsed));
+      auto routed =
+          co_await [&]() -> boost::asio::awaitable<route::response_head> {
+        trace::span span{"route::api_head", context};
+        co_return co_await route::api_head(config, target_path,
+                                           std::move(parsed), context);
+      }();
+      accounting::scope counted{context.id};
 
       boost::beast::http::response<boost::beast::http::empty_body> response{
-          boost::beast::http::status::ok, request.version()};
+          routed.status, request.version()};
       response.set(boost::beast::http::field::access_control_allow_origin,
                    request["origin"]);
       response.set(boost::beast::http::field::server,
                    BOOST_BEAST_VERSION_STRING);
+      stamp_date(response);
       response.set(boost::beast::http::field::content_type, routed.mime_type);
       response.content_length(routed.size.value_or(0));
+      for (const auto &[name, value] : routed.headers) {
+        response.set(name, value);
+      }
       response.keep_alive(request.keep_alive());
-      std::chrono::high_resolution_clock::time_point t1 =
-          std::chrono::high_resolution_clock::now();
-      response.set(
-          "X-Response-Time",
-          std::to_string(
-              std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0)
-                  .count()));
-
-      return response;
+      response.set("X-Response-Time",
+                   std::to_string(timekeeper::milliseconds_since(t0)));
+
+      co_return response;
     }
     case boost::beast::http::verb::get: {
-      auto routed = route::api_get(config, target_path, std::move(parsed));
+      auto routed =
+          co_await [&]() -> boost::asio::awaitable<route::response_get> {
+        trace::span span{"route::api_get", context};
+        co_return co_await route::api_get(config, target_path,
+                                          std::move(parsed), context);
+      }();
+      accounting::scope counted{context.id};
 
       if (std::holds_alternative<Json::Value>(routed.body)) {
         auto &&body_json = std::get<Json::Value>(routed.body);
@@ -209,19 +266,90 @@ handle(boost::beast::http::request<
                      request["origin"]);
         response.set(boost::beast::http::field::server,
                      BOOST_BEAST_VERSION_STRING);
+        stamp_date(response);
         response.set(boost::beast::http::field::content_type, routed.mime_type);
+        for (const auto &[name, value] : routed.headers) {
+          response.set(name, value);
+        }
         response.keep_alive(request.keep_alive());
 
         Json::StreamWriterBuilder builder;
         builder.settings_["indentation"] = "";
-        std::chrono::high_resolution_clock::time_point t1 =
-            std::chrono::high_resolution_clock::now();
         body_json["responseTime"] =
-            std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0)
-                .count();
+            static_cast<Json::UInt64>(timekeeper::milliseconds_since(t0));
         response.body() = Json::writeString(builder, body_json);
         response.prepare_payload();
-        return response;
+        co_return response;
+      } else if (std::holds_alternative<multipart::body::value_type>(
+                     routed.body)) {
+        auto &&body_parts =
+            std::get<multipart::body::value_type>(routed.body);
+        boost::beast::http::response<multipart::body> response{
+            routed.status, request.version()};
+        response.set(boost::beast::http::field::access_control_allow_origin,
+                     request["origin"]);
+        response.set(boost::beast::http::field::server,
+                     BOOST_BEAST_VERSION_STRING);
+        stamp_date(response);
+        response.set(boost::beast::http::field::content_type,
+                     routed.mime_type + "; boundary=" +
+                         std::string{body_parts.boundary()});
+        response.keep_alive(request.keep_alive());
+        body_parts.charge_to(context.id);
+        response.body() = std::move(body_parts);
+        response.set("X-Response-Time",
+                     std::to_string(timekeeper::milliseconds_since(t0)));
+        response.prepare_payload();
+        co_return response;
+      } else if (std::holds_alternative<splice::body::value_type>(
+                     routed.body)) {
+        auto &&body_spliced = std::get<splice::body::value_type>(routed.body);
+
+        // the client already has this exact content
+        if (routed.etag &&
+            none_match(request[boost::beast::http::field::if_none_match],
+                       *routed.etag)) {
+          boost::beast::http::response<boost::beast::http::empty_body>
+              response{boost::beast::http::status::not_modified,
+                       request.version()};
+          response.set(boost::beast::http::field::access_control_allow_origin,
+                       request["origin"]);
+          response.set(boost::beast::http::field::server,
+                       BOOST_BEAST_VERSION_STRING);
+          stamp_date(response);
+          response.set(boost::beast::http::field::etag, *routed.etag);
+          if (routed.cache_control) {
+            response.set(boost::beast::http::field::cache_control,
+                         *routed.cache_control);
+          }
+          response.keep_alive(request.keep_alive());
+          response.set("X-Response-Time",
+                       std::to_string(timekeeper::milliseconds_since(t0)));
+          co_return response;
+        }
+
+        boost::beast::http::response<splice::body> response{routed.status,
+                                                            request.version()};
+        response.set(boost::beast::http::field::access_control_allow_origin,
+                     request["origin"]);
+        response.set(boost::beast::http::field::server,
+                     BOOST_BEAST_VERSION_STRING);
+        stamp_date(response);
+        response.set(boost::beast::http::field::content_type, routed.mime_type);
+        if (routed.cache_control) {
+          response.set(boost::beast::http::field::cache_control,
+                       *routed.cache_control);
+        }
+        if (routed.etag) {
+          response.set(boost::beast::http::field::etag, *routed.etag);
+        }
+        response.keep_alive(request.keep_alive());
+        body_spliced.charge_to(context.id);
+        response.body() = std::move(body_spliced);
+        response.set("X-Response-Time",
+                     std::to_string(timekeeper::milliseconds_since(t0)));
+        response.prepare_payload();
+        co_return response;
       } else {
         auto &&body_file =
             std::get<boost::beast::http::file_body::value_type>(routed.body);
@@ -231,31 +359,85 @@ handle(boost::beast::http::request<
                      request["origin"]);
         response.set(boost::beast::http::field::server,
                      BOOST_BEAST_VERSION_STRING);
+        stamp_date(response);
         response.set(boost::beast::http::field::content_type, routed.mime_type);
         response.keep_alive(request.keep_alive());
         response.body() = std::move(body_file);
-        std::chrono::high_resolution_clock::time_point t1 =
-            std::chrono::high_resolution_clock::now();
-        response.set(
-            "X-Response-Time",
-            std::to_string(
-                std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0)
-                    .count()));
+        response.set("X-Response-Time",
+                     std::to_string(timekeeper::milliseconds_since(t0)));
+        response.prepare_payload();
+        co_return response;
+      }
+    }
+    case boost::beast::http::verb::post: {
+      if constexpr (!std::is_same_v<Body, boost::beast::http::string_body>) {
+        co_return bad_request();
+      } else {
+        auto routed =
+            co_await [&]() -> boost::asio::awaitable<route::response_post> {
+          trace::span span{"route::api_post", context};
+          co_return co_await route::api_post(config, target_path,
+                                             std::move(parsed),
+                                             std::move(request.body()),
+                                             context);
+        }();
+        accounting::scope counted{context.id};
+
+        boost::beast::http::response<boost::beast::http::string_body> response{
+            routed.status, request.version()};
+        response.set(boost::beast::http::field::access_control_allow_origin,
+                     request["origin"]);
+        response.set(boost::beast::http::field::server,
+                     BOOST_BEAST_VERSION_STRING);
+        stamp_date(response);
+        response.set(boost::beast::http::field::content_type, routed.mime_type);
+        response.keep_alive(request.keep_alive());
+
+        Json::StreamWriterBuilder builder;
+        builder.settings_["indentation"] = "";
+        routed.body["responseTime"] =
+            static_cast<Json::UInt64>(timekeeper::milliseconds_since(t0));
+        response.body() = Json::writeString(builder, routed.body);
         response.prepare_payload();
-        return response;
+        co_return response;
       }
     }
     default: {
-      return bad_request();
+      co_return bad_request();
     }
     }
   } catch (const std::exception &e) {
     logger::log(logger::severity::error,
                 "HTTP generator errored, printing stacktrace");
     exception_handler::print_nested(e);
-    return server_error();
+    co_return server_error();
   }
 }
+
+/// @brief Generates a HTTP/1.1 response
+/// @tparam Body HTTP request body type
+/// @tparam Allocator HTTP request allocator type
+/// @param request The HTTP request
+/// @param config A listener configuration, must outlive the coroutine
+/// @param peer_ip The peer IP address
+/// @param peer_port The peer port
+/// @param context The request's trace context
+/// @return a message response
+template <class Body, class Allocator>
+boost::asio::awaitable<boost::beast::http::message_generator>
+handle(boost::beast::http::request<
+           Body, boost::beast::http::basic_fields<Allocator>> request,
+       const environment::configuration &config, std::string peer_ip,
+       const U16 peer_port, trace::context context) {
+  auto response = co_await respond(std::move(request), config,
+                                   std::move(peer_ip), peer_port, context);
+  accounting::scope counted{context.id};
+  co_return std::visit(
+      [](auto &&message) {
+        return boost::beast::http::message_generator{std::move(message)};
+      },
+      std::move(response));
+}
 } // namespace server_gen
 } // namespace cobble
 #endif
\ No newline at end of file
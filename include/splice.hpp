@@ -0,0 +1,120 @@
+#if !defined(COBBLE_SPLICE)
+#define COBBLE_SPLICE
+#include "descriptor.hpp"
+#include "main.hpp"
+#include <boost/beast.hpp>
+#include <boost/optional.hpp>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+namespace cobble {
+/// @brief Response bodies stitched together from bytes in memory and byte
+/// ranges of a file. Not `splice(2)`: file ranges are read a chunk at a time
+/// into the writer's buffer, so a file is never held in memory whole, but its
+/// bytes are copied once on their way to the socket.
+namespace splice {
+/// @brief A Beast Body sending its head, then its file ranges in order
+struct body {
+  /// @brief The head, the file ranges and a read cursor over them
+  class value_type {
+    std::string _head{};
+    std::shared_ptr<const std::string> _shared{};
+    std::shared_ptr<const descriptor::file> _file{};
+    std::vector<std::pair<U64, U64>> _ranges{};
+
+    U64 _request = 0;
+    std::size_t _head_offset = 0;
+    std::size_t _range = 0;
+    U64 _range_offset = 0;
+
+    std::string_view _head_bytes() const;
+
+  public:
+    /// @brief The bytes sent before any file range
+    /// @return The head, to write into
+    std::string &head();
+
+    /// @brief Sends bytes held elsewhere as the head instead, without copying
+    /// them
+    /// @param bytes The bytes, like an object in the memory cache
+    void share(std::shared_ptr<const std::string> bytes);
+
+    /// @brief Sets the file ranges are taken from
+    /// @param which The open file, shared with other responses
+    void use(std::shared_ptr<const descriptor::file> which);
+
+    /// @brief Appends a file range, merged with the previous one if adjacent
+    /// @param offset Where the range starts in the file
+    /// @param length How many bytes the range has
+    void add(U64 offset, U64 length);
+
+    /// @brief The exact size, for the response's `Content-Length`
+    /// @return The size in bytes
+    U64 size() const;
+
+    /// @brief Hands out the head bytes not sent yet where they are, as if
+    /// they were read
+    /// @return The bytes, empty once the head is sent
+    boost::asio::const_buffer take_head();
+
+    /// @brief Charges reading the body to a request in accounting
+    /// @param request The request's ID, from its ledger
+    void charge_to(U64 request);
+
+    /// @brief Copies the next bytes of the body, sequentially, reading file
+    /// ranges with `pread`
+    /// @param buffer Where to put them
+    /// @param length How many bytes fit
+    /// @param ec Set on file read errors
+    /// @return Bytes put in `buffer`, zero once the body is done
+    std::size_t read(void *buffer, std::size_t length,
+                     boost::beast::error_code &ec);
+  };
+
+  /// @brief Beast's hook for `Content-Length`
+  /// @param value The body
+  /// @return The size in bytes
+  static U64 size(const value_type &value) { return value.size(); }
+
+  /// @brief Serializes the body for Beast, the head in place and the file
+  /// ranges through a 16 KiB chunk buffer of its own
+  class writer {
+    value_type &_value;
+    char _chunk[16384];
+
+  public:
+    /// @brief A buffer sequence of one buffer
+    using const_buffers_type = boost::asio::const_buffer;
+
+    template <bool isRequest, class Fields>
+    writer(const boost::beast::http::header<isRequest, Fields> &,
+           value_type &value)
+        : _value{value} {}
+
+    /// @brief Nothing to prepare
+    /// @param ec Always cleared
+    void init(boost::beast::error_code &ec) { ec = {}; }
+
+    /// @brief Hands Beast the next chunk
+    /// @param ec Set on file read errors
+    /// @return The chunk and whether more follows, or nothing when done
+    boost::optional<std::pair<const_buffers_type, bool>>
+    get(boost::beast::error_code &ec) {
+      ec = {};
+      if (const auto head = _value.take_head(); head.size() > 0) {
+        return {{head, true}};
+      }
+
+      const auto length = _value.read(_chunk, sizeof(_chunk), ec);
+      if (ec || length == 0) {
+        return boost::none;
+      }
+      return {{const_buffers_type{_chunk, length}, true}};
+    }
+  };
+};
+} // namespace splice
+} // namespace cobble
+#endif
@@ -0,0 +1,77 @@
+#if !defined(COBBLE_STORAGE)
+#define COBBLE_STORAGE
+#include "environment.hpp"
+#include "main.hpp"
+#include <filesystem>
+#include <json/json.h>
+#include <memory>
+#include <string>
+#include <vector>
+namespace cobble {
+/// @brief Where media is stored, read through a memory cache, the storage
+/// directory and optionally an S3-compatible object store, in that order
+namespace storage {
+/// @brief Where an object can be read from right now
+struct location {
+  /// @brief The object's file in the storage directory, empty while it's
+  /// still being fetched or if there's no such object
+  std::filesystem::path path{};
+
+  /// @brief The whole object if it's small and hot, or nothing
+  std::shared_ptr<const std::string> bytes{};
+
+  /// @brief The content hash of `bytes` if it was ingested, or nothing
+  std::string hash{};
+
+  /// @brief If the object is being fetched from the object store, ask again
+  /// later
+  bool fetching = false;
+};
+
+/// @brief An Abstract Base Class for a storage backend
+class backend {
+public:
+  virtual ~backend() = default;
+
+  /// @brief Finds an object without ever waiting on the network, a fetch is
+  /// started in the background if it's only in the object store
+  /// @param key The object, like `thumbnails/1.webp`
+  /// @param small If the object may be kept in memory
+  /// @return Where it is
+  virtual location locate(const std::string &key, bool small) = 0;
+
+  /// @brief Lists objects without ever waiting on the network, the object
+  /// store's listing may be a little old
+  /// @param prefix The objects' common prefix, like `videos/`
+  /// @return Their keys
+  virtual std::vector<std::string> list(const std::string &prefix) = 0;
+
+  /// @brief How well the caches have done so far
+  /// @return Counters per tier
+  virtual Json::Value stats() = 0;
+};
+
+/// @brief The subdirectory of the storage directory that objects from the
+/// object store are downloaded into, the only one that's ever evicted from
+constexpr const char *CACHE_DIRECTORY = "cache";
+
+/// @brief Where an object's file is, or will be once it's fetched
+/// @param config The server configuration
+/// @param key The object, like `thumbnails/1.webp`
+/// @return The path, under `CACHE_DIRECTORY` with an object store
+std::filesystem::path local_path(const environment::configuration &config,
+                                 const std::string &key);
+
+/// @brief Gets the backend for a configuration, only rebuilt when its
+/// storage settings change so caches survive reloads
+/// @param config The server configuration
+/// @return The backend
+std::shared_ptr<backend> open(const environment::configuration &config);
+
+/// @brief Waits for fetches in progress, then stops fetching from the object
+/// store and evicting from the storage directory, for a process handing it
+/// over. Objects already there are still served.
+void stop();
+} // namespace storage
+} // namespace cobble
+#endif
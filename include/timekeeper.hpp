@@ -0,0 +1,60 @@
+#if !defined(COBBLE_TIMEKEEPER)
+#define COBBLE_TIMEKEEPER
+#include "main.hpp"
+#include <string>
+#include <string_view>
+namespace cobble {
+/// @brief A process-wide clock. One thread formats the wall time every tick so
+/// that logging and responses only copy it, and latency is measured with a
+/// counter that's cheaper to read than `std::chrono` clocks.
+namespace timekeeper {
+/// @brief A short formatted time, copied out of the last tick
+struct text {
+  /// @brief The characters, not null-terminated
+  char data[64];
+
+  /// @brief How many characters are used
+  std::size_t size;
+
+  /// @brief Views the characters
+  /// @return The view, valid as long as this text is
+  std::string_view view() const { return {data, size}; }
+};
+
+/// @brief Starts the ticking thread if it isn't running yet, the formatted
+/// times start it on first use too
+void start();
+
+/// @brief Stops and joins the ticking thread, for the end of `main`. The
+/// formatted times keep the last tick, so late log lines still work.
+void stop();
+
+/// @brief The local time of the last tick, for logs
+/// @return Like `2024-01-31 23:59:59.120`
+text log_timestamp();
+
+/// @brief The time of the last tick, for the HTTP `Date` header
+/// @return Like `Wed, 31 Jan 2024 23:59:59 GMT`
+text http_date();
+
+/// @brief A reading of the monotonic counter, the TSC on x86 and
+/// `CLOCK_MONOTONIC_COARSE` elsewhere
+using instant = U64;
+
+/// @brief Reads the monotonic counter
+/// @return The reading
+instant now();
+
+/// @brief Converts the time between two readings to nanoseconds
+/// @param from The earlier reading
+/// @param to The later reading
+/// @return Nanoseconds in between
+U64 nanoseconds_between(instant from, instant to);
+
+/// @brief Measures the time since an earlier reading
+/// @param since The earlier reading
+/// @return Whole milliseconds since then
+U64 milliseconds_since(instant since);
+} // namespace timekeeper
+} // namespace cobble
+#endif
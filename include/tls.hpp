@@ -0,0 +1,29 @@
+#if !defined(COBBLE_TLS)
+#define COBBLE_TLS
+#include "environment.hpp"
+#include "main.hpp"
+#include <boost/asio/ssl.hpp>
+#include <memory>
+namespace cobble {
+/// @brief Handles the TLS listener's OpenSSL state
+namespace tls {
+/// @brief Creates the TLS context shared by every HTTPS connection, so its
+/// session cache and ticket keys let clients resume cheaply
+/// @param settings The TLS listener configuration
+/// @param http2 Whether to offer `h2` over ALPN ahead of `http/1.1`
+/// @return The server-side TLS context
+std::unique_ptr<boost::asio::ssl::context>
+make_context(const environment::tls_settings &settings, bool http2);
+
+/// @brief Checks if ALPN settled on HTTP/2 during a handshake
+/// @param ssl The connection's OpenSSL handle
+/// @return true if the peer and we agreed on `h2`
+bool negotiated_http2(SSL *ssl);
+
+/// @brief Checks if the kernel took over record encryption after a handshake
+/// @param ssl The connection's OpenSSL handle
+/// @return true if kTLS transmit offload is active
+bool ktls_active(SSL *ssl);
+} // namespace tls
+} // namespace cobble
+#endif
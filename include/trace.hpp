@@ -0,0 +1,73 @@
+#if !defined(COBBLE_TRACE)
+#define COBBLE_TRACE
+#include "main.hpp"
+#include <filesystem>
+#include <json/json.h>
+namespace cobble {
+/// @brief Samples per-request phase timings into Chrome trace events
+namespace trace {
+/// @brief The sampling decision for one request
+struct context {
+  /// @brief Request identifier, shared by all spans of the request
+  U64 id = 0;
+
+  /// @brief If false, spans of this request record nothing
+  bool sampled = false;
+};
+
+/// @brief Decides if a new request gets traced
+/// @param sample_rate 0.0 disables tracing, 1.0 traces every request
+/// @return The request's trace context
+context sample(F64 sample_rate);
+
+/// @brief Makes a request context current on this thread for a synchronous
+/// section, so nested spans can be opened without passing it around
+class scope {
+  context _previous;
+
+public:
+  /// @brief Makes `current` the thread's context
+  /// @param current The request's trace context
+  scope(const context &current);
+
+  /// @brief Restores the previous context
+  ~scope();
+
+  scope(const scope &) = delete;
+  scope &operator=(const scope &) = delete;
+};
+
+/// @brief Records the duration of a phase when it goes out of scope
+class span {
+  const char *_name;
+  U64 _id;
+  U64 _t0;
+  bool _sampled;
+
+public:
+  /// @brief Opens a span under the thread's current context
+  /// @param name Phase name, must outlive the trace buffers (use a literal)
+  span(const char *name);
+
+  /// @brief Opens a span under an explicit context
+  /// @param name Phase name, must outlive the trace buffers (use a literal)
+  /// @param current The request's trace context
+  span(const char *name, const context &current);
+
+  /// @brief Closes the span and records it if sampled
+  ~span();
+
+  span(const span &) = delete;
+  span &operator=(const span &) = delete;
+};
+
+/// @brief Collects every thread's recorded spans
+/// @return A Chrome trace JSON object, loadable in Perfetto
+Json::Value collect();
+
+/// @brief Writes every thread's recorded spans to a file
+/// @param where The file path
+void dump(const std::filesystem::path &where);
+} // namespace trace
+} // namespace cobble
+#endif
@@ -0,0 +1,59 @@
+#if !defined(COBBLE_TRENDING)
+#define COBBLE_TRENDING
+#include "main.hpp"
+#include <json/json.h>
+#include <memory>
+#include <vector>
+namespace cobble {
+/// @brief Finds the videos watched most lately. Each thread buffers its hits,
+/// a background thread folds them every few seconds into a Space-Saving
+/// sketch of time-decayed counts and publishes its top videos as an
+/// immutable snapshot, so listing them never waits on the sketch.
+namespace trending {
+/// @brief Most videos a snapshot lists
+constexpr std::size_t MAX_LISTED = 100;
+
+/// @brief How much watching a video counts
+constexpr F64 VIDEO_WEIGHT = 1.0;
+
+/// @brief How much fetching a thumbnail counts, listings fetch many of them
+constexpr F64 THUMBNAIL_WEIGHT = 0.1;
+
+/// @brief A listed video
+struct video {
+  /// @brief The video ID
+  U64 id;
+
+  /// @brief Its decayed hits, counting a hit as 1 now and as 0.5 a half-life
+  /// ago
+  F64 score;
+
+  /// @brief How much of the score may belong to videos it replaced in the
+  /// sketch, 0 if it's been tracked all along
+  F64 overestimate;
+};
+
+/// @brief The top videos as of one fold
+struct snapshot {
+  /// @brief The videos, highest score first
+  std::vector<video> videos;
+
+  /// @brief How many folds came before this one
+  U64 folds;
+};
+
+/// @brief Counts a hit, only locking the calling thread's own buffer
+/// @param id The video ID
+/// @param weight How much it counts, like `VIDEO_WEIGHT`
+void hit(U64 id, F64 weight);
+
+/// @brief Gets the latest snapshot, starting the folding thread on first use
+/// @return It, empty until the first fold
+std::shared_ptr<const snapshot> top();
+
+/// @brief How much was counted so far
+/// @return Counters of hits, dropped hits, folds and tracked videos
+Json::Value stats();
+} // namespace trending
+} // namespace cobble
+#endif
@@ -0,0 +1,35 @@
+#if !defined(COBBLE_VIEWS)
+#define COBBLE_VIEWS
+#include "environment.hpp"
+#include "main.hpp"
+#include <json/json.h>
+namespace cobble {
+/// @brief Counts video views. Each thread counts into its own table, a
+/// background thread sums the tables every second, appends the sums to a
+/// write-ahead log with one `fdatasync` and compacts the log once it's large.
+namespace views {
+/// @brief Replays the write-ahead log in the storage directory and starts
+/// flushing to it, only the first call does anything so the log stays where
+/// it started across reloads
+/// @param config The server configuration
+void start(const environment::configuration &config);
+
+/// @brief Flushes one last time and closes the log, for a process handing
+/// the storage directory over. Views counted later aren't persisted.
+void stop();
+
+/// @brief Counts one view, without locking or touching shared memory
+/// @param id The video ID
+void record(U64 id);
+
+/// @brief Gets a video's views, as of the last flush
+/// @param id The video ID
+/// @return The views
+U64 total(U64 id);
+
+/// @brief How much has been counted and persisted so far
+/// @return Counters of views, flushes, log bytes and compactions
+Json::Value stats();
+} // namespace views
+} // namespace cobble
+#endif
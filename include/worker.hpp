@@ -0,0 +1,63 @@
+#if !defined(COBBLE_WORKER)
+#define COBBLE_WORKER
+#include "main.hpp"
+#include <boost/asio.hpp>
+#include <json/json.h>
+#include <type_traits>
+#include <utility>
+namespace cobble {
+/// @brief Runs CPU-heavy or blocking work off the connection threads, so one
+/// slow request doesn't stall every other connection on its thread
+namespace worker {
+/// @brief Gets the worker pool, started on first use with a thread per core
+/// @return The pool
+boost::asio::thread_pool &pool();
+
+/// @brief Counts one offloaded job as running, from when it's queued
+/// @return Its epoch, for `end`
+U64 begin();
+
+/// @brief Counts an offloaded job as done
+/// @param started What `begin` returned for it
+void end(U64 started);
+
+/// @brief Starts a new epoch, so jobs offloaded before can be waited on
+/// without waiting on later ones too
+/// @return The epoch that ended, for `settled`
+U64 fence();
+
+/// @brief Checks if every job offloaded before a fence is done
+/// @param ended What `fence` returned
+/// @return true once they are
+bool settled(U64 ended);
+
+/// @brief How much work was offloaded so far
+/// @return Counters of threads and offloaded jobs
+Json::Value stats();
+
+/// @brief Runs a function on the worker pool and resumes the awaiting
+/// coroutine on its own executor once it's done, exceptions included
+/// @tparam Function A callable taking no arguments, returning nothing or
+/// something default constructible
+/// @param function The work, kept alive until it's done
+/// @return What the function returns
+template <class Function>
+boost::asio::awaitable<std::invoke_result_t<Function &>>
+offload(Function function) {
+  using result = std::invoke_result_t<Function &>;
+  const auto epoch = begin();
+  co_return co_await boost::asio::co_spawn(
+      pool(),
+      [function = std::move(function), epoch]() mutable
+      -> boost::asio::awaitable<result> {
+        const struct ending {
+          U64 epoch;
+          ~ending() { end(epoch); }
+        } done{epoch};
+        co_return function();
+      },
+      boost::asio::use_awaitable);
+}
+} // namespace worker
+} // namespace cobble
+#endif
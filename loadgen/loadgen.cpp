@@ -0,0 +1,395 @@
+#include "../include/exception_handler.hpp"
+#include "../include/logger.hpp"
+#include "../include/main.hpp"
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <json/json.h>
+#include <map>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+using namespace cobble;
+
+using tcp_stream = typename boost::beast::tcp_stream::rebind_executor<
+    boost::asio::use_awaitable_t<>::executor_with_default<
+        boost::asio::any_io_executor>>::other;
+
+/// @brief One replayable request from the JSONL corpus
+struct corpus_entry {
+  /// @brief HTTP method
+  boost::beast::http::verb method;
+
+  /// @brief Request target, path and query string
+  std::string target;
+
+  /// @brief Extra request headers
+  std::vector<std::pair<std::string, std::string>> headers;
+
+  /// @brief The `Origin` header, if any
+  std::string origin;
+
+  /// @brief Relative selection weight
+  F64 weight;
+};
+
+/// @brief Load generator options, set from the command line
+struct options {
+  /// @brief The JSONL corpus file
+  std::string corpus;
+
+  /// @brief The host Cobble listens with
+  std::string host = "127.0.0.1";
+
+  /// @brief The port Cobble listens on
+  std::string port = "8080";
+
+  /// @brief Concurrent keep-alive connections
+  U32 connections = 8;
+
+  /// @brief Target request rate per second, zero for a closed loop
+  F64 rate = 0.0;
+
+  /// @brief How long to generate load for
+  std::chrono::seconds duration{10};
+
+  /// @brief I/O context threads
+  S32 threads = 1;
+
+  /// @brief How long one request may take, from connecting to the last byte
+  /// of its response, before it counts as an error
+  std::chrono::seconds timeout{5};
+};
+
+/// @brief What a single connection measured
+struct connection_result {
+  /// @brief Latencies in microseconds
+  std::vector<U64> latencies{};
+
+  /// @brief Response counts by HTTP status
+  std::map<U32, U64> statuses{};
+
+  /// @brief Failed requests (connection or parse errors)
+  U64 errors = 0;
+};
+
+/// @brief State shared between all connections in a run
+struct run_state {
+  /// @brief The parsed options
+  const options &opts;
+
+  /// @brief The parsed corpus
+  const std::vector<corpus_entry> &corpus;
+
+  /// @brief Corpus entry selection by weight
+  std::discrete_distribution<std::size_t> pick;
+
+  /// @brief When the run started
+  std::chrono::steady_clock::time_point t0;
+
+  /// @brief When the run should stop sending
+  std::chrono::steady_clock::time_point t1;
+
+  /// @brief Next schedule slot in open loop mode
+  std::atomic<U64> next_slot{0};
+};
+
+static std::vector<corpus_entry> load_corpus(const std::string &where) {
+  std::ifstream file{where};
+  if (!file) {
+    throw std::runtime_error{"Could not open corpus '" + where + "'"};
+  }
+
+  std::vector<corpus_entry> corpus{};
+  Json::CharReaderBuilder builder;
+  std::string line;
+  U64 line_number = 0;
+
+  while (std::getline(file, line)) {
+    line_number++;
+    if (line.empty()) {
+      continue;
+    }
+
+    Json::Value root;
+    std::string errors;
+    std::unique_ptr<Json::CharReader> reader{builder.newCharReader()};
+    if (!reader->parse(line.data(), line.data() + line.size(), &root,
+                       &errors)) {
+      throw std::runtime_error{"Corpus line " + std::to_string(line_number) +
+                               " is not JSON: " + errors};
+    }
+
+    corpus_entry entry{};
+    entry.method =
+        boost::beast::http::string_to_verb(root.get("method", "GET").asString());
+    if (entry.method == boost::beast::http::verb::unknown) {
+      throw std::runtime_error{"Corpus line " + std::to_string(line_number) +
+                               " has an unknown method"};
+    }
+    entry.target = root.get("target", "/").asString();
+    entry.origin = root.get("origin", "").asString();
+    entry.weight = root.get("weight", 1.0).asDouble();
+
+    const auto &headers = root["headers"];
+    if (headers.isObject()) {
+      for (const auto &name : headers.getMemberNames()) {
+        entry.headers.emplace_back(name, headers[name].asString());
+      }
+    }
+
+    corpus.emplace_back(std::move(entry));
+  }
+
+  if (corpus.empty()) {
+    throw std::runtime_error{"Corpus '" + where + "' has no requests"};
+  }
+
+  return corpus;
+}
+
+static options parse_options(int argc, char **argv) {
+  options opts{};
+
+  if (argc < 2) {
+    throw std::runtime_error{
+        "Usage: cobble-loadgen <corpus.jsonl> [--host H] [--port P] "
+        "[--connections N] [--rate R] [--duration S] [--threads T] "
+        "[--timeout S]"};
+  }
+  opts.corpus = argv[1];
+
+  for (auto i = 2; i < argc; i++) {
+    const std::string flag{argv[i]};
+    if (i + 1 >= argc) {
+      throw std::runtime_error{"Missing a value for '" + flag + "'"};
+    }
+    const std::string value{argv[++i]};
+
+    if (flag == "--host") {
+      opts.host = value;
+    } else if (flag == "--port") {
+      opts.port = value;
+    } else if (flag == "--connections") {
+      opts.connections = std::stoul(value);
+    } else if (flag == "--rate") {
+      opts.rate = std::stod(value);
+    } else if (flag == "--duration") {
+      opts.duration = std::chrono::seconds{std::stoll(value)};
+    } else if (flag == "--threads") {
+      opts.threads = std::stoi(value);
+    } else if (flag == "--timeout") {
+      opts.timeout = std::chrono::seconds{std::stoll(value)};
+    } else {
+      throw std::runtime_error{"Unknown option '" + flag + "'"};
+    }
+  }
+
+  if (opts.connections < 1 || opts.threads < 1) {
+    throw std::runtime_error{"Connections and threads must be above zero"};
+  }
+  if (opts.timeout.count() < 1) {
+    throw std::runtime_error{"The timeout must be above zero"};
+  }
+
+  return opts;
+}
+
+static boost::beast::http::request<boost::beast::http::string_body>
+make_request(const options &opts, const corpus_entry &entry) {
+  boost::beast::http::request<boost::beast::http::string_body> request{
+      entry.method, entry.target, 11};
+  request.set(boost::beast::http::field::host, opts.host + ":" + opts.port);
+  request.set(boost::beast::http::field::user_agent, "cobble-loadgen");
+  if (!entry.origin.empty()) {
+    request.set(boost::beast::http::field::origin, entry.origin);
+  }
+  for (const auto &[name, value] : entry.headers) {
+    request.set(name, value);
+  }
+  request.keep_alive(true);
+  request.prepare_payload();
+  return request;
+}
+
+boost::asio::awaitable<void> do_connection(run_state &state,
+                                           connection_result &result,
+                                           U32 seed) {
+  auto executor = co_await boost::asio::this_coro::executor;
+  boost::asio::ip::tcp::resolver resolver{executor};
+  boost::asio::steady_timer timer{executor};
+  std::minstd_rand rng{seed};
+  auto pick = state.pick;
+
+  const auto endpoints = co_await resolver.async_resolve(
+      state.opts.host, state.opts.port, boost::asio::use_awaitable);
+
+  std::optional<tcp_stream> stream{};
+  boost::beast::flat_buffer buffer;
+
+  for (;;) {
+    // In open loop mode every request has an intended start time, latency is
+    // measured from it so a stalled server can't hide its queueing delay
+    auto intended = std::chrono::steady_clock::now();
+    if (state.opts.rate > 0.0) {
+      const auto slot = state.next_slot.fetch_add(1);
+      intended = state.t0 + std::chrono::duration_cast<
+                                std::chrono::steady_clock::duration>(
+                                std::chrono::duration<F64>(
+                                    static_cast<F64>(slot) / state.opts.rate));
+      if (intended >= state.t1) {
+        break;
+      }
+      timer.expires_at(intended);
+      co_await timer.async_wait(boost::asio::use_awaitable);
+    } else if (intended >= state.t1) {
+      break;
+    }
+
+    const auto &entry = state.corpus[pick(rng)];
+
+    try {
+      // one deadline covers the whole exchange, a stuck request is an error
+      // rather than a stalled connection
+      if (!stream) {
+        stream.emplace(executor);
+        stream->expires_after(state.opts.timeout);
+        co_await stream->async_connect(endpoints);
+      }
+      stream->expires_after(state.opts.timeout);
+
+      auto request = make_request(state.opts, entry);
+      co_await boost::beast::http::async_write(*stream, request);
+
+      // HEAD responses announce a Content-Length but carry no body
+      boost::beast::http::response_parser<boost::beast::http::string_body>
+          parser;
+      parser.skip(entry.method == boost::beast::http::verb::head);
+      co_await boost::beast::http::async_read(*stream, buffer, parser);
+      stream->expires_never();
+      const auto &response = parser.get();
+
+      const auto t = std::chrono::steady_clock::now();
+      result.latencies.emplace_back(
+          std::chrono::duration_cast<std::chrono::microseconds>(t - intended)
+              .count());
+      result.statuses[response.result_int()]++;
+
+      if (!response.keep_alive()) {
+        stream.reset();
+        buffer.clear();
+      }
+    } catch (const boost::system::system_error &e) {
+      result.errors++;
+      stream.reset();
+      buffer.clear();
+    }
+  }
+
+  if (stream) {
+    boost::beast::error_code ec;
+    stream->socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  }
+}
+
+static U64 percentile(const std::vector<U64> &sorted, F64 p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  const auto rank = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+int main(int argc, char **argv) {
+  try {
+    logger::all_loggers().emplace_back(new logger::stdout_listener());
+
+    const auto opts = parse_options(argc, argv);
+    const auto corpus = load_corpus(opts.corpus);
+
+    std::vector<F64> weights{};
+    for (const auto &entry : corpus) {
+      weights.emplace_back(entry.weight);
+    }
+
+    run_state state{.opts = opts,
+                    .corpus = corpus,
+                    .pick = {weights.begin(), weights.end()}};
+    std::vector<connection_result> results(opts.connections);
+
+    logger::log(logger::severity::notice, "Replaying ", corpus.size(),
+                " corpus entries against ", opts.host, ":", opts.port,
+                " with ", opts.connections, " connections for ",
+                static_cast<S64>(opts.duration.count()), "s",
+                opts.rate > 0.0 ? " at a fixed rate" : " in a closed loop");
+
+    boost::asio::io_context io_context{opts.threads};
+    state.t0 = std::chrono::steady_clock::now();
+    state.t1 = state.t0 + opts.duration;
+
+    for (U32 i = 0; i < opts.connections; i++) {
+      boost::asio::co_spawn(io_context, do_connection(state, results[i], i + 1),
+                            [](std::exception_ptr e) {
+                              if (e) {
+                                std::rethrow_exception(e);
+                              }
+                            });
+    }
+
+    std::vector<std::thread> thread_pool{};
+    for (auto thr = opts.threads - 1; thr > 0; --thr) {
+      thread_pool.emplace_back([&io_context] { io_context.run(); });
+    }
+    io_context.run();
+    for (auto &&thr : thread_pool) {
+      thr.join();
+    }
+
+    const auto elapsed = std::chrono::duration<F64>(
+                             std::chrono::steady_clock::now() - state.t0)
+                             .count();
+
+    // merge everything the connections measured
+    std::vector<U64> latencies{};
+    std::map<U32, U64> statuses{};
+    U64 errors = 0;
+    for (auto &&result : results) {
+      latencies.insert(latencies.end(), result.latencies.begin(),
+                       result.latencies.end());
+      for (const auto &[status, count] : result.statuses) {
+        statuses[status] += count;
+      }
+      errors += result.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    logger::log(logger::severity::notice, "Completed ", latencies.size(),
+                " requests (", errors, " errors) in ", elapsed, "s, ",
+                latencies.size() / elapsed, " req/s");
+    for (const auto &[status, count] : statuses) {
+      logger::log(logger::severity::notice, "  HTTP ", status, ": ", count);
+    }
+    logger::log(logger::severity::notice, "Latency (us) p50 ",
+                percentile(latencies, 0.50), ", p90 ",
+                percentile(latencies, 0.90), ", p99 ",
+                percentile(latencies, 0.99), ", p99.9 ",
+                percentile(latencies, 0.999), ", max ",
+                latencies.empty() ? 0 : latencies.back());
+
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (const std::exception &e) {
+    logger::log(logger::severity::emergency,
+                "Terminating, stacktrace is below");
+    exception_handler::print_nested(e);
+
+    return EXIT_FAILURE;
+  }
+}
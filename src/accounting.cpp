@@ -0,0 +1,643 @@
+#include "../include/accounting.hpp"
+#if defined(ACCOUNTING_IN_USE)
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#endif
+using namespace cobble;
+
+#if defined(ACCOUNTING_IN_USE)
+/// @brief Most routes counted apart, routes past that are charged together
+/// to the last slot
+constexpr std::size_t MAX_ROUTES = 64;
+
+/// @brief Most ledgers open at once, requests past that are only charged to
+/// their routes
+constexpr std::size_t MAX_OPEN_LEDGERS = 4096;
+
+/// @brief Closed ledgers listed in `stats`, the oldest goes first
+constexpr std::size_t MAX_RECENT_LEDGERS = 64;
+
+/// @brief Set in the IDs given to requests that aren't traced, so they never
+/// collide with trace IDs
+constexpr U64 UNTRACED = U64{1} << 63;
+
+/// @brief One thread's counters. They're constant-initialized, so the hooks
+/// below never run a thread-local constructor, and only their own thread
+/// writes them.
+struct tally {
+  std::atomic<U64> allocations;
+  std::atomic<U64> bytes;
+  std::atomic<U64> frees;
+  std::atomic<U64> syscalls;
+
+  /// @brief The kernel's thread ID, once the thread is enrolled
+  pid_t thread;
+  tally *next;
+  tally *previous;
+};
+
+struct accounting::route_usage {
+  std::atomic<bool> used;
+  std::string_view name;
+  std::atomic<U64> requests;
+  std::atomic<U64> allocations;
+  std::atomic<U64> bytes;
+  std::atomic<U64> frees;
+  std::atomic<U64> syscalls;
+};
+
+static thread_local constinit tally mine{};
+static thread_local constinit accounting::scope *active = nullptr;
+
+/// @brief Threads that opened a scope or asked for totals, and what the
+/// ones that exited used
+static constinit std::mutex enrolled_lock{};
+static constinit tally *enrolled = nullptr;
+static constinit accounting::usage exited{};
+
+static constinit accounting::route_usage routes[MAX_ROUTES]{};
+static constinit std::mutex routes_lock{};
+
+/// @brief An open ledger, what its request used in and outside its route
+struct open_ledger {
+  accounting::route_usage *route = nullptr;
+  accounting::usage routed{};
+  accounting::usage unrouted{};
+};
+
+/// @brief A closed ledger, as listed in `stats`
+struct closed_ledger {
+  U64 request;
+  std::string_view route;
+  accounting::usage used;
+};
+
+static constinit std::mutex ledgers_lock{};
+static constinit closed_ledger recent[MAX_RECENT_LEDGERS]{};
+static constinit U64 closed = 0;
+static constinit std::atomic<U64> untraced{0};
+
+static std::unordered_map<U64, open_ledger> &open_ledgers() {
+  static std::unordered_map<U64, open_ledger> open{};
+  return open;
+}
+
+/// @brief Adds to a counter only its own thread writes, without a locked
+/// instruction
+static void bump(std::atomic<U64> &counter, U64 by) {
+  counter.store(counter.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+}
+
+static accounting::usage snapshot(const tally &of) {
+  return accounting::usage{
+      .allocations = of.allocations.load(std::memory_order_relaxed),
+      .bytes = of.bytes.load(std::memory_order_relaxed),
+      .frees = of.frees.load(std::memory_order_relaxed),
+      .syscalls = of.syscalls.load(std::memory_order_relaxed)};
+}
+
+static void add(accounting::usage &to, const accounting::usage &more) {
+  to.allocations += more.allocations;
+  to.bytes += more.bytes;
+  to.frees += more.frees;
+  to.syscalls += more.syscalls;
+}
+
+static void add(accounting::route_usage &to, const accounting::usage &more) {
+  to.allocations.fetch_add(more.allocations, std::memory_order_relaxed);
+  to.bytes.fetch_add(more.bytes, std::memory_order_relaxed);
+  to.frees.fetch_add(more.frees, std::memory_order_relaxed);
+  to.syscalls.fetch_add(more.syscalls, std::memory_order_relaxed);
+}
+
+/// @brief Charges a request's open ledger, requests whose ledger is closed
+/// already, like a stream reset while its body was sent, aren't charged
+/// @param route The route it was used in, or nothing outside any route
+static void charge_ledger(U64 request, accounting::route_usage *route,
+                          const accounting::usage &used) {
+  std::lock_guard lock{ledgers_lock};
+  const auto found = open_ledgers().find(request);
+  if (found == open_ledgers().end()) {
+    return;
+  }
+  if (route != nullptr) {
+    found->second.route = route;
+    add(found->second.routed, used);
+  } else {
+    add(found->second.unrouted, used);
+  }
+}
+
+/// @brief Unlinks its thread's counters when the thread exits
+struct leaver {
+  ~leaver() {
+    std::lock_guard lock{enrolled_lock};
+    add(exited, snapshot(mine));
+    if (mine.previous != nullptr) {
+      mine.previous->next = mine.next;
+    } else {
+      enrolled = mine.next;
+    }
+    if (mine.next != nullptr) {
+      mine.next->previous = mine.previous;
+    }
+  }
+};
+
+/// @brief Lists this thread's counters in `stats`, once
+static void enroll() {
+  if (mine.thread != 0) {
+    return;
+  }
+  mine.thread = ::gettid();
+  {
+    std::lock_guard lock{enrolled_lock};
+    mine.next = enrolled;
+    if (enrolled != nullptr) {
+      enrolled->previous = &mine;
+    }
+    enrolled = &mine;
+  }
+  static thread_local leaver leaving{};
+}
+
+/// @brief Finds a route's counters, giving it a slot the first time
+static accounting::route_usage *find(std::string_view name) {
+  for (auto &route : routes) {
+    if (!route.used.load(std::memory_order_acquire)) {
+      break;
+    }
+    if (route.name == name) {
+      return &route;
+    }
+  }
+
+  std::lock_guard lock{routes_lock};
+  for (std::size_t at = 0; at < MAX_ROUTES; at++) {
+    auto &route = routes[at];
+    if (!route.used.load(std::memory_order_relaxed)) {
+      route.name = at + 1 < MAX_ROUTES ? name : "(other)";
+      route.used.store(true, std::memory_order_release);
+      return &route;
+    }
+    if (route.name == name) {
+      return &route;
+    }
+  }
+  return &routes[MAX_ROUTES - 1];
+}
+
+static void counted(std::size_t size) {
+  bump(mine.allocations, 1);
+  bump(mine.bytes, size);
+}
+
+static void uncounted(void *pointer) {
+  if (pointer != nullptr) {
+    bump(mine.frees, 1);
+  }
+}
+
+static void *allocate(std::size_t size) {
+  counted(size);
+  if (auto *pointer = std::malloc(size == 0 ? 1 : size)) {
+    return pointer;
+  }
+  throw std::bad_alloc{};
+}
+
+static void *allocate(std::size_t size, std::align_val_t alignment) {
+  counted(size);
+  const auto align = static_cast<std::size_t>(alignment);
+  const auto rounded = std::max(align, (size + align - 1) / align * align);
+  if (auto *pointer = std::aligned_alloc(align, rounded)) {
+    return pointer;
+  }
+  throw std::bad_alloc{};
+}
+
+static void release(void *pointer) {
+  uncounted(pointer);
+  std::free(pointer);
+}
+
+/// @brief Looks up the libc function a hook below hides
+template <class Function> static Function *hidden(const char *name) {
+  return reinterpret_cast<Function *>(::dlsym(RTLD_NEXT, name));
+}
+
+/// @brief Counts a file syscall, then makes it
+template <class Function, class... Arguments>
+static auto pass(Function *call, Arguments... arguments) {
+  bump(mine.syscalls, 1);
+  return call(arguments...);
+}
+
+/// @brief Reads the mode `open` only takes when it creates a file
+static mode_t mode_of(int flags, va_list rest) {
+  const bool creates =
+      (flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE;
+  return creates ? va_arg(rest, mode_t) : 0;
+}
+// ============================================================================
+void *operator new(std::size_t size) { return allocate(size); }
+
+void *operator new[](std::size_t size) { return allocate(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  counted(size);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  counted(size);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return allocate(size, alignment);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return allocate(size, alignment);
+}
+
+void operator delete(void *pointer) noexcept { release(pointer); }
+
+void operator delete[](void *pointer) noexcept { release(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  release(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept {
+  release(pointer);
+}
+
+extern "C" {
+int open(const char *path, int flags, ...) {
+  static const auto next = hidden<int(const char *, int, ...)>("open");
+  va_list rest;
+  va_start(rest, flags);
+  const auto mode = mode_of(flags, rest);
+  va_end(rest);
+  return pass(next, path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) {
+  static const auto next = hidden<int(const char *, int, ...)>("open64");
+  va_list rest;
+  va_start(rest, flags);
+  const auto mode = mode_of(flags, rest);
+  va_end(rest);
+  return pass(next, path, flags, mode);
+}
+
+int openat(int directory, const char *path, int flags, ...) {
+  static const auto next =
+      hidden<int(int, const char *, int, ...)>("openat");
+  va_list rest;
+  va_start(rest, flags);
+  const auto mode = mode_of(flags, rest);
+  va_end(rest);
+  return pass(next, directory, path, flags, mode);
+}
+
+int openat64(int directory, const char *path, int flags, ...) {
+  static const auto next =
+      hidden<int(int, const char *, int, ...)>("openat64");
+  va_list rest;
+  va_start(rest, flags);
+  const auto mode = mode_of(flags, rest);
+  va_end(rest);
+  return pass(next, directory, path, flags, mode);
+}
+
+int __open_2(const char *path, int flags) {
+  static const auto next = hidden<int(const char *, int)>("__open_2");
+  return pass(next, path, flags);
+}
+
+int __open64_2(const char *path, int flags) {
+  static const auto next = hidden<int(const char *, int)>("__open64_2");
+  return pass(next, path, flags);
+}
+
+FILE *fopen(const char *path, const char *mode) {
+  static const auto next = hidden<FILE *(const char *, const char *)>("fopen");
+  return pass(next, path, mode);
+}
+
+FILE *fopen64(const char *path, const char *mode) {
+  static const auto next =
+      hidden<FILE *(const char *, const char *)>("fopen64");
+  return pass(next, path, mode);
+}
+
+int close(int fd) {
+  static const auto next = hidden<int(int)>("close");
+  return pass(next, fd);
+}
+
+int fclose(FILE *file) {
+  static const auto next = hidden<int(FILE *)>("fclose");
+  return pass(next, file);
+}
+
+ssize_t read(int fd, void *buffer, size_t size) {
+  static const auto next = hidden<ssize_t(int, void *, size_t)>("read");
+  return pass(next, fd, buffer, size);
+}
+
+ssize_t __read_chk(int fd, void *buffer, size_t size, size_t capacity) {
+  static const auto next =
+      hidden<ssize_t(int, void *, size_t, size_t)>("__read_chk");
+  return pass(next, fd, buffer, size, capacity);
+}
+
+ssize_t pread(int fd, void *buffer, size_t size, off_t offset) {
+  static const auto next =
+      hidden<ssize_t(int, void *, size_t, off_t)>("pread");
+  return pass(next, fd, buffer, size, offset);
+}
+
+ssize_t pread64(int fd, void *buffer, size_t size, off64_t offset) {
+  static const auto next =
+      hidden<ssize_t(int, void *, size_t, off64_t)>("pread64");
+  return pass(next, fd, buffer, size, offset);
+}
+
+ssize_t __pread_chk(int fd, void *buffer, size_t size, off_t offset,
+                    size_t capacity) {
+  static const auto next =
+      hidden<ssize_t(int, void *, size_t, off_t, size_t)>("__pread_chk");
+  return pass(next, fd, buffer, size, offset, capacity);
+}
+
+ssize_t __pread64_chk(int fd, void *buffer, size_t size, off64_t offset,
+                      size_t capacity) {
+  static const auto next =
+      hidden<ssize_t(int, void *, size_t, off64_t, size_t)>("__pread64_chk");
+  return pass(next, fd, buffer, size, offset, capacity);
+}
+
+ssize_t write(int fd, const void *buffer, size_t size) {
+  static const auto next =
+      hidden<ssize_t(int, const void *, size_t)>("write");
+  return pass(next, fd, buffer, size);
+}
+
+ssize_t pwrite(int fd, const void *buffer, size_t size, off_t offset) {
+  static const auto next =
+      hidden<ssize_t(int, const void *, size_t, off_t)>("pwrite");
+  return pass(next, fd, buffer, size, offset);
+}
+
+ssize_t pwrite64(int fd, const void *buffer, size_t size, off64_t offset) {
+  static const auto next =
+      hidden<ssize_t(int, const void *, size_t, off64_t)>("pwrite64");
+  return pass(next, fd, buffer, size, offset);
+}
+
+int fsync(int fd) {
+  static const auto next = hidden<int(int)>("fsync");
+  return pass(next, fd);
+}
+
+int fdatasync(int fd) {
+  static const auto next = hidden<int(int)>("fdatasync");
+  return pass(next, fd);
+}
+
+int ftruncate(int fd, off_t size) noexcept {
+  static const auto next = hidden<int(int, off_t)>("ftruncate");
+  return pass(next, fd, size);
+}
+
+int fstat(int fd, struct stat *status) noexcept {
+  static const auto next = hidden<int(int, struct stat *)>("fstat");
+  return pass(next, fd, status);
+}
+
+int stat(const char *path, struct stat *status) noexcept {
+  static const auto next =
+      hidden<int(const char *, struct stat *)>("stat");
+  return pass(next, path, status);
+}
+
+int rename(const char *from, const char *to) noexcept {
+  static const auto next = hidden<int(const char *, const char *)>("rename");
+  return pass(next, from, to);
+}
+
+int unlink(const char *path) noexcept {
+  static const auto next = hidden<int(const char *)>("unlink");
+  return pass(next, path);
+}
+
+int link(const char *from, const char *to) noexcept {
+  static const auto next = hidden<int(const char *, const char *)>("link");
+  return pass(next, from, to);
+}
+
+int posix_fadvise(int fd, off_t offset, off_t length, int advice) noexcept {
+  static const auto next =
+      hidden<int(int, off_t, off_t, int)>("posix_fadvise");
+  return pass(next, fd, offset, length, advice);
+}
+}
+
+accounting::usage accounting::now() { return snapshot(mine); }
+
+accounting::usage accounting::total() {
+  enroll();
+  std::lock_guard lock{enrolled_lock};
+  auto sum = exited;
+  for (auto *thread = enrolled; thread != nullptr; thread = thread->next) {
+    add(sum, snapshot(*thread));
+  }
+  return sum;
+}
+
+accounting::scope::scope(std::string_view route) : scope{route, 0} {}
+
+accounting::scope::scope(std::string_view route, U64 request)
+    : _route{find(route)}, _request{request}, _start{now()}, _outer{active} {
+  enroll();
+  if (_outer != nullptr) {
+    _outer->charge();
+  }
+  active = this;
+}
+
+accounting::scope::scope(U64 request)
+    : _route{nullptr}, _request{request}, _start{now()}, _outer{active} {
+  enroll();
+  if (_outer != nullptr) {
+    _outer->charge();
+  }
+  active = this;
+}
+
+accounting::scope::~scope() {
+  charge();
+  // requests with a ledger are counted once, when it closes
+  if (_route != nullptr && _request == 0) {
+    _route->requests.fetch_add(1, std::memory_order_relaxed);
+  }
+  active = _outer;
+  if (_outer != nullptr) {
+    _outer->_start = now();
+  }
+}
+
+void accounting::scope::charge() {
+  const auto at = now();
+  const usage used{.allocations = at.allocations - _start.allocations,
+                   .bytes = at.bytes - _start.bytes,
+                   .frees = at.frees - _start.frees,
+                   .syscalls = at.syscalls - _start.syscalls};
+  if (_route != nullptr) {
+    add(*_route, used);
+  }
+  if (_request != 0) {
+    charge_ledger(_request, _route, used);
+  }
+  _start = now();
+}
+
+accounting::ledger::ledger(trace::context &request) {
+  if (request.id == 0) {
+    request.id = UNTRACED | untraced.fetch_add(1, std::memory_order_relaxed);
+  }
+  _id = request.id;
+
+  std::lock_guard lock{ledgers_lock};
+  if (open_ledgers().size() < MAX_OPEN_LEDGERS) {
+    open_ledgers().try_emplace(_id);
+  }
+}
+
+accounting::ledger::~ledger() {
+  open_ledger closing{};
+  {
+    std::lock_guard lock{ledgers_lock};
+    const auto found = open_ledgers().find(_id);
+    if (found == open_ledgers().end()) {
+      return;
+    }
+    closing = found->second;
+    open_ledgers().erase(found);
+  }
+
+  // refused before routing, like rate limited or unknown paths
+  auto *route = closing.route != nullptr ? closing.route : find("(unrouted)");
+  add(*route, closing.unrouted);
+  route->requests.fetch_add(1, std::memory_order_relaxed);
+
+  auto used = closing.routed;
+  add(used, closing.unrouted);
+  std::lock_guard lock{ledgers_lock};
+  recent[closed++ % MAX_RECENT_LEDGERS] =
+      closed_ledger{.request = _id, .route = route->name, .used = used};
+}
+
+static Json::Value json(const accounting::usage &used) {
+  Json::Value root;
+  root["allocations"] = static_cast<Json::UInt64>(used.allocations);
+  root["bytes"] = static_cast<Json::UInt64>(used.bytes);
+  root["frees"] = static_cast<Json::UInt64>(used.frees);
+  root["syscalls"] = static_cast<Json::UInt64>(used.syscalls);
+  return root;
+}
+
+Json::Value accounting::stats() {
+  std::vector<std::pair<pid_t, usage>> threads{};
+  usage gone{};
+  {
+    std::lock_guard lock{enrolled_lock};
+    gone = exited;
+    for (auto *thread = enrolled; thread != nullptr; thread = thread->next) {
+      threads.emplace_back(thread->thread, snapshot(*thread));
+    }
+  }
+
+  Json::Value root;
+  root["enabled"] = true;
+  root["threads"] = Json::arrayValue;
+  for (const auto &[thread, used] : threads) {
+    auto each = json(used);
+    each["thread"] = thread;
+    root["threads"].append(each);
+  }
+  root["exited"] = json(gone);
+
+  root["routes"] = Json::objectValue;
+  for (const auto &route : routes) {
+    if (!route.used.load(std::memory_order_acquire)) {
+      break;
+    }
+    auto each = json(usage{
+        .allocations = route.allocations.load(std::memory_order_relaxed),
+        .bytes = route.bytes.load(std::memory_order_relaxed),
+        .frees = route.frees.load(std::memory_order_relaxed),
+        .syscalls = route.syscalls.load(std::memory_order_relaxed)});
+    each["requests"] = static_cast<Json::UInt64>(
+        route.requests.load(std::memory_order_relaxed));
+    root["routes"][std::string{route.name}] = each;
+  }
+
+  std::vector<closed_ledger> requests{};
+  {
+    std::lock_guard lock{ledgers_lock};
+    const auto count = std::min<U64>(closed, MAX_RECENT_LEDGERS);
+    for (U64 back = 1; back <= count; back++) {
+      requests.emplace_back(recent[(closed - back) % MAX_RECENT_LEDGERS]);
+    }
+  }
+  root["requests"] = Json::arrayValue;
+  for (const auto &request : requests) {
+    auto each = json(request.used);
+    each["request"] = static_cast<Json::UInt64>(request.request);
+    each["route"] = std::string{request.route};
+    root["requests"].append(each);
+  }
+  return root;
+}
+#else
+// ============================================================================
+Json::Value accounting::stats() {
+  Json::Value root;
+  root["enabled"] = false;
+  return root;
+}
+#endif
@@ -0,0 +1,756 @@
+#include "../include/catalog.hpp"
+#include "../include/logger.hpp"
+#include "../include/posix.hpp"
+#include "../include/timekeeper.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+using namespace cobble;
+
+/// @brief The log's file in the storage directory
+constexpr const char *LOG_NAME = "catalog.log";
+
+/// @brief The snapshot's file in the storage directory
+constexpr const char *SNAPSHOT_NAME = "catalog.idx";
+
+/// @brief Starts every entry in the log, `CCL1`
+constexpr U32 ENTRY_MAGIC = 0x314C4343;
+
+/// @brief Starts the snapshot, `CCI1`
+constexpr U32 SNAPSHOT_MAGIC = 0x31494343;
+
+/// @brief Entries logged after the snapshot that trigger a new one
+constexpr std::size_t SNAPSHOT_ENTRIES = 4096;
+
+/// @brief Largest entry accepted, anything larger is corruption
+constexpr U32 MAX_ENTRY_SIZE = 1024 * 1024;
+
+/// @brief Bytes read at a time when the log is scanned
+constexpr std::size_t SCAN_CHUNK = 1024 * 1024;
+
+/// @brief An entry in the log, followed by `size` bytes of payload in native
+/// byte order
+struct entry_header {
+  U32 magic;
+  U32 size;
+  U64 checksum;
+};
+
+/// @brief The snapshot, followed by `slots` sorted slots
+struct snapshot_header {
+  U32 magic;
+  U32 reserved;
+  U64 slots;
+
+  /// @brief Log bytes the slots cover, entries past this were logged later
+  U64 covered;
+  U64 checksum;
+};
+
+static std::size_t read_at(int fd, void *data, std::size_t size, U64 offset) {
+  auto *at = static_cast<U8 *>(data);
+  std::size_t done = 0;
+  while (done < size) {
+    const auto got = ::pread(fd, at + done, size - done,
+                             static_cast<off_t>(offset + done));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      throw posix::error("Could not read the catalog");
+    }
+    if (got == 0) {
+      break;
+    }
+    done += static_cast<std::size_t>(got);
+  }
+  return done;
+}
+
+/// @brief Makes a rename in a directory last
+static void sync_directory(const std::filesystem::path &directory) {
+  const auto fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+template <class T> static void encode(std::string &out, const T &value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static void encode(std::string &out, const std::string &value) {
+  encode(out, static_cast<U32>(value.size()));
+  out += value;
+}
+
+/// @brief Reads a payload, throwing if it runs out
+class decoder {
+  const char *_at;
+  const char *_end;
+
+public:
+  decoder(const std::string &payload)
+      : _at{payload.data()}, _end{payload.data() + payload.size()} {}
+
+  template <class T> T take() {
+    T value{};
+    if (static_cast<std::size_t>(_end - _at) < sizeof(T)) {
+      throw std::runtime_error{"A catalog entry is cut short"};
+    }
+    std::memcpy(&value, _at, sizeof(T));
+    _at += sizeof(T);
+    return value;
+  }
+
+  std::string text() {
+    const auto size = take<U32>();
+    if (static_cast<std::size_t>(_end - _at) < size) {
+      throw std::runtime_error{"A catalog entry is cut short"};
+    }
+    std::string value{_at, size};
+    _at += size;
+    return value;
+  }
+};
+
+static std::string payload_of(const catalog::entry &which) {
+  std::string out{};
+  encode(out, which.id);
+  encode(out, which.title);
+  encode(out, static_cast<U32>(which.tags.size()));
+  for (const auto &tag : which.tags) {
+    encode(out, tag);
+  }
+
+  encode(out, static_cast<U8>(which.info.has_value()));
+  if (which.info) {
+    encode(out, which.info->duration);
+    encode(out, which.info->width);
+    encode(out, which.info->height);
+    encode(out, which.info->video_codec);
+    encode(out, which.info->audio_codec);
+    encode(out, which.info->size);
+    encode(out, which.info->bitrate);
+  }
+  return out;
+}
+
+static catalog::entry entry_of(const std::string &payload) {
+  decoder in{payload};
+  catalog::entry which{};
+  which.id = in.take<U64>();
+  which.title = in.text();
+  const auto tags = in.take<U32>();
+  for (U32 i = 0; i < tags; i++) {
+    which.tags.emplace_back(in.text());
+  }
+
+  if (in.take<U8>() != 0) {
+    mp4::info info{};
+    info.duration = in.take<F64>();
+    info.width = in.take<U32>();
+    info.height = in.take<U32>();
+    info.video_codec = in.text();
+    info.audio_codec = in.text();
+    info.size = in.take<U64>();
+    info.bitrate = in.take<U64>();
+    which.info = std::move(info);
+  }
+  return which;
+}
+
+/// @brief A catalog and the storage directory it's in
+struct opened {
+  std::filesystem::path directory;
+  std::shared_ptr<catalog::store> catalog;
+};
+
+/// @brief Parses a file name like `12.json` as an ID
+static std::optional<U64> id_of(const std::filesystem::path &file,
+                                const char *extension) {
+  const auto stem = file.stem().string();
+  U64 id = 0;
+  const auto [end, parsed] =
+      std::from_chars(stem.data(), stem.data() + stem.size(), id);
+  if (file.extension() != extension || parsed != std::errc{} ||
+      end != stem.data() + stem.size()) {
+    return std::nullopt;
+  }
+  return id;
+}
+
+/// @brief Catalogs what's in a storage directory but not in the catalog yet,
+/// videos are probed later when they're first listed
+/// @return The entries cataloged
+static std::vector<catalog::entry>
+import_from(catalog::store &into, const std::filesystem::path &directory) {
+  const auto started = timekeeper::now();
+  std::map<U64, catalog::entry> found{};
+  std::error_code ec;
+  for (const auto &file :
+       std::filesystem::directory_iterator{directory / "videos", ec}) {
+    const auto id = id_of(file.path(), ".mp4");
+    if (id && !into.contains(*id)) {
+      found[*id].id = *id;
+    }
+  }
+  for (const auto &file :
+       std::filesystem::directory_iterator{directory / "metadata", ec}) {
+    const auto id = id_of(file.path(), ".json");
+    if (!id || into.contains(*id)) {
+      continue;
+    }
+    try {
+      auto &which = found[*id];
+      which.id = *id;
+      catalog::describe(which, file.path());
+    } catch (const std::exception &e) {
+      logger::log(logger::severity::warning, "Not cataloging video ", *id,
+                  ": ", e.what());
+    }
+  }
+  if (found.empty()) {
+    return {};
+  }
+
+  std::vector<catalog::entry> entries{};
+  entries.reserve(found.size());
+  for (auto &[id, which] : found) {
+    entries.emplace_back(std::move(which));
+  }
+  into.put(entries);
+  logger::log(logger::severity::notice, "Imported ", entries.size(),
+              " videos into the catalog in ",
+              timekeeper::milliseconds_since(started), "ms");
+  return entries;
+}
+
+bool catalog::describe(entry &which, const json_view::value &root) {
+  const auto title = root["title"].string();
+  if (!title) {
+    return false;
+  }
+
+  std::vector<std::string> tags{};
+  if (const auto listed = root["tags"]) {
+    if (listed.type() != json_view::kind::array) {
+      return false;
+    }
+    auto all_strings = true;
+    tags.reserve(listed.size());
+    listed.each([&tags, &all_strings](json_view::value tag) {
+      auto text = tag.string();
+      all_strings = all_strings && text;
+      tags.emplace_back(std::move(text).value_or(""));
+    });
+    if (!all_strings) {
+      return false;
+    }
+  }
+
+  which.title = std::move(*title);
+  which.tags = std::move(tags);
+  return true;
+}
+
+void catalog::describe(entry &which, const std::filesystem::path &file) {
+  std::ifstream in{file, std::ios::binary};
+  if (!in) {
+    throw std::runtime_error{"Could not open '" + file.string() + "'"};
+  }
+
+  const auto parsed = json_view::document::parse(
+      std::string{std::istreambuf_iterator<char>{in}, {}});
+  if (!parsed) {
+    throw std::runtime_error{"Could not parse '" + file.string() +
+                             "': " + parsed.error().code + " at byte " +
+                             std::to_string(parsed.error().offset)};
+  }
+  if (!describe(which, parsed->root())) {
+    throw std::runtime_error{"'" + file.string() +
+                             "' has no title or bad tags"};
+  }
+}
+
+catalog::store::store(const std::filesystem::path &directory)
+    : _directory{directory} {
+  std::filesystem::create_directories(_directory);
+  const auto path = _directory / LOG_NAME;
+  _log = ::open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (_log < 0) {
+    throw posix::error("Could not open '" + path.string() + "'");
+  }
+
+  struct stat status;
+  if (::fstat(_log, &status) != 0) {
+    throw posix::error("Could not stat '" + path.string() + "'");
+  }
+  _log_bytes = static_cast<U64>(status.st_size);
+
+  // a snapshot that doesn't check out is only a slower start
+  U64 covered = 0;
+  if (_map()) {
+    const auto *header = static_cast<const snapshot_header *>(_mapped);
+    covered = header->covered;
+  }
+  _count = _slot_count;
+  _scan(covered);
+
+  if (_recent.size() >= SNAPSHOT_ENTRIES) {
+    _snapshot();
+  }
+}
+
+catalog::store::~store() {
+  _unmap();
+  if (_log >= 0) {
+    ::close(_log);
+  }
+}
+
+bool catalog::store::_map() {
+  const auto path = _directory / SNAPSHOT_NAME;
+  const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat status;
+  if (::fstat(fd, &status) != 0 ||
+      static_cast<std::size_t>(status.st_size) < sizeof(snapshot_header)) {
+    ::close(fd);
+    return false;
+  }
+
+  const auto size = static_cast<std::size_t>(status.st_size);
+  auto *mapped = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+
+  const auto *header = static_cast<const snapshot_header *>(mapped);
+  const auto *slots = reinterpret_cast<const slot *>(header + 1);
+  if (header->magic != SNAPSHOT_MAGIC ||
+      (size - sizeof(snapshot_header)) / sizeof(slot) != header->slots ||
+      (size - sizeof(snapshot_header)) % sizeof(slot) != 0 ||
+      header->covered > _log_bytes ||
+      posix::checksum(slots, header->slots * sizeof(slot)) !=
+          header->checksum) {
+    logger::log(logger::severity::warning,
+                "Ignoring a bad catalog snapshot, replaying the whole log");
+    ::munmap(mapped, size);
+    return false;
+  }
+
+  ::madvise(mapped, size, MADV_RANDOM);
+  _mapped = mapped;
+  _mapped_size = size;
+  _slots = slots;
+  _slot_count = header->slots;
+  return true;
+}
+
+void catalog::store::_unmap() {
+  if (_mapped) {
+    ::munmap(_mapped, _mapped_size);
+  }
+  _mapped = nullptr;
+  _mapped_size = 0;
+  _slots = nullptr;
+  _slot_count = 0;
+}
+
+void catalog::store::_scan(U64 from) {
+  std::vector<U8> buffer{};
+  std::size_t buffered = 0;
+  U64 buffer_offset = from;
+  U64 at = from;
+
+  // whatever follows the last whole entry is a torn write
+  for (;;) {
+    if (at + sizeof(entry_header) > buffer_offset + buffered) {
+      // keep the unconsumed bytes and read more after them
+      const auto kept = buffer_offset + buffered - at;
+      if (kept > 0) {
+        std::memmove(buffer.data(), buffer.data() + (at - buffer_offset),
+                     kept);
+      }
+      buffer.resize(kept + SCAN_CHUNK);
+      buffered = kept + read_at(_log, buffer.data() + kept,
+                                buffer.size() - kept, at + kept);
+      buffer_offset = at;
+      if (buffered < sizeof(entry_header)) {
+        break;
+      }
+    }
+
+    entry_header header{};
+    std::memcpy(&header, buffer.data() + (at - buffer_offset),
+                sizeof(entry_header));
+    if (header.magic != ENTRY_MAGIC || header.size > MAX_ENTRY_SIZE ||
+        header.size < sizeof(U64)) {
+      break;
+    }
+
+    const auto whole = sizeof(entry_header) + header.size;
+    if (at + whole > buffer_offset + buffered) {
+      const auto kept = buffer_offset + buffered - at;
+      std::memmove(buffer.data(), buffer.data() + (at - buffer_offset), kept);
+      buffer.resize(std::max<std::size_t>(SCAN_CHUNK, whole));
+      buffered = kept + read_at(_log, buffer.data() + kept,
+                                buffer.size() - kept, at + kept);
+      buffer_offset = at;
+      if (buffered < whole) {
+        break;
+      }
+    }
+
+    const auto *payload =
+        buffer.data() + (at - buffer_offset) + sizeof(entry_header);
+    if (posix::checksum(payload, header.size) != header.checksum) {
+      break;
+    }
+
+    U64 id = 0;
+    std::memcpy(&id, payload, sizeof(U64));
+    if (!_offset(id)) {
+      _count++;
+    }
+    _recent.insert_or_assign(id, at);
+    _recovered++;
+    at += whole;
+  }
+
+  if (at < _log_bytes) {
+    logger::log(logger::severity::warning, "Cutting ", _log_bytes - at,
+                " torn bytes off the end of the catalog");
+    if (::ftruncate(_log, static_cast<off_t>(at)) != 0) {
+      throw posix::error("Could not cut the catalog");
+    }
+  }
+  _log_bytes = at;
+}
+
+void catalog::store::_snapshot() {
+  std::vector<slot> slots{};
+  {
+    std::shared_lock<std::shared_mutex> lock{_mutex};
+    slots.reserve(_count);
+    auto recent = _recent.begin();
+    for (std::size_t i = 0; i < _slot_count; i++) {
+      while (recent != _recent.end() && recent->first < _slots[i].id) {
+        slots.emplace_back(slot{.id = recent->first, .offset = recent->second});
+        recent++;
+      }
+      if (recent != _recent.end() && recent->first == _slots[i].id) {
+        continue;
+      }
+      slots.emplace_back(_slots[i]);
+    }
+    for (; recent != _recent.end(); recent++) {
+      slots.emplace_back(slot{.id = recent->first, .offset = recent->second});
+    }
+  }
+
+  const snapshot_header header{
+      .magic = SNAPSHOT_MAGIC,
+      .reserved = 0,
+      .slots = slots.size(),
+      .covered = _log_bytes,
+      .checksum = posix::checksum(slots.data(), slots.size() * sizeof(slot))};
+
+  // written aside and renamed over, a crash leaves one snapshot or the other
+  const auto path = _directory / SNAPSHOT_NAME;
+  auto staged = path;
+  staged += ".tmp";
+  const auto fd =
+      ::open(staged.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw posix::error("Could not write the catalog snapshot");
+  }
+  try {
+    if (!posix::write_all(fd, &header, sizeof(header)) ||
+        !posix::write_all(fd, slots.data(), slots.size() * sizeof(slot)) ||
+        ::fdatasync(fd) != 0) {
+      throw posix::error("Could not write the catalog snapshot");
+    }
+  } catch (...) {
+    ::close(fd);
+    ::unlink(staged.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (::rename(staged.c_str(), path.c_str()) != 0) {
+    throw posix::error("Could not replace the catalog snapshot");
+  }
+  sync_directory(_directory);
+
+  std::unique_lock<std::shared_mutex> lock{_mutex};
+  _unmap();
+  if (!_map()) {
+    throw std::runtime_error{"Could not map the new catalog snapshot"};
+  }
+  _recent.clear();
+  _snapshots++;
+}
+
+std::optional<U64> catalog::store::_offset(U64 id) const {
+  const auto recent = _recent.find(id);
+  if (recent != _recent.end()) {
+    return recent->second;
+  }
+
+  const auto *end = _slots + _slot_count;
+  const auto *found = std::lower_bound(
+      _slots, end, id, [](const slot &a, U64 b) { return a.id < b; });
+  if (found == end || found->id != id) {
+    return std::nullopt;
+  }
+  return found->offset;
+}
+
+catalog::entry catalog::store::_read(U64 offset) const {
+  entry_header header{};
+  if (read_at(_log, &header, sizeof(header), offset) != sizeof(header) ||
+      header.magic != ENTRY_MAGIC || header.size > MAX_ENTRY_SIZE) {
+    throw std::runtime_error{"A catalog entry is damaged"};
+  }
+
+  std::string payload(header.size, '\0');
+  if (read_at(_log, payload.data(), payload.size(),
+              offset + sizeof(header)) != payload.size() ||
+      posix::checksum(payload.data(), payload.size()) != header.checksum) {
+    throw std::runtime_error{"A catalog entry is damaged"};
+  }
+  return entry_of(payload);
+}
+
+void catalog::store::put(const std::vector<entry> &entries) {
+  if (entries.empty()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock{_append};
+  if (_sealed) {
+    return;
+  }
+
+  std::string out{};
+  std::vector<std::pair<U64, U64>> offsets{};
+  for (const auto &which : entries) {
+    const auto payload = payload_of(which);
+    const entry_header header{
+        .magic = ENTRY_MAGIC,
+        .size = static_cast<U32>(payload.size()),
+        .checksum = posix::checksum(payload.data(), payload.size())};
+    offsets.emplace_back(which.id, _log_bytes + out.size());
+    encode(out, header);
+    out += payload;
+  }
+
+  // one sync however many entries, they're only visible once it's done
+  try {
+    if (!posix::write_all(_log, out.data(), out.size())) {
+      throw posix::error("Could not write the catalog");
+    }
+    if (::fdatasync(_log) != 0) {
+      throw posix::error("Could not sync the catalog");
+    }
+  } catch (...) {
+    if (::ftruncate(_log, static_cast<off_t>(_log_bytes)) != 0) {
+      logger::log(logger::severity::error,
+                  "Could not cut a failed write off the catalog");
+    }
+    throw;
+  }
+
+  {
+    std::unique_lock<std::shared_mutex> exclusive{_mutex};
+    for (const auto &[id, offset] : offsets) {
+      if (!_offset(id)) {
+        _count++;
+      }
+      _recent.insert_or_assign(id, offset);
+    }
+    _log_bytes += out.size();
+    _appended += entries.size();
+  }
+
+  if (_recent.size() >= SNAPSHOT_ENTRIES) {
+    _snapshot();
+  }
+}
+
+void catalog::store::put(const entry &which) {
+  put(std::vector<entry>{which});
+}
+
+void catalog::store::seal() {
+  std::lock_guard<std::mutex> lock{_append};
+  _sealed = true;
+}
+
+bool catalog::store::contains(U64 id) const {
+  std::shared_lock<std::shared_mutex> lock{_mutex};
+  return _offset(id).has_value();
+}
+
+std::optional<catalog::entry> catalog::store::find(U64 id) const {
+  U64 offset = 0;
+  {
+    std::shared_lock<std::shared_mutex> lock{_mutex};
+    const auto found = _offset(id);
+    if (!found) {
+      return std::nullopt;
+    }
+    offset = *found;
+  }
+  return _read(offset);
+}
+
+std::vector<U64> catalog::store::newest(U64 skip, U64 count) const {
+  std::vector<U64> ids{};
+  std::shared_lock<std::shared_mutex> lock{_mutex};
+
+  // both are sorted, so they're merged from the highest ID down
+  auto recent = _recent.rbegin();
+  auto snapshotted = _slot_count;
+  while (ids.size() < count &&
+         (recent != _recent.rend() || snapshotted > 0)) {
+    U64 id = 0;
+    if (snapshotted == 0 || (recent != _recent.rend() &&
+                             recent->first >= _slots[snapshotted - 1].id)) {
+      id = recent->first;
+      if (snapshotted > 0 && _slots[snapshotted - 1].id == id) {
+        snapshotted--;
+      }
+      recent++;
+    } else {
+      id = _slots[--snapshotted].id;
+    }
+
+    if (skip > 0) {
+      skip--;
+    } else {
+      ids.emplace_back(id);
+    }
+  }
+  return ids;
+}
+
+void catalog::store::each(
+    const std::function<void(const entry &)> &visit) const {
+  U64 end = 0;
+  {
+    std::shared_lock<std::shared_mutex> lock{_mutex};
+    end = _log_bytes;
+  }
+
+  std::vector<U8> buffer(SCAN_CHUNK);
+  std::size_t buffered = 0;
+  U64 buffer_offset = 0;
+  for (U64 at = 0; at < end;) {
+    if (at + sizeof(entry_header) > buffer_offset + buffered) {
+      buffer_offset = at;
+      buffered = read_at(_log, buffer.data(), buffer.size(), at);
+    }
+    entry_header header{};
+    std::memcpy(&header, buffer.data() + (at - buffer_offset),
+                sizeof(header));
+    const auto whole = sizeof(entry_header) + header.size;
+    if (at + whole > buffer_offset + buffered) {
+      if (buffer.size() < whole) {
+        buffer.resize(whole);
+      }
+      buffer_offset = at;
+      buffered = read_at(_log, buffer.data(), buffer.size(), at);
+    }
+
+    // older entries of an ID were replaced by a later one
+    const auto *payload =
+        buffer.data() + (at - buffer_offset) + sizeof(entry_header);
+    U64 id = 0;
+    std::memcpy(&id, payload, sizeof(U64));
+    bool current = false;
+    {
+      std::shared_lock<std::shared_mutex> lock{_mutex};
+      current = _offset(id) == at;
+    }
+    if (current) {
+      visit(entry_of(std::string{reinterpret_cast<const char *>(payload),
+                                 header.size}));
+    }
+    at += whole;
+  }
+}
+
+Json::Value catalog::store::stats() const {
+  Json::Value root;
+
+  std::shared_lock<std::shared_mutex> lock{_mutex};
+  root["videos"] = static_cast<Json::UInt64>(_count);
+  root["logBytes"] = static_cast<Json::UInt64>(_log_bytes);
+  root["snapshotted"] = static_cast<Json::UInt64>(_slot_count);
+  root["sinceSnapshot"] = static_cast<Json::UInt64>(_recent.size());
+  root["snapshots"] = static_cast<Json::UInt64>(_snapshots);
+  root["replayed"] = static_cast<Json::UInt64>(_recovered);
+  root["appended"] = static_cast<Json::UInt64>(_appended);
+
+  return root;
+}
+// ============================================================================
+std::shared_ptr<catalog::store>
+catalog::open(const environment::configuration &config) {
+  static std::atomic<std::shared_ptr<const opened>> shared{};
+  static std::mutex reopening{};
+
+  auto current = shared.load(std::memory_order_acquire);
+  if (current && current->directory == config.data_path) {
+    return current->catalog;
+  }
+
+  std::lock_guard<std::mutex> lock{reopening};
+  current = shared.load(std::memory_order_acquire);
+  if (!current || current->directory != config.data_path) {
+    const auto started = timekeeper::now();
+    auto catalog = std::make_shared<store>(config.data_path);
+    logger::log(logger::severity::notice, "Opened the catalog in ",
+                timekeeper::milliseconds_since(started), "ms");
+
+    // only the first entry is looked at, opening never walks the directory
+    std::error_code ec;
+    const std::filesystem::directory_iterator videos{
+        config.data_path / "videos", ec};
+    if (catalog->newest(0, 1).empty() && !ec &&
+        videos != std::filesystem::directory_iterator{}) {
+      logger::log(logger::severity::warning,
+                  "The catalog is empty but there are videos, POST "
+                  "/admin/import once to catalog them");
+    }
+
+    current = std::make_shared<const opened>(
+        opened{.directory = config.data_path, .catalog = std::move(catalog)});
+    shared.store(current, std::memory_order_release);
+  }
+  return current->catalog;
+}
+
+std::vector<catalog::entry>
+catalog::import(const environment::configuration &config) {
+  static std::mutex importing{};
+  std::lock_guard<std::mutex> lock{importing};
+  return import_from(*open(config), config.data_path);
+}
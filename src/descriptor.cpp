@@ -0,0 +1,179 @@
+#include "../include/descriptor.hpp"
+#include "../include/ingest.hpp"
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace cobble;
+
+/// @brief How long an open file is trusted before its path is checked again,
+/// a replaced file is served stale for at most this long
+constexpr U64 REVALIDATE_MS = 1000;
+
+/// @brief What the open file tables did, shared by every table
+struct counters {
+  std::atomic<U64> hits{0};
+  std::atomic<U64> misses{0};
+  std::atomic<U64> stale{0};
+  std::atomic<U64> evicted{0};
+};
+
+static counters &count() {
+  static counters shared{};
+  return shared;
+}
+// ============================================================================
+descriptor::file::file(const std::filesystem::path &path,
+                       boost::beast::error_code &ec)
+    : _fd{-1}, _size{0}, _device{0}, _inode{0}, _modified{} {
+  ec = {};
+  _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (_fd < 0) {
+    ec.assign(errno, boost::system::generic_category());
+    return;
+  }
+
+  struct stat status;
+  if (::fstat(_fd, &status) != 0) {
+    ec.assign(errno, boost::system::generic_category());
+    return;
+  }
+  _size = static_cast<U64>(status.st_size);
+  _device = status.st_dev;
+  _inode = status.st_ino;
+  _modified = status.st_mtim;
+  _hash = ingest::hash_of(_fd);
+}
+
+descriptor::file::~file() {
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+}
+
+U64 descriptor::file::size() const { return _size; }
+
+const std::string &descriptor::file::hash() const { return _hash; }
+
+bool descriptor::file::stale(const std::filesystem::path &path) const {
+  struct stat status;
+  if (::stat(path.c_str(), &status) != 0) {
+    return true;
+  }
+
+  // a rename over the path shows up as another inode, an edit in place as
+  // another size or modification time
+  return status.st_dev != _device || status.st_ino != _inode ||
+         static_cast<U64>(status.st_size) != _size ||
+         status.st_mtim.tv_sec != _modified.tv_sec ||
+         status.st_mtim.tv_nsec != _modified.tv_nsec;
+}
+
+std::size_t descriptor::file::read(U64 offset, void *buffer,
+                                   std::size_t length,
+                                   boost::beast::error_code &ec) const {
+  ec = {};
+  for (;;) {
+    const auto got = ::pread(_fd, buffer, length, static_cast<off_t>(offset));
+    if (got >= 0) {
+      return static_cast<std::size_t>(got);
+    }
+    if (errno != EINTR) {
+      ec.assign(errno, boost::system::generic_category());
+      return 0;
+    }
+  }
+}
+
+descriptor::cache::cache(std::size_t capacity) : _capacity{capacity} {}
+
+std::shared_ptr<const descriptor::file>
+descriptor::cache::open(U64 id, const std::filesystem::path &path,
+                        boost::beast::error_code &ec) {
+  ec = {};
+  std::shared_ptr<const file> found{};
+  bool revalidate = false;
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    const auto existing = _entries.find(id);
+    if (existing != _entries.end()) {
+      found = existing->second.opened;
+      revalidate =
+          timekeeper::milliseconds_since(existing->second.checked) >=
+          REVALIDATE_MS;
+      _recent.splice(_recent.begin(), _recent, existing->second.recent);
+    }
+  }
+
+  // stat() runs unlocked, at most once a second per file
+  if (found && !revalidate) {
+    count().hits.fetch_add(1, std::memory_order_relaxed);
+    return found;
+  }
+  if (found && !found->stale(path)) {
+    count().hits.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock{_mutex};
+    const auto existing = _entries.find(id);
+    if (existing != _entries.end() && existing->second.opened == found) {
+      existing->second.checked = timekeeper::now();
+    }
+    return found;
+  }
+  if (found) {
+    count().stale.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    count().misses.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  auto opened = std::make_shared<const file>(path, ec);
+  if (ec) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    const auto existing = _entries.find(id);
+    if (existing != _entries.end() && existing->second.opened == found) {
+      _recent.erase(existing->second.recent);
+      _entries.erase(existing);
+    }
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock{_mutex};
+  const auto existing = _entries.find(id);
+  if (existing != _entries.end()) {
+    // a racing miss may have opened it too, the newest open wins
+    existing->second.opened = opened;
+    existing->second.checked = timekeeper::now();
+    _recent.splice(_recent.begin(), _recent, existing->second.recent);
+    return opened;
+  }
+
+  if (_entries.size() >= _capacity && !_recent.empty()) {
+    _entries.erase(_recent.back());
+    _recent.pop_back();
+    count().evicted.fetch_add(1, std::memory_order_relaxed);
+  }
+  _recent.push_front(id);
+  _entries.insert_or_assign(id, entry{.opened = opened,
+                                      .checked = timekeeper::now(),
+                                      .recent = _recent.begin()});
+  return opened;
+}
+
+Json::Value descriptor::stats() {
+  Json::Value root;
+
+  const auto hits = count().hits.load(std::memory_order_relaxed);
+  const auto misses = count().misses.load(std::memory_order_relaxed);
+  const auto stale = count().stale.load(std::memory_order_relaxed);
+  root["hits"] = static_cast<Json::UInt64>(hits);
+  root["misses"] = static_cast<Json::UInt64>(misses);
+  root["stale"] = static_cast<Json::UInt64>(stale);
+  root["evicted"] = static_cast<Json::UInt64>(
+      count().evicted.load(std::memory_order_relaxed));
+  root["hitRatio"] = hits + misses + stale == 0
+                         ? 0.0
+                         : static_cast<F64>(hits) /
+                               static_cast<F64>(hits + misses + stale);
+
+  return root;
+}
@@ -1,11 +1,15 @@
 #include "../include/environment.hpp"
 #include "../include/logger.hpp"
+#include <atomic>
 #include <exception>
 #include <stdexcept>
+#include <string_view>
 #include <utility>
 #include <vector>
 using namespace cobble;
 
+static std::atomic<environment::snapshot> published{};
+
 environment::configuration
 environment::load(const std::filesystem::path &where) {
   configuration config{};
@@ -15,9 +19,66 @@ environment::load(const std::filesystem::path &where) {
 
   table = toml::parse_file(where.string());
 
+  config.source = where;
+
   config.data_path = std::filesystem::path{
       *table["storage"]["directory"].value<std::string>()};
 
+  auto &&storage = config.storage;
+  const auto backend =
+      table["storage"]["backend"].value_or<std::string>("local");
+  if (backend == "local") {
+    storage.backend = storage_settings::kind::local;
+  } else if (backend == "s3") {
+    storage.backend = storage_settings::kind::s3;
+  } else {
+    throw std::runtime_error{"Storage backend must be 'local' or 's3'"};
+  }
+
+  S64 memory_candidate =
+      table["storage"]["memory_cache"].value_or<S64>(64 * 1024 * 1024);
+  S64 disk_candidate =
+      table["storage"]["disk_cache"].value_or<S64>(16LL * 1024 * 1024 * 1024);
+  if (memory_candidate < 0 || disk_candidate < 1) {
+    throw std::runtime_error{"Storage cache sizes are out of range"};
+  }
+  storage.memory_cache = memory_candidate;
+  storage.disk_cache = disk_candidate;
+
+  if (storage.backend == storage_settings::kind::s3) {
+    // only plain HTTP, the object store is expected to be on a private network
+    const auto endpoint =
+        *table["storage"]["s3"]["endpoint"].value<std::string>();
+    constexpr std::string_view SCHEME = "http://";
+    if (!endpoint.starts_with(SCHEME)) {
+      throw std::runtime_error{"S3 endpoint must start with 'http://'"};
+    }
+    auto authority = endpoint.substr(SCHEME.size());
+    while (authority.ends_with('/')) {
+      authority.pop_back();
+    }
+    const auto colon = authority.rfind(':');
+    storage.s3.host = authority.substr(0, colon);
+    if (colon != std::string::npos) {
+      S64 s3_port_candidate = std::stoll(authority.substr(colon + 1));
+      if (!std::in_range<U16>(s3_port_candidate)) {
+        throw std::runtime_error{"S3 endpoint port must be 0-65535"};
+      }
+      storage.s3.port = s3_port_candidate;
+    }
+    if (storage.s3.host.empty()) {
+      throw std::runtime_error{"S3 endpoint has no host"};
+    }
+
+    storage.s3.bucket = *table["storage"]["s3"]["bucket"].value<std::string>();
+    storage.s3.region =
+        table["storage"]["s3"]["region"].value_or<std::string>("us-east-1");
+    storage.s3.access_key =
+        *table["storage"]["s3"]["access_key"].value<std::string>();
+    storage.s3.secret_key =
+        *table["storage"]["s3"]["secret_key"].value<std::string>();
+  }
+
   config.listen_address = boost::asio::ip::make_address(
       table["http"]["listen"].value<std::string>()->c_str());
 
@@ -56,7 +117,7 @@ environment::load(const std::filesystem::path &where) {
     }
 
     for (auto i = 0; i < cors_array_entries6.size(); i++) {
-      auto v6 = cors_array_entries4[i].value<std::string>();
+      auto v6 = cors_array_entries6[i].value<std::string>();
       if (v6) {
         logger::log(logger::severity::debug,
                     "Adding IPv6 subnet to CORS list: '", *v6, "'");
@@ -88,5 +149,121 @@ environment::load(const std::filesystem::path &where) {
     }
   }
 
+  config.http2 = table["http"]["http2"].value_or<bool>(false);
+
+  config.tls.enabled = table["http"]["tls"]["enabled"].value_or<bool>(false);
+  if (config.tls.enabled) {
+    S64 tls_port_candidate = *table["http"]["tls"]["port"].value<S64>();
+    if (!std::in_range<U16>(tls_port_candidate)) {
+      throw std::runtime_error{"TLS listener port must be 0-65535"};
+    }
+    config.tls.port = tls_port_candidate;
+
+    config.tls.certificate = std::filesystem::path{
+        *table["http"]["tls"]["certificate"].value<std::string>()};
+    config.tls.private_key = std::filesystem::path{
+        *table["http"]["tls"]["private_key"].value<std::string>()};
+    config.tls.ktls = table["http"]["tls"]["ktls"].value_or<bool>(false);
+
+    S64 cache_candidate =
+        table["http"]["tls"]["session_cache_size"].value_or<S64>(20480);
+    if (!std::in_range<U32>(cache_candidate)) {
+      throw std::runtime_error{"TLS session cache size is out of range"};
+    }
+    config.tls.session_cache_size = cache_candidate;
+  }
+
+  auto &&limits = config.rate_limit;
+  limits.enabled =
+      table["http"]["rate_limit"]["enabled"].value_or<bool>(false);
+  if (limits.enabled) {
+    limits.rate = *table["http"]["rate_limit"]["rate"].value<F64>();
+    limits.burst = *table["http"]["rate_limit"]["burst"].value<F64>();
+    limits.subnet_rate =
+        *table["http"]["rate_limit"]["subnet_rate"].value<F64>();
+    limits.subnet_burst =
+        *table["http"]["rate_limit"]["subnet_burst"].value<F64>();
+    if (limits.rate <= 0.0 || limits.subnet_rate <= 0.0 ||
+        limits.burst < 1.0 || limits.subnet_burst < 1.0) {
+      throw std::runtime_error{
+          "Rate limits must be above zero and bursts at least one"};
+    }
+
+    S64 subnet_v4_candidate =
+        table["http"]["rate_limit"]["subnet_v4"].value_or<S64>(24);
+    S64 subnet_v6_candidate =
+        table["http"]["rate_limit"]["subnet_v6"].value_or<S64>(64);
+    if (subnet_v4_candidate < 0 || subnet_v4_candidate > 32 ||
+        subnet_v6_candidate < 0 || subnet_v6_candidate > 128) {
+      throw std::runtime_error{"Rate limit subnet prefixes are out of range"};
+    }
+    limits.subnet_v4 = subnet_v4_candidate;
+    limits.subnet_v6 = subnet_v6_candidate;
+
+    S64 capacity_candidate =
+        table["http"]["rate_limit"]["capacity"].value_or<S64>(65536);
+    if (!std::in_range<U32>(capacity_candidate) || capacity_candidate < 1) {
+      throw std::runtime_error{"Rate limit capacity must be above zero"};
+    }
+    limits.capacity = capacity_candidate;
+  }
+
+  config.prefetch_enabled =
+      table["prefetch"]["enabled"].value_or<bool>(true);
+
+  config.admin_enabled = table["admin"]["enabled"].value_or<bool>(false);
+
+  config.trace_sample_rate = table["trace"]["sample_rate"].value_or<F64>(0.0);
+  if (config.trace_sample_rate < 0.0 || config.trace_sample_rate > 1.0) {
+    throw std::runtime_error{"Trace sample rate must be within 0.0-1.0"};
+  }
+
   return config;
+}
+
+environment::snapshot environment::current() {
+  return published.load(std::memory_order_acquire);
+}
+
+void environment::publish(configuration &&config) {
+  published.store(std::make_shared<const configuration>(std::move(config)),
+                  std::memory_order_release);
+}
+
+environment::snapshot environment::reload() {
+  const auto previous = current();
+  if (!previous) {
+    throw std::runtime_error{"No configuration was published to reload"};
+  }
+
+  auto next = load(previous->source);
+
+  // these are bound once by server::start and can't change under it
+  if (next.listen_address != previous->listen_address ||
+      next.listen_port != previous->listen_port) {
+    logger::log(logger::severity::warning,
+                "Listener address changes need a restart, keeping ",
+                previous->listen_address.to_string(), ":",
+                previous->listen_port);
+    next.listen_address = previous->listen_address;
+    next.listen_port = previous->listen_port;
+  }
+  if (next.tls.enabled != previous->tls.enabled ||
+      next.tls.port != previous->tls.port) {
+    logger::log(logger::severity::warning,
+                "TLS listener changes need a restart, keeping the current one");
+    next.tls = previous->tls;
+  }
+  if (next.threads != previous->threads) {
+    logger::log(logger::severity::warning,
+                "I/O context thread count changes need a restart, keeping ",
+                previous->threads, " threads");
+    next.threads = previous->threads;
+  }
+
+  publish(std::move(next));
+  logger::log(logger::severity::notice, "Reloaded configuration '",
+              previous->source, "'");
+
+  return current();
 }
\ No newline at end of file
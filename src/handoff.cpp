@@ -0,0 +1,302 @@
+#include "../include/handoff.hpp"
+#include "../include/logger.hpp"
+#include "../include/posix.hpp"
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+using namespace cobble;
+
+extern char **environ;
+
+/// @brief Sent along with the sockets
+constexpr char SOCKETS = 'S';
+
+/// @brief Sent by the new process once it adopted the sockets
+constexpr char LISTENING = 'L';
+
+/// @brief Sent by the old process once it stopped writing
+constexpr char RELEASED = 'R';
+
+/// @brief Where the new process finds its end of the channel, right after
+/// the standard streams
+constexpr int CHANNEL_FD = 3;
+
+/// @brief Most listening sockets handed over at once
+constexpr std::size_t MAX_LISTENERS = 16;
+
+/// @brief How long the new process gets to start listening
+constexpr int LISTENING_TIMEOUT_MS = 30000;
+
+/// @brief How long the old process gets to stop writing
+constexpr int RELEASED_TIMEOUT_MS = 10000;
+
+static std::atomic<bool> drained{false};
+
+/// @brief Waits for one byte on the channel
+/// @param channel The channel
+/// @param timeout_ms How long to wait
+/// @return The byte, or nothing on timeout, errors or a closed channel
+static std::optional<char> read_byte(int channel, int timeout_ms) {
+  pollfd ready{.fd = channel, .events = POLLIN, .revents = 0};
+  int polled = 0;
+  do {
+    polled = ::poll(&ready, 1, timeout_ms);
+  } while (polled < 0 && errno == EINTR);
+  if (polled <= 0) {
+    return std::nullopt;
+  }
+
+  char byte = 0;
+  ssize_t got = 0;
+  do {
+    got = ::read(channel, &byte, 1);
+  } while (got < 0 && errno == EINTR);
+  return got == 1 ? std::optional<char>{byte} : std::nullopt;
+}
+
+/// @brief Writes one byte on the channel, a peer that's gone is ignored
+static void write_byte(int channel, char byte) {
+  while (::send(channel, &byte, 1, MSG_NOSIGNAL) < 0 && errno == EINTR) {
+  }
+}
+
+/// @brief Reads the arguments this process was started with
+static std::vector<std::string> arguments() {
+  std::ifstream in{"/proc/self/cmdline", std::ios::binary};
+  const std::string all{std::istreambuf_iterator<char>{in}, {}};
+
+  std::vector<std::string> split{};
+  for (std::size_t at = 0; at < all.size();) {
+    const auto end = all.find('\0', at);
+    split.emplace_back(all.substr(at, end - at));
+    at = end == std::string::npos ? all.size() : end + 1;
+  }
+  return split;
+}
+
+/// @brief Finds where this binary is now, a deploy that replaced it leaves
+/// the running one marked as deleted
+static std::string executable() {
+  char path[4096];
+  const auto size = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (size < 0) {
+    throw posix::error("Could not find this executable");
+  }
+
+  std::string found{path, static_cast<std::size_t>(size)};
+  constexpr std::string_view deleted{" (deleted)"};
+  if (found.ends_with(deleted)) {
+    found.resize(found.size() - deleted.size());
+  }
+  return found;
+}
+// ============================================================================
+int handoff::inherited::take(const boost::asio::ip::tcp::endpoint &endpoint) {
+  for (auto it = listeners.begin(); it != listeners.end(); ++it) {
+    boost::asio::ip::tcp::endpoint local{};
+    auto size = static_cast<socklen_t>(local.capacity());
+    if (::getsockname(*it, local.data(), &size) == 0) {
+      local.resize(size);
+      if (local == endpoint) {
+        const auto fd = *it;
+        listeners.erase(it);
+        return fd;
+      }
+    }
+  }
+  return -1;
+}
+
+void handoff::inherited::take_over() {
+  write_byte(channel, LISTENING);
+  if (read_byte(channel, RELEASED_TIMEOUT_MS) != RELEASED) {
+    logger::log(logger::severity::warning,
+                "The upgraded process didn't release the storage directory, ",
+                "taking over anyway");
+  }
+
+  for (const auto fd : listeners) {
+    ::close(fd);
+  }
+  listeners.clear();
+  ::close(channel);
+  channel = -1;
+}
+
+handoff::successor handoff::spawn(const std::vector<int> &listeners) {
+  if (listeners.empty() || listeners.size() > MAX_LISTENERS) {
+    throw std::runtime_error{"Can't hand over " +
+                             std::to_string(listeners.size()) + " sockets"};
+  }
+
+  int pair[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+    throw posix::error("Could not open a handoff channel");
+  }
+
+  // only the new process's end survives its exec, even if it's already at
+  // `CHANNEL_FD` and isn't duplicated
+  if (::fcntl(pair[1], F_SETFD, 0) != 0) {
+    const auto error = posix::error("Could not share the handoff channel");
+    ::close(pair[0]);
+    ::close(pair[1]);
+    throw error;
+  }
+
+  auto args = arguments();
+  std::vector<char *> argv{};
+  for (auto &arg : args) {
+    argv.emplace_back(arg.data());
+  }
+  argv.emplace_back(nullptr);
+
+  std::vector<std::string> variables{std::string{CHANNEL_VARIABLE} + "=" +
+                                     std::to_string(CHANNEL_FD)};
+  for (auto **each = environ; *each != nullptr; ++each) {
+    if (!std::string_view{*each}.starts_with(
+            std::string{CHANNEL_VARIABLE} + "=")) {
+      variables.emplace_back(*each);
+    }
+  }
+  std::vector<char *> envp{};
+  for (auto &variable : variables) {
+    envp.emplace_back(variable.data());
+  }
+  envp.emplace_back(nullptr);
+
+  // Asio opens sockets without close-on-exec, so every session and listener
+  // would leak into the new process. It only keeps the standard streams and
+  // the channel, the listeners are sent over it.
+  posix_spawn_file_actions_t actions;
+  ::posix_spawn_file_actions_init(&actions);
+  ::posix_spawn_file_actions_adddup2(&actions, pair[1], CHANNEL_FD);
+  ::posix_spawn_file_actions_addclosefrom_np(&actions, CHANNEL_FD + 1);
+
+  const auto path = executable();
+  pid_t pid = 0;
+  const auto spawned = ::posix_spawn(&pid, path.c_str(), &actions, nullptr,
+                                     argv.data(), envp.data());
+  ::posix_spawn_file_actions_destroy(&actions);
+  ::close(pair[1]);
+  if (spawned != 0) {
+    ::close(pair[0]);
+    errno = spawned;
+    throw posix::error("Could not start '" + path + "'");
+  }
+
+  // the sockets ride along with one byte of payload
+  char payload = SOCKETS;
+  iovec vector{.iov_base = &payload, .iov_len = 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)]{};
+  msghdr message{};
+  message.msg_iov = &vector;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+  auto *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+  std::memcpy(CMSG_DATA(header), listeners.data(),
+              sizeof(int) * listeners.size());
+
+  ssize_t sent = 0;
+  do {
+    sent = ::sendmsg(pair[0], &message, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  if (sent != 1) {
+    const auto error =
+        posix::error("Could not hand over the listening sockets");
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+    ::close(pair[0]);
+    throw error;
+  }
+
+  return successor{.pid = pid, .channel = pair[0]};
+}
+
+bool handoff::await_listening(const successor &next) {
+  if (read_byte(next.channel, LISTENING_TIMEOUT_MS) == LISTENING) {
+    return true;
+  }
+
+  ::kill(next.pid, SIGKILL);
+  ::waitpid(next.pid, nullptr, 0);
+  ::close(next.channel);
+  return false;
+}
+
+void handoff::release(const successor &next) {
+  write_byte(next.channel, RELEASED);
+  ::close(next.channel);
+}
+
+std::optional<handoff::inherited> handoff::receive() {
+  const char *named = std::getenv(CHANNEL_VARIABLE);
+  if (named == nullptr) {
+    return std::nullopt;
+  }
+
+  const std::string_view text{named};
+  int channel = -1;
+  const auto [end, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), channel);
+  ::unsetenv(CHANNEL_VARIABLE);
+  if (ec != std::errc{} || channel < 0) {
+    throw std::runtime_error{"Bad handoff channel"};
+  }
+  ::fcntl(channel, F_SETFD, FD_CLOEXEC);
+
+  char payload = 0;
+  iovec vector{.iov_base = &payload, .iov_len = 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)]{};
+  msghdr message{};
+  message.msg_iov = &vector;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  ssize_t got = 0;
+  do {
+    got = ::recvmsg(channel, &message, MSG_CMSG_CLOEXEC);
+  } while (got < 0 && errno == EINTR);
+  if (got != 1 || payload != SOCKETS) {
+    const auto error = posix::error("Could not receive the listening sockets");
+    ::close(channel);
+    throw error;
+  }
+
+  inherited handed{.channel = channel, .listeners = {}};
+  for (auto *header = CMSG_FIRSTHDR(&message); header != nullptr;
+       header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    const auto count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (std::size_t i = 0; i < count; i++) {
+      int fd = -1;
+      std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+      handed.listeners.emplace_back(fd);
+    }
+  }
+  return handed;
+}
+
+void handoff::drain() { drained.store(true, std::memory_order_relaxed); }
+
+bool handoff::draining() { return drained.load(std::memory_order_relaxed); }
@@ -0,0 +1,305 @@
+#include "../include/http2.hpp"
+#include "../include/accounting.hpp"
+#include "../include/environment.hpp"
+#include "../include/server_gen.hpp"
+#include "../include/trace.hpp"
+#include <algorithm>
+#include <cctype>
+#include <nghttp2/nghttp2.h>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+using namespace cobble;
+
+/// @brief Streams a peer may have open at once
+constexpr U32 MAX_CONCURRENT_STREAMS = 100;
+
+/// @brief One request/response exchange on the connection
+struct http2::connection::stream {
+  /// @brief What the stream used, open from when it's routed until it's
+  /// closed
+  std::optional<accounting::ledger> ledger{};
+
+  /// @brief The request, assembled from HEADERS and DATA frames
+  boost::beast::http::request<boost::beast::http::string_body> request{
+      boost::beast::http::verb::unknown, "", 11};
+
+  /// @brief The routed response, once the request ended
+  std::optional<server_gen::response> response{};
+
+  /// @brief The response body's size, taken once when it's routed since a
+  /// multipart body works it out part by part
+  std::size_t length = 0;
+
+  /// @brief How much of the response body was handed to nghttp2
+  std::size_t offset = 0;
+};
+
+/// @brief nghttp2's C callbacks, they never let an exception escape
+struct http2::connection::callbacks {
+  static int on_begin_headers(nghttp2_session *, const nghttp2_frame *frame,
+                              void *user_data) {
+    auto *self = static_cast<connection *>(user_data);
+
+    if (frame->hd.type == NGHTTP2_HEADERS &&
+        frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+      self->_streams.insert_or_assign(frame->hd.stream_id,
+                                      std::make_unique<stream>());
+    }
+    return 0;
+  }
+
+  static int on_header(nghttp2_session *, const nghttp2_frame *frame,
+                       const uint8_t *name, size_t name_length,
+                       const uint8_t *value, size_t value_length, uint8_t,
+                       void *user_data) {
+    auto *self = static_cast<connection *>(user_data);
+    auto found = self->_streams.find(frame->hd.stream_id);
+    if (found == self->_streams.end()) {
+      return 0;
+    }
+
+    auto &request = found->second->request;
+    const std::string_view key{reinterpret_cast<const char *>(name),
+                               name_length};
+    const std::string_view val{reinterpret_cast<const char *>(value),
+                               value_length};
+
+    // pseudo-headers map back onto the HTTP/1.1 request line and Host
+    if (key == ":method") {
+      request.method_string(val);
+    } else if (key == ":path") {
+      request.target(val);
+    } else if (key == ":authority") {
+      request.set(boost::beast::http::field::host, val);
+    } else if (!key.starts_with(":")) {
+      request.insert(key, val);
+    }
+    return 0;
+  }
+
+  static int on_data_chunk(nghttp2_session *session, uint8_t,
+                           int32_t stream_id, const uint8_t *data,
+                           size_t length, void *user_data) {
+    auto *self = static_cast<connection *>(user_data);
+    auto found = self->_streams.find(stream_id);
+    if (found == self->_streams.end()) {
+      return 0;
+    }
+
+    auto &body = found->second->request.body();
+    if (body.size() + length > server_gen::MAX_REQUEST_BODY) {
+      nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id,
+                                NGHTTP2_REFUSED_STREAM);
+      self->_streams.erase(found);
+      return 0;
+    }
+    body.append(reinterpret_cast<const char *>(data), length);
+    return 0;
+  }
+
+  static int on_frame(nghttp2_session *, const nghttp2_frame *frame,
+                      void *user_data) {
+    auto *self = static_cast<connection *>(user_data);
+
+    if ((frame->hd.type == NGHTTP2_HEADERS ||
+         frame->hd.type == NGHTTP2_DATA) &&
+        (frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+      self->_finished.emplace_back(frame->hd.stream_id);
+    }
+    return 0;
+  }
+
+  static int on_stream_close(nghttp2_session *, int32_t stream_id, uint32_t,
+                             void *user_data) {
+    static_cast<connection *>(user_data)->_streams.erase(stream_id);
+    return 0;
+  }
+
+  static ssize_t read_body(nghttp2_session *, int32_t, uint8_t *buf,
+                           size_t length, uint32_t *data_flags,
+                           nghttp2_data_source *source, void *) {
+    auto *current = static_cast<stream *>(source->ptr);
+
+    return std::visit(
+        [current, buf, length, data_flags](auto &&message) -> ssize_t {
+          using body_type = typename std::decay_t<decltype(message)>::body_type;
+          const auto total = current->length;
+          std::size_t copied = 0;
+
+          if constexpr (std::is_same_v<body_type,
+                                       boost::beast::http::string_body>) {
+            const auto &body = message.body();
+            copied = std::min(length, total - current->offset);
+            std::copy_n(body.data() + current->offset, copied, buf);
+          } else if constexpr (std::is_same_v<body_type,
+                                              boost::beast::http::file_body>) {
+            auto &body = message.body();
+            boost::beast::error_code ec;
+            copied = body.file().read(
+                buf, std::min(length, total - current->offset), ec);
+            if (ec) {
+              return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+            }
+          } else if constexpr (std::is_same_v<body_type, multipart::body> ||
+                               std::is_same_v<body_type, splice::body>) {
+            auto &body = message.body();
+            boost::beast::error_code ec;
+            copied = body.read(buf, length, ec);
+            if (ec) {
+              return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+            }
+          }
+
+          current->offset += copied;
+          if (current->offset >= total) {
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+          }
+          return static_cast<ssize_t>(copied);
+        },
+        *current->response);
+  }
+};
+// ============================================================================
+http2::connection::connection(const std::string &peer_ip, U16 peer_port)
+    : _session{nullptr}, _peer_ip{peer_ip}, _peer_port{peer_port} {
+  nghttp2_session_callbacks *table;
+  if (nghttp2_session_callbacks_new(&table) != 0) {
+    throw std::runtime_error{"Could not allocate HTTP/2 callbacks"};
+  }
+
+  nghttp2_session_callbacks_set_on_begin_headers_callback(
+      table, callbacks::on_begin_headers);
+  nghttp2_session_callbacks_set_on_header_callback(table,
+                                                   callbacks::on_header);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+      table, callbacks::on_data_chunk);
+  nghttp2_session_callbacks_set_on_frame_recv_callback(table,
+                                                       callbacks::on_frame);
+  nghttp2_session_callbacks_set_on_stream_close_callback(
+      table, callbacks::on_stream_close);
+
+  const auto rv = nghttp2_session_server_new(&_session, table, this);
+  nghttp2_session_callbacks_del(table);
+  if (rv != 0) {
+    throw std::runtime_error{nghttp2_strerror(rv)};
+  }
+
+  const nghttp2_settings_entry settings[]{
+      {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, MAX_CONCURRENT_STREAMS}};
+  nghttp2_submit_settings(_session, NGHTTP2_FLAG_NONE, settings,
+                          std::size(settings));
+}
+
+http2::connection::~connection() { nghttp2_session_del(_session); }
+
+void http2::connection::receive(const void *data, std::size_t size) {
+  const auto rv = nghttp2_session_mem_recv(
+      _session, static_cast<const uint8_t *>(data), size);
+  if (rv < 0) {
+    throw std::runtime_error{std::string{"HTTP/2 session failed: "} +
+                             nghttp2_strerror(static_cast<int>(rv))};
+  }
+}
+
+boost::asio::const_buffer http2::connection::pending() {
+  const uint8_t *data = nullptr;
+  const auto rv = nghttp2_session_mem_send(_session, &data);
+  if (rv < 0) {
+    throw std::runtime_error{std::string{"HTTP/2 session failed: "} +
+                             nghttp2_strerror(static_cast<int>(rv))};
+  }
+  return boost::asio::const_buffer{data, static_cast<std::size_t>(rv)};
+}
+
+void http2::connection::drain() {
+  if (_draining) {
+    return;
+  }
+  _draining = true;
+  nghttp2_submit_goaway(_session, NGHTTP2_FLAG_NONE,
+                        nghttp2_session_get_last_proc_stream_id(_session),
+                        NGHTTP2_NO_ERROR, nullptr, 0);
+}
+
+bool http2::connection::alive() const {
+  return nghttp2_session_want_read(_session) ||
+         nghttp2_session_want_write(_session);
+}
+
+std::vector<S32> http2::connection::finished() {
+  return std::exchange(_finished, {});
+}
+
+boost::asio::awaitable<void> http2::connection::respond(S32 stream_id) {
+  auto found = _streams.find(stream_id);
+  if (found == _streams.end()) {
+    co_return;
+  }
+
+  // same as HTTP/1.1, a stream keeps the configuration it started with
+  const auto config = environment::current();
+  auto trace_context = trace::sample(config->trace_sample_rate);
+  found->second->ledger.emplace(trace_context);
+  auto request = std::move(found->second->request);
+  request.prepare_payload();
+  auto response =
+      co_await [&]() -> boost::asio::awaitable<server_gen::response> {
+    trace::span span{"server_gen::respond", trace_context};
+    co_return co_await server_gen::respond(std::move(request), *config,
+                                           _peer_ip, _peer_port,
+                                           trace_context);
+  }();
+
+  // the peer may have reset the stream while it was being routed
+  found = _streams.find(stream_id);
+  if (found == _streams.end()) {
+    co_return;
+  }
+  auto &current = *found->second;
+  current.response.emplace(std::move(response));
+
+  // HTTP/2 headers are lowercase and carry no connection-specific fields
+  std::vector<std::pair<std::string, std::string>> headers{};
+  const auto has_body = std::visit(
+      [&headers, &current](auto &&message) {
+        headers.emplace_back(":status", std::to_string(message.result_int()));
+        for (const auto &field : message) {
+          std::string name{field.name_string()};
+          std::transform(name.begin(), name.end(), name.begin(),
+                         [](unsigned char c) { return std::tolower(c); });
+          if (name == "connection" || name == "keep-alive" ||
+              name == "proxy-connection" || name == "transfer-encoding" ||
+              name == "upgrade") {
+            continue;
+          }
+          headers.emplace_back(std::move(name), std::string{field.value()});
+        }
+
+        current.length = message.payload_size().value_or(0);
+        using body_type = typename std::decay_t<decltype(message)>::body_type;
+        return !std::is_same_v<body_type, boost::beast::http::empty_body>;
+      },
+      *current.response);
+
+  std::vector<nghttp2_nv> nva{};
+  nva.reserve(headers.size());
+  for (auto &&[name, value] : headers) {
+    nva.emplace_back(nghttp2_nv{reinterpret_cast<uint8_t *>(name.data()),
+                                reinterpret_cast<uint8_t *>(value.data()),
+                                name.size(), value.size(),
+                                NGHTTP2_NV_FLAG_NONE});
+  }
+
+  nghttp2_data_provider provider{};
+  provider.source.ptr = &current;
+  provider.read_callback = callbacks::read_body;
+
+  const auto rv = nghttp2_submit_response(_session, stream_id, nva.data(),
+                                          nva.size(),
+                                          has_body ? &provider : nullptr);
+  if (rv != 0) {
+    throw std::runtime_error{nghttp2_strerror(rv)};
+  }
+}
@@ -0,0 +1,207 @@
+#include "../include/ingest.hpp"
+#include "../include/logger.hpp"
+#include "../include/posix.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <openssl/evp.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+using namespace cobble;
+
+/// @brief The extended attribute blobs carry their hash in, shared by every
+/// hard link to them
+constexpr const char *HASH_ATTRIBUTE = "user.cobble.sha256";
+
+/// @brief Length of a SHA-256 in hex
+constexpr std::size_t HASH_LENGTH = 64;
+
+/// @brief Bytes hashed per read
+constexpr std::size_t CHUNK_SIZE = 1024 * 1024;
+
+/// @brief Ingest counters
+struct counters {
+  std::atomic<U64> stored{0};
+  std::atomic<U64> deduplicated{0};
+  std::atomic<U64> saved{0};
+  std::atomic<U64> released{0};
+};
+
+static counters &count() {
+  static counters shared{};
+  return shared;
+}
+
+static std::string hex(const unsigned char *bytes, std::size_t length) {
+  constexpr char HEX[] = "0123456789abcdef";
+  std::string out{};
+  out.reserve(length * 2);
+  for (std::size_t i = 0; i < length; i++) {
+    out += HEX[bytes[i] >> 4];
+    out += HEX[bytes[i] & 0xF];
+  }
+  return out;
+}
+
+/// @brief Hashes a file in one sequential pass, OpenSSL picks the fastest
+/// SHA-256 the CPU has (SHA extensions or AVX2)
+/// @return The hash in hex and the file's size
+static std::pair<std::string, U64>
+hash_file(const std::filesystem::path &path) {
+  const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw posix::error("Could not open '" + path.string() + "'");
+  }
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context{
+      EVP_MD_CTX_new(), EVP_MD_CTX_free};
+  if (!context ||
+      EVP_DigestInit_ex(context.get(), EVP_sha256(), nullptr) != 1) {
+    ::close(fd);
+    throw std::runtime_error{"Could not start hashing"};
+  }
+
+  std::vector<char> buffer(CHUNK_SIZE);
+  U64 size = 0;
+  for (;;) {
+    const auto got = ::read(fd, buffer.data(), buffer.size());
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      const auto error = posix::error("Could not read '" + path.string() + "'");
+      ::close(fd);
+      throw error;
+    }
+    if (got == 0) {
+      break;
+    }
+    EVP_DigestUpdate(context.get(), buffer.data(), got);
+    size += got;
+  }
+  ::close(fd);
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int length = 0;
+  EVP_DigestFinal_ex(context.get(), digest, &length);
+  return {hex(digest, length), size};
+}
+
+/// @brief The hash a stored file was tagged with
+/// @return The hash in hex, or nothing
+static std::string hash_at(const std::filesystem::path &path) {
+  char value[HASH_LENGTH];
+  const auto length =
+      ::getxattr(path.c_str(), HASH_ATTRIBUTE, value, sizeof(value));
+  if (length != static_cast<ssize_t>(HASH_LENGTH)) {
+    return std::string{};
+  }
+  return std::string{value, HASH_LENGTH};
+}
+
+/// @brief A suffix no other ingest uses, so ingests of the same key, even by
+/// the process taking over during a handoff, never share a staged link
+static std::string staging_suffix() {
+  static std::atomic<U64> sequence{0};
+  return ".ingest-" + std::to_string(::getpid()) + "-" +
+         std::to_string(sequence.fetch_add(1, std::memory_order_relaxed));
+}
+
+static std::filesystem::path blob_path(const environment::configuration &config,
+                                       const std::string &hash) {
+  // fanned out so no directory gets too large
+  return config.data_path / "blobs" / hash.substr(0, 2) / hash;
+}
+// ============================================================================
+ingest::stored ingest::store(const environment::configuration &config,
+                             const std::string &key,
+                             const std::filesystem::path &source) {
+  if (config.storage.backend != environment::storage_settings::kind::local) {
+    throw std::runtime_error{"Ingest needs the local storage backend"};
+  }
+
+  const auto [hash, size] = hash_file(source);
+  stored result{.hash = hash, .size = size};
+
+  // the blob takes over the source's inode, nothing is copied
+  const auto blob = blob_path(config, hash);
+  std::filesystem::create_directories(blob.parent_path());
+  if (::link(source.c_str(), blob.c_str()) == 0) {
+    if (::setxattr(blob.c_str(), HASH_ATTRIBUTE, hash.data(), hash.size(),
+                   0) != 0) {
+      logger::log(logger::severity::warning, "Could not tag blob ", hash,
+                  ", it's served without an ETag: ", std::strerror(errno));
+    }
+    count().stored.fetch_add(1, std::memory_order_relaxed);
+  } else if (errno == EEXIST) {
+    result.deduplicated = true;
+    count().deduplicated.fetch_add(1, std::memory_order_relaxed);
+    count().saved.fetch_add(size, std::memory_order_relaxed);
+  } else {
+    throw posix::error("Could not store blob " + hash);
+  }
+
+  // swapped in with a rename, readers see either the old or the new content
+  const auto path = config.data_path / key;
+  std::filesystem::create_directories(path.parent_path());
+  const auto previous = hash_at(path);
+  auto staged = path;
+  staged += staging_suffix();
+  ::unlink(staged.c_str());
+  if (::link(blob.c_str(), staged.c_str()) != 0) {
+    throw posix::error("Could not link '" + key + "'");
+  }
+  if (::rename(staged.c_str(), path.c_str()) != 0) {
+    const auto error = posix::error("Could not replace '" + key + "'");
+    ::unlink(staged.c_str());
+    throw error;
+  }
+
+  // renaming over another link to the same blob leaves both in place
+  ::unlink(staged.c_str());
+  ::unlink(source.c_str());
+
+  // the old content goes once only its own blob links to it
+  if (!previous.empty() && previous != hash) {
+    const auto old = blob_path(config, previous);
+    struct stat status;
+    if (::stat(old.c_str(), &status) == 0 && status.st_nlink == 1 &&
+        ::unlink(old.c_str()) == 0) {
+      count().released.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  return result;
+}
+
+std::string ingest::hash_of(int fd) {
+  char value[HASH_LENGTH];
+  const auto length = ::fgetxattr(fd, HASH_ATTRIBUTE, value, sizeof(value));
+  if (length != static_cast<ssize_t>(HASH_LENGTH)) {
+    return std::string{};
+  }
+  return std::string{value, HASH_LENGTH};
+}
+
+Json::Value ingest::stats() {
+  Json::Value root;
+
+  root["stored"] = static_cast<Json::UInt64>(
+      count().stored.load(std::memory_order_relaxed));
+  root["deduplicated"] = static_cast<Json::UInt64>(
+      count().deduplicated.load(std::memory_order_relaxed));
+  root["bytesSaved"] = static_cast<Json::UInt64>(
+      count().saved.load(std::memory_order_relaxed));
+  root["released"] = static_cast<Json::UInt64>(
+      count().released.load(std::memory_order_relaxed));
+
+  return root;
+}
@@ -0,0 +1,455 @@
+#include "../include/json_view.hpp"
+#include <bit>
+#include <charconv>
+#include <cstring>
+using namespace cobble;
+
+/// @brief Finds the next byte a string scan has to stop at, a quote, a
+/// backslash or a control character. Eight bytes are tested at once, only the
+/// lowest flagged byte of a word is exact and that's the only one used.
+/// @param text The JSON text
+/// @param at Where to start
+/// @return Where the stop is, or the end of the text
+static std::size_t string_stop(std::string_view text, std::size_t at) {
+  if constexpr (std::endian::native == std::endian::little) {
+    constexpr U64 ones = 0x0101010101010101;
+    constexpr U64 highs = 0x8080808080808080;
+    for (; at + sizeof(U64) <= text.size(); at += sizeof(U64)) {
+      U64 word;
+      std::memcpy(&word, text.data() + at, sizeof(U64));
+      const auto quote = word ^ (ones * '"');
+      const auto backslash = word ^ (ones * '\\');
+      const auto stops = (((quote - ones) & ~quote) |
+                          ((backslash - ones) & ~backslash) |
+                          ((word - ones * 0x20) & ~word)) &
+                         highs;
+      if (stops != 0) {
+        return at + std::countr_zero(stops) / 8;
+      }
+    }
+  }
+
+  for (; at < text.size(); ++at) {
+    const auto c = static_cast<unsigned char>(text[at]);
+    if (c == '"' || c == '\\' || c < 0x20) {
+      break;
+    }
+  }
+  return at;
+}
+
+/// @brief Reads four hex digits of a `\u` escape
+/// @param digits The digits, already validated
+/// @return The code unit
+static U32 hex_unit(std::string_view digits) {
+  U32 unit = 0;
+  std::from_chars(digits.data(), digits.data() + 4, unit, 16);
+  return unit;
+}
+
+/// @brief Appends a code point as UTF-8
+static void append_utf8(std::string &out, U32 point) {
+  if (point < 0x80) {
+    out += static_cast<char>(point);
+  } else if (point < 0x800) {
+    out += static_cast<char>(0xc0 | (point >> 6));
+    out += static_cast<char>(0x80 | (point & 0x3f));
+  } else if (point < 0x10000) {
+    out += static_cast<char>(0xe0 | (point >> 12));
+    out += static_cast<char>(0x80 | ((point >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (point & 0x3f));
+  } else {
+    out += static_cast<char>(0xf0 | (point >> 18));
+    out += static_cast<char>(0x80 | ((point >> 12) & 0x3f));
+    out += static_cast<char>(0x80 | ((point >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (point & 0x3f));
+  }
+}
+
+/// @brief Decodes a string's escapes, which were validated while parsing.
+/// Unpaired surrogates become U+FFFD.
+/// @param raw The string's text between its quotes
+/// @return The decoded string
+static std::string unescape(std::string_view raw) {
+  std::string out{};
+  out.reserve(raw.size());
+
+  for (std::size_t at = 0; at < raw.size();) {
+    const auto backslash = raw.find('\\', at);
+    out.append(raw.substr(at, backslash - at));
+    if (backslash == std::string_view::npos) {
+      break;
+    }
+
+    const auto escape = raw[backslash + 1];
+    at = backslash + 2;
+    switch (escape) {
+    case 'b':
+      out += '\b';
+      break;
+    case 'f':
+      out += '\f';
+      break;
+    case 'n':
+      out += '\n';
+      break;
+    case 'r':
+      out += '\r';
+      break;
+    case 't':
+      out += '\t';
+      break;
+    case 'u': {
+      auto point = hex_unit(raw.substr(at, 4));
+      at += 4;
+      if (point >= 0xd800 && point < 0xdc00 && raw.substr(at, 2) == "\\u") {
+        const auto low = hex_unit(raw.substr(at + 2, 4));
+        if (low >= 0xdc00 && low < 0xe000) {
+          point = 0x10000 + ((point - 0xd800) << 10) + (low - 0xdc00);
+          at += 6;
+        }
+      }
+      append_utf8(out, point >= 0xd800 && point < 0xe000 ? 0xfffd : point);
+      break;
+    }
+    default:
+      out += escape;
+      break;
+    }
+  }
+  return out;
+}
+
+/// @brief A recursive descent over the text that appends to the tape, depth
+/// is bounded so the recursion is too
+class json_view::document::parser {
+  std::string_view _text;
+  std::vector<node> &_tape;
+  std::size_t _at = 0;
+  std::optional<error> _error{};
+
+  bool _fail(const char *code) {
+    _error = error{.code = code, .offset = _at};
+    return false;
+  }
+
+  void _whitespace() {
+    while (_at < _text.size() &&
+           (_text[_at] == ' ' || _text[_at] == '\n' || _text[_at] == '\r' ||
+            _text[_at] == '\t')) {
+      ++_at;
+    }
+  }
+
+  bool _digits() {
+    const auto from = _at;
+    while (_at < _text.size() && _text[_at] >= '0' && _text[_at] <= '9') {
+      ++_at;
+    }
+    return _at > from;
+  }
+
+  void _leaf(kind type, std::size_t start, bool escaped = false) {
+    const auto index = static_cast<U32>(_tape.size());
+    _tape.emplace_back(node{.type = type,
+                            .escaped = escaped,
+                            .start = static_cast<U32>(start),
+                            .length = static_cast<U32>(_at - start),
+                            .next = index + 1});
+  }
+
+  bool _literal(std::string_view word, kind type) {
+    if (_text.substr(_at, word.size()) != word) {
+      return _fail("BAD_JSON");
+    }
+    const auto start = _at;
+    _at += word.size();
+    _leaf(type, start);
+    return true;
+  }
+
+  bool _number() {
+    const auto start = _at;
+    if (_text[_at] == '-') {
+      ++_at;
+    }
+    if (_at < _text.size() && _text[_at] == '0') {
+      ++_at;
+    } else if (!_digits()) {
+      return _fail("BAD_JSON");
+    }
+    if (_at < _text.size() && _text[_at] == '.') {
+      ++_at;
+      if (!_digits()) {
+        return _fail("BAD_JSON");
+      }
+    }
+    if (_at < _text.size() && (_text[_at] == 'e' || _text[_at] == 'E')) {
+      ++_at;
+      if (_at < _text.size() && (_text[_at] == '+' || _text[_at] == '-')) {
+        ++_at;
+      }
+      if (!_digits()) {
+        return _fail("BAD_JSON");
+      }
+    }
+    _leaf(kind::number, start);
+    return true;
+  }
+
+  bool _string() {
+    const auto start = ++_at;
+    auto escaped = false;
+
+    for (;;) {
+      _at = string_stop(_text, _at);
+      if (_at >= _text.size()) {
+        return _fail("BAD_JSON");
+      }
+
+      const auto c = _text[_at];
+      if (c == '"') {
+        break;
+      }
+      if (c != '\\' || _at + 1 >= _text.size()) {
+        return _fail("BAD_JSON");
+      }
+
+      escaped = true;
+      const auto escape = _text[_at + 1];
+      if (escape == 'u') {
+        const auto digits = _text.substr(_at + 2, 4);
+        if (digits.size() != 4 ||
+            digits.find_first_not_of("0123456789abcdefABCDEF") !=
+                std::string_view::npos) {
+          return _fail("BAD_JSON");
+        }
+        _at += 6;
+      } else if (std::string_view{"\"\\/bfnrt"}.contains(escape)) {
+        _at += 2;
+      } else {
+        return _fail("BAD_JSON");
+      }
+    }
+
+    _leaf(kind::string, start, escaped);
+    ++_at;
+    return true;
+  }
+
+  bool _container(U32 depth, kind type) {
+    if (depth > MAX_DEPTH) {
+      return _fail("JSON_TOO_DEEP");
+    }
+
+    const auto close = type == kind::array ? ']' : '}';
+    const auto index = _tape.size();
+    _tape.emplace_back(node{.type = type,
+                            .escaped = false,
+                            .start = static_cast<U32>(_at),
+                            .length = 0,
+                            .next = 0});
+    ++_at;
+
+    U32 count = 0;
+    _whitespace();
+    if (_at < _text.size() && _text[_at] == close) {
+      ++_at;
+    } else {
+      for (;;) {
+        if (type == kind::object) {
+          _whitespace();
+          if (_at >= _text.size() || _text[_at] != '"') {
+            return _fail("BAD_JSON");
+          }
+          if (!_string()) {
+            return false;
+          }
+          _whitespace();
+          if (_at >= _text.size() || _text[_at] != ':') {
+            return _fail("BAD_JSON");
+          }
+          ++_at;
+        }
+        if (!element(depth)) {
+          return false;
+        }
+        ++count;
+
+        _whitespace();
+        if (_at < _text.size() && _text[_at] == ',') {
+          ++_at;
+        } else if (_at < _text.size() && _text[_at] == close) {
+          ++_at;
+          break;
+        } else {
+          return _fail("BAD_JSON");
+        }
+      }
+    }
+
+    _tape[index].length = count;
+    _tape[index].next = static_cast<U32>(_tape.size());
+    return true;
+  }
+
+public:
+  parser(std::string_view text, std::vector<node> &tape)
+      : _text{text}, _tape{tape} {}
+
+  /// @brief Parses one value and whatever it contains
+  /// @param depth How deep the value's container is
+  /// @return false if the text is bad
+  bool element(U32 depth) {
+    _whitespace();
+    if (_at >= _text.size()) {
+      return _fail("BAD_JSON");
+    }
+
+    switch (_text[_at]) {
+    case '{':
+      return _container(depth + 1, kind::object);
+    case '[':
+      return _container(depth + 1, kind::array);
+    case '"':
+      return _string();
+    case 't':
+      return _literal("true", kind::boolean);
+    case 'f':
+      return _literal("false", kind::boolean);
+    case 'n':
+      return _literal("null", kind::null);
+    default:
+      if (_text[_at] == '-' || (_text[_at] >= '0' && _text[_at] <= '9')) {
+        return _number();
+      }
+      return _fail("BAD_JSON");
+    }
+  }
+
+  /// @brief Parses the whole text
+  /// @return Why it isn't a document, or nothing
+  std::optional<error> run() {
+    if (element(0)) {
+      _whitespace();
+      if (_at != _text.size()) {
+        _fail("BAD_JSON");
+      }
+    }
+    return _error;
+  }
+};
+// ============================================================================
+std::expected<json_view::document, json_view::error>
+json_view::document::parse(std::string text) {
+  if (text.size() > MAX_BYTES) {
+    return std::unexpected{error{.code = "BODY_TOO_LARGE", .offset = 0}};
+  }
+
+  json_view::document parsed{};
+  parsed._text = std::move(text);
+
+  // most values are a handful of bytes, a rough guess saves regrowing
+  parsed._tape.reserve(parsed._text.size() / 8 + 1);
+  if (const auto failed = parser{parsed._text, parsed._tape}.run()) {
+    return std::unexpected{*failed};
+  }
+  return parsed;
+}
+
+json_view::kind json_view::value::type() const {
+  return _document ? _document->_tape[_at].type : kind::missing;
+}
+
+std::optional<bool> json_view::value::boolean() const {
+  if (type() != kind::boolean) {
+    return std::nullopt;
+  }
+  return _document->_text[_document->_tape[_at].start] == 't';
+}
+
+std::optional<U64> json_view::value::unsigned_integer() const {
+  if (type() != kind::number) {
+    return std::nullopt;
+  }
+  const auto &found = _document->_tape[_at];
+  const auto *first = _document->_text.data() + found.start;
+  U64 number = 0;
+  const auto [end, ec] = std::from_chars(first, first + found.length, number);
+  if (ec != std::errc{} || end != first + found.length) {
+    return std::nullopt;
+  }
+  return number;
+}
+
+std::optional<S64> json_view::value::integer() const {
+  if (type() != kind::number) {
+    return std::nullopt;
+  }
+  const auto &found = _document->_tape[_at];
+  const auto *first = _document->_text.data() + found.start;
+  S64 number = 0;
+  const auto [end, ec] = std::from_chars(first, first + found.length, number);
+  if (ec != std::errc{} || end != first + found.length) {
+    return std::nullopt;
+  }
+  return number;
+}
+
+std::optional<F64> json_view::value::real() const {
+  if (type() != kind::number) {
+    return std::nullopt;
+  }
+  const auto &found = _document->_tape[_at];
+  const auto *first = _document->_text.data() + found.start;
+  F64 number = 0;
+  const auto [end, ec] = std::from_chars(first, first + found.length, number);
+  if (ec != std::errc{} || end != first + found.length) {
+    return std::nullopt;
+  }
+  return number;
+}
+
+std::optional<std::string_view> json_view::value::view() const {
+  if (type() != kind::string || _document->_tape[_at].escaped) {
+    return std::nullopt;
+  }
+  const auto &found = _document->_tape[_at];
+  return std::string_view{_document->_text}.substr(found.start, found.length);
+}
+
+std::optional<std::string> json_view::value::string() const {
+  if (type() != kind::string) {
+    return std::nullopt;
+  }
+  const auto &found = _document->_tape[_at];
+  const auto raw =
+      std::string_view{_document->_text}.substr(found.start, found.length);
+  return found.escaped ? unescape(raw) : std::string{raw};
+}
+
+std::size_t json_view::value::size() const {
+  const auto which = type();
+  if (which != kind::array && which != kind::object) {
+    return 0;
+  }
+  return _document->_tape[_at].length;
+}
+
+json_view::value json_view::value::operator[](std::string_view key) const {
+  if (type() != kind::object) {
+    return value{};
+  }
+
+  const auto &tape = _document->_tape;
+  value member{};
+  for (auto at = _at + 1; at < tape[_at].next; at = tape[at + 1].next) {
+    const auto &name = tape[at];
+    const auto raw =
+        std::string_view{_document->_text}.substr(name.start, name.length);
+    if (name.escaped ? unescape(raw) == key : raw == key) {
+      member = value{_document, at + 1};
+    }
+  }
+  return member;
+}
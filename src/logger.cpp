@@ -1,27 +1,14 @@
 #include "../include/logger.hpp"
-#include <chrono>
+#include "../include/timekeeper.hpp"
 #include <cstdio>
-#include <ctime>
 #include <sstream>
 using namespace cobble;
 
 static std::unique_ptr<logger::logger_list> ptr_loggers{nullptr};
 
 void format_timestamp(std::stringstream &format) {
-  constexpr auto BUFFER_SIZE = 256;
-  format << "[";
-  auto t = std::chrono::system_clock::now();
-  auto t_time = std::chrono::system_clock::to_time_t(t);
-  char t_buffer[BUFFER_SIZE]{0};
-  std::strftime(t_buffer, BUFFER_SIZE - 1, "%F %T", std::localtime(&t_time));
-  auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    t.time_since_epoch())
-                    .count() %
-                1000;
-  format << t_buffer;
-  format << ".";
-  format << std::setw(3) << std::setfill('0') << millis;
-  format << std::setw(0) << std::setfill(' ') << "] ";
+  // formatted once per tick by the timekeeper, not once per line
+  format << "[" << timekeeper::log_timestamp().view() << "] ";
 }
 
 logger::logger_list &logger::all_loggers() {
@@ -3,6 +3,7 @@
 #include "../include/exception_handler.hpp"
 #include "../include/logger.hpp"
 #include "../include/server.hpp"
+#include "../include/timekeeper.hpp"
 #include <csignal>
 #include <cstdlib>
 #include <exception>
@@ -14,6 +15,7 @@ void signal_handler(int signal) { run = false; }
 
 int main(int argc, char **argv) {
   try {
+    timekeeper::start();
     logger::all_loggers().emplace_back(new logger::stdout_listener());
     logger::all_loggers().emplace_back(
         new logger::file_listener("console.log"));
@@ -24,21 +26,23 @@ int main(int argc, char **argv) {
     }
 
     run = true;
-    environment::configuration config = environment::load(argv[1]);
+    environment::publish(environment::load(argv[1]));
 
     logger::log(
         logger::severity::notice,
         "Hooking SIGINT, press Ctrl-C to gracefully shut down the server");
 
     std::signal(SIGINT, signal_handler);
-    server::start(config, run);
+    server::start(run);
 
     logger::log(logger::severity::notice, "Server shut down gracefully");
+    timekeeper::stop();
     return EXIT_SUCCESS;
   } catch (const std::exception &e) {
     logger::log(logger::severity::emergency,
                 "Terminating, stacktrace is below");
     exception_handler::print_nested(e);
+    timekeeper::stop();
 
     return EXIT_FAILURE;
   }
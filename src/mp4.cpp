@@ -0,0 +1,704 @@
+#include "../include/mp4.hpp"
+#include <algorithm>
+#include <boost/beast.hpp>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+using namespace cobble;
+
+/// @brief Largest `moov` box we read, real ones stay far below this
+constexpr U64 MAX_MOOV_SIZE = 64 * 1024 * 1024;
+
+/// @brief Largest box read while probing, sample descriptions included
+constexpr U64 MAX_INFO_BOX = 64 * 1024;
+
+/// @brief Most samples a track may have, about 6 days at 30 frames a second
+constexpr U64 MAX_SAMPLES = 1 << 24;
+
+/// @brief `trun` sample flags of a keyframe, depends on no other sample
+constexpr U32 SYNC_SAMPLE_FLAGS = 0x02000000;
+
+/// @brief `trun` sample flags of any other frame
+constexpr U32 NON_SYNC_SAMPLE_FLAGS = 0x01010000;
+
+/// @brief A box inside a buffer
+struct box {
+  /// @brief The four character box type
+  std::string_view type;
+
+  /// @brief What follows the box header
+  std::string_view payload;
+
+  /// @brief The box, header included
+  std::string_view whole;
+};
+
+/// @brief Reads a big-endian unsigned integer, throws if out of bounds
+static U64 read_be(std::string_view data, std::size_t at, std::size_t bytes) {
+  if (at > data.size() || bytes > data.size() - at) {
+    throw std::runtime_error{"Truncated MP4 box"};
+  }
+
+  U64 value = 0;
+  for (std::size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | static_cast<U8>(data[at + i]);
+  }
+  return value;
+}
+
+static U32 be32(std::string_view data, std::size_t at) {
+  return static_cast<U32>(read_be(data, at, 4));
+}
+
+/// @brief Calls `visit` on every box directly inside `data`
+template <class Visitor>
+static void each(std::string_view data, Visitor &&visit) {
+  std::size_t at = 0;
+  while (at + 8 <= data.size()) {
+    U64 size = be32(data, at);
+    std::size_t header = 8;
+    if (size == 1) {
+      size = read_be(data, at + 8, 8);
+      header = 16;
+    } else if (size == 0) {
+      size = data.size() - at;
+    }
+
+    if (size < header || size > data.size() - at) {
+      throw std::runtime_error{"Malformed MP4 box size"};
+    }
+
+    visit(box{.type = data.substr(at + 4, 4),
+              .payload = data.substr(at + header, size - header),
+              .whole = data.substr(at, size)});
+    at += size;
+  }
+}
+
+/// @brief Finds the first box of a type directly inside `data`
+static std::optional<box> find(std::string_view data, std::string_view type) {
+  std::optional<box> found{};
+  each(data, [&found, type](const box &current) {
+    if (!found && current.type == type) {
+      found = current;
+    }
+  });
+  return found;
+}
+
+/// @brief Like `find`, but the box is mandatory
+static box require(std::string_view data, std::string_view type) {
+  auto found = find(data, type);
+  if (!found) {
+    throw std::runtime_error{"MP4 is missing a '" + std::string{type} +
+                             "' box"};
+  }
+  return *found;
+}
+
+/// @brief A box header read from a file
+struct file_box {
+  /// @brief The four character box type
+  char type[4];
+
+  /// @brief Where the payload starts in the file
+  U64 offset;
+
+  /// @brief Size of the payload
+  U64 size;
+
+  bool is(std::string_view other) const {
+    return std::string_view{type, 4} == other;
+  }
+};
+
+static void check(const boost::beast::error_code &ec) {
+  if (ec) {
+    throw std::runtime_error{ec.message()};
+  }
+}
+
+/// @brief Calls `visit` on every box header between two file offsets, with
+/// positioned reads of the headers only
+template <class Visitor>
+static void each_in_file(boost::beast::file &file, U64 begin, U64 end,
+                         Visitor &&visit) {
+  boost::beast::error_code ec;
+  U64 at = begin;
+  while (at + 8 <= end) {
+    char header[16];
+    file.seek(at, ec);
+    check(ec);
+    file.read(header, 8, ec);
+    check(ec);
+
+    const std::string_view view{header, sizeof(header)};
+    U64 size = be32(view, 0);
+    U64 header_size = 8;
+    if (size == 1) {
+      file.read(header + 8, 8, ec);
+      check(ec);
+      size = read_be(view, 8, 8);
+      header_size = 16;
+    } else if (size == 0) {
+      size = end - at;
+    }
+    if (size < header_size || size > end - at) {
+      throw std::runtime_error{"Malformed MP4 box size"};
+    }
+
+    file_box current{.type = {header[4], header[5], header[6], header[7]},
+                     .offset = at + header_size,
+                     .size = size - header_size};
+    visit(current);
+    at += size;
+  }
+}
+
+/// @brief Finds the first box of a type directly inside a box in a file
+static std::optional<file_box>
+find_in_file(boost::beast::file &file, const file_box &parent,
+             std::string_view type) {
+  std::optional<file_box> found{};
+  each_in_file(file, parent.offset, parent.offset + parent.size,
+               [&found, type](const file_box &current) {
+                 if (!found && current.is(type)) {
+                   found = current;
+                 }
+               });
+  return found;
+}
+
+/// @brief Reads a box's payload into `into`, reusing its storage
+static std::string_view read_payload(boost::beast::file &file,
+                                     const file_box &which, std::string &into,
+                                     U64 limit) {
+  if (which.size > limit) {
+    throw std::runtime_error{"MP4 '" + std::string{which.type, 4} +
+                             "' box is too large"};
+  }
+
+  boost::beast::error_code ec;
+  into.resize(which.size);
+  file.seek(which.offset, ec);
+  check(ec);
+  file.read(into.data(), into.size(), ec);
+  check(ec);
+  return into;
+}
+
+static boost::beast::file open_file(const std::filesystem::path &path,
+                                    U64 &file_size) {
+  boost::beast::file file;
+  boost::beast::error_code ec;
+  file.open(path.c_str(), boost::beast::file_mode::scan, ec);
+  check(ec);
+  file_size = file.size(ec);
+  check(ec);
+  return file;
+}
+
+/// @brief Finds the top-level `moov` box, skipping over `mdat` and the rest
+static file_box find_moov(boost::beast::file &file, U64 file_size) {
+  std::optional<file_box> moov{};
+  each_in_file(file, 0, file_size, [&moov](const file_box &current) {
+    if (!moov && current.is("moov")) {
+      moov = current;
+    }
+  });
+
+  if (!moov) {
+    throw std::runtime_error{"MP4 is missing a 'moov' box"};
+  }
+  return *moov;
+}
+
+/// @brief Reads the whole top-level `moov` box
+static std::string read_moov(const std::filesystem::path &path) {
+  U64 file_size = 0;
+  auto file = open_file(path, file_size);
+
+  std::string moov{};
+  read_payload(file, find_moov(file, file_size), moov, MAX_MOOV_SIZE);
+  return moov;
+}
+
+/// @brief Fills in sample sizes, times, keyframes and file offsets
+static void read_samples(std::string_view stbl, mp4::track &current) {
+  auto &samples = current.samples;
+
+  // sizes, every track needs them
+  if (find(stbl, "stz2")) {
+    throw std::runtime_error{"MP4 compact sample sizes are unsupported"};
+  }
+  const auto stsz = require(stbl, "stsz").payload;
+  const auto constant_size = be32(stsz, 4);
+  const U64 count = be32(stsz, 8);
+  if (count > MAX_SAMPLES ||
+      (constant_size == 0 && stsz.size() < 12 + count * 4)) {
+    throw std::runtime_error{"MP4 sample table is too large or truncated"};
+  }
+  samples.resize(count);
+  for (std::size_t i = 0; i < count; i++) {
+    samples[i].size =
+        constant_size != 0 ? constant_size : be32(stsz, 12 + i * 4);
+    samples[i].sync = true;
+  }
+
+  // decode times
+  const auto stts = require(stbl, "stts").payload;
+  std::size_t next = 0;
+  U64 decode_time = 0;
+  for (U32 i = 0, entries = be32(stts, 4); i < entries; i++) {
+    const auto run = be32(stts, 8 + i * 8);
+    const auto delta = be32(stts, 12 + i * 8);
+    for (U32 j = 0; j < run && next < count; j++, next++) {
+      samples[next].decode_time = decode_time;
+      samples[next].duration = delta;
+      decode_time += delta;
+    }
+  }
+  if (next != count) {
+    throw std::runtime_error{"MP4 time to sample table doesn't match"};
+  }
+
+  // composition offsets, version 1 has them signed but both fit in 32 bits
+  if (const auto ctts = find(stbl, "ctts")) {
+    next = 0;
+    for (U32 i = 0, entries = be32(ctts->payload, 4); i < entries; i++) {
+      const auto run = be32(ctts->payload, 8 + i * 8);
+      const auto offset = static_cast<S32>(be32(ctts->payload, 12 + i * 8));
+      for (U32 j = 0; j < run && next < count; j++, next++) {
+        samples[next].composition_offset = offset;
+      }
+    }
+  }
+
+  // keyframes, without a table every sample is one
+  if (const auto stss = find(stbl, "stss")) {
+    for (auto &which : samples) {
+      which.sync = false;
+    }
+    for (U32 i = 0, entries = be32(stss->payload, 4); i < entries; i++) {
+      const auto number = be32(stss->payload, 8 + i * 4);
+      if (number >= 1 && number <= count) {
+        samples[number - 1].sync = true;
+      }
+    }
+  }
+
+  // file offsets, samples of a chunk are stored back to back
+  const auto stco = find(stbl, "stco");
+  const auto chunk_table = stco ? stco->payload : require(stbl, "co64").payload;
+  const std::size_t offset_size = stco ? 4 : 8;
+  const U64 chunk_count = be32(chunk_table, 4);
+  if (chunk_table.size() < 8 + chunk_count * offset_size) {
+    throw std::runtime_error{"MP4 chunk offset table is truncated"};
+  }
+  std::vector<U64> chunks(chunk_count);
+  for (std::size_t i = 0; i < chunks.size(); i++) {
+    chunks[i] = read_be(chunk_table, 8 + i * offset_size, offset_size);
+  }
+
+  const auto stsc = require(stbl, "stsc").payload;
+  next = 0;
+  for (U32 i = 0, entries = be32(stsc, 4); i < entries; i++) {
+    const U64 first = be32(stsc, 8 + i * 12);
+    const auto per_chunk = be32(stsc, 12 + i * 12);
+    const U64 last =
+        i + 1 < entries ? be32(stsc, 8 + (i + 1) * 12) : chunks.size() + 1;
+
+    for (auto chunk = std::max<U64>(first, 1);
+         chunk < last && chunk <= chunks.size(); chunk++) {
+      auto offset = chunks[chunk - 1];
+      for (U32 j = 0; j < per_chunk && next < count; j++, next++) {
+        samples[next].offset = offset;
+        offset += samples[next].size;
+      }
+    }
+  }
+  if (next != count) {
+    throw std::runtime_error{"MP4 sample to chunk table doesn't match"};
+  }
+}
+
+/// @brief Reads a `trak` box, nothing if it's neither video nor audio
+static std::optional<mp4::track> read_track(std::string_view trak) {
+  mp4::track current{};
+
+  const auto mdia = require(trak, "mdia").payload;
+  const auto hdlr = require(mdia, "hdlr");
+  current.handler = std::string{hdlr.payload.substr(8, 4)};
+  if (current.handler != "vide" && current.handler != "soun") {
+    return std::nullopt;
+  }
+  current.hdlr = hdlr.whole;
+
+  const auto tkhd = require(trak, "tkhd");
+  current.tkhd = tkhd.whole;
+  current.id = be32(tkhd.payload, read_be(tkhd.payload, 0, 1) == 1 ? 20 : 12);
+
+  const auto mdhd = require(mdia, "mdhd");
+  current.mdhd = mdhd.whole;
+  if (read_be(mdhd.payload, 0, 1) == 1) {
+    current.timescale = be32(mdhd.payload, 20);
+    current.duration = read_be(mdhd.payload, 24, 8);
+  } else {
+    current.timescale = be32(mdhd.payload, 12);
+    current.duration = be32(mdhd.payload, 16);
+  }
+  if (current.timescale == 0) {
+    throw std::runtime_error{"MP4 track has no timescale"};
+  }
+
+  const auto minf = require(mdia, "minf").payload;
+  current.media_header =
+      require(minf, current.handler == "vide" ? "vmhd" : "smhd").whole;
+  current.dinf = require(minf, "dinf").whole;
+
+  const auto stbl = require(minf, "stbl").payload;
+  current.stsd = require(stbl, "stsd").whole;
+  read_samples(stbl, current);
+
+  return current;
+}
+
+/// @brief Names a track's codec after its first sample description, with the
+/// profile and level appended for AVC like HLS `CODECS` attributes want them
+static std::string codec_of(std::string_view stsd) {
+  std::string codec{};
+  each(stsd.substr(std::min<std::size_t>(8, stsd.size())),
+       [&codec](const box &entry) {
+         if (!codec.empty()) {
+           return;
+         }
+         codec = entry.type;
+
+         // avcC follows the 78 byte visual sample entry
+         if ((entry.type == "avc1" || entry.type == "avc3") &&
+             entry.payload.size() > 78) {
+           if (const auto avcc = find(entry.payload.substr(78), "avcC")) {
+             constexpr char HEX[] = "0123456789abcdef";
+             codec += '.';
+             for (std::size_t i = 1; i < 4; i++) {
+               const auto byte = static_cast<U8>(read_be(avcc->payload, i, 1));
+               codec += HEX[byte >> 4];
+               codec += HEX[byte & 0xF];
+             }
+           }
+         }
+       });
+  return codec;
+}
+
+/// @brief Fills in what a `trak` box says about the first video or audio
+/// track, reading only the few boxes that describe it
+static void probe_track(boost::beast::file &file, const file_box &trak,
+                        std::string &buffer, mp4::info &result) {
+  const auto tkhd = find_in_file(file, trak, "tkhd");
+  const auto mdia = find_in_file(file, trak, "mdia");
+  const auto hdlr = mdia ? find_in_file(file, *mdia, "hdlr") : mdia;
+  const auto minf = mdia ? find_in_file(file, *mdia, "minf") : mdia;
+  const auto stbl = minf ? find_in_file(file, *minf, "stbl") : minf;
+  const auto stsd = stbl ? find_in_file(file, *stbl, "stsd") : stbl;
+  if (!tkhd || !hdlr || !stsd) {
+    return;
+  }
+
+  const auto handler = std::string{
+      read_payload(file, *hdlr, buffer, MAX_INFO_BOX).substr(8, 4)};
+  if (handler == "vide" && result.video_codec.empty()) {
+    // 16.16 fixed point, the last 8 bytes of tkhd
+    const auto header = read_payload(file, *tkhd, buffer, MAX_INFO_BOX);
+    if (header.size() >= 8) {
+      result.width = be32(header, header.size() - 8) >> 16;
+      result.height = be32(header, header.size() - 4) >> 16;
+    }
+    result.video_codec =
+        codec_of(read_payload(file, *stsd, buffer, MAX_INFO_BOX));
+  } else if (handler == "soun" && result.audio_codec.empty()) {
+    result.audio_codec =
+        codec_of(read_payload(file, *stsd, buffer, MAX_INFO_BOX));
+  }
+}
+
+/// @brief Appends a big-endian unsigned integer
+static void put(std::string &out, U64 value, std::size_t bytes) {
+  for (std::size_t i = bytes; i > 0; i--) {
+    out.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xFF));
+  }
+}
+
+/// @brief Overwrites a big-endian 32-bit integer
+static void patch(std::string &out, std::size_t at, U32 value) {
+  for (std::size_t i = 0; i < 4; i++) {
+    out[at + i] = static_cast<char>((value >> ((3 - i) * 8)) & 0xFF);
+  }
+}
+
+/// @brief Starts a box, its size is filled in by `close_box`
+/// @return Where the box starts
+static std::size_t open_box(std::string &out, const char *type) {
+  const auto at = out.size();
+  put(out, 0, 4);
+  out.append(type, 4);
+  return at;
+}
+
+/// @brief Starts a box with version and flags
+/// @return Where the box starts
+static std::size_t open_full_box(std::string &out, const char *type,
+                                 U8 version, U32 flags) {
+  const auto at = open_box(out, type);
+  put(out, (U32{version} << 24) | flags, 4);
+  return at;
+}
+
+static void close_box(std::string &out, std::size_t at) {
+  patch(out, at, static_cast<U32>(out.size() - at));
+}
+// ============================================================================
+mp4::movie mp4::parse(const std::filesystem::path &path) {
+  const auto moov = read_moov(path);
+  movie result{};
+
+  result.mvhd = require(moov, "mvhd").whole;
+  each(moov, [&result](const box &current) {
+    if (current.type == "trak") {
+      if (auto found = read_track(current.payload)) {
+        result.tracks.emplace_back(std::move(*found));
+      }
+    }
+  });
+
+  if (result.tracks.empty()) {
+    throw std::runtime_error{"MP4 has no video or audio tracks"};
+  }
+  return result;
+}
+
+mp4::info mp4::probe(const std::filesystem::path &path) {
+  U64 file_size = 0;
+  auto file = open_file(path, file_size);
+  const auto moov = find_moov(file, file_size);
+  info result{.size = file_size};
+
+  // one buffer for every box read, the sample tables are never read at all
+  std::string buffer{};
+  if (const auto mvhd_box = find_in_file(file, moov, "mvhd")) {
+    const auto mvhd = read_payload(file, *mvhd_box, buffer, MAX_INFO_BOX);
+    const auto version = read_be(mvhd, 0, 1);
+    const auto timescale = be32(mvhd, version == 1 ? 20 : 12);
+    const auto duration =
+        version == 1 ? read_be(mvhd, 24, 8) : read_be(mvhd, 16, 4);
+    if (timescale != 0) {
+      result.duration = static_cast<F64>(duration) / timescale;
+    }
+  }
+
+  each_in_file(file, moov.offset, moov.offset + moov.size,
+               [&file, &buffer, &result](const file_box &trak) {
+                 if (trak.is("trak")) {
+                   probe_track(file, trak, buffer, result);
+                 }
+               });
+
+  if (result.duration > 0.0) {
+    result.bitrate =
+        static_cast<U64>(static_cast<F64>(result.size) * 8.0 / result.duration);
+  }
+  return result;
+}
+
+std::vector<mp4::segment> mp4::segments(const movie &which, F64 target) {
+  // cuts follow the keyframes of the first video track, or the first track
+  std::size_t primary = 0;
+  for (std::size_t i = 0; i < which.tracks.size(); i++) {
+    if (which.tracks[i].handler == "vide") {
+      primary = i;
+      break;
+    }
+  }
+
+  const auto &leader = which.tracks[primary];
+  const auto timescale = static_cast<F64>(leader.timescale);
+  std::vector<std::size_t> cuts{};
+  for (std::size_t i = 0; i < leader.samples.size(); i++) {
+    const auto &current = leader.samples[i];
+    if (cuts.empty() ||
+        (current.sync &&
+         static_cast<F64>(current.decode_time -
+                          leader.samples[cuts.back()].decode_time) >=
+             target * timescale)) {
+      cuts.emplace_back(i);
+    }
+  }
+
+  std::vector<segment> result{};
+  std::vector<std::size_t> next(which.tracks.size(), 0);
+  for (std::size_t k = 0; k < cuts.size(); k++) {
+    const auto last = k + 1 == cuts.size();
+    const auto start =
+        static_cast<F64>(leader.samples[cuts[k]].decode_time) / timescale;
+    const auto end =
+        last ? static_cast<F64>(leader.samples.back().decode_time +
+                                leader.samples.back().duration) /
+                   timescale
+             : static_cast<F64>(leader.samples[cuts[k + 1]].decode_time) /
+                   timescale;
+
+    segment current{.start = start, .duration = end - start, .samples = {}};
+    for (std::size_t t = 0; t < which.tracks.size(); t++) {
+      const auto &samples = which.tracks[t].samples;
+      const auto first = next[t];
+      if (last) {
+        next[t] = samples.size();
+      } else if (t == primary) {
+        next[t] = cuts[k + 1];
+      } else {
+        const auto scale = static_cast<F64>(which.tracks[t].timescale);
+        while (next[t] < samples.size() &&
+               static_cast<F64>(samples[next[t]].decode_time) / scale < end) {
+          next[t]++;
+        }
+      }
+      current.samples.emplace_back(first, next[t]);
+    }
+    result.emplace_back(std::move(current));
+  }
+
+  return result;
+}
+
+std::string mp4::init_segment(const movie &which) {
+  std::string out{};
+
+  const auto ftyp = open_box(out, "ftyp");
+  out.append("iso6");
+  put(out, 0, 4);
+  out.append("iso6mp41");
+  close_box(out, ftyp);
+
+  const auto moov = open_box(out, "moov");
+  out.append(which.mvhd);
+  for (const auto &current : which.tracks) {
+    const auto trak = open_box(out, "trak");
+    out.append(current.tkhd);
+    const auto mdia = open_box(out, "mdia");
+    out.append(current.mdhd);
+    out.append(current.hdlr);
+    const auto minf = open_box(out, "minf");
+    out.append(current.media_header);
+    out.append(current.dinf);
+
+    // the sample tables are empty, every sample comes in a fragment
+    const auto stbl = open_box(out, "stbl");
+    out.append(current.stsd);
+    for (const auto *empty : {"stts", "stsc", "stco"}) {
+      const auto at = open_full_box(out, empty, 0, 0);
+      put(out, 0, 4);
+      close_box(out, at);
+    }
+    const auto stsz = open_full_box(out, "stsz", 0, 0);
+    put(out, 0, 8);
+    close_box(out, stsz);
+    close_box(out, stbl);
+
+    close_box(out, minf);
+    close_box(out, mdia);
+    close_box(out, trak);
+  }
+
+  const auto mvex = open_box(out, "mvex");
+  for (const auto &current : which.tracks) {
+    const auto trex = open_full_box(out, "trex", 0, 0);
+    put(out, current.id, 4);
+    put(out, 1, 4);
+    put(out, 0, 12);
+    close_box(out, trex);
+  }
+  close_box(out, mvex);
+  close_box(out, moov);
+
+  return out;
+}
+
+void mp4::media_segment(const movie &which, const segment &part, U32 sequence,
+                        splice::body::value_type &body) {
+  auto &out = body.head();
+  std::vector<std::size_t> data_offsets{};
+  std::vector<U64> data_sizes{};
+
+  const auto moof = open_box(out, "moof");
+  const auto mfhd = open_full_box(out, "mfhd", 0, 0);
+  put(out, sequence, 4);
+  close_box(out, mfhd);
+
+  for (std::size_t t = 0; t < which.tracks.size(); t++) {
+    const auto &current = which.tracks[t];
+    const auto [first, last] = part.samples[t];
+    if (first == last) {
+      continue;
+    }
+
+    const auto traf = open_box(out, "traf");
+
+    // default-base-is-moof, data offsets count from the start of the moof
+    const auto tfhd = open_full_box(out, "tfhd", 0, 0x020000);
+    put(out, current.id, 4);
+    close_box(out, tfhd);
+
+    const auto tfdt = open_full_box(out, "tfdt", 1, 0);
+    put(out, current.samples[first].decode_time, 8);
+    close_box(out, tfdt);
+
+    // data offset, then duration, size, flags and composition offset
+    const auto trun = open_full_box(out, "trun", 1, 0x000F01);
+    put(out, last - first, 4);
+    data_offsets.emplace_back(out.size());
+    put(out, 0, 4);
+    U64 size = 0;
+    for (auto i = first; i < last; i++) {
+      const auto &current_sample = current.samples[i];
+      put(out, current_sample.duration, 4);
+      put(out, current_sample.size, 4);
+      put(out,
+          current_sample.sync ? SYNC_SAMPLE_FLAGS : NON_SYNC_SAMPLE_FLAGS, 4);
+      put(out, static_cast<U32>(current_sample.composition_offset), 4);
+      size += current_sample.size;
+    }
+    data_sizes.emplace_back(size);
+    close_box(out, trun);
+
+    close_box(out, traf);
+  }
+  close_box(out, moof);
+
+  U64 total = 0;
+  for (const auto size : data_sizes) {
+    total += size;
+  }
+  if (total + 8 <= 0xFFFFFFFF) {
+    put(out, total + 8, 4);
+    out.append("mdat");
+  } else {
+    put(out, 1, 4);
+    out.append("mdat");
+    put(out, total + 16, 8);
+  }
+
+  // the samples follow the mdat header, one track after another
+  U64 data_offset = out.size() - moof;
+  for (std::size_t i = 0; i < data_offsets.size(); i++) {
+    patch(out, data_offsets[i], static_cast<U32>(data_offset));
+    data_offset += data_sizes[i];
+  }
+
+  for (std::size_t t = 0; t < which.tracks.size(); t++) {
+    const auto [first, last] = part.samples[t];
+    for (auto i = first; i < last; i++) {
+      body.add(which.tracks[t].samples[i].offset,
+               which.tracks[t].samples[i].size);
+    }
+  }
+}
@@ -1,51 +1,960 @@
 #include "../include/multimedia.hpp"
+#include "../include/catalog.hpp"
+#include "../include/descriptor.hpp"
+#include "../include/ingest.hpp"
+#include "../include/logger.hpp"
+#include "../include/mp4.hpp"
+#include "../include/prefetch.hpp"
+#include "../include/push.hpp"
+#include "../include/search.hpp"
+#include "../include/storage.hpp"
+#include "../include/trace.hpp"
+#include "../include/trending.hpp"
+#include "../include/views.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <boost/beast.hpp>
+#include <charconv>
+#include <chrono>
+#include <cmath>
 #include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_map>
 using namespace cobble;
 
-route::response_get
-multimedia::thumbnail_get(const environment::configuration &config, U64 id) {
-  route::response_get response{};
+/// @brief Preferred HLS segment duration in seconds
+constexpr F64 SEGMENT_DURATION = 6.0;
 
-  response.mime_type = "image/webp";
-  const auto path = (config.data_path / "thumbnails" / std::to_string(id))
-                        .replace_extension("webp");
-  response.body = boost::beast::http::file_body::value_type{};
-  auto &&body =
-      std::get<boost::beast::http::file_body::value_type>(response.body);
+/// @brief Most videos whose segment index stays cached
+constexpr std::size_t MAX_SEGMENT_INDEXES = 256;
+
+/// @brief Segments of a video never change until the file does
+constexpr const char *SEGMENT_CACHE_CONTROL = "public, max-age=86400";
+
+/// @brief Files remembered as missing
+constexpr std::size_t MAX_MISSING = 65536;
+
+/// @brief How long a file is remembered as missing, new uploads show up after
+/// at most this long
+constexpr U64 MISSING_FOR_MS = 5000;
+
+/// @brief Most videos whose probed metadata stays cached
+constexpr std::size_t MAX_PROBES = 16384;
+
+/// @brief Thumbnails kept open at once, a page of them is only a few dozen
+constexpr std::size_t MAX_OPEN_THUMBNAILS = 1024;
+
+/// @brief Videos kept open at once, each stays open while it's played
+constexpr std::size_t MAX_OPEN_VIDEOS = 256;
+
+/// @brief Videos listed per `/page`
+constexpr U64 VIDEOS_PER_PAGE = 24;
+
+/// @brief Seconds a client waits before asking again for media that's being
+/// fetched from the object store
+constexpr U32 FETCH_RETRY_AFTER = 2;
+
+/// @brief Most videos one metadata update may describe
+constexpr std::size_t MAX_BATCH_METADATA = 1000;
+
+/// @brief A parsed video and where it gets cut
+struct segment_index {
+  mp4::movie movie;
+  std::vector<mp4::segment> segments;
+};
+
+/// @brief Values derived from files, keyed by path, size and modification
+/// time so that a replaced file is never served stale
+template <class T> class file_cache {
+  struct entry {
+    std::filesystem::file_time_type modified;
+    std::uintmax_t size;
+    std::shared_ptr<const T> value;
+  };
+
+  std::mutex _mutex{};
+  std::unordered_map<std::string, entry> _entries{};
+  std::size_t _capacity;
+
+public:
+  file_cache(std::size_t capacity) : _capacity{capacity} {}
+
+  /// @brief Gets a file's value, calling `make` only on a miss
+  /// @return The value, or nothing if there's no such file
+  template <class Make>
+  std::shared_ptr<const T> get(const std::filesystem::path &path,
+                               Make &&make) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (ec) {
+      return nullptr;
+    }
+    const auto modified = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+      return nullptr;
+    }
+
+    const auto key = path.string();
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto found = _entries.find(key);
+      if (found != _entries.end() && found->second.modified == modified &&
+          found->second.size == size) {
+        return found->second.value;
+      }
+    }
+
+    // unlocked, two racing misses just both parse the file and one wins
+    auto value = std::make_shared<const T>(make(path));
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (_entries.size() >= _capacity && !_entries.contains(key)) {
+      _entries.erase(_entries.begin());
+    }
+    _entries.insert_or_assign(
+        key, entry{.modified = modified, .size = size, .value = value});
+    return value;
+  }
+};
+
+/// @brief Files recently found missing, so that floods of requests for IDs
+/// that don't exist never reach the filesystem. Direct-mapped and lock-free
+/// like the rate limiter's buckets, a newer miss simply takes over its slot.
+class missing_files {
+  struct alignas(16) slot {
+    std::atomic<U64> key{0};
+    std::atomic<U64> expires_ms{0};
+  };
+
+  std::unique_ptr<slot[]> _slots;
+  std::size_t _mask;
+
+  static U64 _key(const std::filesystem::path &path) {
+    // zero marks an empty slot
+    return std::hash<std::string>{}(path.native()) | 1;
+  }
+
+  static U64 _now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+public:
+  missing_files(std::size_t capacity)
+      : _slots{std::make_unique<slot[]>(std::bit_ceil(capacity))},
+        _mask{std::bit_ceil(capacity) - 1} {}
+
+  /// @brief Checks if a file was found missing recently
+  bool contains(const std::filesystem::path &path) const {
+    const auto key = _key(path);
+    const auto &found = _slots[key & _mask];
+    return found.key.load(std::memory_order_acquire) == key &&
+           found.expires_ms.load(std::memory_order_relaxed) > _now_ms();
+  }
+
+  /// @brief Remembers a file as missing for a while
+  void insert(const std::filesystem::path &path) {
+    const auto key = _key(path);
+    auto &found = _slots[key & _mask];
+    found.expires_ms.store(_now_ms() + MISSING_FOR_MS,
+                           std::memory_order_relaxed);
+    found.key.store(key, std::memory_order_release);
+  }
+
+  /// @brief Forgets a file that was just stored
+  void erase(const std::filesystem::path &path) {
+    const auto key = _key(path);
+    auto expected = key;
+    _slots[key & _mask].key.compare_exchange_strong(expected, 0,
+                                                    std::memory_order_release);
+  }
+};
+
+static missing_files &missing() {
+  static missing_files files{MAX_MISSING};
+  return files;
+}
+
+static route::failure not_found() {
+  return route::failure{.status = boost::beast::http::status::not_found,
+                        .code = "NOT_FOUND"};
+}
+
+static descriptor::cache &thumbnail_files() {
+  static descriptor::cache files{MAX_OPEN_THUMBNAILS};
+  return files;
+}
+
+static descriptor::cache &video_files() {
+  static descriptor::cache files{MAX_OPEN_VIDEOS};
+  return files;
+}
+
+static route::failure fetching() {
+  return route::failure{
+      .status = boost::beast::http::status::service_unavailable,
+      .code = "FETCHING",
+      .retry_after = FETCH_RETRY_AFTER};
+}
 
+static bool remote(const environment::configuration &config) {
+  return config.storage.backend == environment::storage_settings::kind::s3;
+}
+
+/// @brief Finds a media object in storage, remembering local files that
+/// don't exist
+/// @param small If the object may be served from memory
+/// @return Where it is, or a HTTP 404 failure, or a HTTP 503 failure while
+/// it's fetched from the object store
+static route::result<storage::location>
+locate_media(const environment::configuration &config, const std::string &key,
+             bool small) {
+  // the object store keeps its own list of what it doesn't have
+  if (!remote(config) && missing().contains(config.data_path / key)) {
+    return std::unexpected{not_found()};
+  }
+
+  auto found = [&] {
+    trace::span span{"storage locate"};
+    return storage::open(config)->locate(key, small);
+  }();
+  if (found.fetching) {
+    return std::unexpected{fetching()};
+  }
+  if (found.path.empty()) {
+    return std::unexpected{not_found()};
+  }
+  return found;
+}
+
+/// @brief Gets a located media file from a table of open files
+/// @return The file, or a HTTP 404 failure, or a HTTP 503 failure if it was
+/// evicted from the storage directory in between and has to be fetched again
+static route::result<std::shared_ptr<const descriptor::file>>
+open_media(const environment::configuration &config, descriptor::cache &files,
+           U64 id, const std::filesystem::path &path) {
   boost::beast::error_code ec;
-  body.open(path.c_str(), boost::beast::file_mode::scan, ec);
+  std::shared_ptr<const descriptor::file> opened{};
+  {
+    trace::span span{"file open"};
+    opened = files.open(id, path, ec);
+  }
 
+  if (ec == boost::system::errc::no_such_file_or_directory) {
+    if (remote(config)) {
+      return std::unexpected{fetching()};
+    }
+    missing().insert(path);
+    return std::unexpected{not_found()};
+  }
   if (ec) {
     throw std::runtime_error{ec.message()};
   }
+  return opened;
+}
+
+/// @brief A strong `ETag` from a content hash
+/// @return The tag, or nothing for media that wasn't ingested
+static std::optional<std::string> etag_of(const std::string &hash) {
+  if (hash.empty()) {
+    return std::nullopt;
+  }
+  return "\"" + hash + "\"";
+}
+
+static std::string thumbnail_key(U64 id) {
+  return "thumbnails/" + std::to_string(id) + ".webp";
+}
+
+static std::string video_key(U64 id) {
+  return "videos/" + std::to_string(id) + ".mp4";
+}
+
+/// @brief Gets a video's segment index, parsing the file only on a miss
+/// @return The index, or nothing if there's no such video
+static std::shared_ptr<const segment_index>
+find_segment_index(const std::filesystem::path &path) {
+  static file_cache<segment_index> indexes{MAX_SEGMENT_INDEXES};
+  if (missing().contains(path)) {
+    return nullptr;
+  }
+
+  auto found = indexes.get(path, [](const std::filesystem::path &which) {
+    trace::span span{"mp4 parse"};
+    auto movie = mp4::parse(which);
+    auto segments = mp4::segments(movie, SEGMENT_DURATION);
+    return segment_index{.movie = std::move(movie),
+                         .segments = std::move(segments)};
+  });
+  if (!found) {
+    missing().insert(path);
+  }
+  return found;
+}
+
+/// @brief Gets a video's metadata, probing the file only on a miss
+/// @return The metadata, or nothing if there's no such video
+static std::shared_ptr<const mp4::info>
+find_info(const std::filesystem::path &path) {
+  static file_cache<mp4::info> probes{MAX_PROBES};
+  if (missing().contains(path)) {
+    return nullptr;
+  }
+
+  auto found = probes.get(path, [](const std::filesystem::path &which) {
+    trace::span span{"mp4 probe"};
+    return mp4::probe(which);
+  });
+  if (!found) {
+    missing().insert(path);
+  }
+  return found;
+}
+
+route::result<route::response_get>
+multimedia::thumbnail_get(const environment::configuration &config, U64 id) {
+  route::response_get response{};
+
+  response.mime_type = "image/webp";
+  const auto key = thumbnail_key(id);
+  if (config.prefetch_enabled) {
+    prefetch::claim(storage::local_path(config, key));
+  }
+
+  const auto found = locate_media(config, key, true);
+  if (!found) {
+    return std::unexpected{found.error()};
+  }
+
+  response.body = splice::body::value_type{};
+  auto &&body = std::get<splice::body::value_type>(response.body);
+  if (found->bytes) {
+    body.share(found->bytes);
+    response.etag = etag_of(found->hash);
+  } else {
+    auto opened = open_media(config, thumbnail_files(), id, found->path);
+    if (!opened) {
+      return std::unexpected{std::move(opened.error())};
+    }
+    response.etag = etag_of((*opened)->hash());
+    body.add(0, (*opened)->size());
+    body.use(std::move(*opened));
+  }
 
   response.status = boost::beast::http::status::ok;
+  trending::hit(id, trending::THUMBNAIL_WEIGHT);
 
   return response;
 }
 
-route::response_head
+/// @brief An inline JSON part for an item that couldn't be served
+static multipart::part failed_part(std::string_view id,
+                                   const route::failure &why) {
+  Json::Value root;
+  Json::StreamWriterBuilder builder;
+  builder.settings_["indentation"] = "";
+
+  root["ok"] = false;
+  root["code"] = why.code;
+  // a part can't carry its own `Retry-After` header
+  if (why.retry_after) {
+    root["retryAfter"] = *why.retry_after;
+  }
+
+  return multipart::part{.id = std::string{id},
+                         .status = why.status,
+                         .mime_type = "application/json",
+                         .inline_body = Json::writeString(builder, root)};
+}
+
+route::response_get multimedia::thumbnails_get(
+    const environment::configuration &config,
+    const std::vector<std::pair<std::string_view, std::optional<U64>>> &ids) {
+  route::response_get response{};
+
+  response.mime_type = "multipart/mixed";
+  response.body = multipart::body::value_type{};
+  auto &&body = std::get<multipart::body::value_type>(response.body);
+
+  for (const auto &[sent, id] : ids) {
+    if (!id) {
+      body.add(failed_part(
+          sent,
+          route::failure{.status = boost::beast::http::status::bad_request,
+                         .code = "BAD_THUMBNAIL"}));
+      continue;
+    }
+
+    const auto key = thumbnail_key(*id);
+    if (config.prefetch_enabled) {
+      prefetch::claim(storage::local_path(config, key));
+    }
+    multipart::part thumbnail{.id = std::string{sent},
+                              .status = boost::beast::http::status::ok,
+                              .mime_type = "image/webp"};
+
+    const auto found = locate_media(config, key, true);
+    if (!found) {
+      body.add(failed_part(sent, found.error()));
+      continue;
+    }
+    trending::hit(*id, trending::THUMBNAIL_WEIGHT);
+    if (found->bytes) {
+      thumbnail.shared_body = found->bytes;
+      body.add(std::move(thumbnail));
+      continue;
+    }
+
+    auto opened = open_media(config, thumbnail_files(), *id, found->path);
+    if (!opened) {
+      body.add(failed_part(sent, opened.error()));
+      continue;
+    }
+
+    thumbnail.file = std::move(*opened);
+    body.add(std::move(thumbnail));
+  }
+
+  response.status = boost::beast::http::status::ok;
+
+  return response;
+}
+
+route::result<route::response_head>
 multimedia::thumbnail_head(const environment::configuration &config, U64 id) {
   route::response_head response{};
 
   response.mime_type = "image/webp";
-  const auto path = (config.data_path / "thumbnails" / std::to_string(id))
-                        .replace_extension("webp");
 
-  boost::beast::http::file_body::value_type body;
+  const auto found = locate_media(config, thumbnail_key(id), true);
+  if (!found) {
+    return std::unexpected{found.error()};
+  }
 
-  boost::beast::error_code ec;
-  body.open(path.c_str(), boost::beast::file_mode::scan, ec);
+  response.status = boost::beast::http::status::ok;
+  if (found->bytes) {
+    response.size = found->bytes->size();
+    if (const auto etag = etag_of(found->hash)) {
+      response.headers.emplace_back("ETag", *etag);
+    }
+    return response;
+  }
 
-  if (ec) {
-    throw std::runtime_error{ec.message()};
+  const auto opened = open_media(config, thumbnail_files(), id, found->path);
+  if (!opened) {
+    return std::unexpected{opened.error()};
+  }
+  response.size = (*opened)->size();
+  if (const auto etag = etag_of((*opened)->hash())) {
+    response.headers.emplace_back("ETag", *etag);
+  }
+
+  return response;
+};
+
+route::result<route::response_get>
+multimedia::video_playlist_get(const environment::configuration &config,
+                               U64 id) {
+  const auto found = locate_media(config, video_key(id), false);
+  if (!found) {
+    return std::unexpected{found.error()};
+  }
+  const auto index = find_segment_index(found->path);
+  if (!index) {
+    return std::unexpected{not_found()};
+  }
+
+  F64 longest = 0.0;
+  for (const auto &segment : index->segments) {
+    longest = std::max(longest, segment.duration);
   }
 
+  // URIs are relative to the playlist's, /video/playlist
+  const auto idx = std::to_string(id);
+  std::string playlist = "#EXTM3U\n"
+                         "#EXT-X-VERSION:7\n"
+                         "#EXT-X-PLAYLIST-TYPE:VOD\n"
+                         "#EXT-X-INDEPENDENT-SEGMENTS\n"
+                         "#EXT-X-TARGETDURATION:" +
+                         std::to_string(static_cast<U64>(std::ceil(longest))) +
+                         "\n#EXT-X-MAP:URI=\"init?idx=" + idx + "\"\n";
+  for (std::size_t i = 0; i < index->segments.size(); i++) {
+    playlist += "#EXTINF:" + std::to_string(index->segments[i].duration) +
+                ",\nsegment?idx=" + idx + "&seg=" + std::to_string(i) + "\n";
+  }
+  playlist += "#EXT-X-ENDLIST\n";
+
+  // an HLS playback never asks for the whole video
+  views::record(id);
+  trending::hit(id, trending::VIDEO_WEIGHT);
+
+  route::response_get response{};
   response.status = boost::beast::http::status::ok;
-  response.size = body.size();
+  response.mime_type = "application/vnd.apple.mpegurl";
+  response.cache_control = SEGMENT_CACHE_CONTROL;
+  response.body = splice::body::value_type{};
+  std::get<splice::body::value_type>(response.body).head() =
+      std::move(playlist);
 
   return response;
-};
\ No newline at end of file
+}
+
+route::result<route::response_get>
+multimedia::video_init_get(const environment::configuration &config, U64 id) {
+  const auto found = locate_media(config, video_key(id), false);
+  if (!found) {
+    return std::unexpected{found.error()};
+  }
+  const auto index = find_segment_index(found->path);
+  if (!index) {
+    return std::unexpected{not_found()};
+  }
+
+  route::response_get response{};
+  response.status = boost::beast::http::status::ok;
+  response.mime_type = "video/mp4";
+  response.cache_control = SEGMENT_CACHE_CONTROL;
+  response.body = splice::body::value_type{};
+  std::get<splice::body::value_type>(response.body).head() =
+      mp4::init_segment(index->movie);
+
+  return response;
+}
+
+route::result<route::response_get>
+multimedia::video_segment_get(const environment::configuration &config,
+                              U64 id, U64 segment) {
+  const auto found = locate_media(config, video_key(id), false);
+  if (!found) {
+    return std::unexpected{found.error()};
+  }
+  const auto index = find_segment_index(found->path);
+  if (!index || segment >= index->segments.size()) {
+    return std::unexpected{not_found()};
+  }
+
+  auto opened = open_media(config, video_files(), id, found->path);
+  if (!opened) {
+    return std::unexpected{std::move(opened.error())};
+  }
+
+  route::response_get response{};
+  response.status = boost::beast::http::status::ok;
+  response.mime_type = "video/mp4";
+  response.cache_control = SEGMENT_CACHE_CONTROL;
+  response.body = splice::body::value_type{};
+  auto &&body = std::get<splice::body::value_type>(response.body);
+  body.use(std::move(*opened));
+
+  // fragment sequence numbers start at 1
+  mp4::media_segment(index->movie, index->segments[segment],
+                     static_cast<U32>(segment + 1), body);
+
+  return response;
+}
+
+route::result<route::response_get>
+multimedia::video_get(const environment::configuration &config, U64 id) {
+  route::response_get response{};
+
+  response.mime_type = "video/mp4";
+  const auto found = locate_media(config, video_key(id), false);
+  if (!found) {
+    return std::unexpected{found.error()};
+  }
+
+  auto opened = open_media(config, video_files(), id, found->path);
+  if (!opened) {
+    return std::unexpected{std::move(opened.error())};
+  }
+
+  response.etag = etag_of((*opened)->hash());
+  response.body = splice::body::value_type{};
+  auto &&body = std::get<splice::body::value_type>(response.body);
+  body.add(0, (*opened)->size());
+  body.use(std::move(*opened));
+
+  response.status = boost::beast::http::status::ok;
+  views::record(id);
+  trending::hit(id, trending::VIDEO_WEIGHT);
+
+  return response;
+}
+
+route::result<route::response_head>
+multimedia::video_head(const environment::configuration &config, U64 id) {
+  const auto found = locate_media(config, video_key(id), false);
+  if (!found) {
+    return std::unexpected{found.error()};
+  }
+  const auto info = find_info(found->path);
+  if (!info) {
+    return std::unexpected{not_found()};
+  }
+
+  route::response_head response{.status = boost::beast::http::status::ok,
+                                .size = info->size,
+                                .mime_type = "video/mp4"};
+  response.headers.emplace_back("X-Duration", std::to_string(info->duration));
+  response.headers.emplace_back("X-Width", std::to_string(info->width));
+  response.headers.emplace_back("X-Height", std::to_string(info->height));
+  response.headers.emplace_back("X-Bitrate", std::to_string(info->bitrate));
+  response.headers.emplace_back("X-Codecs",
+                                info->audio_codec.empty()
+                                    ? info->video_codec
+                                    : info->video_codec + "," +
+                                          info->audio_codec);
+
+  return response;
+}
+
+Json::Value multimedia::video_list(const environment::configuration &config,
+                                   U64 page) {
+  const auto catalog = catalog::open(config);
+  std::vector<U64> ids{};
+  if (remote(config)) {
+    // the object store may have videos that were never cataloged here
+    for (const auto &key : storage::open(config)->list("videos/")) {
+      const std::filesystem::path path{key};
+      const auto stem = path.stem().string();
+      U64 id = 0;
+      const auto [end, parsed] =
+          std::from_chars(stem.data(), stem.data() + stem.size(), id);
+      if (path.extension() == ".mp4" && parsed == std::errc{} &&
+          end == stem.data() + stem.size()) {
+        ids.emplace_back(id);
+      }
+    }
+
+    // IDs grow over time, so the newest videos come first
+    std::sort(ids.begin(), ids.end(), std::greater<U64>{});
+    const auto first = std::min<U64>(page * VIDEOS_PER_PAGE, ids.size());
+    const auto last = std::min<U64>(first + VIDEOS_PER_PAGE, ids.size());
+    ids = std::vector<U64>(ids.begin() + first, ids.begin() + last);
+  } else {
+    ids = catalog->newest(page * VIDEOS_PER_PAGE, VIDEOS_PER_PAGE);
+  }
+
+  // probes are logged together, with one sync
+  std::vector<catalog::entry> probed{};
+  Json::Value videos = Json::arrayValue;
+  for (const auto id : ids) {
+    Json::Value video;
+    video["id"] = static_cast<Json::UInt64>(id);
+    video["views"] = static_cast<Json::UInt64>(views::total(id));
+
+    auto known = catalog->find(id);
+    if (known && !known->title.empty()) {
+      video["title"] = known->title;
+      video["tags"] = Json::arrayValue;
+      for (const auto &tag : known->tags) {
+        video["tags"].append(tag);
+      }
+    }
+
+    // probed once, then kept in the catalog
+    if (!known || !known->info) {
+      const auto path = storage::local_path(config, video_key(id));
+
+      // videos only in the object store aren't fetched just to be listed
+      std::error_code ec;
+      if (remote(config) && !std::filesystem::exists(path, ec)) {
+        videos.append(video);
+        continue;
+      }
+
+      std::shared_ptr<const mp4::info> info{};
+      try {
+        info = find_info(path);
+      } catch (const std::exception &e) {
+        logger::log(logger::severity::warning, "Could not probe video ", id,
+                    ": ", e.what());
+      }
+      if (!info) {
+        continue;
+      }
+
+      if (!known) {
+        known = catalog::entry{.id = id};
+      }
+      known->info = *info;
+
+      // a listing racing this one may have logged the same probe already
+      const auto logged = catalog->find(id);
+      if (!logged || logged->info != known->info) {
+        probed.emplace_back(*known);
+      }
+    }
+
+    video["duration"] = known->info->duration;
+    video["width"] = known->info->width;
+    video["height"] = known->info->height;
+    video["videoCodec"] = known->info->video_codec;
+    video["audioCodec"] = known->info->audio_codec;
+    video["size"] = static_cast<Json::UInt64>(known->info->size);
+    video["bitrate"] = static_cast<Json::UInt64>(known->info->bitrate);
+    videos.append(video);
+  }
+  catalog->put(probed);
+
+  return videos;
+}
+
+Json::Value multimedia::trending_list(const environment::configuration &config,
+                                      U64 count) {
+  const auto catalog = catalog::open(config);
+  const auto snapshot = trending::top();
+
+  Json::Value videos = Json::arrayValue;
+  for (const auto &listed : snapshot->videos) {
+    if (videos.size() >= count) {
+      break;
+    }
+
+    Json::Value video;
+    video["id"] = static_cast<Json::UInt64>(listed.id);
+    video["score"] = listed.score;
+    video["views"] = static_cast<Json::UInt64>(views::total(listed.id));
+
+    const auto known = catalog->find(listed.id);
+    if (known && !known->title.empty()) {
+      video["title"] = known->title;
+      video["tags"] = Json::arrayValue;
+      for (const auto &tag : known->tags) {
+        video["tags"].append(tag);
+      }
+    }
+    videos.append(video);
+  }
+
+  return videos;
+}
+
+route::result<route::response_post>
+multimedia::media_ingest(const environment::configuration &config,
+                         const json_view::value &body) {
+  const auto kind = body["kind"].string().value_or("");
+  if (kind != "thumbnail" && kind != "video" && kind != "metadata") {
+    return std::unexpected{
+        route::failure{.status = boost::beast::http::status::bad_request,
+                       .code = "BAD_KIND"}};
+  }
+
+  const auto parsed_id = body["id"].unsigned_integer();
+  if (!parsed_id) {
+    return std::unexpected{route::failure{
+        .status = boost::beast::http::status::bad_request,
+        .code = kind == "thumbnail" ? "BAD_THUMBNAIL" : "BAD_VIDEO"}};
+  }
+  const auto id = *parsed_id;
+
+  std::string key{};
+  if (kind == "thumbnail") {
+    key = thumbnail_key(id);
+  } else if (kind == "video") {
+    key = video_key(id);
+  } else {
+    key = "metadata/" + std::to_string(id) + ".json";
+  }
+
+  const auto file = body["file"].string().value_or("");
+
+  // only plain names, nothing outside the incoming directory
+  if (file.empty() || file == "." || file == ".." ||
+      file.find('/') != std::string::npos) {
+    return std::unexpected{
+        route::failure{.status = boost::beast::http::status::bad_request,
+                       .code = "BAD_FILE"}};
+  }
+  if (remote(config)) {
+    return std::unexpected{
+        route::failure{.status = boost::beast::http::status::conflict,
+                       .code = "LOCAL_STORAGE_ONLY"}};
+  }
+
+  const auto source = config.data_path / "incoming" / file;
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(source, ec)) {
+    return std::unexpected{not_found()};
+  }
+
+  // bad metadata is refused before anything is stored, without saying where
+  // the file was
+  const auto catalog = catalog::open(config);
+  auto cataloged = catalog->find(id).value_or(catalog::entry{.id = id});
+  if (kind == "metadata") {
+    const auto bad_metadata = [] {
+      return std::unexpected{
+          route::failure{.status = boost::beast::http::status::bad_request,
+                         .code = "BAD_METADATA"}};
+    };
+
+    // larger files wouldn't parse anyway, so they aren't read in whole
+    std::ifstream in{source, std::ios::binary};
+    if (!in || std::filesystem::file_size(source, ec) > json_view::MAX_BYTES) {
+      return bad_metadata();
+    }
+    const auto parsed = json_view::document::parse(
+        std::string{std::istreambuf_iterator<char>{in}, {}});
+    if (!parsed || !catalog::describe(cataloged, parsed->root())) {
+      return bad_metadata();
+    }
+  }
+
+  const auto stored = [&] {
+    trace::span span{"ingest"};
+    return ingest::store(config, key, source);
+  }();
+  missing().erase(config.data_path / key);
+
+  if (kind == "video") {
+    const auto info = find_info(config.data_path / key);
+    if (info) {
+      cataloged.info = *info;
+    }
+  }
+  if (kind != "thumbnail") {
+    trace::span span{"catalog"};
+    catalog->put(cataloged);
+    if (!cataloged.title.empty()) {
+      search::open(config)->add(id, cataloged.title, cataloged.tags);
+    }
+    push::publish({cataloged});
+  }
+
+  Json::Value root;
+  root["ok"] = true;
+  root["hash"] = stored.hash;
+  root["size"] = static_cast<Json::UInt64>(stored.size);
+  root["deduplicated"] = stored.deduplicated;
+
+  return route::response_post{.status = boost::beast::http::status::ok,
+                              .body = root,
+                              .mime_type = "application/json"};
+}
+
+route::result<route::response_post>
+multimedia::metadata_post(const environment::configuration &config,
+                          const json_view::value &body) {
+  const auto bad_metadata = [] {
+    return std::unexpected{
+        route::failure{.status = boost::beast::http::status::bad_request,
+                       .code = "BAD_METADATA"}};
+  };
+
+  std::vector<json_view::value> described{};
+  if (const auto videos = body["videos"]) {
+    if (videos.type() != json_view::kind::array || videos.size() == 0 ||
+        videos.size() > MAX_BATCH_METADATA) {
+      return bad_metadata();
+    }
+    described.reserve(videos.size());
+    videos.each([&described](json_view::value video) {
+      described.emplace_back(video);
+    });
+  } else {
+    described.emplace_back(body);
+  }
+
+  // only stored videos get entries, the object store's listing is taken once
+  // for the whole batch rather than fetching every video to find out
+  std::vector<std::string> listed{};
+  if (remote(config)) {
+    listed = storage::open(config)->list("videos/");
+  }
+  const auto stored = [&config, &listed](U64 id) {
+    const auto key = video_key(id);
+    if (remote(config)) {
+      return std::find(listed.begin(), listed.end(), key) != listed.end();
+    }
+    std::error_code ec;
+    return std::filesystem::is_regular_file(config.data_path / key, ec);
+  };
+
+  // every entry is checked before any is logged, a batch is all or nothing
+  const auto catalog = catalog::open(config);
+  std::vector<catalog::entry> entries{};
+  entries.reserve(described.size());
+  for (const auto &video : described) {
+    const auto id = video["id"].unsigned_integer();
+    if (!id) {
+      return bad_metadata();
+    }
+    if (!stored(*id)) {
+      return std::unexpected{not_found()};
+    }
+    auto cataloged = catalog->find(*id).value_or(catalog::entry{.id = *id});
+    if (!catalog::describe(cataloged, video)) {
+      return bad_metadata();
+    }
+    entries.emplace_back(std::move(cataloged));
+  }
+
+  {
+    trace::span span{"catalog"};
+    catalog->put(entries);
+  }
+  const auto index = search::open(config);
+  for (const auto &which : entries) {
+    index->add(which.id, which.title, which.tags);
+  }
+  push::publish(entries);
+
+  Json::Value root;
+  root["ok"] = true;
+  root["updated"] = static_cast<Json::UInt64>(entries.size());
+
+  return route::response_post{.status = boost::beast::http::status::ok,
+                              .body = root,
+                              .mime_type = "application/json"};
+}
+
+route::response_post
+multimedia::catalog_import(const environment::configuration &config) {
+  const auto imported = [&config] {
+    trace::span span{"catalog import"};
+    return catalog::import(config);
+  }();
+
+  const auto index = search::open(config);
+  for (const auto &which : imported) {
+    if (!which.title.empty()) {
+      index->add(which.id, which.title, which.tags);
+    }
+  }
+  if (!imported.empty()) {
+    push::publish(imported);
+  }
+
+  Json::Value root;
+  root["ok"] = true;
+  root["imported"] = static_cast<Json::UInt64>(imported.size());
+
+  return route::response_post{.status = boost::beast::http::status::ok,
+                              .body = root,
+                              .mime_type = "application/json"};
+}
+
+void multimedia::thumbnails_prefetch(const environment::configuration &config,
+                                     const std::vector<U64> &ids) {
+  if (!config.prefetch_enabled) {
+    return;
+  }
+
+  const auto media = storage::open(config);
+  for (const auto id : ids) {
+    const auto key = thumbnail_key(id);
+
+    // thumbnails only in the object store start downloading instead
+    if (remote(config)) {
+      media->locate(key, false);
+    }
+    prefetch::enqueue(storage::local_path(config, key));
+  }
+}
@@ -0,0 +1,190 @@
+#include "../include/multipart.hpp"
+#include "../include/accounting.hpp"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string_view>
+using namespace cobble;
+
+/// @brief Stages of serializing a part
+enum stage : U8 { PART_HEADER = 0, PART_BODY = 1, PART_TRAILER = 2 };
+
+/// @brief Longest `Content-ID` echoed back
+constexpr std::size_t MAX_CONTENT_ID = 64;
+
+/// @brief Keeps an ID from the query string safe to put in a header, only
+/// visible ASCII other than the angle brackets around it is kept
+static std::string content_id(std::string_view sent) {
+  std::string kept{};
+  for (const auto c : sent.substr(0, MAX_CONTENT_ID)) {
+    if (c > ' ' && c < 0x7F && c != '<' && c != '>') {
+      kept += c;
+    }
+  }
+  return kept;
+}
+
+multipart::body::value_type::value_type() {
+  static thread_local std::mt19937_64 rng{std::random_device{}()};
+  constexpr char HEX[] = "0123456789abcdef";
+
+  // random so it can't show up inside a file by accident
+  _boundary = "cobble-";
+  auto bits = rng();
+  for (auto i = 0; i < 16; i++, bits >>= 4) {
+    _boundary += HEX[bits & 0xF];
+  }
+}
+
+void multipart::body::value_type::add(part &&which) {
+  _parts.emplace_back(std::move(which));
+}
+
+std::string_view multipart::body::value_type::boundary() const {
+  return _boundary;
+}
+
+U64 multipart::body::value_type::_length(const part &which) {
+  if (which.file) {
+    return which.file->size();
+  }
+  if (which.shared_body) {
+    return which.shared_body->size();
+  }
+  return which.inline_body.size();
+}
+
+std::string
+multipart::body::value_type::_part_header(const part &which) const {
+  const auto length = _length(which);
+
+  return "--" + _boundary + "\r\nContent-Type: " + which.mime_type +
+         "\r\nContent-ID: <" + content_id(which.id) +
+         ">\r\nX-Status: " + std::to_string(static_cast<U32>(which.status)) +
+         "\r\nContent-Length: " + std::to_string(length) + "\r\n\r\n";
+}
+
+U64 multipart::body::value_type::size() const {
+  U64 total = _boundary.size() + 6; // closing "--" boundary "--\r\n"
+
+  for (const auto &which : _parts) {
+    total += _part_header(which).size();
+    total += _length(which);
+    total += 2; // trailing "\r\n"
+  }
+
+  return total;
+}
+
+boost::asio::const_buffer multipart::body::value_type::take_shared() {
+  if (_scratch_offset < _scratch.size() || _part >= _parts.size() ||
+      _stage != PART_BODY || !_parts[_part].shared_body) {
+    return {};
+  }
+
+  const std::string_view shared{*_parts[_part].shared_body};
+  const auto rest = shared.substr(std::min<U64>(_file_offset, shared.size()));
+  _file_offset = shared.size();
+  return boost::asio::const_buffer{rest.data(), rest.size()};
+}
+
+void multipart::body::value_type::charge_to(U64 request) { _request = request; }
+
+std::size_t multipart::body::value_type::read(void *buffer, std::size_t length,
+                                              boost::beast::error_code &ec) {
+  accounting::scope counted{_request};
+  auto *out = static_cast<char *>(buffer);
+  std::size_t written = 0;
+  ec = {};
+
+  while (written < length && _part <= _parts.size()) {
+    // anything staged goes out first
+    if (_scratch_offset < _scratch.size()) {
+      const auto copied =
+          std::min(length - written, _scratch.size() - _scratch_offset);
+      std::memcpy(out + written, _scratch.data() + _scratch_offset, copied);
+      _scratch_offset += copied;
+      written += copied;
+      continue;
+    }
+
+    // past the last part only the closing delimiter is left
+    if (_part == _parts.size()) {
+      if (_stage == PART_HEADER) {
+        _scratch = "--" + _boundary + "--\r\n";
+        _scratch_offset = 0;
+        _stage = PART_BODY;
+      } else {
+        _part++;
+      }
+      continue;
+    }
+
+    auto &current = _parts[_part];
+    switch (_stage) {
+    case PART_HEADER: {
+      _scratch = _part_header(current);
+      _scratch_offset = 0;
+      _stage = PART_BODY;
+      break;
+    }
+    case PART_BODY: {
+      if (current.shared_body) {
+        const auto &shared = *current.shared_body;
+        if (_file_offset >= shared.size()) {
+          _stage = PART_TRAILER;
+          break;
+        }
+        // the chunk ends here, so the writer can hand the bytes out in place
+        if (written > 0) {
+          return written;
+        }
+        const auto copied =
+            std::min<U64>(length - written, shared.size() - _file_offset);
+        std::memcpy(out + written, shared.data() + _file_offset, copied);
+        _file_offset += copied;
+        written += copied;
+        break;
+      }
+
+      if (!current.file) {
+        _scratch = current.inline_body;
+        _scratch_offset = 0;
+        _stage = PART_TRAILER;
+        break;
+      }
+
+      if (_file_offset >= current.file->size()) {
+        _stage = PART_TRAILER;
+        break;
+      }
+
+      // file bytes skip the scratch string and land in the chunk directly
+      const auto wanted =
+          std::min<U64>(length - written, current.file->size() - _file_offset);
+      const auto got =
+          current.file->read(_file_offset, out + written, wanted, ec);
+      if (ec) {
+        return written;
+      }
+      if (got == 0) {
+        ec = boost::asio::error::eof;
+        return written;
+      }
+      _file_offset += got;
+      written += got;
+      break;
+    }
+    case PART_TRAILER: {
+      _scratch = "\r\n";
+      _scratch_offset = 0;
+      _stage = PART_HEADER;
+      _file_offset = 0;
+      _part++;
+      break;
+    }
+    }
+  }
+
+  return written;
+}
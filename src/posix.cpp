@@ -0,0 +1,34 @@
+#include "../include/posix.hpp"
+#include <cerrno>
+#include <unistd.h>
+using namespace cobble;
+
+// ============================================================================
+std::system_error posix::error(const std::string &what) {
+  return std::system_error{errno, std::generic_category(), what};
+}
+
+U64 posix::checksum(const void *data, std::size_t size) {
+  const auto *bytes = static_cast<const U8 *>(data);
+  U64 hash = 0xcbf29ce484222325;
+  for (std::size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+bool posix::write_all(int fd, const void *data, std::size_t size) {
+  const auto *at = static_cast<const U8 *>(data);
+  while (size > 0) {
+    const auto wrote = ::write(fd, at, size);
+    if (wrote < 0 && errno == EINTR) {
+      continue;
+    }
+    if (wrote <= 0) {
+      return false;
+    }
+    at += wrote;
+    size -= static_cast<std::size_t>(wrote);
+  }
+  return true;
+}
@@ -0,0 +1,181 @@
+#include "../include/prefetch.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+using namespace cobble;
+
+/// @brief Most files waiting to be prefetched
+constexpr std::size_t MAX_QUEUED = 1024;
+
+/// @brief Most prefetched files remembered until they're claimed
+constexpr std::size_t MAX_REMEMBERED = 8192;
+
+/// @brief How long a prefetched file counts as warm
+constexpr std::chrono::seconds WARM_FOR{30};
+
+/// @brief Prefetch counters
+struct counters {
+  std::atomic<U64> queued{0};
+  std::atomic<U64> dropped{0};
+  std::atomic<U64> prefetched{0};
+  std::atomic<U64> failed{0};
+  std::atomic<U64> hits{0};
+  std::atomic<U64> misses{0};
+  std::atomic<U64> wasted{0};
+};
+
+/// @brief The queue, the files prefetched but not claimed yet, and the worker
+class prefetcher {
+  std::mutex _mutex{};
+  std::condition_variable_any _ready{};
+  std::deque<std::string> _queue{};
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point>
+      _warm{};
+  counters _count{};
+
+  // last, so it starts after everything it uses
+  std::jthread _worker;
+
+  /// @brief Forgets files that went cold, each counted as wasted work
+  void _expire(std::chrono::steady_clock::time_point now) {
+    for (auto it = _warm.begin(); it != _warm.end();) {
+      if (now - it->second > WARM_FOR) {
+        it = _warm.erase(it);
+        _count.wasted.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        it++;
+      }
+    }
+  }
+
+  void _run(std::stop_token stop) {
+#if defined(__linux__)
+    // only ever runs when no request handler wants the CPU
+    sched_param param{};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+    for (;;) {
+      std::string path{};
+      {
+        std::unique_lock<std::mutex> lock{_mutex};
+        if (!_ready.wait(lock, stop, [this] { return !_queue.empty(); })) {
+          return;
+        }
+        path = std::move(_queue.front());
+        _queue.pop_front();
+      }
+
+      // the kernel reads the file in asynchronously, nothing is copied here
+      const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        _count.failed.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+      ::close(fd);
+      _count.prefetched.fetch_add(1, std::memory_order_relaxed);
+
+      const auto now = std::chrono::steady_clock::now();
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (_warm.size() >= MAX_REMEMBERED) {
+        _expire(now);
+      }
+      if (_warm.size() < MAX_REMEMBERED) {
+        _warm.insert_or_assign(std::move(path), now);
+      }
+    }
+  }
+
+public:
+  prefetcher()
+      : _worker{[this](std::stop_token stop) { _run(std::move(stop)); }} {}
+
+  void enqueue(const std::filesystem::path &path) {
+    auto key = path.string();
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto found = _warm.find(key);
+      if (found != _warm.end() &&
+          std::chrono::steady_clock::now() - found->second <= WARM_FOR) {
+        return;
+      }
+      if (_queue.size() >= MAX_QUEUED) {
+        _count.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      _queue.emplace_back(std::move(key));
+    }
+    _count.queued.fetch_add(1, std::memory_order_relaxed);
+    _ready.notify_one();
+  }
+
+  const counters &count() const { return _count; }
+
+  void claim(const std::filesystem::path &path) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock{_mutex};
+    const auto found = _warm.find(path.string());
+    if (found == _warm.end()) {
+      _count.misses.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    if (now - found->second <= WARM_FOR) {
+      _count.hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      _count.wasted.fetch_add(1, std::memory_order_relaxed);
+      _count.misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    _warm.erase(found);
+  }
+};
+
+static prefetcher &instance() {
+  static prefetcher worker{};
+  return worker;
+}
+// ============================================================================
+void prefetch::enqueue(const std::filesystem::path &path) {
+  instance().enqueue(path);
+}
+
+void prefetch::claim(const std::filesystem::path &path) {
+  instance().claim(path);
+}
+
+Json::Value prefetch::stats() {
+  const auto &count = instance().count();
+  Json::Value root;
+
+  const auto prefetched = count.prefetched.load(std::memory_order_relaxed);
+  const auto hits = count.hits.load(std::memory_order_relaxed);
+  root["queued"] =
+      static_cast<Json::UInt64>(count.queued.load(std::memory_order_relaxed));
+  root["dropped"] =
+      static_cast<Json::UInt64>(count.dropped.load(std::memory_order_relaxed));
+  root["prefetched"] = static_cast<Json::UInt64>(prefetched);
+  root["failed"] =
+      static_cast<Json::UInt64>(count.failed.load(std::memory_order_relaxed));
+  root["hits"] = static_cast<Json::UInt64>(hits);
+  root["misses"] =
+      static_cast<Json::UInt64>(count.misses.load(std::memory_order_relaxed));
+  root["wasted"] =
+      static_cast<Json::UInt64>(count.wasted.load(std::memory_order_relaxed));
+  root["hitRatio"] = prefetched == 0 ? 0.0
+                                     : static_cast<F64>(hits) /
+                                           static_cast<F64>(prefetched);
+
+  return root;
+}
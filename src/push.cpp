@@ -0,0 +1,152 @@
+#include "../include/push.hpp"
+#include <algorithm>
+#include <atomic>
+using namespace cobble;
+
+static std::mutex subscribers_mutex{};
+static std::vector<std::weak_ptr<push::subscriber>> subscribers{};
+
+static std::atomic<U64> sequence{0};
+static std::atomic<bool> closing{false};
+static std::atomic<U64> subscribed{0};
+static std::atomic<U64> queued{0};
+static std::atomic<U64> overflows{0};
+
+/// @brief Serializes an event without whitespace
+static push::message serialize(const Json::Value &event) {
+  Json::StreamWriterBuilder builder;
+  builder.settings_["indentation"] = "";
+  return std::make_shared<const std::string>(
+      Json::writeString(builder, event));
+}
+// ============================================================================
+push::subscriber::subscriber(std::function<void()> wake)
+    : _wake{std::move(wake)} {}
+
+void push::subscriber::offer(const message &queued_message) {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (_overflowed) {
+      return;
+    }
+    if (_queue.size() >= MAX_QUEUED) {
+      // what's queued is stale anyway, the client reloads on reconnecting
+      _queue.clear();
+      _overflowed = true;
+      overflows.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      _queue.emplace_back(queued_message);
+      queued.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  _wake();
+}
+
+std::vector<push::message> push::subscriber::take() {
+  std::lock_guard<std::mutex> lock{_mutex};
+  std::vector<message> taken{std::make_move_iterator(_queue.begin()),
+                             std::make_move_iterator(_queue.end())};
+  _queue.clear();
+  return taken;
+}
+
+bool push::subscriber::overflowed() {
+  std::lock_guard<std::mutex> lock{_mutex};
+  return _overflowed;
+}
+
+std::shared_ptr<push::subscriber>
+push::subscribe(std::function<void()> wake) {
+  auto made = std::make_shared<subscriber>(std::move(wake));
+  {
+    std::lock_guard<std::mutex> lock{subscribers_mutex};
+    std::erase_if(subscribers, [](const std::weak_ptr<subscriber> &each) {
+      return each.expired();
+    });
+    subscribers.emplace_back(made);
+  }
+  subscribed.fetch_add(1, std::memory_order_relaxed);
+  return made;
+}
+
+push::message push::hello() {
+  Json::Value event;
+  event["type"] = "hello";
+  event["sequence"] =
+      static_cast<Json::UInt64>(sequence.load(std::memory_order_relaxed));
+  return serialize(event);
+}
+
+void push::publish(const std::vector<catalog::entry> &entries) {
+  if (entries.empty()) {
+    return;
+  }
+
+  Json::Value event;
+  event["type"] = "catalog";
+  event["videos"] = Json::arrayValue;
+  for (const auto &which : entries) {
+    Json::Value video;
+    video["id"] = static_cast<Json::UInt64>(which.id);
+    if (!which.title.empty()) {
+      video["title"] = which.title;
+      video["tags"] = Json::arrayValue;
+      for (const auto &tag : which.tags) {
+        video["tags"].append(tag);
+      }
+    }
+    if (which.info) {
+      video["duration"] = which.info->duration;
+    }
+    event["videos"].append(video);
+  }
+
+  // numbered under the lock, so every subscriber sees events in order
+  std::lock_guard<std::mutex> lock{subscribers_mutex};
+  event["sequence"] = static_cast<Json::UInt64>(
+      sequence.fetch_add(1, std::memory_order_relaxed) + 1);
+  const auto serialized = serialize(event);
+  std::erase_if(subscribers, [&serialized](
+                                 const std::weak_ptr<subscriber> &each) {
+    const auto alive = each.lock();
+    if (alive) {
+      alive->offer(serialized);
+    }
+    return !alive;
+  });
+}
+
+void push::close() {
+  closing.store(true, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lock{subscribers_mutex};
+  for (const auto &each : subscribers) {
+    if (const auto alive = each.lock()) {
+      alive->wake();
+    }
+  }
+}
+
+bool push::closed() { return closing.load(std::memory_order_relaxed); }
+
+Json::Value push::stats() {
+  Json::Value root;
+
+  {
+    std::lock_guard<std::mutex> lock{subscribers_mutex};
+    root["subscribers"] = static_cast<Json::UInt64>(std::count_if(
+        subscribers.begin(), subscribers.end(),
+        [](const std::weak_ptr<subscriber> &each) {
+          return !each.expired();
+        }));
+  }
+  const auto load = [](const std::atomic<U64> &counter) {
+    return static_cast<Json::UInt64>(counter.load(std::memory_order_relaxed));
+  };
+  root["subscribed"] = load(subscribed);
+  root["events"] = load(sequence);
+  root["queued"] = load(queued);
+  root["dropped"] = load(overflows);
+
+  return root;
+}
@@ -67,4 +67,35 @@ query_string::parse_only_query(const std::string &what) {
   }
 
   return parsed;
-}
\ No newline at end of file
+}
+
+std::string query_string::decode(const std::string &what) {
+  const auto nibble = [](char c) -> int {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    }
+    return -1;
+  };
+
+  std::string decoded{};
+  decoded.reserve(what.size());
+  for (std::size_t i = 0; i < what.size(); i++) {
+    if (what[i] == '+') {
+      decoded += ' ';
+    } else if (what[i] == '%' && i + 2 < what.size() &&
+               nibble(what[i + 1]) >= 0 && nibble(what[i + 2]) >= 0) {
+      decoded += static_cast<char>(nibble(what[i + 1]) << 4 |
+                                   nibble(what[i + 2]));
+      i += 2;
+    } else {
+      decoded += what[i];
+    }
+  }
+  return decoded;
+}
@@ -0,0 +1,263 @@
+#include "../include/rate_limit.hpp"
+#include <algorithm>
+#include <bit>
+#include <boost/beast.hpp>
+#include <chrono>
+#include <cmath>
+#include <json/json.h>
+#include <limits>
+using namespace cobble;
+
+/// @brief Slots per set, a key may only live in its own set
+constexpr std::size_t WAYS = 4;
+
+/// @brief Bits of a bucket state holding milli-tokens
+constexpr U64 TOKEN_BITS = 24;
+
+/// @brief Mask of a bucket state's milli-tokens
+constexpr U64 TOKEN_MASK = (U64{1} << TOKEN_BITS) - 1;
+
+/// @brief Milli-tokens a single request costs
+constexpr U64 TOKEN_COST = 1000;
+
+/// @brief SplitMix64 finalizer, spreads keys over the sets
+static U64 mix(U64 x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EB;
+  x ^= x >> 31;
+  return x;
+}
+
+/// @brief Milli-tokens a bucket holds after refilling up to `now_ms`
+static U64 refilled(U64 state, F64 rate, U64 full, U64 now_ms) {
+  const auto last = state >> TOKEN_BITS;
+  const auto tokens = state & TOKEN_MASK;
+
+  if (now_ms <= last) {
+    return tokens;
+  }
+
+  // tokens per second happen to be milli-tokens per millisecond
+  const auto gained = static_cast<U64>(static_cast<F64>(now_ms - last) * rate);
+  return std::min(full, tokens + gained);
+}
+
+/// @brief Milliseconds until a bucket holds a whole token again
+static U64 wait_for(U64 tokens, F64 rate) {
+  return static_cast<U64>(
+      std::ceil(static_cast<F64>(TOKEN_COST - tokens) / rate));
+}
+
+/// @brief Bucket size in milli-tokens, clamped to what a state can hold
+static U64 full_bucket(F64 burst) {
+  return std::min<U64>(static_cast<U64>(burst * TOKEN_COST), TOKEN_MASK);
+}
+
+static U64 now_millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// @brief Keys an address masked to a prefix length, never zero
+static U64 address_key(const boost::asio::ip::address &address, U8 prefix) {
+  if (address.is_v4()) {
+    const U64 bits = address.to_v4().to_uint();
+    const U64 mask =
+        prefix == 0 ? 0 : (0xFFFFFFFF << (32 - std::min<U8>(prefix, 32))) &
+                              0xFFFFFFFF;
+    return (U64{4} << 56) | (U64{prefix} << 40) | (bits & mask);
+  }
+
+  const auto bytes = address.to_v6().to_bytes();
+  U64 halves[2]{0, 0};
+  for (std::size_t i = 0; i < bytes.size(); i++) {
+    const auto bit = i * 8;
+    if (bit >= prefix) {
+      break;
+    }
+    auto byte = static_cast<U64>(bytes[i]);
+    if (prefix - bit < 8) {
+      byte &= (0xFF << (8 - (prefix - bit))) & 0xFF;
+    }
+    halves[i / 8] |= byte << (56 - (i % 8) * 8);
+  }
+
+  const auto key = mix(halves[0] ^ mix(halves[1] ^ prefix));
+  return key == 0 ? 1 : key;
+}
+
+static std::optional<U32> to_seconds(std::optional<U64> wait_ms) {
+  if (!wait_ms) {
+    return std::nullopt;
+  }
+  return static_cast<U32>(std::max<U64>(1, (*wait_ms + 999) / 1000));
+}
+
+static rate_limit::table &clients(std::size_t capacity) {
+  static rate_limit::table buckets{capacity};
+  return buckets;
+}
+
+static rate_limit::table &subnets(std::size_t capacity) {
+  static rate_limit::table buckets{capacity};
+  return buckets;
+}
+// ============================================================================
+rate_limit::table::table(std::size_t capacity)
+    : _sets{std::bit_ceil(std::max<std::size_t>(capacity / WAYS, 1))} {
+  _buckets = std::make_unique<bucket[]>(_sets * WAYS);
+}
+
+rate_limit::table::bucket &rate_limit::table::_find(U64 key, U64 now_ms,
+                                                    U64 full) {
+  auto *set = &_buckets[(mix(key) & (_sets - 1)) * WAYS];
+
+  for (;;) {
+    bucket *victim = nullptr;
+    U64 victim_key = 0;
+    U64 oldest = std::numeric_limits<U64>::max();
+
+    for (std::size_t i = 0; i < WAYS; i++) {
+      const auto candidate = set[i].key.load(std::memory_order_acquire);
+      if (candidate == key) {
+        return set[i];
+      }
+
+      const auto last =
+          candidate == 0
+              ? 0
+              : set[i].state.load(std::memory_order_relaxed) >> TOKEN_BITS;
+      if (last < oldest) {
+        oldest = last;
+        victim = &set[i];
+        victim_key = candidate;
+      }
+    }
+
+    // evict the least recently refilled bucket, whoever wins the swap owns it
+    if (victim->key.compare_exchange_strong(victim_key, key,
+                                            std::memory_order_acq_rel)) {
+      victim->state.store((now_ms << TOKEN_BITS) | full,
+                          std::memory_order_release);
+      return *victim;
+    }
+  }
+}
+
+std::optional<U64> rate_limit::table::take(U64 key, F64 rate, F64 burst,
+                                           U64 now_ms) {
+  const auto full = full_bucket(burst);
+  auto &found = _find(key, now_ms, full);
+  auto state = found.state.load(std::memory_order_relaxed);
+
+  for (;;) {
+    const auto tokens = refilled(state, rate, full, now_ms);
+    if (tokens < TOKEN_COST) {
+      return wait_for(tokens, rate);
+    }
+
+    const auto stamp = std::max(now_ms, state >> TOKEN_BITS);
+    const auto next = (stamp << TOKEN_BITS) | (tokens - TOKEN_COST);
+    if (found.state.compare_exchange_weak(state, next,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_relaxed)) {
+      return std::nullopt;
+    }
+  }
+}
+
+std::optional<U64> rate_limit::table::peek(U64 key, F64 rate, F64 burst,
+                                           U64 now_ms) {
+  const auto *set = &_buckets[(mix(key) & (_sets - 1)) * WAYS];
+
+  for (std::size_t i = 0; i < WAYS; i++) {
+    if (set[i].key.load(std::memory_order_acquire) == key) {
+      const auto tokens =
+          refilled(set[i].state.load(std::memory_order_relaxed), rate,
+                   full_bucket(burst), now_ms);
+      if (tokens < TOKEN_COST) {
+        return wait_for(tokens, rate);
+      }
+      break;
+    }
+  }
+
+  // untracked clients have a full bucket
+  return std::nullopt;
+}
+// ============================================================================
+std::optional<U32> rate_limit::take(const environment::rate_limits &limits,
+                                    const boost::asio::ip::address &address) {
+  if (!limits.enabled) {
+    return std::nullopt;
+  }
+
+  const auto now_ms = now_millis();
+  const auto prefix = address.is_v4() ? limits.subnet_v4 : limits.subnet_v6;
+
+  // the subnet only gets charged for requests its client was allowed
+  auto wait = clients(limits.capacity)
+                  .take(address_key(address, address.is_v4() ? 32 : 128),
+                        limits.rate, limits.burst, now_ms);
+  if (!wait) {
+    wait = subnets(limits.capacity)
+               .take(address_key(address, prefix), limits.subnet_rate,
+                     limits.subnet_burst, now_ms);
+  }
+
+  return to_seconds(wait);
+}
+
+std::optional<U32>
+rate_limit::exhausted(const environment::rate_limits &limits,
+                      const boost::asio::ip::address &address) {
+  if (!limits.enabled) {
+    return std::nullopt;
+  }
+
+  const auto now_ms = now_millis();
+  const auto prefix = address.is_v4() ? limits.subnet_v4 : limits.subnet_v6;
+
+  auto wait = clients(limits.capacity)
+                  .peek(address_key(address, address.is_v4() ? 32 : 128),
+                        limits.rate, limits.burst, now_ms);
+  if (!wait) {
+    wait = subnets(limits.capacity)
+               .peek(address_key(address, prefix), limits.subnet_rate,
+                     limits.subnet_burst, now_ms);
+  }
+
+  return to_seconds(wait);
+}
+
+const std::string &rate_limit::rendered_body() {
+  static const std::string body = [] {
+    Json::Value root;
+    Json::StreamWriterBuilder builder;
+    builder.settings_["indentation"] = "";
+
+    root["ok"] = false;
+    root["code"] = "TOO_MANY_REQUESTS";
+    root["maintenanceMessage"] = "Slow down and try again later";
+
+    return Json::writeString(builder, root);
+  }();
+
+  return body;
+}
+
+std::string rate_limit::rendered_response(U32 retry_after) {
+  static const std::string head =
+      "HTTP/1.1 429 Too Many Requests\r\n"
+      "Server: " BOOST_BEAST_VERSION_STRING "\r\n"
+      "Content-Type: application/json\r\n"
+      "Connection: close\r\n"
+      "Content-Length: " +
+      std::to_string(rendered_body().size()) + "\r\n";
+
+  return head + "Retry-After: " + std::to_string(retry_after) + "\r\n\r\n" +
+         rendered_body();
+}
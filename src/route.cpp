@@ -1,26 +1,150 @@
 #include "../include/route.hpp"
+#include "../include/accounting.hpp"
+#include "../include/catalog.hpp"
+#include "../include/descriptor.hpp"
+#include "../include/handoff.hpp"
+#include "../include/ingest.hpp"
+#include "../include/json_view.hpp"
 #include "../include/multimedia.hpp"
+#include "../include/prefetch.hpp"
+#include "../include/push.hpp"
+#include "../include/query_string.hpp"
+#include "../include/search.hpp"
+#include "../include/storage.hpp"
+#include "../include/trace.hpp"
+#include "../include/trending.hpp"
+#include "../include/views.hpp"
+#include "../include/worker.hpp"
+#include <charconv>
 #include <functional>
+#include <string_view>
 using namespace cobble;
 
+/// @brief Most thumbnails one `/thumbs` request may ask for
+constexpr std::size_t MAX_BATCH_THUMBNAILS = 64;
+
+/// @brief Videos `/trending` lists unless asked for another count
+constexpr U64 TRENDING_COUNT = 24;
+
+/// @brief Admin endpoints pretend not to exist unless enabled
+/// @tparam Response `response_get` or `response_post`
+template <class Response>
+static Response admin_disabled(const std::string &resource) {
+  Json::Value root;
+
+  root["ok"] = false;
+  root["code"] = "NOT_FOUND";
+  root["resource"] = resource;
+
+  return Response{.status = boost::beast::http::status::not_found,
+                  .body = root,
+                  .mime_type = "application/json"};
+}
+
+/// @brief Renders a GET result, whichever way it went
+static route::response_get
+unwrap(route::result<route::response_get> &&routed) {
+  return routed ? std::move(*routed) : route::failed_get(routed.error());
+}
+
+/// @brief Renders a POST result, whichever way it went
+static route::response_post
+unwrap(route::result<route::response_post> &&routed) {
+  return routed ? std::move(*routed) : route::failed_post(routed.error());
+}
+
+/// @brief Renders a HEAD result, whichever way it went
+static route::response_head
+unwrap(route::result<route::response_head> &&routed) {
+  return routed ? std::move(*routed) : route::failed_head(routed.error());
+}
+
+/// @brief GET handlers that may suspend, like to hand blocking work to the
+/// worker pool. Their query is owned by their coroutine frame.
+const static std::unordered_map<
+    std::filesystem::path,
+    std::function<boost::asio::awaitable<route::response_get>(
+        const environment::configuration &,
+        std::unordered_map<std::string, std::string>, trace::context)>>
+    coroutines_get{
+        {std::filesystem::path{"/page"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> query,
+            trace::context context)
+             -> boost::asio::awaitable<route::response_get> {
+           const auto page =
+               query.contains("page")
+                   ? route::number_parameter(query, "page", "BAD_PAGE")
+                   : route::result<U64>{0};
+           if (!page) {
+             co_return route::failed_get(page.error());
+           }
+
+           // listing reads the catalog and may probe MP4s on a cold start
+           co_return co_await worker::offload([&config, page = *page,
+                                               context] {
+             trace::scope scope{context};
+             accounting::scope counted{"/page", context.id};
+             trace::span span{"multimedia::video_list"};
+             Json::Value root;
+
+             root["ok"] = true;
+             root["version"]["readable"] = Cobble_VSTRING_FULL;
+             root["version"]["major"] = Cobble_VMAJOR;
+             root["version"]["minor"] = Cobble_VMINOR;
+             root["version"]["patch"] = Cobble_VPATCH;
+             root["videos"] = multimedia::video_list(config, page);
+
+             // the client asks for every listed thumbnail right after this
+             std::vector<U64> listed{};
+             for (const auto &video : root["videos"]) {
+               listed.emplace_back(video["id"].asUInt64());
+             }
+             multimedia::thumbnails_prefetch(config, listed);
+
+             return route::response_get{
+                 .status = boost::beast::http::status::ok,
+                 .body = root,
+                 .mime_type = "application/json"};
+           });
+         }}};
+
+/// @brief GET handlers that run to completion on the connection's thread
 const static std::unordered_map<
     std::filesystem::path,
     std::function<route::response_get(
         const environment::configuration &,
         std::unordered_map<std::string, std::string> &&)>>
     endpoints_get{
-        {std::filesystem::path{"/page"},
+        {std::filesystem::path{"/search"},
          [](const environment::configuration &config,
             std::unordered_map<std::string, std::string> &&query) {
-           Json::Value root;
+           if (!query.contains("q")) {
+             return route::failed_get(route::failure{
+                 .status = boost::beast::http::status::bad_request,
+                 .code = "BAD_QUERY"});
+           }
 
-           root["ok"] = true;
-           root["version"]["readable"] = Cobble_VSTRING_FULL;
-           root["version"]["major"] = Cobble_VMAJOR;
-           root["version"]["minor"] = Cobble_VMINOR;
-           root["version"]["patch"] = Cobble_VPATCH;
-           root["videos"] = Json::arrayValue;
+           return unwrap(search::results_get(
+               config, query_string::decode(query.at("q")),
+               query.contains("cursor") ? query.at("cursor") : ""));
+         }},
+        {std::filesystem::path{"/trending"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&query) {
+           const auto count =
+               query.contains("count")
+                   ? route::number_parameter(query, "count", "BAD_COUNT")
+                   : route::result<U64>{TRENDING_COUNT};
+           if (!count || *count == 0 || *count > trending::MAX_LISTED) {
+             return route::failed_get(route::failure{
+                 .status = boost::beast::http::status::bad_request,
+                 .code = "BAD_COUNT"});
+           }
 
+           Json::Value root;
+           root["ok"] = true;
+           root["videos"] = multimedia::trending_list(config, *count);
            return route::response_get{.status = boost::beast::http::status::ok,
                                       .body = root,
                                       .mime_type = "application/json"};
@@ -28,20 +152,130 @@ const static std::unordered_map<
         {std::filesystem::path{"/thumb"},
          [](const environment::configuration &config,
             std::unordered_map<std::string, std::string> &&query) {
-           if (query.contains("idx")) {
-             return multimedia::thumbnail_get(config,
-                                              std::stoull(query.at("idx")));
-           } else {
+           const auto id =
+               route::number_parameter(query, "idx", "BAD_THUMBNAIL");
+           if (!id) {
+             return route::failed_get(id.error());
+           }
+
+           return unwrap(multimedia::thumbnail_get(config, *id));
+         }},
+        {std::filesystem::path{"/thumbs"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&query) {
+           std::vector<std::pair<std::string_view, std::optional<U64>>> ids{};
+           if (query.contains("ids")) {
+             std::string_view rest{query.at("ids")};
+             while (!rest.empty() && ids.size() <= MAX_BATCH_THUMBNAILS) {
+               const auto comma = rest.find(',');
+               const auto token = rest.substr(0, comma);
+               rest = comma == std::string_view::npos
+                          ? std::string_view{}
+                          : rest.substr(comma + 1);
+
+               U64 id = 0;
+               const auto *last = token.data() + token.size();
+               const auto [end, ec] = std::from_chars(token.data(), last, id);
+               if (!token.empty() && ec == std::errc{} && end == last) {
+                 ids.emplace_back(token, id);
+               } else {
+                 ids.emplace_back(token, std::nullopt);
+               }
+             }
+           }
+
+           if (ids.empty() || ids.size() > MAX_BATCH_THUMBNAILS) {
              Json::Value root;
 
              root["ok"] = false;
-             root["code"] = "BAD_THUMBNAIL";
+             root["code"] = "BAD_THUMBNAIL_BATCH";
+             root["maximum"] = static_cast<Json::UInt64>(MAX_BATCH_THUMBNAILS);
 
              return route::response_get{
                  .status = boost::beast::http::status::bad_request,
                  .body = root,
                  .mime_type = "application/json"};
            }
+
+           return multimedia::thumbnails_get(config, ids);
+         }},
+        {std::filesystem::path{"/video"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&query) {
+           const auto id = route::number_parameter(query, "idx", "BAD_VIDEO");
+           if (!id) {
+             return route::failed_get(id.error());
+           }
+
+           return unwrap(multimedia::video_get(config, *id));
+         }},
+        {std::filesystem::path{"/video/playlist"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&query) {
+           const auto id = route::number_parameter(query, "idx", "BAD_VIDEO");
+           if (!id) {
+             return route::failed_get(id.error());
+           }
+
+           return unwrap(multimedia::video_playlist_get(config, *id));
+         }},
+        {std::filesystem::path{"/video/init"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&query) {
+           const auto id = route::number_parameter(query, "idx", "BAD_VIDEO");
+           if (!id) {
+             return route::failed_get(id.error());
+           }
+
+           return unwrap(multimedia::video_init_get(config, *id));
+         }},
+        {std::filesystem::path{"/video/segment"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&query) {
+           const auto id = route::number_parameter(query, "idx", "BAD_VIDEO");
+           const auto segment =
+               route::number_parameter(query, "seg", "BAD_VIDEO");
+           if (!id || !segment) {
+             return route::failed_get(!id ? id.error() : segment.error());
+           }
+
+           return unwrap(multimedia::video_segment_get(config, *id, *segment));
+         }},
+        {std::filesystem::path{"/admin/trace"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&) {
+           if (!config.admin_enabled) {
+             return admin_disabled<route::response_get>("/admin/trace");
+           }
+
+           return route::response_get{.status = boost::beast::http::status::ok,
+                                      .body = trace::collect(),
+                                      .mime_type = "application/json"};
+         }},
+        {std::filesystem::path{"/admin/stats"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&) {
+           if (!config.admin_enabled) {
+             return admin_disabled<route::response_get>("/admin/stats");
+           }
+
+           Json::Value root;
+           root["ok"] = true;
+           root["prefetch"] = prefetch::stats();
+           root["descriptors"] = descriptor::stats();
+           root["storage"] = storage::open(config)->stats();
+           root["ingest"] = ingest::stats();
+           root["catalog"] = catalog::open(config)->stats();
+           root["search"] = search::open(config)->stats();
+           root["views"] = views::stats();
+           root["worker"] = worker::stats();
+           root["trending"] = trending::stats();
+           root["push"] = push::stats();
+           root["accounting"] = accounting::stats();
+
+           return route::response_get{.status = boost::beast::http::status::ok,
+                                      .body = root,
+                                      .mime_type = "application/json"};
          }}};
 
 const static std::unordered_map<
@@ -50,32 +284,181 @@ const static std::unordered_map<
         const environment::configuration &,
         std::unordered_map<std::string, std::string> &&)>>
     endpoints_head{
-        {std::filesystem::path{"/page"},
+        {std::filesystem::path{"/video"},
          [](const environment::configuration &config,
             std::unordered_map<std::string, std::string> &&query) {
+           const auto id = route::number_parameter(query, "idx", "BAD_VIDEO");
+           if (!id) {
+             return route::failed_head(id.error());
+           }
+
+           return unwrap(multimedia::video_head(config, *id));
+         }},
+        {std::filesystem::path{"/page"},
+         [](const environment::configuration &,
+            std::unordered_map<std::string, std::string> &&) {
            return route::response_head{.status = boost::beast::http::status::ok,
                                        .mime_type = "application/json"};
          }},
         {std::filesystem::path{"/thumb"},
          [](const environment::configuration &config,
             std::unordered_map<std::string, std::string> &&query) {
-           if (query.contains("idx")) {
-             return multimedia::thumbnail_head(config,
-                                               std::stoull(query.at("idx")));
-           } else {
-             return route::response_head{
-                 .status = boost::beast::http::status::bad_request,
-                 .mime_type = "application/json"};
+           const auto id =
+               route::number_parameter(query, "idx", "BAD_THUMBNAIL");
+           if (!id) {
+             return route::failed_head(id.error());
            }
+
+           return unwrap(multimedia::thumbnail_head(config, *id));
          }}
     };
 
-route::response_get
+/// @brief POST handlers, given a view of the parsed body
+const static std::unordered_map<
+    std::filesystem::path,
+    std::function<route::response_post(
+        const environment::configuration &,
+        std::unordered_map<std::string, std::string> &&,
+        const json_view::value &)>>
+    endpoints_post{
+        {std::filesystem::path{"/admin/metadata"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&,
+            const json_view::value &body) {
+           if (!config.admin_enabled) {
+             return admin_disabled<route::response_post>("/admin/metadata");
+           }
+
+           return unwrap(multimedia::metadata_post(config, body));
+         }},
+        {std::filesystem::path{"/admin/ingest"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&,
+            const json_view::value &body) {
+           if (!config.admin_enabled) {
+             return admin_disabled<route::response_post>("/admin/ingest");
+           }
+
+           trace::span span{"multimedia::media_ingest"};
+           try {
+             return unwrap(multimedia::media_ingest(config, body));
+           } catch (const std::exception &e) {
+             Json::Value root;
+             root["ok"] = false;
+             root["code"] = "INGEST_FAILED";
+             root["maintenanceMessage"] = e.what();
+             return route::response_post{
+                 .status = boost::beast::http::status::internal_server_error,
+                 .body = root,
+                 .mime_type = "application/json"};
+           }
+         }},
+        {std::filesystem::path{"/admin/import"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&,
+            const json_view::value &) {
+           if (!config.admin_enabled) {
+             return admin_disabled<route::response_post>("/admin/import");
+           }
+
+           return multimedia::catalog_import(config);
+         }},
+        {std::filesystem::path{"/admin/reload"},
+         [](const environment::configuration &config,
+            std::unordered_map<std::string, std::string> &&,
+            const json_view::value &) {
+           if (!config.admin_enabled) {
+             return admin_disabled<route::response_post>("/admin/reload");
+           }
+
+           Json::Value root;
+           try {
+             environment::reload();
+             root["ok"] = true;
+           } catch (const std::exception &e) {
+             root["ok"] = false;
+             root["code"] = "RELOAD_FAILED";
+             root["maintenanceMessage"] = e.what();
+           }
+
+           return route::response_post{
+               .status = root["ok"].asBool()
+                             ? boost::beast::http::status::ok
+                             : boost::beast::http::status::bad_request,
+               .body = root,
+               .mime_type = "application/json"};
+         }}};
+
+route::result<U64> route::number_parameter(
+    const std::unordered_map<std::string, std::string> &query,
+    const std::string &key, const char *code) {
+  const auto found = query.find(key);
+  if (found != query.end()) {
+    const auto &value = found->second;
+    U64 number = 0;
+    const auto *last = value.data() + value.size();
+    const auto [end, ec] = std::from_chars(value.data(), last, number);
+    if (!value.empty() && ec == std::errc{} && end == last) {
+      return number;
+    }
+  }
+
+  return std::unexpected{
+      failure{.status = boost::beast::http::status::bad_request, .code = code}};
+}
+
+route::response_get route::failed_get(const failure &why) {
+  Json::Value root;
+
+  root["ok"] = false;
+  root["code"] = why.code;
+
+  route::response_get response{
+      .status = why.status, .body = root, .mime_type = "application/json"};
+  if (why.retry_after) {
+    response.headers.emplace_back("Retry-After",
+                                  std::to_string(*why.retry_after));
+  }
+  return response;
+}
+
+route::response_post route::failed_post(const failure &why) {
+  Json::Value root;
+
+  root["ok"] = false;
+  root["code"] = why.code;
+
+  return route::response_post{
+      .status = why.status, .body = root, .mime_type = "application/json"};
+}
+
+route::response_head route::failed_head(const failure &why) {
+  route::response_head response{.status = why.status,
+                                .mime_type = "application/json"};
+  if (why.retry_after) {
+    response.headers.emplace_back("Retry-After",
+                                  std::to_string(*why.retry_after));
+  }
+  return response;
+}
+
+boost::asio::awaitable<route::response_get>
 route::api_get(const environment::configuration &config,
                const std::filesystem::path &path,
-               std::unordered_map<std::string, std::string> &&query) {
-  if (endpoints_get.contains(path)) {
-    return endpoints_get.at(path)(config, std::move(query));
+               std::unordered_map<std::string, std::string> query,
+               trace::context context) {
+  if (const auto found = coroutines_get.find(path);
+      found != coroutines_get.end()) {
+    co_return co_await found->second(config, std::move(query), context);
+  }
+
+  // synchronous handlers are adapted by running them to completion here,
+  // nothing suspends while the trace context is current on this thread
+  trace::scope scope{context};
+  if (const auto found = endpoints_get.find(path);
+      found != endpoints_get.end()) {
+    accounting::scope counted{found->first.native(), context.id};
+    co_return found->second(config, std::move(query));
   } else {
     Json::Value root;
 
@@ -84,20 +467,67 @@ route::api_get(const environment::configuration &config,
     root["maintenanceMessage"] = "Please try again later";
     root["resource"] = path.string();
 
-    return route::response_get{.status = boost::beast::http::status::not_found,
-                               .body = root,
-                               .mime_type = "application/json"};
+    co_return route::response_get{
+        .status = boost::beast::http::status::not_found,
+        .body = root,
+        .mime_type = "application/json"};
   }
 }
-route::response_head
+boost::asio::awaitable<route::response_head>
 route::api_head(const environment::configuration &config,
                 const std::filesystem::path &path,
-                std::unordered_map<std::string, std::string> &&query) {
-  if (endpoints_head.contains(path)) {
-    return endpoints_head.at(path)(config, std::move(query));
+                std::unordered_map<std::string, std::string> query,
+                trace::context context) {
+  trace::scope scope{context};
+  if (const auto found = endpoints_head.find(path);
+      found != endpoints_head.end()) {
+    accounting::scope counted{found->first.native(), context.id};
+    co_return found->second(config, std::move(query));
   } else {
 
-    return route::response_head{.status = boost::beast::http::status::not_found,
-                                .mime_type = "application/json"};
+    co_return route::response_head{
+        .status = boost::beast::http::status::not_found,
+        .mime_type = "application/json"};
   }
-}
\ No newline at end of file
+}
+boost::asio::awaitable<route::response_post>
+route::api_post(const environment::configuration &config,
+                const std::filesystem::path &path,
+                std::unordered_map<std::string, std::string> query,
+                std::string body, trace::context context) {
+  const auto found = endpoints_post.find(path);
+  if (found == endpoints_post.end()) {
+    co_return failed_post(failure{
+        .status = boost::beast::http::status::not_found,
+        .code = "NOT_FOUND"});
+  }
+
+  // the storage directory belongs to the process this one handed over to
+  if (handoff::draining()) {
+    co_return failed_post(failure{
+        .status = boost::beast::http::status::service_unavailable,
+        .code = "DRAINING"});
+  }
+
+  const auto parsed = [&body, &context, &found] {
+    trace::span span{"json_view::parse", context};
+    accounting::scope counted{found->first.native(), context.id};
+    return json_view::document::parse(std::move(body));
+  }();
+  if (!parsed) {
+    const std::string_view code{parsed.error().code};
+    co_return failed_post(failure{
+        .status = code == "BODY_TOO_LARGE"
+                      ? boost::beast::http::status::payload_too_large
+                      : boost::beast::http::status::bad_request,
+        .code = std::string{code}});
+  }
+
+  // writes wait on fdatasync, so every POST handler runs on the worker pool
+  co_return co_await worker::offload(
+      [&config, &found, &query, &parsed, context] {
+        trace::scope scope{context};
+        accounting::scope counted{found->first.native(), context.id};
+        return found->second(config, std::move(query), parsed->root());
+      });
+}
@@ -0,0 +1,512 @@
+#include "../include/search.hpp"
+#include "../include/catalog.hpp"
+#include "../include/logger.hpp"
+#include "../include/timekeeper.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <utility>
+using namespace cobble;
+
+/// @brief Ordinals per posting block, a block is the unit intersections skip
+constexpr U32 BLOCK_SIZE = 128;
+
+/// @brief Longest word indexed, longer words are cut
+constexpr std::size_t MAX_WORD_LENGTH = 64;
+
+/// @brief Longest query accepted, in bytes
+constexpr std::size_t MAX_QUERY_LENGTH = 256;
+
+/// @brief Most words of a query that are matched, the rest are ignored
+constexpr std::size_t MAX_QUERY_WORDS = 8;
+
+/// @brief Most matching videos ranked per query, the newest ones win, so a
+/// query matching much of the catalog still costs a bounded amount
+constexpr std::size_t MAX_RANKED = 1000;
+
+/// @brief Hits per page of `/search`
+constexpr std::size_t RESULTS_PER_PAGE = 20;
+
+/// @brief Splits text into lowercase words, anything that isn't a letter or
+/// digit separates them and non-ASCII bytes are kept as they are
+static std::vector<std::string> words_of(std::string_view text) {
+  std::vector<std::string> words{};
+  std::string word{};
+  const auto flush = [&] {
+    if (!word.empty()) {
+      words.emplace_back(std::move(word));
+      word.clear();
+    }
+  };
+
+  for (const auto c : text) {
+    const auto byte = static_cast<U8>(c);
+    if (byte >= 'A' && byte <= 'Z') {
+      word += static_cast<char>(byte - 'A' + 'a');
+    } else if ((byte >= 'a' && byte <= 'z') || (byte >= '0' && byte <= '9') ||
+               byte >= 0x80) {
+      word += c;
+    } else {
+      flush();
+      continue;
+    }
+    if (word.size() > MAX_WORD_LENGTH) {
+      word.pop_back();
+    }
+  }
+  flush();
+  return words;
+}
+
+/// @brief Adds the trigrams of a word, starting with a space so the first
+/// trigram only matches at the start of a word
+static void trigrams_of(const std::string &word, std::vector<U32> &out) {
+  U32 window = static_cast<U8>(' ');
+  for (std::size_t i = 0; i < word.size(); i++) {
+    window = (window << 8 | static_cast<U8>(word[i])) & 0xFFFFFF;
+    if (i >= 1) {
+      out.emplace_back(window);
+    }
+  }
+}
+
+/// @brief How well a word of a query matched a document's words
+/// @param whole Score for a whole word
+/// @param prefix Score for the start of a word
+static U32 matched(const std::string &query,
+                   const std::vector<std::string> &words, U32 whole,
+                   U32 prefix) {
+  U32 best = 0;
+  for (const auto &word : words) {
+    if (word == query) {
+      return whole;
+    }
+    if (word.starts_with(query)) {
+      best = prefix;
+    }
+  }
+  return best;
+}
+
+/// @brief Parses a cursor as sent to clients, `<score>.<id>`
+static std::optional<search::position> parse_cursor(const std::string &text) {
+  const auto dot = text.find('.');
+  if (dot == std::string::npos) {
+    return std::nullopt;
+  }
+
+  search::position parsed{.score = 0, .id = 0};
+  const auto *first = text.data();
+  const auto *middle = first + dot;
+  const auto *last = first + text.size();
+  const auto [score_end, score_ec] =
+      std::from_chars(first, middle, parsed.score);
+  const auto [id_end, id_ec] = std::from_chars(middle + 1, last, parsed.id);
+  if (dot == 0 || score_ec != std::errc{} || score_end != middle ||
+      id_ec != std::errc{} || id_end != last) {
+    return std::nullopt;
+  }
+  return parsed;
+}
+
+void search::index::postings::append(U32 ordinal) {
+  // the same trigram twice in a video is only listed once
+  if (count > 0 && ordinal == last) {
+    return;
+  }
+
+  if (count % BLOCK_SIZE == 0) {
+    heads.emplace_back(ordinal);
+    offsets.emplace_back(static_cast<U32>(deltas.size()));
+  } else {
+    for (auto delta = ordinal - last;; delta >>= 7) {
+      if (delta < 0x80) {
+        deltas.emplace_back(static_cast<U8>(delta));
+        break;
+      }
+      deltas.emplace_back(static_cast<U8>(delta | 0x80));
+    }
+  }
+  last = ordinal;
+  count++;
+}
+
+void search::index::postings::decode(std::size_t block,
+                                     std::vector<U32> &out) const {
+  out.clear();
+  auto value = heads[block];
+  out.emplace_back(value);
+
+  auto at = offsets[block];
+  const auto end = block + 1 < offsets.size()
+                       ? offsets[block + 1]
+                       : static_cast<U32>(deltas.size());
+  while (at < end) {
+    U32 delta = 0;
+    for (U32 shift = 0;; shift += 7) {
+      const auto byte = deltas[at++];
+      delta |= static_cast<U32>(byte & 0x7F) << shift;
+      if (byte < 0x80) {
+        break;
+      }
+    }
+    value += delta;
+    out.emplace_back(value);
+  }
+}
+
+void search::index::_match(const std::vector<std::string> &words,
+                           const std::function<bool(U32)> &visit) const {
+  std::vector<U32> trigrams{};
+  for (const auto &word : words) {
+    trigrams_of(word, trigrams);
+  }
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                 trigrams.end());
+
+  std::vector<const postings *> lists{};
+  for (const auto trigram : trigrams) {
+    const auto found = _postings.find(trigram);
+    if (found == _postings.end()) {
+      return;
+    }
+    lists.emplace_back(&found->second);
+  }
+  if (lists.empty()) {
+    return;
+  }
+
+  // the rarest trigram's blocks are walked newest first, every other list
+  // is only probed for their ordinals
+  std::sort(lists.begin(), lists.end(), [](const auto *a, const auto *b) {
+    return a->count < b->count;
+  });
+
+  std::vector<U32> candidates{}, kept{}, block{};
+  for (auto first = lists.front()->heads.size(); first-- > 0;) {
+    lists.front()->decode(first, candidates);
+
+    for (auto list = lists.begin() + 1;
+         list != lists.end() && !candidates.empty(); list++) {
+      const auto &heads = (*list)->heads;
+      kept.clear();
+      auto decoded = heads.size();
+      std::size_t at = 0;
+      std::size_t current = 0;
+
+      for (const auto candidate : candidates) {
+        // skip to the block that would hold it, without decoding the others
+        if (current + 1 < heads.size() && heads[current + 1] <= candidate) {
+          current = std::upper_bound(heads.begin() + current + 1,
+                                     heads.end(), candidate) -
+                    heads.begin() - 1;
+        }
+        if (heads[current] > candidate) {
+          continue;
+        }
+        if (decoded != current) {
+          (*list)->decode(current, block);
+          decoded = current;
+          at = 0;
+        }
+
+        // a plain scan, at most one pass per block, SSE2 compares here and
+        // SWAR varint decoding measured no faster on a million videos
+        while (at < block.size() && block[at] < candidate) {
+          at++;
+        }
+        if (at < block.size() && block[at] == candidate) {
+          kept.emplace_back(candidate);
+        }
+      }
+      candidates.swap(kept);
+    }
+
+    for (auto candidate = candidates.rbegin(); candidate != candidates.rend();
+         candidate++) {
+      if (!visit(*candidate)) {
+        return;
+      }
+    }
+  }
+}
+
+bool search::index::_add(U64 id, const std::string &title,
+                         const std::vector<std::string> &tags, bool replace) {
+  document added{.id = id,
+                 .title = title,
+                 .tags = tags,
+                 .title_words = words_of(title),
+                 .tag_words = {},
+                 .live = true};
+  for (const auto &tag : tags) {
+    for (auto &word : words_of(tag)) {
+      added.tag_words.emplace_back(std::move(word));
+    }
+  }
+
+  std::vector<U32> trigrams{};
+  for (const auto &word : added.title_words) {
+    trigrams_of(word, trigrams);
+  }
+  for (const auto &word : added.tag_words) {
+    trigrams_of(word, trigrams);
+  }
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                 trigrams.end());
+
+  std::unique_lock<std::shared_mutex> lock{_mutex};
+
+  // the old entry stays in the posting lists, it's skipped as dead
+  const auto existing = _ordinals.find(id);
+  if (existing != _ordinals.end()) {
+    if (!replace) {
+      return false;
+    }
+    _documents[existing->second] = document{.id = id,
+                                            .title = {},
+                                            .tags = {},
+                                            .title_words = {},
+                                            .tag_words = {},
+                                            .live = false};
+    _live--;
+  }
+
+  const auto ordinal = static_cast<U32>(_documents.size());
+  _documents.emplace_back(std::move(added));
+  _ordinals.insert_or_assign(id, ordinal);
+  for (const auto trigram : trigrams) {
+    _postings[trigram].append(ordinal);
+  }
+  _live++;
+  return true;
+}
+
+void search::index::add(U64 id, const std::string &title,
+                        const std::vector<std::string> &tags) {
+  _add(id, title, tags, true);
+}
+
+bool search::index::seed(U64 id, const std::string &title,
+                         const std::vector<std::string> &tags) {
+  return _add(id, title, tags, false);
+}
+
+search::page search::index::find(std::string_view query,
+                                 const std::optional<position> &after,
+                                 std::size_t limit) const {
+  auto words = words_of(query);
+  if (words.size() > MAX_QUERY_WORDS) {
+    words.resize(MAX_QUERY_WORDS);
+  }
+
+  struct ranked {
+    U32 score;
+    U64 id;
+    U32 ordinal;
+  };
+  const auto before = [](U32 score, U64 id, U32 other_score, U64 other_id) {
+    return score > other_score || (score == other_score && id > other_id);
+  };
+
+  std::shared_lock<std::shared_mutex> lock{_mutex};
+
+  // nothing can rank above a hit with every word whole in its title, or
+  // above the previous page, so once a page of those and one more is found
+  // the rest are older and lose on ID
+  auto ceiling = static_cast<U32>(words.size() * 4);
+  if (after) {
+    ceiling = std::min(ceiling, after->score);
+  }
+  std::size_t unbeatable = 0;
+
+  // trigrams can match across words, so every candidate is checked
+  std::vector<ranked> hits{};
+  _match(words, [&](U32 ordinal) {
+    const auto &found = _documents[ordinal];
+    if (!found.live) {
+      return true;
+    }
+
+    U32 score = 0;
+    for (const auto &word : words) {
+      const auto best = std::max(matched(word, found.title_words, 4, 2),
+                                 matched(word, found.tag_words, 2, 1));
+      if (best == 0) {
+        return true;
+      }
+      score += best;
+    }
+    if (after && !before(after->score, after->id, score, found.id)) {
+      return true;
+    }
+    hits.emplace_back(
+        ranked{.score = score, .id = found.id, .ordinal = ordinal});
+    if (score == ceiling && ++unbeatable > limit) {
+      return false;
+    }
+    return hits.size() < MAX_RANKED;
+  });
+
+  const auto order = [&](const ranked &a, const ranked &b) {
+    return before(a.score, a.id, b.score, b.id);
+  };
+  page found{};
+  if (hits.size() > limit) {
+    std::partial_sort(hits.begin(), hits.begin() + limit, hits.end(), order);
+    hits.resize(limit);
+    found.next = position{.score = hits.back().score, .id = hits.back().id};
+  } else {
+    std::sort(hits.begin(), hits.end(), order);
+  }
+
+  for (const auto &hit : hits) {
+    const auto &indexed = _documents[hit.ordinal];
+    found.hits.emplace_back(search::hit{.id = hit.id,
+                                        .score = hit.score,
+                                        .title = indexed.title,
+                                        .tags = indexed.tags});
+  }
+  return found;
+}
+
+Json::Value search::index::stats() const {
+  Json::Value root;
+
+  std::shared_lock<std::shared_mutex> lock{_mutex};
+  U64 bytes = 0;
+  for (const auto &[trigram, list] : _postings) {
+    bytes += list.heads.size() * sizeof(U32) +
+             list.offsets.size() * sizeof(U32) + list.deltas.size();
+  }
+  root["videos"] = static_cast<Json::UInt64>(_live);
+  root["indexed"] = static_cast<Json::UInt64>(_documents.size());
+  root["trigrams"] = static_cast<Json::UInt64>(_postings.size());
+  root["postingBytes"] = static_cast<Json::UInt64>(bytes);
+
+  return root;
+}
+
+/// @brief An index, the catalog it's filled from and the thread filling it
+struct built {
+  std::shared_ptr<catalog::store> catalog;
+  std::shared_ptr<search::index> index;
+  std::jthread filler;
+};
+
+/// @brief Indexes every cataloged video with a title, while the index
+/// already answers queries
+static void fill(std::stop_token stop,
+                 std::shared_ptr<catalog::store> catalog,
+                 std::shared_ptr<search::index> index) {
+  const auto started = timekeeper::now();
+  std::vector<catalog::entry> titled{};
+  catalog->each([&](const catalog::entry &which) {
+    if (!stop.stop_requested() && !which.title.empty()) {
+      titled.emplace_back(which);
+    }
+  });
+
+  // matches are walked newest ordinal first and cut at `MAX_RANKED`, so
+  // ordinals follow IDs rather than where each entry was last logged
+  std::sort(titled.begin(), titled.end(),
+            [](const catalog::entry &a, const catalog::entry &b) {
+              return a.id < b.id;
+            });
+
+  // live adds while this runs are newer than what was read above, so they
+  // aren't replaced
+  U64 indexed = 0;
+  for (const auto &which : titled) {
+    if (stop.stop_requested()) {
+      break;
+    }
+    if (index->seed(which.id, which.title, which.tags)) {
+      indexed++;
+    }
+  }
+
+  logger::log(logger::severity::notice, "Indexed ", indexed,
+              " videos for search in ",
+              timekeeper::milliseconds_since(started), "ms");
+}
+// ============================================================================
+std::shared_ptr<search::index>
+search::open(const environment::configuration &config) {
+  static std::atomic<std::shared_ptr<const built>> shared{};
+  static std::mutex rebuilding{};
+
+  const auto catalog = catalog::open(config);
+  auto current = shared.load(std::memory_order_acquire);
+  if (current && current->catalog == catalog) {
+    return current->index;
+  }
+
+  std::lock_guard<std::mutex> lock{rebuilding};
+  current = shared.load(std::memory_order_acquire);
+  if (!current || current->catalog != catalog) {
+    auto index = std::make_shared<search::index>();
+    current = std::make_shared<const built>(
+        built{.catalog = catalog,
+              .index = index,
+              .filler = std::jthread{fill, catalog, index}});
+    shared.store(current, std::memory_order_release);
+  }
+  return current->index;
+}
+
+route::result<route::response_get>
+search::results_get(const environment::configuration &config,
+                    const std::string &query, const std::string &cursor) {
+  // at least one word has to be long enough for a trigram
+  const auto words = words_of(query);
+  if (query.size() > MAX_QUERY_LENGTH ||
+      std::none_of(words.begin(), words.end(),
+                   [](const auto &word) { return word.size() >= 2; })) {
+    return std::unexpected{
+        route::failure{.status = boost::beast::http::status::bad_request,
+                       .code = "BAD_QUERY"}};
+  }
+
+  std::optional<position> after{};
+  if (!cursor.empty()) {
+    after = parse_cursor(cursor);
+    if (!after) {
+      return std::unexpected{
+          route::failure{.status = boost::beast::http::status::bad_request,
+                         .code = "BAD_CURSOR"}};
+    }
+  }
+
+  const auto found = open(config)->find(query, after, RESULTS_PER_PAGE);
+
+  Json::Value root;
+  root["ok"] = true;
+  root["results"] = Json::arrayValue;
+  for (const auto &hit : found.hits) {
+    Json::Value video;
+    video["id"] = static_cast<Json::UInt64>(hit.id);
+    video["title"] = hit.title;
+    video["tags"] = Json::arrayValue;
+    for (const auto &tag : hit.tags) {
+      video["tags"].append(tag);
+    }
+    video["score"] = hit.score;
+    root["results"].append(video);
+  }
+  if (found.next) {
+    root["cursor"] = std::to_string(found.next->score) + "." +
+                     std::to_string(found.next->id);
+  }
+
+  return route::response_get{.status = boost::beast::http::status::ok,
+                             .body = root,
+                             .mime_type = "application/json"};
+}
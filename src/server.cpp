@@ -1,11 +1,36 @@
 #include "../include/server.hpp"
+#include "../include/accounting.hpp"
+#include "../include/catalog.hpp"
 #include "../include/exception_handler.hpp"
+#include "../include/handoff.hpp"
+#include "../include/http2.hpp"
 #include "../include/logger.hpp"
+#include "../include/push.hpp"
+#include "../include/rate_limit.hpp"
+#include "../include/search.hpp"
 #include "../include/server_gen.hpp"
+#include "../include/storage.hpp"
+#include "../include/tls.hpp"
+#include "../include/trace.hpp"
+#include "../include/views.hpp"
+#include "../include/worker.hpp"
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
 #include <boost/beast.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+#include <algorithm>
 #include <chrono>
+#include <atomic>
+#include <csignal>
 #include <cstdlib>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
 #include <thread>
 #include <vector>
 using namespace cobble;
@@ -14,39 +39,464 @@ using tcp_stream = typename boost::beast::tcp_stream::rebind_executor<
     boost::asio::use_awaitable_t<>::executor_with_default<
         boost::asio::any_io_executor>>::other;
 
+using tls_stream = boost::beast::ssl_stream<tcp_stream>;
+
+/// @brief How long an upgraded process waits for its sessions to end
+constexpr std::chrono::seconds DRAIN_DEADLINE{60};
+
+/// @brief How often draining checks on the sessions left
+constexpr std::chrono::milliseconds DRAIN_POLL{100};
+
+/// @brief How long a push subscriber gets to take one message
+constexpr std::chrono::seconds PUSH_WRITE_TIMEOUT{10};
+
+/// @brief How long an HTTP/2 connection may sit with nothing in flight
+constexpr std::chrono::seconds HTTP2_IDLE_TIMEOUT{30};
+
+/// @brief How long an HTTP/2 peer gets to take one chunk of frames
+constexpr std::chrono::seconds HTTP2_WRITE_TIMEOUT{30};
+
+/// @brief Largest message a push subscriber may send, they're ignored anyway
+constexpr std::size_t MAX_PUSH_READ = 4096;
+
+/// @brief A listening socket, accepting on its own strand so an upgrade can
+/// close it from any thread
+struct listener {
+  boost::asio::strand<boost::asio::io_context::executor_type> strand;
+  boost::asio::ip::tcp::acceptor acceptor;
+};
+
+/// @brief Sessions still going, an upgraded process waits for them
+static std::atomic<U64> sessions{0};
+
+/// @brief If an upgrade is under way, only one runs at a time
+static std::atomic<bool> upgrading{false};
+
+/// @brief Counts a session for as long as it lives
+struct session_count {
+  session_count() { sessions.fetch_add(1, std::memory_order_relaxed); }
+  ~session_count() { sessions.fetch_sub(1, std::memory_order_relaxed); }
+};
+
+/// @brief Wakeups of sessions that should end as soon as this process drains
+static std::mutex drain_mutex{};
+static std::list<std::function<void()>> drain_wakes{};
+
+/// @brief Has draining wake a session for as long as this lives
+class drain_watch {
+  std::list<std::function<void()>>::iterator _wake;
+
+public:
+  /// @brief Starts watching
+  /// @param wake Called from the draining thread, must only post to the
+  /// session's strand
+  drain_watch(std::function<void()> wake) {
+    std::scoped_lock lock{drain_mutex};
+    _wake = drain_wakes.emplace(drain_wakes.end(), std::move(wake));
+  }
+  ~drain_watch() {
+    std::scoped_lock lock{drain_mutex};
+    drain_wakes.erase(_wake);
+  }
+
+  drain_watch(const drain_watch &) = delete;
+  drain_watch &operator=(const drain_watch &) = delete;
+};
+
+/// @brief Wakes every watching session, once `handoff::drain` was called
+static void wake_drained() {
+  std::scoped_lock lock{drain_mutex};
+  for (const auto &wake : drain_wakes) {
+    wake();
+  }
+}
+
+template <class Stream>
+boost::asio::awaitable<bool> detect_http2(Stream &stream,
+                                          boost::beast::flat_buffer &buffer) {
+  // read only as far as needed to tell the preface apart from HTTP/1.1, the
+  // bytes stay buffered for whichever protocol wins
+  for (;;) {
+    const auto data = buffer.data();
+    const std::string_view received{static_cast<const char *>(data.data()),
+                                    data.size()};
+    const auto compared = std::min(received.size(),
+                                   http2::CLIENT_PREFACE.size());
+
+    if (received.substr(0, compared) !=
+        http2::CLIENT_PREFACE.substr(0, compared)) {
+      co_return false;
+    }
+    if (compared == http2::CLIENT_PREFACE.size()) {
+      co_return true;
+    }
+
+    buffer.commit(co_await stream.async_read_some(buffer.prepare(4096),
+                                                  boost::asio::use_awaitable));
+  }
+}
+
+/// @brief Upgrades a request to a WebSocket and pushes catalog updates on it
+/// until the client leaves, falls behind or this process drains
+template <class Stream>
 boost::asio::awaitable<void>
-do_session(tcp_stream stream, const environment::configuration &config) {
+do_push(Stream &stream,
+        boost::beast::http::request<boost::beast::http::string_body> request,
+        const std::string &peer_ip, const U16 peer_port) {
+  // the session's strand, so the wakeups posted below never race it
+  const auto executor = co_await boost::asio::this_coro::executor;
+  auto &&lowest = boost::beast::get_lowest_layer(stream);
+  lowest.expires_never();
 
-  const auto peer_ip = stream.socket().remote_endpoint().address().to_string();
-  const auto peer_port = stream.socket().remote_endpoint().port();
-  logger::log(logger::severity::debug, peer_ip, ":", peer_port, " connects");
-  boost::beast::flat_buffer buffer;
+  boost::beast::websocket::stream<Stream &> socket{stream};
+  socket.set_option(boost::beast::websocket::stream_base::timeout::suggested(
+      boost::beast::role_type::server));
+  socket.read_message_max(MAX_PUSH_READ);
+  boost::system::error_code ec{};
+  co_await socket.async_accept(
+      request, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  if (ec) {
+    co_return;
+  }
+  socket.text(true);
+  logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+              " subscribes to updates");
 
-  try {
-    for (;;) {
-      // set timeout
-      stream.expires_after(std::chrono::seconds(1));
+  // woken by cancelling its wait, a late wakeup finds it gone
+  const auto wake = std::make_shared<boost::asio::steady_timer>(
+      executor, boost::asio::steady_timer::time_point::max());
+  const auto subscriber =
+      push::subscribe([executor, weak = std::weak_ptr{wake}] {
+        boost::asio::post(executor, [weak] {
+          if (const auto timer = weak.lock()) {
+            timer->cancel();
+          }
+        });
+      });
 
-      // HTTP requests require a read of headers
-      boost::beast::http::request<boost::beast::http::string_body> request;
-      co_await boost::beast::http::async_read(stream, buffer, request);
+  // reading answers pings and notices the client closing
+  bool reading = true;
+  boost::asio::steady_timer read_done{
+      executor, boost::asio::steady_timer::time_point::max()};
+  boost::asio::co_spawn(
+      executor,
+      [&socket, &reading, &wake, &read_done]() -> boost::asio::awaitable<void> {
+        boost::beast::flat_buffer ignored{};
+        boost::system::error_code read_ec{};
+        while (!read_ec) {
+          co_await socket.async_read(
+              ignored,
+              boost::asio::redirect_error(boost::asio::use_awaitable, read_ec));
+          ignored.clear();
+        }
+        reading = false;
+        wake->cancel();
+        read_done.cancel();
+      },
+      boost::asio::detached);
 
-      // handle request
-      boost::beast::http::message_generator message =
-          server_gen::handle(std::move(request), config, peer_ip, peer_port);
+  auto reason = boost::beast::websocket::close_code::going_away;
+  const auto hello = push::hello();
+  co_await socket.async_write(
+      boost::asio::buffer(*hello),
+      boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  while (!ec && reading && !push::closed()) {
+    if (subscriber->overflowed()) {
+      logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+                  " fell behind on updates, dropping it");
+      reason = boost::beast::websocket::close_code::try_again_later;
+      break;
+    }
 
-      // determines if connection is done
-      bool is_keepalive = message.keep_alive();
+    // anything queued after this wakes the wait below, posts run only once
+    // this coroutine suspends
+    const auto messages = subscriber->take();
+    if (messages.empty()) {
+      wake->expires_at(boost::asio::steady_timer::time_point::max());
+      co_await wake->async_wait(
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      ec = {};
+      continue;
+    }
 
-      // send response
-      co_await boost::beast::async_write(stream, std::move(message),
-                                         boost::asio::use_awaitable);
+    // the same bytes go to every subscriber, nothing is copied
+    for (const auto &message : messages) {
+      lowest.expires_after(PUSH_WRITE_TIMEOUT);
+      co_await socket.async_write(
+          boost::asio::buffer(*message),
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      lowest.expires_never();
+      if (ec) {
+        break;
+      }
+    }
+  }
+
+  // closing makes the pending read end once the client answers
+  if (reading) {
+    co_await socket.async_close(
+        reason, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  }
+  if (reading) {
+    co_await read_done.async_wait(
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  }
+  logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+              " unsubscribes from updates");
+}
+
+template <class Stream>
+boost::asio::awaitable<void> do_http1(Stream &stream,
+                                      boost::beast::flat_buffer &buffer,
+                                      const std::string &peer_ip,
+                                      const U16 peer_port) {
+  const auto executor = co_await boost::asio::this_coro::executor;
+  auto &&lowest = boost::beast::get_lowest_layer(stream);
 
-      if (!is_keepalive) {
+  for (;;) {
+    // set timeout
+    lowest.expires_after(std::chrono::seconds(1));
+
+    // every request runs to completion on the configuration it started
+    // with, even if a reload publishes another one meanwhile
+    const auto config = environment::current();
+
+    // decide if this request's phases get traced
+    auto trace_context = trace::sample(config->trace_sample_rate);
+
+    // HTTP requests require a read of headers
+    boost::beast::http::request_parser<boost::beast::http::string_body> parser;
+    parser.body_limit(server_gen::MAX_REQUEST_BODY);
+    {
+      trace::span span{"async_read", trace_context};
+
+      // draining cancels the read while no byte of a request has come in,
+      // the wakeup only touches the session while this block still runs
+      const auto waiting = std::make_shared<bool>(true);
+      const drain_watch watch{
+          [executor, weak = std::weak_ptr{waiting}, &lowest, &parser] {
+            boost::asio::post(executor, [weak, &lowest, &parser] {
+              if (weak.lock() && !parser.got_some()) {
+                lowest.cancel();
+              }
+            });
+          }};
+      if (handoff::draining() && buffer.size() == 0) {
+        break;
+      }
+
+      boost::system::error_code ec{};
+      co_await boost::beast::http::async_read(
+          stream, buffer, parser,
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      if (ec == boost::asio::error::operation_aborted &&
+          handoff::draining() && !parser.got_some()) {
         logger::log(logger::severity::debug, peer_ip, ":", peer_port,
-                    " done with sending");
+                    " was idle while draining");
         break;
       }
+      if (ec) {
+        throw boost::system::system_error{ec};
+      }
+    }
+    auto request = parser.release();
+
+    // a subscriber to updates keeps the connection to itself from here on
+    const auto target = request.target();
+    if (boost::beast::websocket::is_upgrade(request) &&
+        target.substr(0, target.find('?')) == push::PATH &&
+        !handoff::draining() &&
+        server_gen::origin_allowed(*config, request["origin"], peer_ip)) {
+      co_await do_push(stream, std::move(request), peer_ip, peer_port);
+      break;
+    }
+
+    // what the request uses is accounted for until its response is sent
+    accounting::ledger ledger{trace_context};
+
+    // handle request, a handler that offloads its work suspends only this
+    // connection
+    auto message = co_await [&]()
+        -> boost::asio::awaitable<boost::beast::http::message_generator> {
+      trace::span span{"server_gen::handle", trace_context};
+      co_return co_await server_gen::handle(std::move(request), *config,
+                                            peer_ip, peer_port, trace_context);
+    }();
+
+    // determines if connection is done
+    bool is_keepalive = message.keep_alive();
+
+    // send response
+    {
+      trace::span span{"async_write", trace_context};
+      co_await boost::beast::async_write(stream, std::move(message),
+                                         boost::asio::use_awaitable);
+    }
+
+    // after an upgrade the client reconnects to the new process
+    if (!is_keepalive || handoff::draining()) {
+      logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+                  " done with sending");
+      break;
+    }
+  }
+}
+
+template <class Stream>
+boost::asio::awaitable<void> do_http2(Stream &stream,
+                                      boost::beast::flat_buffer &buffer,
+                                      const std::string &peer_ip,
+                                      const U16 peer_port) {
+  // the session's strand, the reader and every stream's response share the
+  // connection on it
+  const auto executor = co_await boost::asio::this_coro::executor;
+  auto &&lowest = boost::beast::get_lowest_layer(stream);
+  lowest.expires_never();
+  http2::connection connection{peer_ip, peer_port};
+  logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+              " speaks HTTP/2");
+
+  // woken by cancelling its wait whenever there may be bytes to send
+  boost::asio::steady_timer wake{executor,
+                                 boost::asio::steady_timer::time_point::max()};
+
+  // draining wakes it too, so even an idle connection sends GOAWAY at once
+  const auto watching = std::make_shared<bool>(true);
+  const drain_watch watch{[executor, weak = std::weak_ptr{watching}, &wake] {
+    boost::asio::post(executor, [weak, &wake] {
+      if (weak.lock()) {
+        wake.cancel();
+      }
+    });
+  }};
+  std::size_t responding = 0;
+  bool reading = true;
+  bool done = false;
+  std::exception_ptr failed{};
+
+  // each stream is answered as soon as its request ends, one that offloads
+  // its work holds up neither the other streams nor PING, SETTINGS and
+  // WINDOW_UPDATE
+  const auto respond = [&](const S32 stream_id) {
+    responding++;
+    boost::asio::co_spawn(executor, connection.respond(stream_id),
+                          [&](std::exception_ptr e) {
+                            responding--;
+                            if (e && !failed) {
+                              failed = e;
+                            }
+                            wake.cancel();
+                          });
+  };
+
+  boost::asio::co_spawn(
+      executor,
+      [&]() -> boost::asio::awaitable<void> {
+        try {
+          for (;;) {
+            if (buffer.size() > 0) {
+              connection.receive(buffer.data().data(), buffer.size());
+              buffer.consume(buffer.size());
+            }
+            for (const auto stream_id : connection.finished()) {
+              respond(stream_id);
+            }
+            wake.cancel();
+            buffer.commit(co_await stream.async_read_some(
+                buffer.prepare(16384), boost::asio::use_awaitable));
+          }
+        } catch (...) {
+          if (!done && !failed) {
+            failed = std::current_exception();
+          }
+        }
+        reading = false;
+        wake.cancel();
+      },
+      boost::asio::detached);
+
+  while (!failed && reading) {
+    // after an upgrade the client opens new streams on the new process
+    if (handoff::draining()) {
+      connection.drain();
+    }
+
+    boost::system::error_code ec{};
+    for (auto out = connection.pending(); out.size() > 0 && !ec;
+         out = connection.pending()) {
+      lowest.expires_after(HTTP2_WRITE_TIMEOUT);
+      co_await boost::asio::async_write(
+          stream, out,
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      lowest.expires_never();
+    }
+    if (ec && !failed) {
+      failed = std::make_exception_ptr(boost::system::system_error{ec});
+    }
+    if (failed || !connection.alive()) {
+      break;
+    }
+
+    // a connection with nothing in flight gets the same treatment as an idle
+    // keep-alive, GOAWAY and then closed
+    if (responding == 0) {
+      wake.expires_after(HTTP2_IDLE_TIMEOUT);
+    } else {
+      wake.expires_at(boost::asio::steady_timer::time_point::max());
+    }
+    co_await wake.async_wait(
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (!ec) {
+      connection.drain();
+    }
+  }
+
+  // the reader and every response use the connection, so they end first
+  done = true;
+  lowest.cancel();
+  while (reading || responding > 0) {
+    wake.expires_at(boost::asio::steady_timer::time_point::max());
+    boost::system::error_code ec{};
+    co_await wake.async_wait(
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  }
+  if (failed) {
+    std::rethrow_exception(failed);
+  }
+}
+
+template <class Stream> boost::asio::awaitable<void> do_session(Stream stream) {
+  const session_count counted{};
+  auto &&lowest = boost::beast::get_lowest_layer(stream);
+  const auto peer_ip = lowest.socket().remote_endpoint().address().to_string();
+  const auto peer_port = lowest.socket().remote_endpoint().port();
+  logger::log(logger::severity::debug, peer_ip, ":", peer_port, " connects");
+  boost::beast::flat_buffer buffer;
+
+  try {
+    auto use_http2 = false;
+
+    if constexpr (std::is_same_v<Stream, tls_stream>) {
+      lowest.expires_after(std::chrono::seconds(5));
+      co_await stream.async_handshake(boost::asio::ssl::stream_base::server,
+                                      boost::asio::use_awaitable);
+      logger::log(logger::severity::debug, peer_ip, ":", peer_port,
+                  SSL_session_reused(stream.native_handle())
+                      ? " resumed a TLS session"
+                      : " negotiated a new TLS session",
+                  tls::ktls_active(stream.native_handle())
+                      ? " with kTLS offload"
+                      : "");
+      use_http2 = tls::negotiated_http2(stream.native_handle());
+    } else if (environment::current()->http2) {
+      lowest.expires_after(std::chrono::seconds(1));
+      use_http2 = co_await detect_http2(stream, buffer);
+    }
+
+    if (use_http2) {
+      co_await do_http2(stream, buffer, peer_ip, peer_port);
+    } else {
+      co_await do_http1(stream, buffer, peer_ip, peer_port);
     }
   } catch (boost::system::system_error &e) {
     const auto code = e.code();
@@ -59,59 +509,280 @@ do_session(tcp_stream stream, const environment::configuration &config) {
       co_return;
     }
 
-    if (code != boost::beast::http::error::end_of_stream) {
+    // TLS peers often skip close_notify and HTTP/2 peers just hang up, those
+    // are normal ends of stream too
+    if (code != boost::beast::http::error::end_of_stream &&
+        code != boost::asio::error::eof &&
+        code != boost::asio::ssl::error::stream_truncated) {
       throw e;
     }
   }
 
   logger::log(logger::severity::debug, peer_ip, ":", peer_port, " disconnects");
-  stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send);
+  if constexpr (std::is_same_v<Stream, tls_stream>) {
+    boost::system::error_code ec;
+    co_await stream.async_shutdown(
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  } else {
+    // a closed WebSocket already tore the connection down
+    boost::system::error_code ec;
+    stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+  }
+}
+
+boost::asio::awaitable<void> do_refuse(boost::asio::ip::tcp::socket socket,
+                                       const U32 retry_after) {
+  const auto response = rate_limit::rendered_response(retry_after);
+
+  // best effort, a throttled client that stops reading just gets dropped
+  boost::system::error_code ec;
+  co_await boost::asio::async_write(
+      socket, boost::asio::buffer(response.data(), response.size()),
+      boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+  socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+}
+
+/// @brief Listens on an endpoint, adopting the socket the previous process
+/// handed over if there's one for it
+static void listen_on(std::list<listener> &listeners,
+                      boost::asio::io_context &io_context,
+                      const boost::asio::ip::tcp::endpoint &endpoint,
+                      std::optional<handoff::inherited> &inherited) {
+  auto strand = boost::asio::make_strand(io_context);
+  auto &made = listeners.emplace_back(
+      listener{strand, boost::asio::ip::tcp::acceptor{strand}});
+
+  const auto adopted = inherited ? inherited->take(endpoint) : -1;
+  if (adopted >= 0) {
+    made.acceptor.assign(endpoint.protocol(), adopted);
+    logger::log(logger::severity::notice, "Adopted the listener on port ",
+                endpoint.port());
+    return;
+  }
+
+  made.acceptor.open(endpoint.protocol());
+  made.acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+  made.acceptor.bind(endpoint);
+  made.acceptor.listen(boost::asio::socket_base::max_listen_connections);
 }
 
 boost::asio::awaitable<void>
-do_listen(boost::asio::ip::tcp::endpoint endpoint,
-          const environment::configuration &config) {
-  auto acceptor =
-      boost::asio::use_awaitable.as_default_on(boost::asio::ip::tcp::acceptor(
-          co_await boost::asio::this_coro::executor));
-  acceptor.open(endpoint.protocol());
-  acceptor.set_option(boost::asio::socket_base::reuse_address(true));
-  acceptor.bind(endpoint);
-  acceptor.listen(boost::asio::socket_base::max_listen_connections);
+do_listen(listener &listening, boost::asio::any_io_executor executor,
+          boost::asio::ssl::context *tls_context) {
+  auto &acceptor = listening.acceptor;
 
   for (;;) {
-    boost::asio::co_spawn(
-        acceptor.get_executor(),
-        do_session(tcp_stream{co_await acceptor.async_accept()}, config),
-        [](std::exception_ptr e) {
-          if (e) {
-            std::rethrow_exception(e);
-          }
-        });
+    // sessions run on the whole pool, each on its own strand rather than the
+    // acceptor's, so what's posted to a session never runs beside it
+    boost::system::error_code accept_ec;
+    auto socket = co_await acceptor.async_accept(
+        boost::asio::any_io_executor{boost::asio::make_strand(executor)},
+        boost::asio::redirect_error(boost::asio::use_awaitable, accept_ec));
+    if (accept_ec) {
+      // an upgrade closed the acceptor, the new process accepts from here on
+      if (handoff::draining()) {
+        co_return;
+      }
+      throw boost::system::system_error{accept_ec};
+    }
+
+    // clients already out of tokens don't get a session at all, a TLS client
+    // couldn't read a plaintext 429 so it's just dropped
+    boost::system::error_code ec;
+    const auto peer = socket.remote_endpoint(ec);
+    const auto wait =
+        ec ? std::nullopt
+           : rate_limit::exhausted(environment::current()->rate_limit,
+                                   peer.address());
+    if (wait && tls_context) {
+      socket.close(ec);
+      continue;
+    }
+    if (wait) {
+      boost::asio::co_spawn(executor, do_refuse(std::move(socket), *wait),
+                            boost::asio::detached);
+      continue;
+    }
+
+    const auto on_done = [](std::exception_ptr e) {
+      if (e) {
+        std::rethrow_exception(e);
+      }
+    };
+    const auto strand = socket.get_executor();
+    if (tls_context) {
+      boost::asio::co_spawn(
+          strand,
+          do_session(tls_stream{tcp_stream{std::move(socket)}, *tls_context}),
+          on_done);
+    } else {
+      boost::asio::co_spawn(strand, do_session(tcp_stream{std::move(socket)}),
+                            on_done);
+    }
+  }
+}
+
+/// @brief Hands the listening sockets to a new process started from the
+/// binary on disk, then drains this one and stops it
+boost::asio::awaitable<void> do_upgrade(std::list<listener> &listeners,
+                                        std::atomic<bool> &run) {
+  std::vector<int> sockets{};
+  for (auto &each : listeners) {
+    sockets.emplace_back(each.acceptor.native_handle());
+  }
+  const auto next = handoff::spawn(sockets);
+  logger::log(logger::severity::notice, "Upgrading to process ", next.pid);
+
+  // both sides block on the channel, so they're waited on off the
+  // connection threads
+  if (!co_await worker::offload(
+          [next] { return handoff::await_listening(next); })) {
+    logger::log(logger::severity::error,
+                "The new process never listened, keeping this one");
+    co_return;
+  }
+
+  handoff::drain();
+  wake_drained();
+  push::close();
+  for (auto &each : listeners) {
+    boost::asio::post(each.strand, [&acceptor = each.acceptor] {
+      boost::system::error_code ec;
+      acceptor.close(ec);
+    });
+  }
+
+  // an ingest or metadata post that got past the draining check may still
+  // be copying into the storage directory, later jobs are refused writes
+  boost::asio::steady_timer timer{co_await boost::asio::this_coro::executor};
+  const auto fence = worker::fence();
+  while (!worker::settled(fence)) {
+    timer.expires_after(DRAIN_POLL);
+    co_await timer.async_wait(boost::asio::use_awaitable);
+  }
+
+  co_await worker::offload([next] {
+    storage::stop();
+    views::stop();
+    catalog::open(*environment::current())->seal();
+    handoff::release(next);
+  });
+  logger::log(logger::severity::notice, "Handed over to process ", next.pid,
+              ", draining ", sessions.load(std::memory_order_relaxed),
+              " sessions");
+
+  const auto deadline = std::chrono::steady_clock::now() + DRAIN_DEADLINE;
+  while (sessions.load(std::memory_order_relaxed) > 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    timer.expires_after(DRAIN_POLL);
+    co_await timer.async_wait(boost::asio::use_awaitable);
+  }
+
+  logger::log(logger::severity::notice, "Drained, ",
+              sessions.load(std::memory_order_relaxed),
+              " sessions were cut off");
+  run = false;
+}
+
+boost::asio::awaitable<void> do_signals(std::list<listener> &listeners,
+                                        std::atomic<bool> &run) {
+  boost::asio::signal_set signals{co_await boost::asio::this_coro::executor,
+                                  SIGUSR1, SIGHUP, SIGUSR2};
+
+  for (;;) {
+    const auto signal = co_await signals.async_wait(boost::asio::use_awaitable);
+
+    if (signal == SIGUSR1) {
+      trace::dump("trace.json");
+    } else if (signal == SIGHUP) {
+      try {
+        environment::reload();
+      } catch (const std::exception &e) {
+        logger::log(logger::severity::error,
+                    "Configuration reload failed, keeping the current one");
+        exception_handler::print_nested(e);
+      }
+    } else if (signal == SIGUSR2 && !upgrading.exchange(true)) {
+      boost::asio::co_spawn(
+          co_await boost::asio::this_coro::executor,
+          do_upgrade(listeners, run), [](std::exception_ptr e) {
+            if (e) {
+              logger::log(logger::severity::error,
+                          "Upgrade failed, keeping this process");
+              try {
+                std::rethrow_exception(e);
+              } catch (const std::exception &failed) {
+                exception_handler::print_nested(failed);
+              }
+            }
+            upgrading = handoff::draining();
+          });
+    }
   }
 }
 
-void server::start(const environment::configuration &config,
-                   std::atomic<bool> &run) {
+void server::start(std::atomic<bool> &run) {
+  const auto config = environment::current();
   logger::log(logger::severity::notice, "Spinning up server with ",
-              config.threads, " threads...");
-  boost::asio::io_context io_context{config.threads};
+              config->threads, " threads...");
+  boost::asio::io_context io_context{config->threads};
+
+  // listeners are adopted from the process being upgraded, if any, then
+  // connections queue in their backlog until the I/O context runs
+  auto inherited = handoff::receive();
+  std::list<listener> listeners{};
+  listen_on(listeners, io_context,
+            boost::asio::ip::tcp::endpoint{config->listen_address,
+                                           config->listen_port},
+            inherited);
+  if (config->tls.enabled) {
+    listen_on(listeners, io_context,
+              boost::asio::ip::tcp::endpoint{config->listen_address,
+                                             config->tls.port},
+              inherited);
+  }
+  if (inherited) {
+    inherited->take_over();
+    logger::log(logger::severity::notice,
+                "Took over from the upgraded process");
+  }
+
+  // the catalog is opened before the first request can wait on it, search
+  // fills in from it in the background
+  search::open(*config);
+  views::start(*config);
 
+  const auto on_done = [](std::exception_ptr e) {
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  };
   boost::asio::co_spawn(
-      io_context,
-      do_listen(boost::asio::ip::tcp::endpoint{config.listen_address,
-                                               config.listen_port},
-                config),
-      [&io_context](std::exception_ptr e) {
-        if (e) {
-          std::rethrow_exception(e);
-        }
-      });
+      listeners.front().strand,
+      do_listen(listeners.front(), io_context.get_executor(), nullptr),
+      on_done);
+
+  // HTTPS shares one TLS context, and with it the session cache
+  std::unique_ptr<boost::asio::ssl::context> tls_context{nullptr};
+  if (config->tls.enabled) {
+    tls_context = tls::make_context(config->tls, config->http2);
+    logger::log(logger::severity::notice, "Serving HTTPS on port ",
+                config->tls.port);
+
+    boost::asio::co_spawn(listeners.back().strand,
+                          do_listen(listeners.back(),
+                                    io_context.get_executor(),
+                                    tls_context.get()),
+                          on_done);
+  }
+
+  // SIGUSR2 upgrades to the binary on disk
+  boost::asio::co_spawn(io_context, do_signals(listeners, run), on_done);
 
   std::vector<std::thread> thread_pool{};
-  thread_pool.reserve(config.threads - 1);
+  thread_pool.reserve(config->threads - 1);
 
-  for (auto thr = config.threads - 1; thr > 0; --thr) {
+  for (auto thr = config->threads - 1; thr > 0; --thr) {
     thread_pool.emplace_back([&io_context] { io_context.run(); });
   }
 
@@ -0,0 +1,81 @@
+#include "../include/server_gen.hpp"
+using namespace cobble;
+
+bool server_gen::origin_allowed(const environment::configuration &config,
+                                std::string_view origin,
+                                const std::string &peer_ip) {
+  if (std::holds_alternative<std::forward_list<std::string>>(
+          config.cors_entries)) {
+    // holding DNS entries
+    const auto &cors =
+        std::get<std::forward_list<std::string>>(config.cors_entries);
+    for (const auto &entry : cors) {
+      if (origin == entry || entry == "*") {
+        return true;
+      }
+    }
+  } else {
+    // holding IP address ranges
+    const auto ip_converted = boost::asio::ip::make_address(peer_ip);
+    const auto &cors =
+        std::get<environment::cidr_network_list>(config.cors_entries);
+
+    if (ip_converted.is_v4()) {
+      // peer is IPv4 so we need to use IPv4 ranges
+      for (const auto &cidr : cors.v4) {
+        auto hosts = cidr.hosts();
+        if (hosts.find(ip_converted.to_v4()) != hosts.end()) {
+          return true;
+        }
+      }
+    } else {
+      // peer is IPv6 so we need to use IPv6 ranges
+      for (const auto &cidr : cors.v6) {
+        auto hosts = cidr.hosts();
+        if (hosts.find(ip_converted.to_v6()) != hosts.end()) {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+bool server_gen::none_match(std::string_view if_none_match,
+                            std::string_view etag) {
+  // weak comparison, a tag matches whether or not either side is weak
+  if (etag.starts_with("W/")) {
+    etag.remove_prefix(2);
+  }
+
+  std::size_t at = 0;
+  while (at < if_none_match.size()) {
+    const auto c = if_none_match[at];
+    if (c == ' ' || c == '\t' || c == ',') {
+      at++;
+      continue;
+    }
+    if (c == '*') {
+      return true;
+    }
+    if (if_none_match.substr(at).starts_with("W/")) {
+      at += 2;
+    }
+
+    // tags may hold commas, so they're read quote to quote
+    if (at >= if_none_match.size() || if_none_match[at] != '"') {
+      return false;
+    }
+    const auto end = if_none_match.find('"', at + 1);
+    if (end == std::string_view::npos) {
+      return false;
+    }
+    if (if_none_match.substr(at, end + 1 - at) == etag) {
+      return true;
+    }
+    at = end + 1;
+  }
+
+  return false;
+}
@@ -0,0 +1,91 @@
+#include "../include/splice.hpp"
+#include "../include/accounting.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+using namespace cobble;
+
+std::string_view splice::body::value_type::_head_bytes() const {
+  return _shared ? std::string_view{*_shared} : std::string_view{_head};
+}
+
+std::string &splice::body::value_type::head() { return _head; }
+
+void splice::body::value_type::share(
+    std::shared_ptr<const std::string> bytes) {
+  _shared = std::move(bytes);
+}
+
+void splice::body::value_type::use(
+    std::shared_ptr<const descriptor::file> which) {
+  _file = std::move(which);
+}
+
+void splice::body::value_type::add(U64 offset, U64 length) {
+  if (length == 0) {
+    return;
+  }
+
+  // samples of a track usually sit back to back in their chunks
+  if (!_ranges.empty() &&
+      _ranges.back().first + _ranges.back().second == offset) {
+    _ranges.back().second += length;
+  } else {
+    _ranges.emplace_back(offset, length);
+  }
+}
+
+U64 splice::body::value_type::size() const {
+  U64 total = _head_bytes().size();
+  for (const auto &[offset, length] : _ranges) {
+    total += length;
+  }
+  return total;
+}
+
+boost::asio::const_buffer splice::body::value_type::take_head() {
+  const auto head = _head_bytes().substr(_head_offset);
+  _head_offset += head.size();
+  return boost::asio::const_buffer{head.data(), head.size()};
+}
+
+void splice::body::value_type::charge_to(U64 request) { _request = request; }
+
+std::size_t splice::body::value_type::read(void *buffer, std::size_t length,
+                                           boost::beast::error_code &ec) {
+  accounting::scope counted{_request};
+  auto *out = static_cast<char *>(buffer);
+  std::size_t written = 0;
+  ec = {};
+
+  if (const auto head = _head_bytes(); _head_offset < head.size()) {
+    const auto copied = std::min(length, head.size() - _head_offset);
+    std::memcpy(out, head.data() + _head_offset, copied);
+    _head_offset += copied;
+    written += copied;
+  }
+
+  while (written < length && _range < _ranges.size()) {
+    const auto &[offset, range_length] = _ranges[_range];
+    const auto wanted =
+        std::min<U64>(length - written, range_length - _range_offset);
+    const auto got =
+        _file->read(offset + _range_offset, out + written, wanted, ec);
+    if (ec) {
+      return written;
+    }
+    if (got == 0) {
+      ec = boost::asio::error::eof;
+      return written;
+    }
+
+    _range_offset += got;
+    written += got;
+    if (_range_offset == range_length) {
+      _range++;
+      _range_offset = 0;
+    }
+  }
+
+  return written;
+}
@@ -0,0 +1,896 @@
+#include "../include/storage.hpp"
+#include "../include/ingest.hpp"
+#include "../include/logger.hpp"
+#include "../include/timekeeper.hpp"
+#include "../include/worker.hpp"
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+using namespace cobble;
+
+using tcp_stream = typename boost::beast::tcp_stream::rebind_executor<
+    boost::asio::use_awaitable_t<>::executor_with_default<
+        boost::asio::any_io_executor>>::other;
+
+/// @brief Largest object kept in memory, thumbnails are far smaller
+constexpr U64 MAX_MEMORY_OBJECT = 1024 * 1024;
+
+/// @brief How long an object in memory is trusted before its file is checked
+/// again
+constexpr U64 REVALIDATE_MS = 1000;
+
+/// @brief Threads fetching from the object store, so that a slow fetch never
+/// holds up the others
+constexpr std::size_t FETCH_THREADS = 4;
+
+/// @brief Most fetches waiting for a thread
+constexpr std::size_t MAX_QUEUED_FETCHES = 1024;
+
+/// @brief How long an object the object store doesn't have is remembered
+constexpr U64 MISSING_FOR_MS = 5000;
+
+/// @brief Objects remembered as missing from the object store
+constexpr std::size_t MAX_MISSING = 65536;
+
+/// @brief How long an object store listing is used before it's refreshed
+constexpr U64 LISTING_FOR_MS = 30000;
+
+/// @brief How long the object store may go silent during a request
+constexpr std::chrono::seconds REMOTE_TIMEOUT{30};
+
+/// @brief Suffix of objects still being downloaded into the storage directory
+constexpr std::string_view PARTIAL = ".part";
+
+/// @brief Signed in place of a payload hash, requests here have no body
+constexpr const char *UNSIGNED_PAYLOAD = "UNSIGNED-PAYLOAD";
+
+/// @brief Headers covered by request signatures, sorted
+constexpr const char *SIGNED_HEADERS = "host;x-amz-content-sha256;x-amz-date";
+
+/// @brief Cache counters, relaxed since they're only ever reported
+struct counters {
+  std::atomic<U64> memory_hits{0};
+  std::atomic<U64> memory_misses{0};
+  std::atomic<U64> memory_evicted{0};
+  std::atomic<U64> disk_hits{0};
+  std::atomic<U64> disk_evicted{0};
+  std::atomic<U64> fetched{0};
+  std::atomic<U64> failed{0};
+  std::atomic<U64> missing{0};
+  std::atomic<U64> dropped{0};
+};
+
+/// @brief Stats a regular file
+/// @return Its status, or nothing if it isn't there
+static std::optional<struct stat> status_of(const std::filesystem::path &path) {
+  struct stat status;
+  if (::stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) {
+    return std::nullopt;
+  }
+  return status;
+}
+
+/// @brief Reads a whole file into memory, with its content hash
+/// @return The bytes, or nothing if the file isn't `size` bytes long anymore
+static std::shared_ptr<const std::string>
+read_whole(const std::filesystem::path &path, U64 size, std::string &hash) {
+  const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  hash = ingest::hash_of(fd);
+
+  std::string bytes(size, '\0');
+  U64 offset = 0;
+  while (offset < size) {
+    const auto got = ::read(fd, bytes.data() + offset, size - offset);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    offset += got;
+  }
+  ::close(fd);
+
+  if (offset != size) {
+    return nullptr;
+  }
+  return std::make_shared<const std::string>(std::move(bytes));
+}
+
+static std::string hex(std::string_view bytes) {
+  constexpr char HEX[] = "0123456789abcdef";
+  std::string out{};
+  out.reserve(bytes.size() * 2);
+  for (const unsigned char c : bytes) {
+    out += HEX[c >> 4];
+    out += HEX[c & 0xF];
+  }
+  return out;
+}
+
+static std::string sha256(std::string_view data) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char *>(data.data()), data.size(),
+         digest);
+  return std::string{reinterpret_cast<const char *>(digest), sizeof(digest)};
+}
+
+static std::string hmac_sha256(std::string_view key, std::string_view data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int length = 0;
+  HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()),
+       reinterpret_cast<const unsigned char *>(data.data()), data.size(),
+       digest, &length);
+  return std::string{reinterpret_cast<const char *>(digest), length};
+}
+
+/// @brief Percent-encodes everything but RFC3986 unreserved characters, the
+/// way request signatures expect
+static std::string uri_encode(std::string_view text, bool keep_slashes) {
+  constexpr char HEX[] = "0123456789ABCDEF";
+  std::string out{};
+  for (const unsigned char c : text) {
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+        (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' ||
+        c == '~' || (keep_slashes && c == '/')) {
+      out += c;
+    } else {
+      out += '%';
+      out += HEX[c >> 4];
+      out += HEX[c & 0xF];
+    }
+  }
+  return out;
+}
+
+/// @brief Undoes the XML escapes object store listings use
+static std::string xml_text(std::string_view text) {
+  constexpr std::pair<std::string_view, char> ENTITIES[]{
+      {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'},
+      {"&apos;", '\''}};
+
+  std::string out{};
+  for (std::size_t i = 0; i < text.size();) {
+    bool replaced = false;
+    for (const auto &[entity, c] : ENTITIES) {
+      if (text.substr(i).starts_with(entity)) {
+        out += c;
+        i += entity.size();
+        replaced = true;
+        break;
+      }
+    }
+    if (!replaced) {
+      out += text[i++];
+    }
+  }
+  return out;
+}
+
+/// @brief Every element's text in a flat XML document
+static std::vector<std::string> xml_elements(std::string_view document,
+                                             std::string_view name) {
+  const auto open = "<" + std::string{name} + ">";
+  const auto close = "</" + std::string{name} + ">";
+
+  std::vector<std::string> found{};
+  for (auto start = document.find(open); start != std::string_view::npos;
+       start = document.find(open, start)) {
+    start += open.size();
+    const auto end = document.find(close, start);
+    if (end == std::string_view::npos) {
+      break;
+    }
+    found.emplace_back(xml_text(document.substr(start, end - start)));
+    start = end + close.size();
+  }
+  return found;
+}
+
+/// @brief A client for the few S3 requests we need, signed with AWS Signature
+/// Version 4. Every call blocks, so it's only used on fetch threads.
+class s3_client {
+  environment::s3_settings _settings;
+
+  std::string _authority() const {
+    return _settings.port == 80
+               ? _settings.host
+               : _settings.host + ":" + std::to_string(_settings.port);
+  }
+
+  void _sign(boost::beast::http::request<boost::beast::http::empty_body> &which,
+             const std::string &uri, const std::string &query) const {
+    const auto now =
+        std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char stamp[17];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &utc);
+    const std::string amz_date{stamp};
+    const auto date = amz_date.substr(0, 8);
+    const auto host = _authority();
+
+    const auto canonical = "GET\n" + uri + "\n" + query + "\nhost:" + host +
+                           "\nx-amz-content-sha256:" + UNSIGNED_PAYLOAD +
+                           "\nx-amz-date:" + amz_date + "\n\n" +
+                           SIGNED_HEADERS + "\n" + UNSIGNED_PAYLOAD;
+    const auto scope = date + "/" + _settings.region + "/s3/aws4_request";
+    const auto to_sign = "AWS4-HMAC-SHA256\n" + amz_date + "\n" + scope +
+                         "\n" + hex(sha256(canonical));
+
+    auto key = hmac_sha256("AWS4" + _settings.secret_key, date);
+    key = hmac_sha256(key, _settings.region);
+    key = hmac_sha256(key, "s3");
+    key = hmac_sha256(key, "aws4_request");
+
+    which.set(boost::beast::http::field::host, host);
+    which.set("x-amz-content-sha256", UNSIGNED_PAYLOAD);
+    which.set("x-amz-date", amz_date);
+    which.set(boost::beast::http::field::authorization,
+              "AWS4-HMAC-SHA256 Credential=" + _settings.access_key + "/" +
+                  scope + ", SignedHeaders=" + SIGNED_HEADERS +
+                  ", Signature=" + hex(hmac_sha256(key, to_sign)));
+  }
+
+  template <class Body>
+  boost::asio::awaitable<void>
+  _exchange(std::string uri, std::string query,
+            boost::beast::http::response_parser<Body> &parser) const {
+    const auto executor = co_await boost::asio::this_coro::executor;
+    boost::asio::ip::tcp::resolver resolver{executor};
+    tcp_stream stream{executor};
+
+    const auto endpoints = co_await resolver.async_resolve(
+        _settings.host, std::to_string(_settings.port),
+        boost::asio::use_awaitable);
+    stream.expires_after(REMOTE_TIMEOUT);
+    co_await stream.async_connect(endpoints);
+
+    boost::beast::http::request<boost::beast::http::empty_body> request{
+        boost::beast::http::verb::get, query.empty() ? uri : uri + "?" + query,
+        11};
+    _sign(request, uri, query);
+    stream.expires_after(REMOTE_TIMEOUT);
+    co_await boost::beast::http::async_write(stream, request);
+
+    // the timeout is per read, large objects take as long as they take
+    boost::beast::flat_buffer buffer;
+    stream.expires_after(REMOTE_TIMEOUT);
+    co_await boost::beast::http::async_read_header(stream, buffer, parser);
+    while (!parser.is_done()) {
+      stream.expires_after(REMOTE_TIMEOUT);
+      co_await boost::beast::http::async_read_some(stream, buffer, parser);
+    }
+
+    boost::beast::error_code ec;
+    stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  }
+
+  template <class Body>
+  void _get(const std::string &uri, const std::string &query,
+            boost::beast::http::response_parser<Body> &parser) const {
+    boost::asio::io_context context{1};
+    std::exception_ptr failure{};
+    boost::asio::co_spawn(context, _exchange(uri, query, parser),
+                          [&failure](std::exception_ptr e) { failure = e; });
+    context.run();
+    if (failure) {
+      std::rethrow_exception(failure);
+    }
+  }
+
+public:
+  s3_client(const environment::s3_settings &settings) : _settings{settings} {}
+
+  /// @brief Downloads an object into a file, throws on errors
+  /// @return If the object existed
+  bool download(const std::string &key,
+                const std::filesystem::path &destination) const {
+    boost::beast::http::response_parser<boost::beast::http::file_body>
+        parser{};
+    parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+
+    boost::beast::error_code ec;
+    parser.get().body().open(destination.c_str(),
+                             boost::beast::file_mode::write, ec);
+    if (ec) {
+      throw std::runtime_error{ec.message()};
+    }
+    _get("/" + _settings.bucket + "/" + uri_encode(key, true), "", parser);
+    parser.get().body().close();
+
+    const auto status = parser.get().result();
+    if (status == boost::beast::http::status::ok) {
+      return true;
+    }
+
+    std::error_code removed;
+    std::filesystem::remove(destination, removed);
+    if (status == boost::beast::http::status::not_found) {
+      return false;
+    }
+    throw std::runtime_error{"Object store answered HTTP " +
+                             std::to_string(parser.get().result_int())};
+  }
+
+  /// @brief Lists every object under a prefix, throws on errors
+  /// @return Their keys
+  std::vector<std::string> list(const std::string &prefix) const {
+    std::vector<std::string> keys{};
+    std::string token{};
+
+    do {
+      // parameters sorted by name, as signatures expect
+      std::string query{};
+      if (!token.empty()) {
+        query += "continuation-token=" + uri_encode(token, false) + "&";
+      }
+      query += "list-type=2&prefix=" + uri_encode(prefix, false);
+
+      boost::beast::http::response_parser<boost::beast::http::string_body>
+          parser{};
+      _get("/" + _settings.bucket, query, parser);
+      if (parser.get().result() != boost::beast::http::status::ok) {
+        throw std::runtime_error{"Object store answered HTTP " +
+                                 std::to_string(parser.get().result_int())};
+      }
+
+      const auto &body = parser.get().body();
+      for (auto &&key : xml_elements(body, "Key")) {
+        keys.emplace_back(std::move(key));
+      }
+
+      token.clear();
+      const auto truncated = xml_elements(body, "IsTruncated");
+      const auto next = xml_elements(body, "NextContinuationToken");
+      if (!truncated.empty() && truncated.front() == "true" && !next.empty()) {
+        token = next.front();
+      }
+    } while (!token.empty());
+
+    return keys;
+  }
+};
+
+/// @brief Small, hot objects kept in memory, least recently used out first
+class memory_tier {
+  struct entry {
+    std::shared_ptr<const std::string> bytes;
+    std::string hash;
+    ino_t inode;
+    timespec modified;
+    timekeeper::instant checked;
+    std::list<std::string>::iterator recent;
+  };
+
+  std::mutex _mutex{};
+  std::unordered_map<std::string, entry> _entries{};
+  std::list<std::string> _recent{};
+  U64 _budget;
+  U64 _used = 0;
+  counters &_count;
+
+  void _erase(std::unordered_map<std::string, entry>::iterator which) {
+    _used -= which->second.bytes->size();
+    _recent.erase(which->second.recent);
+    _entries.erase(which);
+  }
+
+public:
+  memory_tier(U64 budget, counters &count) : _budget{budget}, _count{count} {}
+
+  /// @brief Gets an object's bytes and content hash, dropped if its file
+  /// changed
+  /// @return The bytes, or nothing on a miss
+  std::shared_ptr<const std::string> find(const std::string &key,
+                                          const std::filesystem::path &path,
+                                          std::string &hash) {
+    std::shared_ptr<const std::string> found{};
+    ino_t inode = 0;
+    timespec modified{};
+    bool revalidate = false;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto existing = _entries.find(key);
+      if (existing == _entries.end()) {
+        _count.memory_misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      found = existing->second.bytes;
+      hash = existing->second.hash;
+      inode = existing->second.inode;
+      modified = existing->second.modified;
+      revalidate = timekeeper::milliseconds_since(existing->second.checked) >=
+                   REVALIDATE_MS;
+      _recent.splice(_recent.begin(), _recent, existing->second.recent);
+    }
+
+    if (!revalidate) {
+      _count.memory_hits.fetch_add(1, std::memory_order_relaxed);
+      return found;
+    }
+
+    // checked outside the lock, the file is only looked at once a second
+    const auto status = status_of(path);
+    const auto unchanged = status && status->st_ino == inode &&
+                           static_cast<U64>(status->st_size) == found->size() &&
+                           status->st_mtim.tv_sec == modified.tv_sec &&
+                           status->st_mtim.tv_nsec == modified.tv_nsec;
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    const auto existing = _entries.find(key);
+    if (existing == _entries.end() || existing->second.bytes != found) {
+      _count.memory_misses.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    if (!unchanged) {
+      _erase(existing);
+      _count.memory_misses.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    existing->second.checked = timekeeper::now();
+    _count.memory_hits.fetch_add(1, std::memory_order_relaxed);
+    return found;
+  }
+
+  /// @brief Reads an object's file and content hash into memory if it's
+  /// small enough
+  /// @return The bytes, or nothing if it's too large or couldn't be read
+  std::shared_ptr<const std::string> insert(const std::string &key,
+                                            const std::filesystem::path &path,
+                                            const struct stat &status,
+                                            std::string &hash) {
+    const auto size = static_cast<U64>(status.st_size);
+    if (size > MAX_MEMORY_OBJECT || size > _budget) {
+      return nullptr;
+    }
+
+    // read outside the lock, a racing miss only reads the same file twice
+    auto bytes = read_whole(path, size, hash);
+    if (!bytes) {
+      return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (const auto existing = _entries.find(key); existing != _entries.end()) {
+      _erase(existing);
+    }
+    while (_used + size > _budget && !_recent.empty()) {
+      _erase(_entries.find(_recent.back()));
+      _count.memory_evicted.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    _recent.push_front(key);
+    _entries.insert_or_assign(key, entry{.bytes = bytes,
+                                         .hash = hash,
+                                         .inode = status.st_ino,
+                                         .modified = status.st_mtim,
+                                         .checked = timekeeper::now(),
+                                         .recent = _recent.begin()});
+    _used += size;
+    return bytes;
+  }
+
+  /// @brief Bytes held right now
+  U64 used() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _used;
+  }
+};
+
+/// @brief Object store objects downloaded into their own subdirectory of the
+/// storage directory, least recently used deleted first. Nothing outside it
+/// is ever looked at, the catalog, view log and blobs live next to it.
+class disk_tier {
+  struct entry {
+    U64 size;
+    std::list<std::string>::iterator recent;
+  };
+
+  std::mutex _mutex{};
+  std::unordered_map<std::string, entry> _entries{};
+  std::list<std::string> _recent{};
+  std::filesystem::path _directory;
+  U64 _budget;
+  U64 _used = 0;
+  bool _frozen = false;
+  counters &_count;
+
+public:
+  /// @brief Picks up whatever earlier runs downloaded
+  disk_tier(const std::filesystem::path &directory, U64 budget,
+            counters &count)
+      : _directory{directory}, _budget{budget}, _count{count} {
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    for (const auto &file :
+         std::filesystem::recursive_directory_iterator{directory, ec}) {
+      if (!file.is_regular_file(ec)) {
+        continue;
+      }
+
+      // downloads cut short by a restart
+      if (file.path().native().ends_with(PARTIAL)) {
+        std::filesystem::remove(file.path(), ec);
+        continue;
+      }
+      touch(file.path().lexically_relative(directory).generic_string(),
+            file.file_size(ec));
+    }
+  }
+
+  /// @brief Marks an object as just used, deleting the least recently used
+  /// others while the directory is over budget
+  void touch(const std::string &key, U64 size) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (const auto existing = _entries.find(key); existing != _entries.end()) {
+      _used = _used - existing->second.size + size;
+      existing->second.size = size;
+      _recent.splice(_recent.begin(), _recent, existing->second.recent);
+    } else {
+      _recent.push_front(key);
+      _entries.insert_or_assign(key,
+                                entry{.size = size, .recent = _recent.begin()});
+      _used += size;
+    }
+
+    // an open file stays readable after it's deleted, responses finish fine
+    while (!_frozen && _used > _budget && _recent.back() != key) {
+      const auto victim = _entries.find(_recent.back());
+      std::error_code ec;
+      std::filesystem::remove(_directory / victim->first, ec);
+      _used -= victim->second.size;
+      _entries.erase(victim);
+      _recent.pop_back();
+      _count.disk_evicted.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /// @brief Stops deleting anything, the directory belongs to another
+  /// process from here on
+  void freeze() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _frozen = true;
+  }
+
+  /// @brief Bytes held right now
+  U64 used() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _used;
+  }
+};
+
+/// @brief Memory, then the storage directory, then the object store if
+/// there is one. Object store requests only ever happen on fetch threads.
+class tiered : public storage::backend {
+  /// @brief A cached object store listing
+  struct listing {
+    std::vector<std::string> keys;
+    timekeeper::instant refreshed;
+  };
+
+  environment::storage_settings _settings;
+  std::filesystem::path _directory;
+  std::filesystem::path _files;
+  counters _count{};
+  memory_tier _memory;
+  std::optional<s3_client> _remote{};
+  std::optional<disk_tier> _disk{};
+
+  std::mutex _mutex{};
+  std::condition_variable_any _ready{};
+  std::deque<std::string> _queue{};
+  std::unordered_set<std::string> _pending{};
+  std::unordered_map<std::string, timekeeper::instant> _missing{};
+  std::unordered_map<std::string, listing> _listings{};
+  bool _stopped = false;
+
+  // last, so they start after everything they use
+  std::vector<std::jthread> _workers{};
+
+  /// @brief Queues an object, or a listing for keys ending in `/`, to be
+  /// fetched once, the lock must be held
+  void _enqueue(const std::string &key) {
+    if (_stopped || _pending.contains(key)) {
+      return;
+    }
+    if (_queue.size() >= MAX_QUEUED_FETCHES) {
+      _count.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    _pending.insert(key);
+    _queue.emplace_back(key);
+    _ready.notify_one();
+  }
+
+  void _fetch(const std::string &key) {
+    const auto path = _files / key;
+    auto partial = path;
+    partial += PARTIAL;
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    bool found = false;
+    try {
+      found = _remote->download(key, partial);
+    } catch (...) {
+      std::filesystem::remove(partial, ec);
+      throw;
+    }
+
+    if (!found) {
+      _count.missing.fetch_add(1, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (_missing.size() >= MAX_MISSING) {
+        _missing.clear();
+      }
+      _missing.insert_or_assign(key, timekeeper::now());
+      return;
+    }
+
+    // renamed into place whole, readers never see half an object
+    std::filesystem::rename(partial, path);
+    _disk->touch(key, std::filesystem::file_size(path));
+    _count.fetched.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void _refresh(const std::string &prefix) {
+    auto keys = _remote->list(prefix);
+    std::lock_guard<std::mutex> lock{_mutex};
+    _listings.insert_or_assign(prefix,
+                               listing{.keys = std::move(keys),
+                                       .refreshed = timekeeper::now()});
+  }
+
+  void _run(std::stop_token stop) {
+    for (;;) {
+      std::string key{};
+      {
+        std::unique_lock<std::mutex> lock{_mutex};
+        if (!_ready.wait(lock, stop, [this] { return !_queue.empty(); })) {
+          return;
+        }
+        key = std::move(_queue.front());
+        _queue.pop_front();
+      }
+
+      try {
+        if (key.ends_with('/')) {
+          _refresh(key);
+        } else {
+          _fetch(key);
+        }
+      } catch (const std::exception &e) {
+        _count.failed.fetch_add(1, std::memory_order_relaxed);
+        logger::log(logger::severity::warning, "Could not fetch '", key,
+                    "' from the object store: ", e.what());
+      }
+
+      std::lock_guard<std::mutex> lock{_mutex};
+      _pending.erase(key);
+    }
+  }
+
+public:
+  tiered(const environment::configuration &config)
+      : _settings{config.storage}, _directory{config.data_path},
+        _files{storage::local_path(config, "")},
+        _memory{config.storage.memory_cache, _count} {
+    if (_settings.backend != environment::storage_settings::kind::s3) {
+      return;
+    }
+
+    _remote.emplace(_settings.s3);
+    _disk.emplace(_files, _settings.disk_cache, _count);
+    for (std::size_t i = 0; i < FETCH_THREADS; i++) {
+      _workers.emplace_back(
+          [this](std::stop_token stop) { _run(std::move(stop)); });
+    }
+  }
+
+  /// @brief Waits for fetches in progress and stops fetching and evicting,
+  /// later fetches are never started
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _stopped = true;
+      _queue.clear();
+    }
+    for (auto &worker : _workers) {
+      worker.request_stop();
+    }
+    for (auto &worker : _workers) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
+    if (_disk) {
+      _disk->freeze();
+    }
+  }
+
+  /// @brief Checks if this backend was built for a configuration
+  bool serves(const environment::configuration &config) const {
+    return _settings == config.storage && _directory == config.data_path;
+  }
+
+  storage::location locate(const std::string &key, bool small) override {
+    const auto path = _files / key;
+    const auto in_memory = small && _settings.memory_cache > 0;
+    std::string hash{};
+    if (in_memory) {
+      if (auto bytes = _memory.find(key, path, hash)) {
+        return storage::location{
+            .path = path, .bytes = std::move(bytes), .hash = std::move(hash)};
+      }
+    }
+
+    // opening a local file tells if it's there, no need to look twice
+    if (!in_memory && !_remote) {
+      return storage::location{.path = path};
+    }
+
+    if (const auto status = status_of(path)) {
+      if (_disk) {
+        _disk->touch(key, status->st_size);
+        _count.disk_hits.fetch_add(1, std::memory_order_relaxed);
+      }
+      auto bytes =
+          in_memory ? _memory.insert(key, path, *status, hash) : nullptr;
+      return storage::location{
+          .path = path, .bytes = std::move(bytes), .hash = std::move(hash)};
+    }
+    if (!_remote) {
+      return storage::location{.path = path};
+    }
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    const auto missing = _missing.find(key);
+    if (missing != _missing.end() &&
+        timekeeper::milliseconds_since(missing->second) < MISSING_FOR_MS) {
+      return storage::location{};
+    }
+    _enqueue(key);
+    return storage::location{.fetching = true};
+  }
+
+  std::vector<std::string> list(const std::string &prefix) override {
+    if (_remote) {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto found = _listings.find(prefix);
+      if (found == _listings.end() ||
+          timekeeper::milliseconds_since(found->second.refreshed) >=
+              LISTING_FOR_MS) {
+        _enqueue(prefix);
+      }
+      if (found != _listings.end()) {
+        return found->second.keys;
+      }
+    }
+
+    // the storage directory, also while the first listing is fetched
+    std::vector<std::string> keys{};
+    std::error_code ec;
+    for (const auto &file :
+         std::filesystem::directory_iterator{_files / prefix, ec}) {
+      const auto name = file.path().filename().string();
+      if (file.is_regular_file(ec) && !name.ends_with(PARTIAL)) {
+        keys.emplace_back(prefix + name);
+      }
+    }
+    return keys;
+  }
+
+  Json::Value stats() override {
+    Json::Value root;
+    root["backend"] = _remote ? "s3" : "local";
+
+    const auto load = [](const std::atomic<U64> &counter) {
+      return static_cast<Json::UInt64>(
+          counter.load(std::memory_order_relaxed));
+    };
+
+    root["memory"]["hits"] = load(_count.memory_hits);
+    root["memory"]["misses"] = load(_count.memory_misses);
+    root["memory"]["evicted"] = load(_count.memory_evicted);
+    root["memory"]["bytes"] = static_cast<Json::UInt64>(_memory.used());
+
+    if (_remote) {
+      root["disk"]["hits"] = load(_count.disk_hits);
+      root["disk"]["evicted"] = load(_count.disk_evicted);
+      root["disk"]["bytes"] = static_cast<Json::UInt64>(_disk->used());
+
+      root["remote"]["fetched"] = load(_count.fetched);
+      root["remote"]["failed"] = load(_count.failed);
+      root["remote"]["missing"] = load(_count.missing);
+      root["remote"]["dropped"] = load(_count.dropped);
+      std::lock_guard<std::mutex> lock{_mutex};
+      root["remote"]["queued"] = static_cast<Json::UInt64>(_queue.size());
+    }
+
+    return root;
+  }
+};
+/// @brief Deletes a backend on the worker pool once nothing uses it, its
+/// destructor joins its fetch threads and mustn't stall a request thread
+struct retire {
+  void operator()(tiered *replaced) const {
+    boost::asio::post(worker::pool(), [replaced] { delete replaced; });
+  }
+};
+
+/// @brief The current backend, set up after the worker pool so it's
+/// destroyed before it at exit
+static std::atomic<std::shared_ptr<tiered>> &shared() {
+  static std::atomic<std::shared_ptr<tiered>> current{
+      (worker::pool(), std::shared_ptr<tiered>{})};
+  return current;
+}
+
+static std::mutex rebuilding{};
+
+/// @brief If the storage directory was handed over, the backend is kept
+/// whatever the configuration says, rebuilding it would fetch again
+static std::atomic<bool> stopped{false};
+// ============================================================================
+std::filesystem::path
+storage::local_path(const environment::configuration &config,
+                    const std::string &key) {
+  if (config.storage.backend == environment::storage_settings::kind::s3) {
+    return config.data_path / CACHE_DIRECTORY / key;
+  }
+  return config.data_path / key;
+}
+
+std::shared_ptr<storage::backend>
+storage::open(const environment::configuration &config) {
+  auto current = shared().load(std::memory_order_acquire);
+  if (current && (current->serves(config) ||
+                  stopped.load(std::memory_order_acquire))) {
+    return current;
+  }
+
+  std::lock_guard<std::mutex> lock{rebuilding};
+  current = shared().load(std::memory_order_acquire);
+  if (!current || (!current->serves(config) &&
+                   !stopped.load(std::memory_order_relaxed))) {
+    current = std::shared_ptr<tiered>{new tiered{config}, retire{}};
+    shared().store(current, std::memory_order_release);
+  }
+  return current;
+}
+
+void storage::stop() {
+  std::lock_guard<std::mutex> lock{rebuilding};
+  stopped.store(true, std::memory_order_release);
+  if (const auto current = shared().load(std::memory_order_acquire)) {
+    current->stop();
+  }
+}
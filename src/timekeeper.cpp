@@ -0,0 +1,226 @@
+#include "../include/timekeeper.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+using namespace cobble;
+
+/// @brief How often the formatted times are refreshed
+constexpr std::chrono::milliseconds TICK{10};
+
+/// @brief Words of a published text, the first byte holds its size
+constexpr std::size_t WORDS = 8;
+
+/// @brief A short string written by one thread and copied by many, behind a
+/// sequence lock so readers never wait on the writer
+class published_text {
+  std::atomic<U64> _sequence{0};
+  std::atomic<U64> _words[WORDS]{};
+
+public:
+  constexpr published_text() = default;
+
+  void store(std::string_view value) {
+    U64 words[WORDS]{};
+    const auto size = std::min(value.size(), sizeof(words) - 1);
+    auto *bytes = reinterpret_cast<char *>(words);
+    bytes[0] = static_cast<char>(size);
+    std::memcpy(bytes + 1, value.data(), size);
+
+    // odd while the words are being written
+    _sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < WORDS; i++) {
+      _words[i].store(words[i], std::memory_order_relaxed);
+    }
+    _sequence.fetch_add(1, std::memory_order_release);
+  }
+
+  timekeeper::text load() const {
+    U64 words[WORDS];
+    for (;;) {
+      const auto before = _sequence.load(std::memory_order_acquire);
+      if (before & 1) {
+        continue;
+      }
+      for (std::size_t i = 0; i < WORDS; i++) {
+        words[i] = _words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (_sequence.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+
+    timekeeper::text result{};
+    const auto *bytes = reinterpret_cast<const char *>(words);
+    result.size = static_cast<U8>(bytes[0]);
+    std::memcpy(result.data, bytes + 1, result.size);
+    return result;
+  }
+};
+
+// constant-initialized, so logging still works during static destruction
+static published_text log_stamp{};
+static published_text date_stamp{};
+
+static U64 read_counter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  timespec now{};
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return static_cast<U64>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+}
+
+static U64 steady_nanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// @brief Both clocks' readings at startup, for calibrating the counter
+static const U64 counter_origin = read_counter();
+static const U64 steady_origin = steady_nanoseconds();
+
+/// @brief Nanoseconds per counter step, as raw bits of a F64
+static std::atomic<U64> scale_bits{0};
+
+/// @brief Measures the counter's scale against the steady clock over
+/// everything since startup, and publishes it
+/// @return The scale, or zero if the counter hasn't moved yet
+static F64 calibrate() {
+  const auto counted = read_counter() - counter_origin;
+  const auto elapsed = steady_nanoseconds() - steady_origin;
+  if (counted == 0) {
+    return 0.0;
+  }
+
+  const auto scale = static_cast<F64>(elapsed) / static_cast<F64>(counted);
+  U64 bits = 0;
+  std::memcpy(&bits, &scale, sizeof(bits));
+  scale_bits.store(bits, std::memory_order_relaxed);
+  return scale;
+}
+
+static F64 scale() {
+  const auto bits = scale_bits.load(std::memory_order_relaxed);
+  if (bits == 0) {
+    // not ticking yet, the time since startup is a good enough sample
+    return calibrate();
+  }
+  F64 value = 0.0;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/// @brief Formats the current wall time into both published texts
+static void refresh() {
+  const auto now = std::chrono::system_clock::now();
+  const auto seconds = std::chrono::system_clock::to_time_t(now);
+  const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          now.time_since_epoch())
+                          .count() %
+                      1000;
+
+  // the _r variants, localtime and gmtime share a buffer between threads
+  std::tm local{};
+  std::tm utc{};
+  localtime_r(&seconds, &local);
+  gmtime_r(&seconds, &utc);
+
+  char buffer[64]{0};
+  auto size = std::strftime(buffer, sizeof(buffer), "%F %T", &local);
+  size += std::snprintf(buffer + size, sizeof(buffer) - size, ".%03lld",
+                        static_cast<long long>(millis));
+  log_stamp.store({buffer, size});
+
+  // HTTP dates are always in English, strftime's %a and %b follow the locale
+  constexpr const char *DAYS[]{"Sun", "Mon", "Tue", "Wed",
+                               "Thu", "Fri", "Sat"};
+  constexpr const char *MONTHS[]{"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                 "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  size = std::snprintf(buffer, sizeof(buffer),
+                       "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                       DAYS[utc.tm_wday], utc.tm_mday, MONTHS[utc.tm_mon],
+                       utc.tm_year + 1900, utc.tm_hour, utc.tm_min,
+                       utc.tm_sec);
+  date_stamp.store({buffer, size});
+}
+
+/// @brief Guards starting and stopping the ticking thread
+static std::mutex ticking_lock{};
+
+/// @brief The ticking thread, owned here rather than by a static object so it
+/// is never destroyed behind a late log line's back
+static std::jthread *ticking = nullptr;
+
+/// @brief Set once the thread was started, it isn't started again after
+/// `stop`
+static std::atomic<bool> started{false};
+
+static void tick(std::stop_token stop) {
+  while (!stop.stop_requested()) {
+    std::this_thread::sleep_for(TICK);
+    refresh();
+    calibrate();
+  }
+}
+// ============================================================================
+void timekeeper::start() {
+  if (started.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  std::scoped_lock lock{ticking_lock};
+  if (started.load(std::memory_order_relaxed)) {
+    return;
+  }
+  refresh();
+  ticking = new std::jthread{tick};
+  started.store(true, std::memory_order_release);
+}
+
+void timekeeper::stop() {
+  std::jthread *thread = nullptr;
+  {
+    std::scoped_lock lock{ticking_lock};
+    thread = std::exchange(ticking, nullptr);
+    started.store(true, std::memory_order_release);
+  }
+  // joins it, the published texts keep the last tick
+  delete thread;
+}
+
+timekeeper::text timekeeper::log_timestamp() {
+  start();
+  return log_stamp.load();
+}
+
+timekeeper::text timekeeper::http_date() {
+  start();
+  return date_stamp.load();
+}
+
+timekeeper::instant timekeeper::now() { return read_counter(); }
+
+U64 timekeeper::nanoseconds_between(instant from, instant to) {
+  if (to <= from) {
+    return 0;
+  }
+  return static_cast<U64>(static_cast<F64>(to - from) * scale());
+}
+
+U64 timekeeper::milliseconds_since(instant since) {
+  return nanoseconds_between(since, now()) / 1000000;
+}
@@ -0,0 +1,89 @@
+#include "../include/tls.hpp"
+#include "../include/logger.hpp"
+#include <openssl/ssl.h>
+#include <stdexcept>
+using namespace cobble;
+
+/// @brief Distinguishes our cached sessions from any other application's
+constexpr unsigned char SESSION_ID_CONTEXT[] = "cobble";
+
+/// @brief ALPN protocols in order of preference, length-prefixed
+constexpr unsigned char PROTOCOLS_HTTP2[] = "\x02h2\x08http/1.1";
+constexpr unsigned char PROTOCOLS_HTTP1[] = "\x08http/1.1";
+
+static int select_protocol(SSL *, const unsigned char **out,
+                           unsigned char *out_length, const unsigned char *in,
+                           unsigned int in_length, void *arg) {
+  const auto http2 = arg != nullptr;
+  const auto *protocols = http2 ? PROTOCOLS_HTTP2 : PROTOCOLS_HTTP1;
+  const auto length = static_cast<unsigned int>(
+      http2 ? sizeof(PROTOCOLS_HTTP2) - 1 : sizeof(PROTOCOLS_HTTP1) - 1);
+
+  // picks our most preferred protocol that the client also offers
+  if (SSL_select_next_proto(const_cast<unsigned char **>(out), out_length,
+                            protocols, length, in,
+                            in_length) != OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  return SSL_TLSEXT_ERR_OK;
+}
+
+std::unique_ptr<boost::asio::ssl::context>
+tls::make_context(const environment::tls_settings &settings, bool http2) {
+  auto context = std::make_unique<boost::asio::ssl::context>(
+      boost::asio::ssl::context::tls_server);
+
+  context->set_options(boost::asio::ssl::context::default_workarounds |
+                       boost::asio::ssl::context::no_sslv2 |
+                       boost::asio::ssl::context::no_sslv3 |
+                       boost::asio::ssl::context::no_tlsv1 |
+                       boost::asio::ssl::context::no_tlsv1_1 |
+                       boost::asio::ssl::context::single_dh_use);
+  context->use_certificate_chain_file(settings.certificate.string());
+  context->use_private_key_file(settings.private_key.string(),
+                                boost::asio::ssl::context::pem);
+
+  auto *handle = context->native_handle();
+
+  // One server-side session cache for all connections, TLS 1.2 clients resume
+  // by session ID and TLS 1.3 clients by tickets sealed with this context's
+  // keys, both skip the full handshake
+  SSL_CTX_set_session_cache_mode(handle, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(handle, settings.session_cache_size);
+  SSL_CTX_set_session_id_context(handle, SESSION_ID_CONTEXT,
+                                 sizeof(SESSION_ID_CONTEXT) - 1);
+  SSL_CTX_clear_options(handle, SSL_OP_NO_TICKET);
+
+  // the callback only needs to know if h2 is on the table
+  SSL_CTX_set_alpn_select_cb(handle, select_protocol,
+                             http2 ? handle : nullptr);
+
+  if (settings.ktls) {
+#if defined(SSL_OP_ENABLE_KTLS)
+    SSL_CTX_set_options(handle, SSL_OP_ENABLE_KTLS);
+    logger::log(logger::severity::informational,
+                "Requesting kTLS offload for HTTPS connections");
+#else
+    logger::log(logger::severity::warning,
+                "kTLS offload requested but OpenSSL was built without it");
+#endif
+  }
+
+  return context;
+}
+
+bool tls::negotiated_http2(SSL *ssl) {
+  const unsigned char *protocol = nullptr;
+  unsigned int length = 0;
+  SSL_get0_alpn_selected(ssl, &protocol, &length);
+
+  return length == 2 && protocol[0] == 'h' && protocol[1] == '2';
+}
+
+bool tls::ktls_active([[maybe_unused]] SSL *ssl) {
+#if defined(SSL_OP_ENABLE_KTLS)
+  return BIO_get_ktls_send(SSL_get_wbio(ssl)) == 1;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,149 @@
+#include "../include/trace.hpp"
+#include "../include/logger.hpp"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace cobble;
+
+/// @brief Spans each thread keeps before overwriting the oldest ones
+constexpr std::size_t BUFFER_CAPACITY = 16384;
+
+/// @brief A finished span
+struct event {
+  const char *name;
+  U64 id;
+  U64 t0;
+  U64 duration;
+};
+
+/// @brief A thread's ring of finished spans, only locked against a collector
+struct thread_buffer {
+  std::mutex lock{};
+  std::vector<event> events{};
+  std::size_t head = 0;
+  U64 tid = 0;
+};
+
+static std::atomic<U64> next_id{1};
+static const auto epoch = std::chrono::steady_clock::now();
+
+static std::mutex registry_lock{};
+static std::vector<std::shared_ptr<thread_buffer>> registry{};
+
+static thread_local trace::context current{};
+
+static U64 now_micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+static thread_buffer &local_buffer() {
+  static thread_local std::shared_ptr<thread_buffer> buffer = [] {
+    auto created = std::make_shared<thread_buffer>();
+    created->events.reserve(BUFFER_CAPACITY);
+    created->tid = std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+    std::lock_guard guard{registry_lock};
+    registry.emplace_back(created);
+    return created;
+  }();
+
+  return *buffer;
+}
+
+static void record(const char *name, U64 id, U64 t0, U64 t1) {
+  auto &buffer = local_buffer();
+  std::lock_guard guard{buffer.lock};
+
+  if (buffer.events.size() < BUFFER_CAPACITY) {
+    buffer.events.emplace_back(event{name, id, t0, t1 - t0});
+  } else {
+    buffer.events[buffer.head] = event{name, id, t0, t1 - t0};
+    buffer.head = (buffer.head + 1) % BUFFER_CAPACITY;
+  }
+}
+
+trace::context trace::sample(F64 rate) {
+  if (rate <= 0.0) {
+    return context{};
+  }
+
+  static thread_local std::minstd_rand rng{static_cast<U32>(
+      std::hash<std::thread::id>{}(std::this_thread::get_id()))};
+  if (rate < 1.0 && std::uniform_real_distribution<F64>{}(rng) >= rate) {
+    return context{};
+  }
+
+  return context{.id = next_id.fetch_add(1, std::memory_order_relaxed),
+                 .sampled = true};
+}
+// ============================================================================
+trace::scope::scope(const context &which) : _previous{current} {
+  current = which;
+}
+
+trace::scope::~scope() { current = _previous; }
+// ============================================================================
+trace::span::span(const char *name) : span{name, current} {}
+
+trace::span::span(const char *name, const context &which)
+    : _name{name}, _id{which.id}, _t0{0}, _sampled{which.sampled} {
+  if (_sampled) {
+    _t0 = now_micros();
+  }
+}
+
+trace::span::~span() {
+  if (_sampled) {
+    record(_name, _id, _t0, now_micros());
+  }
+}
+// ============================================================================
+Json::Value trace::collect() {
+  Json::Value root;
+  root["displayTimeUnit"] = "ms";
+  root["traceEvents"] = Json::arrayValue;
+  auto &events = root["traceEvents"];
+  const auto pid = static_cast<Json::UInt64>(getpid());
+
+  std::lock_guard registry_guard{registry_lock};
+  for (const auto &buffer : registry) {
+    std::lock_guard guard{buffer->lock};
+
+    for (const auto &recorded : buffer->events) {
+      Json::Value entry;
+      entry["name"] = recorded.name;
+      entry["cat"] = "cobble";
+      entry["ph"] = "X";
+      entry["ts"] = static_cast<Json::UInt64>(recorded.t0);
+      entry["dur"] = static_cast<Json::UInt64>(recorded.duration);
+      entry["pid"] = pid;
+      entry["tid"] = static_cast<Json::UInt64>(buffer->tid & 0xFFFFFFFF);
+      entry["args"]["request"] = static_cast<Json::UInt64>(recorded.id);
+      events.append(std::move(entry));
+    }
+  }
+
+  return root;
+}
+
+void trace::dump(const std::filesystem::path &where) {
+  Json::StreamWriterBuilder builder;
+  builder.settings_["indentation"] = "";
+
+  const auto root = collect();
+  std::ofstream file{where, std::ios::trunc};
+  file << Json::writeString(builder, root);
+
+  logger::log(logger::severity::notice, "Dumped ",
+              static_cast<U64>(root["traceEvents"].size()),
+              " trace events to '", where, "'");
+}
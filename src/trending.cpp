@@ -0,0 +1,275 @@
+#include "../include/trending.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <numbers>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+using namespace cobble;
+
+/// @brief Videos the sketch tracks, every video scoring more than the total
+/// score divided by this is guaranteed to be among them
+constexpr std::size_t MAX_TRACKED = 4096;
+
+/// @brief Hits a thread buffers between folds, the rest are dropped
+constexpr std::size_t MAX_BUFFERED = 65536;
+
+/// @brief How often buffers are folded into the sketch
+constexpr std::chrono::milliseconds FOLD_INTERVAL{2000};
+
+/// @brief Time after which a hit counts half as much
+constexpr std::chrono::seconds HALF_LIFE{3600};
+
+/// @brief Growth exponent past which every count is scaled back down
+constexpr F64 MAX_EXPONENT = 32.0;
+
+/// @brief One thread's hits since the last fold
+struct buffer {
+  /// @brief Held while adding hits or taking them out
+  std::mutex mutex{};
+
+  std::vector<std::pair<U64, F64>> hits{};
+
+  /// @brief Emptied hits swapped in on each fold, only touched by the
+  /// folding thread, so neither vector gives up its capacity
+  std::vector<std::pair<U64, F64>> spare{};
+};
+
+/// @brief Space-Saving over forward-decayed counts. Rather than shrinking
+/// every count as time passes, a hit is weighted by how long after the
+/// landmark it came, which keeps older counts valid. Once those weights grow
+/// large, every count is scaled down and the landmark moves up.
+class sketch {
+  /// @brief A tracked video, `error` is the count it inherited when it took
+  /// another video's place
+  struct counter {
+    U64 id;
+    F64 count;
+    F64 error;
+  };
+
+  /// @brief A min-heap on counts, so the video to replace is at the root
+  std::vector<counter> _heap{};
+  std::unordered_map<U64, std::size_t> _at{};
+
+  void _swap(std::size_t a, std::size_t b) {
+    std::swap(_heap[a], _heap[b]);
+    _at[_heap[a].id] = a;
+    _at[_heap[b].id] = b;
+  }
+
+  void _up(std::size_t i) {
+    while (i > 0 && _heap[(i - 1) / 2].count > _heap[i].count) {
+      _swap(i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+  }
+
+  void _down(std::size_t i) {
+    for (;;) {
+      auto least = i;
+      for (const auto child : {2 * i + 1, 2 * i + 2}) {
+        if (child < _heap.size() && _heap[child].count < _heap[least].count) {
+          least = child;
+        }
+      }
+      if (least == i) {
+        return;
+      }
+      _swap(i, least);
+      i = least;
+    }
+  }
+
+public:
+  void add(U64 id, F64 weight) {
+    if (const auto found = _at.find(id); found != _at.end()) {
+      _heap[found->second].count += weight;
+      _down(found->second);
+    } else if (_heap.size() < MAX_TRACKED) {
+      _heap.emplace_back(counter{.id = id, .count = weight, .error = 0.0});
+      _at[id] = _heap.size() - 1;
+      _up(_heap.size() - 1);
+    } else {
+      // the least counted video makes room, its count becomes the error
+      auto &least = _heap.front();
+      _at.erase(least.id);
+      least = counter{
+          .id = id, .count = least.count + weight, .error = least.count};
+      _at[id] = 0;
+      _down(0);
+    }
+  }
+
+  /// @brief Multiplies every count, which keeps the heap in order
+  void scale(F64 factor) {
+    for (auto &each : _heap) {
+      each.count *= factor;
+      each.error *= factor;
+    }
+  }
+
+  /// @brief Lists the highest counts
+  /// @param factor Turns counts into scores as of now
+  std::vector<trending::video> top(F64 factor) const {
+    auto sorted = _heap;
+    const auto listed = std::min(sorted.size(), trending::MAX_LISTED);
+    std::partial_sort(sorted.begin(), sorted.begin() + listed, sorted.end(),
+                      [](const counter &a, const counter &b) {
+                        return a.count > b.count;
+                      });
+
+    std::vector<trending::video> videos{};
+    videos.reserve(listed);
+    for (std::size_t i = 0; i < listed; i++) {
+      videos.emplace_back(trending::video{
+          .id = sorted[i].id,
+          .score = sorted[i].count * factor,
+          .overestimate = sorted[i].error * factor});
+    }
+    return videos;
+  }
+
+  std::size_t size() const { return _heap.size(); }
+};
+
+/// @brief Every thread's buffer, the sketch and the thread folding into it
+class tracker {
+  std::mutex _buffers_mutex{};
+  std::vector<std::unique_ptr<buffer>> _buffers{};
+
+  // only touched by the folding thread
+  sketch _sketch{};
+  std::chrono::steady_clock::time_point _landmark{
+      std::chrono::steady_clock::now()};
+
+  std::atomic<std::shared_ptr<const trending::snapshot>> _published{
+      std::make_shared<const trending::snapshot>()};
+
+  std::atomic<U64> _hits{0};
+  std::atomic<U64> _dropped{0};
+  std::atomic<U64> _folds{0};
+  std::atomic<U64> _tracked{0};
+
+  std::mutex _wait_mutex{};
+  std::condition_variable_any _wake{};
+
+  // declared last, it's joined while the buffers it folds still exist
+  std::jthread _folder{};
+
+  /// @brief Folds every buffer into the sketch and publishes its top videos
+  void _fold() {
+    // decay per second, so a hit's weight doubles every half-life
+    constexpr F64 rate =
+        std::numbers::ln2 / std::chrono::duration<F64>{HALF_LIFE}.count();
+    const auto now = std::chrono::steady_clock::now();
+    auto exponent =
+        rate * std::chrono::duration<F64>{now - _landmark}.count();
+    if (exponent > MAX_EXPONENT) {
+      _sketch.scale(std::exp(-exponent));
+      _landmark = now;
+      exponent = 0.0;
+    }
+    const auto growth = std::exp(exponent);
+
+    // summed first, so a video hit many times is looked up once
+    std::unordered_map<U64, F64> sums{};
+    U64 hits = 0;
+    {
+      std::lock_guard<std::mutex> lock{_buffers_mutex};
+      for (auto &each : _buffers) {
+        {
+          std::lock_guard<std::mutex> swap_lock{each->mutex};
+          each->hits.swap(each->spare);
+        }
+        for (const auto &[id, weight] : each->spare) {
+          sums[id] += weight;
+        }
+        hits += each->spare.size();
+        each->spare.clear();
+      }
+    }
+    for (const auto &[id, weight] : sums) {
+      _sketch.add(id, weight * growth);
+    }
+
+    _published.store(std::make_shared<const trending::snapshot>(
+                         trending::snapshot{
+                             .videos = _sketch.top(1.0 / growth),
+                             .folds = _folds.load(std::memory_order_relaxed)}),
+                     std::memory_order_release);
+    _hits.fetch_add(hits, std::memory_order_relaxed);
+    _tracked.store(_sketch.size(), std::memory_order_relaxed);
+    _folds.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void _run(std::stop_token stop) {
+    while (!stop.stop_requested()) {
+      {
+        std::unique_lock<std::mutex> lock{_wait_mutex};
+        _wake.wait_for(lock, stop, FOLD_INTERVAL, [] { return false; });
+      }
+      _fold();
+    }
+  }
+
+public:
+  tracker() {
+    _folder = std::jthread{[this](std::stop_token stop) {
+      _run(std::move(stop));
+    }};
+  }
+
+  buffer &join() {
+    std::lock_guard<std::mutex> lock{_buffers_mutex};
+    return *_buffers.emplace_back(std::make_unique<buffer>());
+  }
+
+  void dropped() { _dropped.fetch_add(1, std::memory_order_relaxed); }
+
+  std::shared_ptr<const trending::snapshot> top() const {
+    return _published.load(std::memory_order_acquire);
+  }
+
+  Json::Value stats() const {
+    Json::Value root;
+
+    const auto load = [](const std::atomic<U64> &counter) {
+      return static_cast<Json::UInt64>(
+          counter.load(std::memory_order_relaxed));
+    };
+    root["hits"] = load(_hits);
+    root["droppedHits"] = load(_dropped);
+    root["folds"] = load(_folds);
+    root["tracked"] = load(_tracked);
+
+    return root;
+  }
+};
+
+static tracker &instance() {
+  static tracker shared{};
+  return shared;
+}
+// ============================================================================
+void trending::hit(U64 id, F64 weight) {
+  thread_local buffer &mine = instance().join();
+
+  std::lock_guard<std::mutex> lock{mine.mutex};
+  if (mine.hits.size() < MAX_BUFFERED) {
+    mine.hits.emplace_back(id, weight);
+  } else {
+    instance().dropped();
+  }
+}
+
+std::shared_ptr<const trending::snapshot> trending::top() {
+  return instance().top();
+}
+
+Json::Value trending::stats() { return instance().stats(); }
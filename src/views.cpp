@@ -0,0 +1,441 @@
+#include "../include/views.hpp"
+#include "../include/logger.hpp"
+#include "../include/posix.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stop_token>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+using namespace cobble;
+
+/// @brief Slots in each thread's table, a power of two
+constexpr std::size_t SHARD_SLOTS = 16384;
+
+/// @brief Slots probed before a thread's table counts as full
+constexpr std::size_t MAX_PROBES = 16;
+
+/// @brief How often tables are summed and the log is synced
+constexpr std::chrono::milliseconds FLUSH_INTERVAL{1000};
+
+/// @brief Log size that triggers a compaction into one batch of totals
+constexpr U64 COMPACT_BYTES = 16 * 1024 * 1024;
+
+/// @brief Starts every batch in the log, `CVW1`
+constexpr U32 BATCH_MAGIC = 0x31575643;
+
+/// @brief The log's file in the storage directory
+constexpr const char *LOG_NAME = "views.wal";
+
+/// @brief A batch in the log, followed by `entries` pairs of video ID and
+/// views in native byte order. Torn batches at the end fail the checksum and
+/// are cut off when the log is replayed.
+struct batch_header {
+  U32 magic;
+  U32 entries;
+  U64 checksum;
+};
+
+/// @brief Serializes sums as one batch
+static std::vector<U8> batch_of(const std::unordered_map<U64, U64> &sums) {
+  std::vector<U8> out(sizeof(batch_header) + sums.size() * 2 * sizeof(U64));
+  auto *at = out.data() + sizeof(batch_header);
+  for (const auto &[id, views] : sums) {
+    std::memcpy(at, &id, sizeof(U64));
+    std::memcpy(at + sizeof(U64), &views, sizeof(U64));
+    at += 2 * sizeof(U64);
+  }
+
+  const batch_header header{
+      .magic = BATCH_MAGIC,
+      .entries = static_cast<U32>(sums.size()),
+      .checksum = posix::checksum(out.data() + sizeof(batch_header),
+                              out.size() - sizeof(batch_header))};
+  std::memcpy(out.data(), &header, sizeof(batch_header));
+  return out;
+}
+
+/// @brief One thread's counts. Only the owning thread claims slots, so a
+/// claimed slot's ID never changes outside the mutex, and the flusher takes
+/// counts out with an exchange that never loses a concurrent increment.
+struct shard {
+  /// @brief A video's views since the last flush, `key` is its ID plus one
+  /// so zero means free
+  struct slot {
+    std::atomic<U64> key{0};
+    std::atomic<U64> views{0};
+  };
+
+  std::unique_ptr<slot[]> slots{new slot[SHARD_SLOTS]};
+
+  /// @brief Held while draining or clearing the slots, and for `overflow`
+  std::mutex mutex{};
+
+  /// @brief Counts that didn't fit, only touched when the table is full
+  std::unordered_map<U64, U64> overflow{};
+
+  /// @brief The flush during which the owner last freed the slots
+  U64 freed = 0;
+
+  /// @brief Moves every count into `sums` and frees the slots if asked to,
+  /// only the owning thread may free them
+  void drain(std::unordered_map<U64, U64> &sums, bool free) {
+    for (std::size_t i = 0; i < SHARD_SLOTS; i++) {
+      const auto key = slots[i].key.load(std::memory_order_acquire);
+      if (key == 0) {
+        continue;
+      }
+      const auto views = slots[i].views.exchange(0, std::memory_order_relaxed);
+      if (views > 0) {
+        sums[key - 1] += views;
+      }
+      if (free) {
+        slots[i].key.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+/// @brief Every thread's table, the totals and the thread flushing them
+class ledger {
+  std::mutex _shards_mutex{};
+  std::vector<std::unique_ptr<shard>> _shards{};
+
+  mutable std::shared_mutex _totals_mutex{};
+  std::unordered_map<U64, U64> _totals{};
+
+  std::mutex _start_mutex{};
+  std::filesystem::path _path{};
+  int _fd = -1;
+  U64 _log_bytes = 0;
+
+  std::atomic<U64> _generation{0};
+  std::atomic<U64> _views{0};
+  std::atomic<U64> _flushes{0};
+  std::atomic<U64> _failed{0};
+  std::atomic<U64> _compactions{0};
+  std::atomic<U64> _recovered{0};
+  std::atomic<U64> _logged{0};
+
+  std::condition_variable_any _wake{};
+
+  // last, so it stops before everything it uses
+  std::jthread _flusher{};
+
+  /// @brief Reads the log into the totals and cuts off a torn tail
+  void _replay() {
+    const auto fd = ::open(_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+
+    std::vector<U8> data{};
+    U8 chunk[65536];
+    for (;;) {
+      const auto got = ::read(fd, chunk, sizeof(chunk));
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got <= 0) {
+        break;
+      }
+      data.insert(data.end(), chunk, chunk + got);
+    }
+
+    std::size_t at = 0;
+    U64 entries = 0;
+    while (at + sizeof(batch_header) <= data.size()) {
+      batch_header header{};
+      std::memcpy(&header, data.data() + at, sizeof(batch_header));
+      const auto size = static_cast<std::size_t>(header.entries) * 2 *
+                        sizeof(U64);
+      const auto *payload = data.data() + at + sizeof(batch_header);
+      if (header.magic != BATCH_MAGIC ||
+          at + sizeof(batch_header) + size > data.size() ||
+          posix::checksum(payload, size) != header.checksum) {
+        break;
+      }
+
+      for (U32 i = 0; i < header.entries; i++) {
+        U64 id = 0, views = 0;
+        std::memcpy(&id, payload + i * 2 * sizeof(U64), sizeof(U64));
+        std::memcpy(&views, payload + i * 2 * sizeof(U64) + sizeof(U64),
+                    sizeof(U64));
+        _totals[id] += views;
+      }
+      entries += header.entries;
+      at += sizeof(batch_header) + size;
+    }
+
+    if (at < data.size()) {
+      logger::log(logger::severity::warning, "Cutting ", data.size() - at,
+                  " torn bytes off the end of the view log");
+      if (::ftruncate(fd, static_cast<off_t>(at)) != 0) {
+        logger::log(logger::severity::error,
+                    "Could not cut the view log: ", std::strerror(errno));
+      }
+    }
+    ::close(fd);
+
+    _log_bytes = at;
+    _recovered.store(entries, std::memory_order_relaxed);
+    logger::log(logger::severity::notice, "Replayed ", entries,
+                " view log entries for ", _totals.size(), " videos");
+  }
+
+  /// @brief Rewrites the log as one batch of totals, swapped in by rename
+  void _compact() {
+    std::unordered_map<U64, U64> totals{};
+    {
+      std::shared_lock<std::shared_mutex> lock{_totals_mutex};
+      totals = _totals;
+    }
+    const auto out = batch_of(totals);
+
+    auto compacted = _path;
+    compacted += ".compact";
+    const auto fd = ::open(compacted.c_str(),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      return;
+    }
+    if (!posix::write_all(fd, out.data(), out.size()) || ::fdatasync(fd) != 0 ||
+        ::rename(compacted.c_str(), _path.c_str()) != 0) {
+      logger::log(logger::severity::error,
+                  "Could not compact the view log: ", std::strerror(errno));
+      ::close(fd);
+      ::unlink(compacted.c_str());
+      return;
+    }
+    ::close(fd);
+
+    // the rename only lasts once the directory is synced too
+    const auto directory =
+        ::open(_path.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory >= 0) {
+      ::fsync(directory);
+      ::close(directory);
+    }
+
+    ::close(_fd);
+    _fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    _log_bytes = out.size();
+    _compactions.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// @brief Opens the log again at its last good length, leaves `_fd` at -1
+  /// if it can't
+  void _reopen() {
+    _fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                 0644);
+    if (_fd >= 0 && ::ftruncate(_fd, static_cast<off_t>(_log_bytes)) != 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+
+  /// @brief Cuts a failed batch off the log, so the next one isn't appended
+  /// after a torn one and lost when the log is replayed
+  void _rollback() {
+    if (_fd < 0 || ::ftruncate(_fd, static_cast<off_t>(_log_bytes)) == 0) {
+      return;
+    }
+    logger::log(logger::severity::error,
+                "Could not cut a failed write off the view log: ",
+                std::strerror(errno));
+    ::close(_fd);
+    _reopen();
+  }
+
+  /// @brief Sums every table, logs the sums and adds them to the totals
+  void _flush() {
+    _generation.fetch_add(1, std::memory_order_relaxed);
+    std::unordered_map<U64, U64> sums{};
+    {
+      std::lock_guard<std::mutex> lock{_shards_mutex};
+      for (auto &each : _shards) {
+        std::lock_guard<std::mutex> drain_lock{each->mutex};
+        each->drain(sums, false);
+        for (const auto &[id, views] : each->overflow) {
+          sums[id] += views;
+        }
+        each->overflow.clear();
+      }
+    }
+    if (sums.empty()) {
+      return;
+    }
+
+    // one sync per flush, however many views it holds
+    const auto out = batch_of(sums);
+    if (_fd < 0) {
+      _reopen();
+    }
+    if (_fd < 0 || !posix::write_all(_fd, out.data(), out.size()) ||
+        ::fdatasync(_fd) != 0) {
+      _failed.fetch_add(1, std::memory_order_relaxed);
+      _rollback();
+    } else {
+      _log_bytes += out.size();
+      _logged.fetch_add(sums.size(), std::memory_order_relaxed);
+    }
+
+    U64 views = 0;
+    {
+      std::unique_lock<std::shared_mutex> lock{_totals_mutex};
+      for (const auto &[id, counted] : sums) {
+        _totals[id] += counted;
+        views += counted;
+      }
+    }
+    _views.fetch_add(views, std::memory_order_relaxed);
+    _flushes.fetch_add(1, std::memory_order_relaxed);
+
+    if (_log_bytes >= COMPACT_BYTES) {
+      _compact();
+    }
+  }
+
+  void _run(std::stop_token stop) {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock{_start_mutex};
+        _wake.wait_for(lock, stop, FLUSH_INTERVAL, [] { return false; });
+      }
+
+      // the last views are flushed on the way out
+      _flush();
+      if (stop.stop_requested()) {
+        return;
+      }
+    }
+  }
+
+public:
+  ~ledger() { stop(); }
+
+  void stop() {
+    if (_flusher.joinable()) {
+      _flusher.request_stop();
+      _flusher.join();
+    }
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+
+  void start(const std::filesystem::path &directory) {
+    std::lock_guard<std::mutex> lock{_start_mutex};
+    if (_flusher.joinable()) {
+      return;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    _path = directory / LOG_NAME;
+    _replay();
+    _fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                 0644);
+    if (_fd < 0) {
+      logger::log(logger::severity::error, "Could not open the view log, ",
+                  "views won't be persisted: ", std::strerror(errno));
+    }
+
+    _flusher = std::jthread{[this](std::stop_token stop) {
+      _run(std::move(stop));
+    }};
+  }
+
+  shard &join() {
+    std::lock_guard<std::mutex> lock{_shards_mutex};
+    return *_shards.emplace_back(std::make_unique<shard>());
+  }
+
+  U64 generation() const {
+    return _generation.load(std::memory_order_relaxed);
+  }
+
+  U64 total(U64 id) const {
+    std::shared_lock<std::shared_mutex> lock{_totals_mutex};
+    const auto found = _totals.find(id);
+    return found == _totals.end() ? 0 : found->second;
+  }
+
+  Json::Value stats() const {
+    Json::Value root;
+
+    const auto load = [](const std::atomic<U64> &counter) {
+      return static_cast<Json::UInt64>(
+          counter.load(std::memory_order_relaxed));
+    };
+    root["views"] = load(_views);
+    root["flushes"] = load(_flushes);
+    root["failedFlushes"] = load(_failed);
+    root["loggedEntries"] = load(_logged);
+    root["recoveredEntries"] = load(_recovered);
+    root["compactions"] = load(_compactions);
+    {
+      std::shared_lock<std::shared_mutex> lock{_totals_mutex};
+      root["videos"] = static_cast<Json::UInt64>(_totals.size());
+    }
+
+    return root;
+  }
+};
+
+static ledger &instance() {
+  static ledger shared{};
+  return shared;
+}
+// ============================================================================
+void views::start(const environment::configuration &config) {
+  instance().start(config.data_path);
+}
+
+void views::stop() { instance().stop(); }
+
+void views::record(U64 id) {
+  thread_local shard &mine = instance().join();
+
+  // IDs are mixed so sequential ones don't probe into each other
+  const auto key = id + 1;
+  if (key != 0) {
+    const auto hash = static_cast<std::size_t>(key * 0x9E3779B97F4A7C15 >> 32);
+    for (std::size_t probe = 0; probe < MAX_PROBES; probe++) {
+      auto &slot = mine.slots[(hash + probe) & (SHARD_SLOTS - 1)];
+      const auto found = slot.key.load(std::memory_order_relaxed);
+      if (found == 0) {
+        slot.key.store(key, std::memory_order_release);
+      } else if (found != key) {
+        continue;
+      }
+      slot.views.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  // a full table is emptied into the overflow, which the next flush takes,
+  // at most once per flush so a large working set doesn't rescan it
+  std::lock_guard<std::mutex> lock{mine.mutex};
+  const auto generation = instance().generation();
+  if (mine.freed != generation) {
+    mine.drain(mine.overflow, true);
+    mine.freed = generation;
+  }
+  mine.overflow[id]++;
+}
+
+U64 views::total(U64 id) { return instance().total(id); }
+
+Json::Value views::stats() { return instance().stats(); }
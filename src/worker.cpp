@@ -0,0 +1,60 @@
+#include "../include/worker.hpp"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+using namespace cobble;
+
+/// @brief Fewest worker threads, so offloading still overlaps on small hosts
+constexpr U32 MIN_THREADS = 2;
+
+static std::atomic<U64> offloaded{0};
+
+/// @brief Jobs not done yet per epoch, a fence starts a new epoch
+static std::mutex jobs_mutex{};
+static std::map<U64, U64> running{};
+static U64 epoch = 0;
+
+/// @brief How many threads the pool runs
+static U32 thread_count() {
+  return std::max(MIN_THREADS, std::thread::hardware_concurrency());
+}
+// ============================================================================
+boost::asio::thread_pool &worker::pool() {
+  static boost::asio::thread_pool workers{thread_count()};
+  return workers;
+}
+
+U64 worker::begin() {
+  offloaded.fetch_add(1, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock{jobs_mutex};
+  running[epoch]++;
+  return epoch;
+}
+
+void worker::end(U64 started) {
+  std::lock_guard<std::mutex> lock{jobs_mutex};
+  if (const auto found = running.find(started);
+      found != running.end() && --found->second == 0) {
+    running.erase(found);
+  }
+}
+
+U64 worker::fence() {
+  std::lock_guard<std::mutex> lock{jobs_mutex};
+  return epoch++;
+}
+
+bool worker::settled(U64 ended) {
+  std::lock_guard<std::mutex> lock{jobs_mutex};
+  return running.empty() || running.begin()->first > ended;
+}
+
+Json::Value worker::stats() {
+  Json::Value root;
+  root["threads"] = thread_count();
+  root["offloaded"] =
+      static_cast<Json::UInt64>(offloaded.load(std::memory_order_relaxed));
+  return root;
+}